@@ -47,10 +47,58 @@ struct bgpstream {
 
   /* set to 1 once BGPStream has been started */
   int started;
+
+  /* maximum number of records returned by bgpstream_get_next_records (0 if
+     batches are not enabled) */
+  int batch_size;
+
+  /* number of records in the last batch (to be released by the next call) */
+  int batch_cnt;
 };
 
 /* ========== INTERNAL METHODS (see bgpstream_int.h) ========== */
 
+int bgpstream_set_record_hold(bgpstream_t *bs, int hold)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_record_hold(bs->di_mgr, hold);
+}
+
+void bgpstream_release_record(bgpstream_t *bs)
+{
+  bgpstream_di_mgr_release_record(bs->di_mgr);
+}
+
+int bgpstream_restrict_interval_filter(bgpstream_t *bs, uint32_t begin_time,
+                                       uint32_t end_time)
+{
+  bgpstream_interval_filter_t *TIF = bs->filter_mgr->time_interval;
+
+  assert(!bs->started);
+  assert(end_time != BGPSTREAM_FOREVER);
+
+  if (TIF == NULL) {
+    return bgpstream_filter_mgr_interval_filter_add(bs->filter_mgr,
+                                                    begin_time, end_time)
+             ? 1
+             : -1;
+  }
+
+  if (TIF->begin_time > begin_time) {
+    begin_time = TIF->begin_time;
+  }
+  if (TIF->end_time != BGPSTREAM_FOREVER && TIF->end_time < end_time) {
+    end_time = TIF->end_time;
+  }
+  if (begin_time > end_time) {
+    return 0;
+  }
+
+  TIF->begin_time = begin_time;
+  TIF->end_time = end_time;
+  return 1;
+}
+
 /* ========== PUBLIC METHODS (see bgpstream_int.h) ========== */
 
 bgpstream_t *bgpstream_create()
@@ -80,12 +128,14 @@ err:
 int bgpstream_add_filter(bgpstream_t *bs, bgpstream_filter_type_t filter_type,
                           const char *filter_value)
 {
+  assert(!bs->started);
   return bgpstream_filter_mgr_filter_add(bs->filter_mgr, filter_type,
       filter_value);
 }
 
 int bgpstream_add_rib_period_filter(bgpstream_t *bs, uint32_t period)
 {
+  assert(!bs->started);
   return bgpstream_filter_mgr_rib_period_filter_add(bs->filter_mgr, period);
 }
 
@@ -95,6 +145,8 @@ int bgpstream_add_recent_interval_filter(bgpstream_t *bs, const char *interval,
 
   uint32_t starttime, endtime;
 
+  assert(!bs->started);
+
   if (!bgpstream_time_calc_recent_interval(&starttime, &endtime, interval)) {
     bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid time interval '%s'", interval);
     return 0;
@@ -112,6 +164,7 @@ int bgpstream_add_recent_interval_filter(bgpstream_t *bs, const char *interval,
 int bgpstream_add_interval_filter(bgpstream_t *bs, uint32_t begin_time,
                                    uint32_t end_time)
 {
+  assert(!bs->started);
   if (end_time == BGPSTREAM_FOREVER) {
     bgpstream_set_live_mode(bs);
   }
@@ -202,6 +255,88 @@ void bgpstream_set_live_mode(bgpstream_t *bs)
   bgpstream_di_mgr_set_blocking(bs->di_mgr);
 }
 
+int bgpstream_set_reader_concurrency(bgpstream_t *bs, int concurrency)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_reader_concurrency(bs->di_mgr, concurrency);
+}
+
+int bgpstream_set_reader_readahead(bgpstream_t *bs, int readahead)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_reader_readahead(bs->di_mgr, readahead);
+}
+
+int bgpstream_set_decompress_threads(bgpstream_t *bs, int threads)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_decompress_threads(bs->di_mgr, threads);
+}
+
+void bgpstream_set_time_index(bgpstream_t *bs, int enabled)
+{
+  assert(!bs->started);
+  bgpstream_di_mgr_set_time_index(bs->di_mgr, enabled);
+}
+
+void bgpstream_set_mmap(bgpstream_t *bs, int enabled)
+{
+  assert(!bs->started);
+  bgpstream_di_mgr_set_mmap(bs->di_mgr, enabled);
+}
+
+int bgpstream_set_decode_threads(bgpstream_t *bs, int threads)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_decode_threads(bs->di_mgr, threads);
+}
+
+int bgpstream_set_lookahead(bgpstream_t *bs, int groups, int max_records)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_lookahead(bs->di_mgr, groups, max_records);
+}
+
+int bgpstream_set_merge_shards(bgpstream_t *bs, int shards)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_merge_shards(bs->di_mgr, shards);
+}
+
+int bgpstream_set_ordering(bgpstream_t *bs, bgpstream_ordering_t ordering)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_ordering(bs->di_mgr, ordering);
+}
+
+int bgpstream_set_batch_size(bgpstream_t *bs, int max)
+{
+  assert(!bs->started);
+  if (max <= 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid batch size: %d", max);
+    return -1;
+  }
+  if (bgpstream_di_mgr_set_record_hold(bs->di_mgr, max) != 0) {
+    return -1;
+  }
+  bs->batch_size = max;
+  return 0;
+}
+
+void bgpstream_set_elem_fields(bgpstream_t *bs, uint32_t fields)
+{
+  assert(!bs->started);
+  bgpstream_filter_mgr_set_elem_fields(bs->filter_mgr, fields);
+}
+
+void bgpstream_set_resource_stats_cb(bgpstream_t *bs,
+                                     bgpstream_resource_stats_cb_t *cb,
+                                     void *user)
+{
+  assert(!bs->started);
+  bgpstream_di_mgr_set_resource_stats_cb(bs->di_mgr, cb, user);
+}
+
 /* turn on the bgpstream interface, i.e.:
  * it makes the interface ready
  * for a new get next call
@@ -216,6 +351,9 @@ int bgpstream_start(bgpstream_t *bs)
     return rc;
   }
 
+  // decide the order in which elem filters are checked
+  bgpstream_filter_mgr_compile(bs->filter_mgr);
+
   // start the data interface
   if (bgpstream_di_mgr_start(bs->di_mgr) != 0) {
     return -1;
@@ -228,11 +366,50 @@ int bgpstream_start(bgpstream_t *bs)
 int bgpstream_get_next_record(bgpstream_t *bs, bgpstream_record_t **record)
 {
   assert(bs->started);
+  assert(bs->batch_size == 0);
   *record = NULL;
   // simply ask the DI manager to get us a record
   return bgpstream_di_mgr_get_next_record(bs->di_mgr, record);
 }
 
+int bgpstream_get_next_records(bgpstream_t *bs, bgpstream_record_t **records,
+                               int max, int *cnt)
+{
+  int rc;
+
+  assert(bs->started);
+  *cnt = 0;
+
+  if (max <= 0 || max > bs->batch_size) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Batch of %d records requested, but batch size is %d", max,
+                  bs->batch_size);
+    return -1;
+  }
+
+  // the caller is done with the previous batch
+  for (; bs->batch_cnt > 0; bs->batch_cnt--) {
+    bgpstream_di_mgr_release_record(bs->di_mgr);
+  }
+
+  rc = bgpstream_di_mgr_get_next_records(bs->di_mgr, records, max, cnt);
+  if (rc < 0) {
+    // the records are still held, but are no use to the caller
+    for (; *cnt > 0; (*cnt)--) {
+      bgpstream_di_mgr_release_record(bs->di_mgr);
+    }
+    return rc;
+  }
+
+  bs->batch_cnt = *cnt;
+  return rc;
+}
+
+void bgpstream_get_stats(bgpstream_t *bs, bgpstream_stats_t *stats)
+{
+  bgpstream_di_mgr_get_stats(bs->di_mgr, stats);
+}
+
 /* destroy a bgpstream interface instance */
 void bgpstream_destroy(bgpstream_t *bs)
 {
@@ -32,6 +32,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -338,6 +339,85 @@ void bgpstream_di_mgr_set_blocking(bgpstream_di_mgr_t *di_mgr)
   di_mgr->blocking = 1;
 }
 
+int bgpstream_di_mgr_set_reader_concurrency(bgpstream_di_mgr_t *di_mgr,
+                                            int concurrency)
+{
+  return bgpstream_resource_mgr_set_reader_concurrency(di_mgr->res_mgr,
+                                                       concurrency);
+}
+
+int bgpstream_di_mgr_set_reader_readahead(bgpstream_di_mgr_t *di_mgr,
+                                          int readahead)
+{
+  return bgpstream_resource_mgr_set_reader_readahead(di_mgr->res_mgr,
+                                                     readahead);
+}
+
+int bgpstream_di_mgr_set_decompress_threads(bgpstream_di_mgr_t *di_mgr,
+                                            int threads)
+{
+  return bgpstream_resource_mgr_set_decompress_threads(di_mgr->res_mgr,
+                                                       threads);
+}
+
+void bgpstream_di_mgr_set_time_index(bgpstream_di_mgr_t *di_mgr, int enabled)
+{
+  bgpstream_resource_mgr_set_time_index(di_mgr->res_mgr, enabled);
+}
+
+void bgpstream_di_mgr_set_mmap(bgpstream_di_mgr_t *di_mgr, int enabled)
+{
+  bgpstream_resource_mgr_set_mmap(di_mgr->res_mgr, enabled);
+}
+
+int bgpstream_di_mgr_set_decode_threads(bgpstream_di_mgr_t *di_mgr,
+                                        int threads)
+{
+  return bgpstream_resource_mgr_set_decode_threads(di_mgr->res_mgr, threads);
+}
+
+int bgpstream_di_mgr_set_lookahead(bgpstream_di_mgr_t *di_mgr, int groups,
+                                   int max_records)
+{
+  return bgpstream_resource_mgr_set_lookahead(di_mgr->res_mgr, groups,
+                                              max_records);
+}
+
+int bgpstream_di_mgr_set_merge_shards(bgpstream_di_mgr_t *di_mgr, int shards)
+{
+  return bgpstream_resource_mgr_set_merge_shards(di_mgr->res_mgr, shards);
+}
+
+int bgpstream_di_mgr_set_ordering(bgpstream_di_mgr_t *di_mgr,
+                                  bgpstream_ordering_t ordering)
+{
+  return bgpstream_resource_mgr_set_ordering(di_mgr->res_mgr, ordering);
+}
+
+int bgpstream_di_mgr_set_record_hold(bgpstream_di_mgr_t *di_mgr, int hold)
+{
+  return bgpstream_resource_mgr_set_record_hold(di_mgr->res_mgr, hold);
+}
+
+void bgpstream_di_mgr_release_record(bgpstream_di_mgr_t *di_mgr)
+{
+  bgpstream_resource_mgr_release_record(di_mgr->res_mgr);
+}
+
+void bgpstream_di_mgr_set_resource_stats_cb(bgpstream_di_mgr_t *di_mgr,
+                                            bgpstream_resource_stats_cb_t *cb,
+                                            void *user)
+{
+  bgpstream_resource_mgr_set_stats_cb(di_mgr->res_mgr, cb, user);
+}
+
+void bgpstream_di_mgr_get_stats(bgpstream_di_mgr_t *di_mgr,
+                                bgpstream_stats_t *stats)
+{
+  memset(stats, 0, sizeof(bgpstream_stats_t));
+  bgpstream_resource_mgr_get_stats(di_mgr->res_mgr, stats);
+}
+
 int bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
                                      bgpstream_record_t **record)
 {
@@ -419,6 +499,34 @@ int bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
   return rc;
 }
 
+int bgpstream_di_mgr_get_next_records(bgpstream_di_mgr_t *di_mgr,
+                                      bgpstream_record_t **records, int max,
+                                      int *cnt)
+{
+  int rc;
+
+  *cnt = 0;
+  if ((rc = bgpstream_di_mgr_get_next_record(di_mgr, &records[0])) <= 0) {
+    return rc;
+  }
+  *cnt = 1;
+
+  // fill the rest of the batch from resources that we already have
+  while (*cnt < max) {
+    if ((rc = bgpstream_resource_mgr_get_ready_record(di_mgr->res_mgr,
+                                                      &records[*cnt])) < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      // queue is empty, or we would have to wait for data
+      break;
+    }
+    (*cnt)++;
+  }
+
+  return 1;
+}
+
 void bgpstream_di_mgr_destroy(bgpstream_di_mgr_t *di_mgr)
 {
   if (di_mgr == NULL) {
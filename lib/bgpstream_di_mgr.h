@@ -132,6 +132,117 @@ int bgpstream_di_mgr_set_data_interface_option(
  */
 void bgpstream_di_mgr_set_blocking(bgpstream_di_mgr_t *di_mgr);
 
+/** Set the maximum number of resources that will be opened concurrently
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param concurrency   maximum number of opener threads (must be > 0)
+ * @return 0 if the concurrency was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_reader_concurrency(bgpstream_di_mgr_t *di_mgr,
+                                            int concurrency);
+
+/** Set the number of records each reader should decode ahead
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param readahead     number of records to decode ahead, or 0 to disable
+ * @return 0 if the read-ahead was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_reader_readahead(bgpstream_di_mgr_t *di_mgr,
+                                          int readahead);
+
+/** Set the number of threads used to decompress each resource
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param threads       number of threads per resource, or 0 to disable
+ * @return 0 if the number of threads was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_decompress_threads(bgpstream_di_mgr_t *di_mgr,
+                                            int threads);
+
+/** Enable or disable the use of sidecar time indexes
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param enabled       1 to use time indexes, 0 otherwise
+ */
+void bgpstream_di_mgr_set_time_index(bgpstream_di_mgr_t *di_mgr, int enabled);
+
+/** Enable or disable mapping uncompressed local files into memory
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param enabled       1 to map files, 0 otherwise
+ */
+void bgpstream_di_mgr_set_mmap(bgpstream_di_mgr_t *di_mgr, int enabled);
+
+/** Set the number of threads used to decode each resource
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param threads       number of threads per resource, or 0 to disable
+ * @return 0 if the number of threads was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_decode_threads(bgpstream_di_mgr_t *di_mgr,
+                                        int threads);
+
+/** Set how many groups of resources to open ahead of the current batch
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param groups        number of groups to open in advance, or 0 to disable
+ * @param max_records   maximum number of records that may be buffered by
+ *                      resources opened in advance, or 0 for no limit
+ * @return 0 if the lookahead was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_lookahead(bgpstream_di_mgr_t *di_mgr, int groups,
+                                   int max_records);
+
+/** Set the number of shards used to merge resources in parallel
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param shards        number of merge shards, or 0 to disable
+ * @return 0 if the number of shards was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_merge_shards(bgpstream_di_mgr_t *di_mgr, int shards);
+
+/** Set the order in which records are returned
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param ordering      record ordering mode
+ * @return 0 if the ordering was set, -1 otherwise
+ */
+int bgpstream_di_mgr_set_ordering(bgpstream_di_mgr_t *di_mgr,
+                                  bgpstream_ordering_t ordering);
+
+/** Keep returned records valid until they are explicitly released
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param hold          maximum number of records that may be held at once
+ * @return 0 if record hold was enabled, -1 otherwise
+ */
+int bgpstream_di_mgr_set_record_hold(bgpstream_di_mgr_t *di_mgr, int hold);
+
+/** Release the oldest held record
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ */
+void bgpstream_di_mgr_release_record(bgpstream_di_mgr_t *di_mgr);
+
+/** Set a callback to receive the counters of each resource that is read to the
+ * end
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param cb            callback to invoke, or NULL to disable
+ * @param user          user pointer to pass to the callback
+ */
+void bgpstream_di_mgr_set_resource_stats_cb(bgpstream_di_mgr_t *di_mgr,
+                                            bgpstream_resource_stats_cb_t *cb,
+                                            void *user);
+
+/** Get the performance counters of all resources read so far
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param[out] stats    filled with the counters
+ */
+void bgpstream_di_mgr_get_stats(bgpstream_di_mgr_t *di_mgr,
+                                bgpstream_stats_t *stats);
+
 /** Start the data interface
  *
  * @param di_mgr        pointer to a data interface manager instance
@@ -155,6 +266,24 @@ int bgpstream_di_mgr_start(bgpstream_di_mgr_t *di_mgr);
 int bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
                                      bgpstream_record_t **record);
 
+/** Get a batch of records from the stream
+ *
+ * @param di_mgr          pointer to a data interface manager instance
+ * @param[out] records    array to fill with borrowed pointers to records
+ * @param max             maximum number of records to get (size of `records`)
+ * @param[out] cnt        set to the number of records in the batch
+ * @return >0 if at least one record was read successfully, 0 if end-of-stream
+ * has been reached, <0 if an error occurred.
+ *
+ * This blocks (in live mode) for the first record in the same way as
+ * bgpstream_di_mgr_get_next_record, but then only adds records that are ready
+ * without waiting for stream resources or for new resources from the data
+ * interface. Record hold must be enabled for at least `max` records.
+ */
+int bgpstream_di_mgr_get_next_records(bgpstream_di_mgr_t *di_mgr,
+                                      bgpstream_record_t **records, int max,
+                                      int *cnt);
+
 /** Destroy the given data interface manager
  *
  * @param di_mgr        pointer to a data interface manager instance to destroy
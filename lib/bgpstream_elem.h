@@ -126,6 +126,42 @@ typedef enum {
 
 } bgpstream_elem_type_t;
 
+/** Optional elem fields, for use with bgpstream_set_elem_fields
+ *
+ * The type, time, peer and prefix fields, and the peer state fields, are always
+ * populated.
+ */
+typedef enum {
+
+  /** Next hop */
+  BGPSTREAM_ELEM_FIELD_NEXTHOP = 0x01,
+
+  /** AS path */
+  BGPSTREAM_ELEM_FIELD_AS_PATH = 0x02,
+
+  /** Communities */
+  BGPSTREAM_ELEM_FIELD_COMMUNITIES = 0x04,
+
+  /** ORIGIN attribute */
+  BGPSTREAM_ELEM_FIELD_ORIGIN = 0x08,
+
+  /** MED attribute */
+  BGPSTREAM_ELEM_FIELD_MED = 0x10,
+
+  /** LOCAL_PREF attribute */
+  BGPSTREAM_ELEM_FIELD_LOCAL_PREF = 0x20,
+
+  /** ATOMIC_AGGREGATE attribute */
+  BGPSTREAM_ELEM_FIELD_ATOMIC_AGGREGATE = 0x40,
+
+  /** AGGREGATOR attribute */
+  BGPSTREAM_ELEM_FIELD_AGGREGATOR = 0x80,
+
+  /** All of the above */
+  BGPSTREAM_ELEM_FIELD_ALL = 0xFF,
+
+} bgpstream_elem_field_t;
+
 typedef struct struct_bgpstream_annotations_t {
 
   /** RPKI active */
@@ -32,11 +32,13 @@
 
 #include "bgpstream_filter.h"
 #include "bgpstream_log.h"
+#include "bgpstream_utils_community_int.h"
 #include "utils.h"
 #include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <ctype.h>
 
@@ -49,6 +51,7 @@ bgpstream_filter_mgr_t *bgpstream_filter_mgr_create()
   if (bs_filter_mgr == NULL) {
     return NULL; // can't allocate memory
   }
+  bs_filter_mgr->elem_fields = BGPSTREAM_ELEM_FIELD_ALL;
   bgpstream_log(BGPSTREAM_LOG_VFINE, "\tBSF_MGR: create end");
   return bs_filter_mgr;
 }
@@ -75,6 +78,174 @@ static int bsf_str_set_insert(bgpstream_str_set_t **setp, const char *value)
   return bgpstream_str_set_insert(*setp, value) >= 0;
 }
 
+// Compile a Cisco AS path regex that is just a sequence of ASNs into a pattern
+// that is matched against the path segments (see aspath_pattern_match).
+// The sequence must be anchored at both ends by "^" and/or "_", and the ASNs
+// must be separated by single "_"s, e.g., "_3356_", "^174_3356_" or
+// "_13335$". Returns 1 if the regex was compiled, 0 if it is not supported.
+static int aspath_pattern_compile(bgpstream_aspath_expr_t *expr,
+                                  const char *filter_value)
+{
+  const char *p = filter_value;
+  const char *digits;
+  uint64_t asn;
+
+  expr->asns_cnt = 0;
+  expr->flags = 0;
+
+  if (*p == '^') {
+    expr->flags |= BGPSTREAM_ASPATH_PATTERN_START;
+    p++;
+  }
+  if (*p == '_') {
+    expr->flags |= BGPSTREAM_ASPATH_PATTERN_START_DELIM;
+    p++;
+  }
+  if (expr->flags == 0) {
+    // the first ASN could match the end of a longer ASN
+    return 0;
+  }
+
+  while (1) {
+    if (!isdigit(*p) || expr->asns_cnt == BGPSTREAM_ASPATH_PATTERN_MAX) {
+      return 0;
+    }
+    digits = p;
+    asn = 0;
+    while (isdigit(*p)) {
+      asn = asn * 10 + (*(p++) - '0');
+      if (asn > UINT32_MAX) {
+        return 0;
+      }
+    }
+    if (*digits == '0' && p - digits > 1) {
+      // ASNs are never printed with leading zeros, so leave it to the regex
+      return 0;
+    }
+    expr->asns[expr->asns_cnt++] = (uint32_t)asn;
+
+    if (*p != '_') {
+      break;
+    }
+    p++;
+    if (!isdigit(*p)) {
+      expr->flags |= BGPSTREAM_ASPATH_PATTERN_END_DELIM;
+      break;
+    }
+  }
+
+  if (*p == '$') {
+    expr->flags |= BGPSTREAM_ASPATH_PATTERN_END;
+    p++;
+  }
+  if (*p != '\0' ||
+      (expr->flags & (BGPSTREAM_ASPATH_PATTERN_END |
+                      BGPSTREAM_ASPATH_PATTERN_END_DELIM)) == 0) {
+    return 0;
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_FINE, "compiled AS path pattern \"%s\"",
+                filter_value);
+  return 1;
+}
+
+// Compile a Cisco AS path regex into a POSIX regex that is matched against the
+// string representation of the path. Returns 1 for success, 0 for failure.
+static int aspath_regex_compile(bgpstream_aspath_expr_t *expr,
+                                const char *filter_value)
+{
+  regex_t *re;
+  if (!(re = malloc(sizeof(regex_t)))) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't allocate memory");
+    return 0;
+  }
+  // Cisco AS path regular expression
+  // https://www.cisco.com/c/en/us/td/docs/routers/crs/software/crs_r4-2/getting_started/configuration/guide/gs42crs/gs42aexp.html
+  // These characters are the same as in POSIX extended:  \|()[].^$*+?
+  // These have no special meaning (unlike POSIX extended):  {}
+  // We also support backreferences, which aren't described in any official
+  // documentation I can find, but are in unofficial descriptions.
+  // Cisco adds "_" which is equivalent to POSIX extended "(^|$|[ {},_])"
+  // We convert the Cisco regex to a POSIX extended regex.
+  // (long enough for the longest natively matched pattern, so that the
+  // regex can be used to check the native matcher)
+  char posix_re[1024];
+  const char *c_ptr = filter_value;
+  char *p_ptr = posix_re;
+  int c_parens = 0;
+  int p_parens = 0;
+  int c2p_parens[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  while (*c_ptr) {
+    if (p_ptr - posix_re > sizeof(posix_re) - 15) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "regex too long");
+      free(re);
+      return 0;
+    }
+    if (*c_ptr == '\\' && isdigit(c_ptr[1])) {
+      // backref may need to be adjusted if we've added extra parens
+      *(p_ptr++) = *(c_ptr++);
+      int n = *(c_ptr++) - '0';
+      if (n > 9 || n > c_parens || c2p_parens[n] > 9) {
+        bgpstream_log(BGPSTREAM_LOG_ERR, "bad backreference in regex");
+        free(re);
+        return 0;
+      }
+      *(p_ptr++) = (char)c2p_parens[n] + '0';
+    } else if (*c_ptr == '\\' && c_ptr[1]) {
+      *(p_ptr++) = *(c_ptr++);
+      *(p_ptr++) = *(c_ptr++);
+    } else if (*c_ptr == '_') {
+      strcpy(p_ptr, "(^|$|[ {},_])");
+      p_ptr += strlen(p_ptr);
+      c_ptr++;
+      p_parens++; // we added parens to posix_re that weren't in cisco_re
+    } else if (strchr("{}", *c_ptr)) {
+      *(p_ptr++) = '\\';
+      *(p_ptr++) = *(c_ptr++);
+    } else if (*c_ptr == '(') {
+      c2p_parens[++c_parens] = ++p_parens;
+      *(p_ptr++) = *(c_ptr++);
+    } else {
+      *(p_ptr++) = *(c_ptr++);
+    }
+  }
+  *(p_ptr++) = '\0';
+  bgpstream_log(BGPSTREAM_LOG_FINE,
+      "convert cisco regex \"%s\" to posix \"%s\"", filter_value, posix_re);
+  int rc = regcomp(re, posix_re, REG_EXTENDED | REG_NOSUB);
+  if (rc != 0) {
+    char errbuf[1024];
+    regerror(rc, re, errbuf, sizeof(errbuf));
+    bgpstream_log(BGPSTREAM_LOG_ERR, "regex error: %s", errbuf);
+    free(re);
+    return 0;
+  }
+  expr->re = re;
+  return 1;
+}
+
+int bgpstream_filter_aspath_expr_compile(bgpstream_aspath_expr_t *expr,
+                                         const char *filter_value, int native)
+{
+  // simple patterns are matched directly against the path segments, and
+  // everything else is converted to a POSIX regex
+  if (native != 0 && aspath_pattern_compile(expr, filter_value) != 0) {
+    return 1;
+  }
+  expr->asns_cnt = 0;
+  expr->flags = 0;
+  return aspath_regex_compile(expr, filter_value);
+}
+
+void bgpstream_filter_aspath_expr_clear(bgpstream_aspath_expr_t *expr)
+{
+  if (expr->re != NULL) {
+    regfree(expr->re);
+    free(expr->re);
+    expr->re = NULL;
+  }
+}
+
 int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
                                     bgpstream_filter_type_t filter_type,
                                     const char *filter_value)
@@ -86,6 +257,9 @@ int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
     return 1; // nothing to customize
   }
 
+  // the elem filter plan is stale until it is compiled again
+  this->checks_compiled = 0;
+
   switch (filter_type) {
   case BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN:
     errno = 0;
@@ -122,70 +296,13 @@ int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
     return 1;
 
   case BGPSTREAM_FILTER_TYPE_ELEM_ASPATH: {
-    regex_t *re;
-    uint8_t negate = 0;
+    bgpstream_aspath_expr_t expr;
+    memset(&expr, 0, sizeof(expr));
     if (*filter_value == '!') {
-      negate = 1;
+      expr.negate = 1;
       filter_value++;
     }
-    if (!(re = malloc(sizeof(regex_t)))) {
-      bgpstream_log(BGPSTREAM_LOG_ERR, "can't allocate memory");
-      return 0;
-    }
-    // Cisco AS path regular expression
-    // https://www.cisco.com/c/en/us/td/docs/routers/crs/software/crs_r4-2/getting_started/configuration/guide/gs42crs/gs42aexp.html
-    // These characters are the same as in POSIX extended:  \|()[].^$*+?
-    // These have no special meaning (unlike POSIX extended):  {}
-    // We also support backreferences, which aren't described in any official
-    // documentation I can find, but are in unofficial descriptions.
-    // Cisco adds "_" which is equivalent to POSIX extended "(^|$|[ {},_])"
-    // We convert the Cisco regex to a POSIX extended regex.
-    char posix_re[256];
-    const char *c_ptr = filter_value;
-    char *p_ptr = posix_re;
-    int c_parens = 0;
-    int p_parens = 0;
-    int c2p_parens[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    while (*c_ptr) {
-      if (p_ptr - posix_re > sizeof(posix_re) - 15) {
-        bgpstream_log(BGPSTREAM_LOG_ERR, "regex too long");
-        return 0;
-      }
-      if (*c_ptr == '\\' && isdigit(c_ptr[1])) {
-        // backref may need to be adjusted if we've added extra parens
-        *(p_ptr++) = *(c_ptr++);
-        int n = *(c_ptr++) - '0';
-        if (n > 9 || n > c_parens || c2p_parens[n] > 9) {
-          bgpstream_log(BGPSTREAM_LOG_ERR, "bad backreference in regex");
-          return 0;
-        }
-        *(p_ptr++) = (char)c2p_parens[n] + '0';
-      } else if (*c_ptr == '\\' && c_ptr[1]) {
-        *(p_ptr++) = *(c_ptr++);
-        *(p_ptr++) = *(c_ptr++);
-      } else if (*c_ptr == '_') {
-        strcpy(p_ptr, "(^|$|[ {},_])");
-        p_ptr += strlen(p_ptr);
-        c_ptr++;
-        p_parens++; // we added parens to posix_re that weren't in cisco_re
-      } else if (strchr("{}", *c_ptr)) {
-        *(p_ptr++) = '\\';
-        *(p_ptr++) = *(c_ptr++);
-      } else if (*c_ptr == '(') {
-        c2p_parens[++c_parens] = ++p_parens;
-        *(p_ptr++) = *(c_ptr++);
-      } else {
-        *(p_ptr++) = *(c_ptr++);
-      }
-    }
-    *(p_ptr++) = '\0';
-    bgpstream_log(BGPSTREAM_LOG_FINE,
-        "convert cisco regex \"%s\" to posix \"%s\"", filter_value, posix_re);
-    int rc = regcomp(re, posix_re, REG_EXTENDED | REG_NOSUB);
-    if (rc != 0) {
-      char errbuf[1024];
-      regerror(rc, re, errbuf, sizeof(errbuf));
-      bgpstream_log(BGPSTREAM_LOG_ERR, "regex error: %s", errbuf);
+    if (bgpstream_filter_aspath_expr_compile(&expr, filter_value, 1) == 0) {
       return 0;
     }
     if (++this->aspath_expr_cnt > this->aspath_expr_alloc_cnt) {
@@ -193,14 +310,13 @@ int bgpstream_filter_mgr_filter_add(bgpstream_filter_mgr_t *this,
           this->aspath_expr_cnt * sizeof(*this->aspath_exprs));
       if (!tmp) {
         bgpstream_log(BGPSTREAM_LOG_ERR, "can't allocate memory");
-        regfree(re);
+        bgpstream_filter_aspath_expr_clear(&expr);
         return 0;
       }
       this->aspath_exprs = tmp;
       this->aspath_expr_alloc_cnt = this->aspath_expr_cnt;
     }
-    this->aspath_exprs[this->aspath_expr_cnt-1].re = re;
-    this->aspath_exprs[this->aspath_expr_cnt-1].negate = negate;
+    this->aspath_exprs[this->aspath_expr_cnt-1] = expr;
     return 1;
   }
 
@@ -367,6 +483,569 @@ int bgpstream_filter_mgr_interval_filter_add(
   return 1;
 }
 
+static bgpstream_patricia_walk_cb_result_t pfx_exists(
+    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
+    void *data)
+{
+  *(int*)data = 1;
+  return BGPSTREAM_PATRICIA_WALK_END_ALL;
+}
+
+static bgpstream_patricia_walk_cb_result_t pfx_allows_more_specifics(
+    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
+    void *data)
+{
+  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
+  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
+      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_MORE) {
+    *(int*)data = 1;
+    return BGPSTREAM_PATRICIA_WALK_END_ALL;
+  }
+  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
+}
+
+static bgpstream_patricia_walk_cb_result_t pfx_allows_less_specifics(
+    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
+    void *data)
+{
+  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
+  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
+      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_LESS) {
+    *(int*)data = 1;
+    return BGPSTREAM_PATRICIA_WALK_END_ALL;
+  }
+  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
+}
+
+int bgpstream_filter_mgr_prefix_check(bgpstream_filter_mgr_t *this,
+                                      bgpstream_pfx_t *pfx)
+{
+  int matched = 0;
+
+  if (this->ipversion && pfx->address.version != this->ipversion) {
+    return 0;
+  }
+  if (this->prefixes == NULL) {
+    return 1;
+  }
+
+  bgpstream_patricia_tree_walk_up_down(this->prefixes, pfx, pfx_exists,
+      pfx_allows_more_specifics, pfx_allows_less_specifics, &matched);
+  return matched;
+}
+
+int bgpstream_filter_mgr_peer_asn_check(bgpstream_filter_mgr_t *this,
+                                        uint32_t peer_asn)
+{
+  return this->peer_asns == NULL ||
+         bgpstream_id_set_exists(this->peer_asns, peer_asn) != 0;
+}
+
+/* number of elems checked between re-orderings of the filter plan */
+#define CHECKS_REORDER_INTERVAL 4096
+
+static int check_elem_type(bgpstream_filter_mgr_t *this,
+                           bgpstream_elem_t *elem)
+{
+  switch (elem->type) {
+  case BGPSTREAM_ELEM_TYPE_RIB:
+    return (this->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_RIB) != 0;
+  case BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT:
+    return (this->elemtype_mask &
+            BGPSTREAM_FILTER_ELEM_TYPE_ANNOUNCEMENT) != 0;
+  case BGPSTREAM_ELEM_TYPE_WITHDRAWAL:
+    return (this->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_WITHDRAWAL) != 0;
+  case BGPSTREAM_ELEM_TYPE_PEERSTATE:
+    return (this->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_PEERSTATE) != 0;
+  default:
+    return 1;
+  }
+}
+
+static int check_peer_asn(bgpstream_filter_mgr_t *this, bgpstream_elem_t *elem)
+{
+  return bgpstream_filter_mgr_peer_asn_check(this, elem->peer_asn);
+}
+
+static int check_origin_asn(bgpstream_filter_mgr_t *this,
+                            bgpstream_elem_t *elem)
+{
+  uint32_t origin_asn;
+
+  if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+      elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+    return 0;
+  }
+  if (bgpstream_as_path_get_origin_val(elem->as_path, &origin_asn) < 0) {
+    return 0;
+  }
+  return bgpstream_id_set_exists(this->origin_asns, origin_asn) != 0;
+}
+
+static int check_prefix(bgpstream_filter_mgr_t *this, bgpstream_elem_t *elem)
+{
+  if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+    return 0;
+  }
+  return bgpstream_filter_mgr_prefix_check(this, &elem->prefix);
+}
+
+// is c one of the characters matched by "_" in a Cisco AS path regex?
+#define IS_ASPATH_DELIM(c)                                                     \
+  ((c) == ' ' || (c) == '{' || (c) == '}' || (c) == ',')
+
+// Match a natively compiled AS path pattern against the path, giving the same
+// result as the equivalent regex would give for the string representation of
+// the path. Each ASN is matched along with the characters that surround it in
+// the string: "_" only matches a space, a brace or a comma (or the start or end
+// of the string), and a single "_" between two ASNs only matches if they are
+// adjacent within a segment, or are in adjacent (simple) ASN segments. The
+// pattern is run as a shift-and automaton: bit k of the state is set if the
+// first k+1 ASNs of the pattern match the path up to the current ASN.
+static int aspath_pattern_match(const bgpstream_aspath_expr_t *expr,
+                                bgpstream_as_path_t *path)
+{
+  bgpstream_as_path_iter_t iter;
+  bgpstream_as_path_seg_t *seg, *next_seg;
+  uint32_t state = 0;
+  uint32_t accept = 1U << (expr->asns_cnt - 1);
+  uint32_t match, start;
+  uint32_t asn;
+  int asns_cnt;
+  const char *chars;
+  char pre, post;
+  int first_seg = 1;
+  int prev_simple = 0;
+  int i, k;
+
+  bgpstream_as_path_iter_reset(&iter);
+  next_seg = bgpstream_as_path_get_next_seg(path, &iter);
+  while ((seg = next_seg) != NULL) {
+    next_seg = bgpstream_as_path_get_next_seg(path, &iter);
+
+    // the characters before, between and after the ASNs of the segment (see
+    // bgpstream_as_path_seg_snprintf)
+    switch (seg->type) {
+    case BGPSTREAM_AS_PATH_SEG_ASN:
+      chars = NULL;
+      break;
+    case BGPSTREAM_AS_PATH_SEG_SET:
+      chars = "{,}";
+      break;
+    case BGPSTREAM_AS_PATH_SEG_CONFED_SEQ:
+      chars = "( )";
+      break;
+    case BGPSTREAM_AS_PATH_SEG_CONFED_SET:
+      chars = "[,]";
+      break;
+    default:
+      chars = "< >";
+      break;
+    }
+    // (segments are packed, so the ASNs are read one at a time)
+    asns_cnt = chars == NULL ? 1 : seg->set.asn_cnt;
+
+    for (i = 0; i < asns_cnt; i++) {
+      if (chars == NULL) {
+        asn = seg->asn.asn;
+        pre = first_seg ? '\0' : ' ';
+        post = next_seg == NULL ? '\0' : ' ';
+      } else {
+        asn = seg->set.asn[i];
+        pre = i == 0 ? chars[0] : chars[1];
+        post = i == asns_cnt - 1 ? chars[2] : chars[1];
+      }
+
+      // the previous ASN is only one character away if it is in this segment,
+      // or if both are simple ASN segments
+      if (i == 0 && (chars != NULL || prev_simple == 0)) {
+        state = 0;
+      }
+
+      // can the pattern start at this ASN?
+      if ((expr->flags & BGPSTREAM_ASPATH_PATTERN_START) != 0) {
+        start = first_seg && i == 0 &&
+                (pre == '\0' ||
+                 ((expr->flags & BGPSTREAM_ASPATH_PATTERN_START_DELIM) != 0 &&
+                  IS_ASPATH_DELIM(pre)));
+      } else {
+        start = pre == '\0' || IS_ASPATH_DELIM(pre);
+      }
+
+      match = 0;
+      for (k = 0; k < expr->asns_cnt; k++) {
+        if (expr->asns[k] == asn) {
+          match |= 1U << k;
+        }
+      }
+      state = ((state << 1) | start) & match;
+
+      // can the pattern end at this ASN?
+      if ((state & accept) != 0) {
+        if ((expr->flags & BGPSTREAM_ASPATH_PATTERN_END) != 0) {
+          if (next_seg == NULL && i == asns_cnt - 1 &&
+              (post == '\0' ||
+               ((expr->flags & BGPSTREAM_ASPATH_PATTERN_END_DELIM) != 0 &&
+                IS_ASPATH_DELIM(post)))) {
+            return 1;
+          }
+        } else if (post == '\0' || IS_ASPATH_DELIM(post)) {
+          return 1;
+        }
+      }
+    }
+
+    first_seg = 0;
+    prev_simple = chars == NULL;
+  }
+
+  return 0;
+}
+
+int bgpstream_filter_aspath_expr_match(const bgpstream_aspath_expr_t *expr,
+                                       bgpstream_as_path_t *path,
+                                       const char *path_str)
+{
+  if (expr->re == NULL) {
+    return aspath_pattern_match(expr, path);
+  }
+  return regexec(expr->re, path_str, 0, NULL, 0) == 0;
+}
+
+static int check_aspath(bgpstream_filter_mgr_t *this, bgpstream_elem_t *elem)
+{
+  bgpstream_aspath_expr_t *expr;
+  char aspath[65536];
+  int pathlen = -1;
+  int result;
+
+  if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+      elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+    return 0;
+  }
+
+  for (int i = 0; i < this->aspath_expr_cnt; i++) {
+    expr = &this->aspath_exprs[i];
+    // only build the string if a regex needs it
+    if (expr->re != NULL && pathlen < 0) {
+      pathlen =
+        bgpstream_as_path_snprintf(aspath, sizeof(aspath), elem->as_path);
+      if (pathlen >= sizeof(aspath)) {
+        bgpstream_log(BGPSTREAM_LOG_WARN,
+                      "AS Path is too long? Filter may not work well.");
+      }
+    }
+    result = bgpstream_filter_aspath_expr_match(expr, elem->as_path, aspath);
+    // All aspath regexes must match
+    if (result != (expr->negate == 0)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+#define COMMUNITY_KEY(c) (((uint32_t)(c)->asn << 16) | (c)->value)
+
+static void community_index_destroy(bgpstream_community_index_t *idx)
+{
+  if (idx == NULL) {
+    return;
+  }
+  if (idx->exact != NULL) {
+    bgpstream_id_set_destroy(idx->exact);
+  }
+  if (idx->asns != NULL) {
+    bgpstream_id_set_destroy(idx->asns);
+  }
+  if (idx->values != NULL) {
+    bgpstream_id_set_destroy(idx->values);
+  }
+  free(idx);
+}
+
+// add a filter to one of the sets of the index, creating it if needed
+static int community_index_add(bgpstream_id_set_t **setp, uint32_t key)
+{
+  if (*setp == NULL && (*setp = bgpstream_id_set_create()) == NULL) {
+    return -1;
+  }
+  return bgpstream_id_set_insert(*setp, key) < 0 ? -1 : 0;
+}
+
+static bgpstream_community_index_t *
+community_index_create(bgpstream_community_filter_t *communities)
+{
+  bgpstream_community_index_t *idx;
+  bgpstream_community_t *c;
+  khiter_t k;
+  int rc;
+
+  if ((idx = malloc_zero(sizeof(bgpstream_community_index_t))) == NULL) {
+    return NULL;
+  }
+  idx->exact_bits.ui32 = UINT32_MAX;
+  idx->asn_bits = UINT16_MAX;
+  idx->value_bits = UINT16_MAX;
+
+  for (k = kh_begin(communities); k != kh_end(communities); ++k) {
+    if (!kh_exist(communities, k)) {
+      continue;
+    }
+    c = &(kh_key(communities, k));
+    switch (kh_value(communities, k)) {
+    case BGPSTREAM_COMMUNITY_FILTER_EXACT:
+      rc = community_index_add(&idx->exact, COMMUNITY_KEY(c));
+      idx->exact_bits.ui32 &= c->ui32;
+      break;
+    case BGPSTREAM_COMMUNITY_FILTER_ASN:
+      rc = community_index_add(&idx->asns, c->asn);
+      idx->asn_bits &= c->asn;
+      break;
+    case BGPSTREAM_COMMUNITY_FILTER_VALUE:
+      rc = community_index_add(&idx->values, c->value);
+      idx->value_bits &= c->value;
+      break;
+    default:
+      // "*:*"
+      idx->any = 1;
+      rc = 0;
+      break;
+    }
+    if (rc != 0) {
+      community_index_destroy(idx);
+      return NULL;
+    }
+  }
+
+  return idx;
+}
+
+static int community_index_match(bgpstream_community_index_t *idx,
+                                 bgpstream_community_set_t *set)
+{
+  bgpstream_community_t hash;
+  const bgpstream_community_t *c;
+  int exact, asns, values;
+  int i, n;
+
+  if ((n = bgpstream_community_set_size(set)) == 0) {
+    return 0;
+  }
+  if (idx->any != 0) {
+    return 1;
+  }
+
+  // only probe the kinds of filter that the hash does not rule out
+  hash = bgpstream_community_set_get_hash(set);
+  exact = idx->exact != NULL &&
+          (hash.ui32 & idx->exact_bits.ui32) == idx->exact_bits.ui32;
+  asns = idx->asns != NULL && (hash.asn & idx->asn_bits) == idx->asn_bits;
+  values =
+    idx->values != NULL && (hash.value & idx->value_bits) == idx->value_bits;
+  if (exact == 0 && asns == 0 && values == 0) {
+    return 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    c = bgpstream_community_set_get(set, i);
+    if ((exact != 0 && bgpstream_id_set_exists(idx->exact, COMMUNITY_KEY(c))) ||
+        (asns != 0 && bgpstream_id_set_exists(idx->asns, c->asn)) ||
+        (values != 0 && bgpstream_id_set_exists(idx->values, c->value))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int check_communities(bgpstream_filter_mgr_t *this,
+                             bgpstream_elem_t *elem)
+{
+  bgpstream_community_t *c;
+  khiter_t k;
+
+  if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
+      elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
+    return 0;
+  }
+
+  if (this->communities_idx != NULL) {
+    return community_index_match(this->communities_idx, elem->communities);
+  }
+
+  // no index (it could not be built), so try each filter in turn
+  for (k = kh_begin(this->communities); k != kh_end(this->communities); ++k) {
+    if (kh_exist(this->communities, k)) {
+      c = &(kh_key(this->communities, k));
+      if (bgpstream_community_set_match(elem->communities, c,
+                                        kh_value(this->communities, k))) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void add_check(bgpstream_filter_mgr_t *this,
+                      bgpstream_filter_check_cb_t *cb, uint32_t cost)
+{
+  bgpstream_filter_check_t *check;
+
+  assert(this->checks_cnt < BGPSTREAM_FILTER_CHECK_MAX);
+  check = &this->checks[this->checks_cnt++];
+  check->cb = cb;
+  check->cost = cost;
+  check->checked_cnt = 0;
+  check->passed_cnt = 0;
+}
+
+// the expected cost of a check per elem that it rejects. running the checks in
+// increasing order of rank minimizes the expected cost of the plan (assuming
+// that the checks are independent)
+static double check_rank(const bgpstream_filter_check_t *check)
+{
+  uint32_t checked = __atomic_load_n(&check->checked_cnt, __ATOMIC_RELAXED);
+  uint32_t passed = __atomic_load_n(&check->passed_cnt, __ATOMIC_RELAXED);
+
+  // the counters are read separately, so they may be slightly inconsistent
+  if (passed > checked) {
+    passed = checked;
+  }
+  // until we have seen some elems, assume that half of them pass
+  return check->cost / ((double)(checked - passed + 1) / (checked + 2));
+}
+
+static void order_checks(bgpstream_filter_mgr_t *this)
+{
+  double rank[BGPSTREAM_FILTER_CHECK_MAX];
+  int idx[BGPSTREAM_FILTER_CHECK_MAX];
+  uint32_t order = 0;
+  bgpstream_filter_check_t *check;
+  int tmp;
+  int i, j;
+
+  for (i = 0; i < this->checks_cnt; i++) {
+    idx[i] = i;
+    rank[i] = check_rank(&this->checks[i]);
+  }
+  for (i = 1; i < this->checks_cnt; i++) {
+    tmp = idx[i];
+    for (j = i; j > 0 && rank[idx[j - 1]] > rank[tmp]; j--) {
+      idx[j] = idx[j - 1];
+    }
+    idx[j] = tmp;
+  }
+
+  // the checks themselves never move, so threads that are running the old
+  // plan are unaffected
+  for (i = 0; i < this->checks_cnt; i++) {
+    order |= (uint32_t)idx[i] << (i * BGPSTREAM_FILTER_CHECK_BITS);
+  }
+  __atomic_store_n(&this->checks_order, order, __ATOMIC_RELEASE);
+
+  // decay the observed pass rates so that the plan follows changes in the
+  // data (this also keeps the counters from overflowing)
+  for (i = 0; i < this->checks_cnt; i++) {
+    check = &this->checks[i];
+    __atomic_store_n(&check->checked_cnt,
+                     __atomic_load_n(&check->checked_cnt, __ATOMIC_RELAXED) / 2,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&check->passed_cnt,
+                     __atomic_load_n(&check->passed_cnt, __ATOMIC_RELAXED) / 2,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+void bgpstream_filter_mgr_compile(bgpstream_filter_mgr_t *this)
+{
+  uint32_t cost;
+  int regex;
+  int i;
+
+  this->checks_cnt = 0;
+  this->checks_run = 0;
+
+  // initial costs are rough estimates of the relative work done by each check
+  if (this->elemtype_mask) {
+    add_check(this, check_elem_type, 1);
+  }
+  if (this->peer_asns) {
+    add_check(this, check_peer_asn, 2);
+  }
+  if (this->origin_asns) {
+    add_check(this, check_origin_asn, 4);
+  }
+  if (this->ipversion || this->prefixes) {
+    add_check(this, check_prefix, this->prefixes != NULL ? 8 : 1);
+  }
+  if (this->communities) {
+    community_index_destroy(this->communities_idx);
+    if ((this->communities_idx = community_index_create(this->communities)) ==
+        NULL) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "Could not index community filters, checking each");
+      add_check(this, check_communities, 4 + 4 * kh_size(this->communities));
+    } else {
+      add_check(this, check_communities, 8);
+    }
+  }
+  if (this->aspath_exprs) {
+    // regexes also need the path to be converted to a string (once)
+    cost = 0;
+    regex = 0;
+    for (i = 0; i < this->aspath_expr_cnt; i++) {
+      if (this->aspath_exprs[i].re == NULL) {
+        cost += 4;
+      } else {
+        cost += 16;
+        regex = 1;
+      }
+    }
+    add_check(this, check_aspath, regex ? cost + 64 : cost);
+  }
+
+  order_checks(this);
+  this->checks_compiled = 1;
+}
+
+int bgpstream_filter_mgr_elem_check(bgpstream_filter_mgr_t *this,
+                                    bgpstream_elem_t *elem)
+{
+  bgpstream_filter_check_t *check;
+  uint32_t order;
+  int i;
+
+  // the plan is compiled once by bgpstream_start and is then read
+  // concurrently, so it must not change under the decode threads
+  assert(this->checks_compiled);
+
+  // re-order the plan based on the pass rates seen so far
+  if (__atomic_add_fetch(&this->checks_run, 1, __ATOMIC_RELAXED) %
+        CHECKS_REORDER_INTERVAL ==
+      0) {
+    order_checks(this);
+  }
+
+  order = __atomic_load_n(&this->checks_order, __ATOMIC_ACQUIRE);
+  for (i = 0; i < this->checks_cnt; i++) {
+    check = &this->checks[(order >> (i * BGPSTREAM_FILTER_CHECK_BITS)) &
+                          ((1 << BGPSTREAM_FILTER_CHECK_BITS) - 1)];
+    __atomic_add_fetch(&check->checked_cnt, 1, __ATOMIC_RELAXED);
+    if (check->cb(this, elem) == 0) {
+      return 0;
+    }
+    __atomic_add_fetch(&check->passed_cnt, 1, __ATOMIC_RELAXED);
+  }
+
+  return 1;
+}
+
+void bgpstream_filter_mgr_set_elem_fields(bgpstream_filter_mgr_t *this,
+                                          uint32_t fields)
+{
+  assert(this != NULL);
+  this->elem_fields = fields;
+}
+
 int bgpstream_filter_mgr_validate(bgpstream_filter_mgr_t *filter_mgr)
 {
   /* currently we only validate the interval */
@@ -423,9 +1102,7 @@ void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *this)
   // aspath expressions
   if (this->aspath_exprs != NULL) {
     for (int i = 0; i < this->aspath_expr_cnt; i++) {
-      if (this->aspath_exprs[i].re) {
-        regfree(this->aspath_exprs[i].re);
-      }
+      bgpstream_filter_aspath_expr_clear(&this->aspath_exprs[i]);
     }
     free(this->aspath_exprs);
   }
@@ -437,6 +1114,7 @@ void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *this)
   if (this->communities != NULL) {
     kh_destroy(bgpstream_community_filter, this->communities);
   }
+  community_index_destroy(this->communities_idx);
   // time_interval
   if (this->time_interval != NULL) {
     free(this->time_interval);
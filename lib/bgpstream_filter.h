@@ -48,6 +48,21 @@ KHASH_INIT(bgpstream_community_filter, bgpstream_community_t, uint8_t, 1,
            bgpstream_community_hash_value, bgpstream_community_equal_value)
 typedef khash_t(bgpstream_community_filter) bgpstream_community_filter_t;
 
+/* index of the community filters, by the parts of the community they match */
+typedef struct struct_bgpstream_community_index_t {
+  /* filters that match the ASN and value, only the ASN, and only the value */
+  bgpstream_id_set_t *exact;
+  bgpstream_id_set_t *asns;
+  bgpstream_id_set_t *values;
+  /* bits set in every filter of each kind (a community set whose hash lacks
+     any of them cannot match a filter of that kind) */
+  bgpstream_community_t exact_bits;
+  uint16_t asn_bits;
+  uint16_t value_bits;
+  /* set if there is a filter that matches any community */
+  uint8_t any;
+} bgpstream_community_index_t;
+
 typedef struct struct_bgpstream_interval_filter_t {
   uint32_t begin_time;
   uint32_t end_time;
@@ -58,11 +73,48 @@ KHASH_INIT(collector_ts, char *, uint32_t, 1, kh_str_hash_func,
 
 typedef khash_t(collector_ts) collector_ts_t;
 
+/* maximum number of ASNs in a natively matched AS path pattern */
+#define BGPSTREAM_ASPATH_PATTERN_MAX 32
+
+/* anchors of a natively matched AS path pattern */
+#define BGPSTREAM_ASPATH_PATTERN_START 0x1      /* "^" before the first ASN */
+#define BGPSTREAM_ASPATH_PATTERN_START_DELIM 0x2 /* "_" before the first ASN */
+#define BGPSTREAM_ASPATH_PATTERN_END 0x4        /* "$" after the last ASN */
+#define BGPSTREAM_ASPATH_PATTERN_END_DELIM 0x8  /* "_" after the last ASN */
+
 typedef struct struct_bgpstream_aspath_expr_t {
+  /* regex matched against the string representation of the path, or NULL if
+     the expression is matched natively using asns and flags */
   regex_t *re;
   uint8_t negate;
+  /* sequence of adjacent ASNs that the path must contain */
+  uint32_t asns[BGPSTREAM_ASPATH_PATTERN_MAX];
+  int asns_cnt;
+  uint8_t flags;
 } bgpstream_aspath_expr_t;
 
+/* the checks that the compiled elem filter plan may run */
+#define BGPSTREAM_FILTER_CHECK_MAX 6
+
+struct struct_bgpstream_filter_mgr_t;
+
+/* check a single elem filter (returns 1 if the elem passes, 0 otherwise) */
+typedef int(bgpstream_filter_check_cb_t)(
+  struct struct_bgpstream_filter_mgr_t *mgr, bgpstream_elem_t *elem);
+
+/* bits used by each check in the plan order (see checks_order) */
+#define BGPSTREAM_FILTER_CHECK_BITS 4
+
+typedef struct struct_bgpstream_filter_check_t {
+  bgpstream_filter_check_cb_t *cb;
+  /* estimated (relative) cost of running the check */
+  uint32_t cost;
+  /* elems checked and passed since the plan was last ordered (updated
+     atomically, since elems may be checked from several threads) */
+  uint32_t checked_cnt;
+  uint32_t passed_cnt;
+} bgpstream_filter_check_t;
+
 typedef struct struct_bgpstream_filter_mgr_t {
   bgpstream_str_set_t *projects;
   bgpstream_str_set_t *collectors;
@@ -76,11 +128,26 @@ typedef struct struct_bgpstream_filter_mgr_t {
   bgpstream_id_set_t *origin_asns;
   bgpstream_patricia_tree_t *prefixes;
   bgpstream_community_filter_t *communities;
+  bgpstream_community_index_t *communities_idx;
   bgpstream_interval_filter_t *time_interval;
   collector_ts_t *last_processed_ts;
   uint32_t rib_period;
   uint8_t ipversion;
   uint8_t elemtype_mask;
+  uint32_t elem_fields;
+  /* elem filter checks (fixed once the plan is compiled) */
+  bgpstream_filter_check_t checks[BGPSTREAM_FILTER_CHECK_MAX];
+  int checks_cnt;
+  /* order in which the checks are run: the index in checks of the i'th check
+     is in bits [i * BGPSTREAM_FILTER_CHECK_BITS, (i + 1) *
+     BGPSTREAM_FILTER_CHECK_BITS). a re-ordered plan is published by storing
+     this word atomically, so threads checking elems always see a complete
+     plan */
+  uint32_t checks_order;
+  /* elems checked since the plan was compiled */
+  uint32_t checks_run;
+  /* set once the plan reflects the current filters */
+  uint8_t checks_compiled;
 } bgpstream_filter_mgr_t;
 
 /* allocate memory for a new bgpstream filter */
@@ -98,9 +165,50 @@ int bgpstream_filter_mgr_interval_filter_add(
   bgpstream_filter_mgr_t *bs_filter_mgr, uint32_t begin_time,
   uint32_t end_time);
 
+/* check if the given prefix passes the IP version and prefix filters (returns
+   1 if it does, 0 otherwise) */
+int bgpstream_filter_mgr_prefix_check(bgpstream_filter_mgr_t *bs_filter_mgr,
+                                      bgpstream_pfx_t *pfx);
+
+/* check if the given peer ASN passes the peer ASN filter (returns 1 if it
+   does, 0 otherwise) */
+int bgpstream_filter_mgr_peer_asn_check(bgpstream_filter_mgr_t *bs_filter_mgr,
+                                        uint32_t peer_asn);
+
+/* select the optional elem fields (bgpstream_elem_field_t) to populate */
+void bgpstream_filter_mgr_set_elem_fields(bgpstream_filter_mgr_t *bs_filter_mgr,
+                                          uint32_t fields);
+
+/* compile an AS path filter expression (without the leading "!"), to be
+   matched directly against the path segments if native is set and the
+   pattern is simple enough, or as a regex otherwise (returns 1 if the
+   expression was compiled, 0 otherwise) */
+int bgpstream_filter_aspath_expr_compile(bgpstream_aspath_expr_t *expr,
+                                         const char *filter_value, int native);
+
+/* check if the given AS path matches the expression, ignoring negation.
+   path_str is the string representation of the path, and is only used if the
+   expression is a regex (returns 1 if the path matches, 0 otherwise) */
+int bgpstream_filter_aspath_expr_match(const bgpstream_aspath_expr_t *expr,
+                                       bgpstream_as_path_t *path,
+                                       const char *path_str);
+
+/* free the memory used by a compiled AS path filter expression */
+void bgpstream_filter_aspath_expr_clear(bgpstream_aspath_expr_t *expr);
+
 /* validate the current filters */
 int bgpstream_filter_mgr_validate(bgpstream_filter_mgr_t *mgr);
 
+/* compile the elem filters into a plan that runs the cheapest and most
+   selective checks first */
+void bgpstream_filter_mgr_compile(bgpstream_filter_mgr_t *mgr);
+
+/* check if the given elem passes the elem filters (returns 1 if it does, 0
+   otherwise). the plan must have been compiled, and no filters may be added
+   once elems are being checked */
+int bgpstream_filter_mgr_elem_check(bgpstream_filter_mgr_t *mgr,
+                                    bgpstream_elem_t *elem);
+
 /* destroy the memory allocated for bgpstream filter */
 void bgpstream_filter_mgr_destroy(bgpstream_filter_mgr_t *bs_filter_mgr);
 
@@ -28,6 +28,7 @@
 #include "bgpstream_record_int.h"
 #include "bgpstream_log.h"
 #include "bgpstream_resource.h"
+#include "bgpstream_stats.h"
 #include "bgpstream_transport.h"
 #include "utils.h"
 #include <assert.h>
@@ -55,8 +56,10 @@ static const format_create_func_t create_functions[] = {
 
 };
 
-bgpstream_format_t *bgpstream_format_create(bgpstream_resource_t *res,
-                                            bgpstream_filter_mgr_t *filter_mgr)
+bgpstream_format_t *
+bgpstream_format_create(bgpstream_resource_t *res,
+                        bgpstream_filter_mgr_t *filter_mgr,
+                        const bgpstream_format_opts_t *opts)
 {
   bgpstream_format_t *format = NULL;
 
@@ -83,11 +86,13 @@ bgpstream_format_t *bgpstream_format_create(bgpstream_resource_t *res,
   format->res = res;
 
   // create the transport reader
-  if ((format->transport = bgpstream_transport_create(res)) == NULL) {
+  if ((format->transport = bgpstream_transport_create(
+         res, opts->decompress_threads, opts->mmap)) == NULL) {
     goto err;
   }
 
   format->filter_mgr = filter_mgr;
+  format->opts = *opts;
 
   if (create_functions[res->format_type](format, res) != 0) {
     goto err;
@@ -105,8 +110,25 @@ bgpstream_format_populate_record(bgpstream_format_t *format,
                                  bgpstream_record_t *record)
 {
   // it is a programming error to use a record with a different format
+  bgpstream_format_status_t rc;
+  uint64_t start;
+
   assert(record->__int->format == format);
-  return format->populate_record(format, record);
+
+  start = bgpstream_stats_now_usec();
+  rc = format->populate_record(format, record);
+  BGPSTREAM_STATS_INC(format->stats.decode_time_usec,
+                      bgpstream_stats_now_usec() - start);
+
+  if (rc == BGPSTREAM_FORMAT_OK) {
+    BGPSTREAM_STATS_INC(format->stats.records_valid, 1);
+  } else if (rc == BGPSTREAM_FORMAT_CORRUPTED_MSG ||
+             rc == BGPSTREAM_FORMAT_UNSUPPORTED_MSG ||
+             rc == BGPSTREAM_FORMAT_CORRUPTED_DUMP) {
+    BGPSTREAM_STATS_INC(format->stats.records_corrupted, 1);
+  }
+
+  return rc;
 }
 
 int bgpstream_format_get_next_elem(bgpstream_format_t *format,
@@ -118,6 +140,18 @@ int bgpstream_format_get_next_elem(bgpstream_format_t *format,
   return format->get_next_elem(format, record, elem);
 }
 
+int bgpstream_format_get_poll_fd(bgpstream_format_t *format)
+{
+  return bgpstream_transport_get_poll_fd(format->transport);
+}
+
+void bgpstream_format_get_stats(bgpstream_format_t *format,
+                                bgpstream_stats_t *stats)
+{
+  bgpstream_stats_add(stats, &format->stats);
+  bgpstream_transport_get_stats(format->transport, stats);
+}
+
 #define DATA(record) ((record)->__int)
 
 int bgpstream_format_init_data(bgpstream_record_t *record)
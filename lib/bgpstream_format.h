@@ -49,14 +49,37 @@ typedef enum {
   BGPSTREAM_FORMAT_UNKNOWN_ERROR,
 } bgpstream_format_status_t;
 
+/** Options that control how a format reads its resource */
+typedef struct bgpstream_format_opts {
+
+  /** Number of threads to decompress the resource with (see
+      bgpstream_transport_create), or 0 to let wandio do it */
+  int decompress_threads;
+
+  /** Use (and build) a sidecar time index if the format supports one */
+  int time_index;
+
+  /** Map the resource into memory if it is an uncompressed local file (see
+      bgpstream_transport_create) */
+  int mmap;
+
+  /** Number of threads to decode messages with if the format supports it, or
+      0 to decode them in the reader thread */
+  int decode_threads;
+
+} bgpstream_format_opts_t;
+
 /** Create a format handler for the given resource
  *
  * @param res           pointer to a resource
  * @param filter_mgr    pointer to filter manager to use for filtering records
+ * @param opts          pointer to the options to read the resource with
  * @return pointer to a format module instance if successful, NULL otherwise
  */
-bgpstream_format_t *bgpstream_format_create(bgpstream_resource_t *res,
-                                            bgpstream_filter_mgr_t *filter_mgr);
+bgpstream_format_t *
+bgpstream_format_create(bgpstream_resource_t *res,
+                        bgpstream_filter_mgr_t *filter_mgr,
+                        const bgpstream_format_opts_t *opts);
 
 /** Populate the given record with the next available record from this resource
  *
@@ -86,6 +109,25 @@ int bgpstream_format_get_next_elem(bgpstream_format_t *format,
                                    bgpstream_record_t *record,
                                    bgpstream_elem_t **elem);
 
+/** Get a file descriptor that becomes readable when more data may be available
+ *
+ * @param format        pointer to the format object to use
+ * @return a pollable file descriptor, or -1 if the underlying transport does
+ * not provide one
+ */
+int bgpstream_format_get_poll_fd(bgpstream_format_t *format);
+
+/** Add the performance counters for the given format instance (and its
+ * transport) to the given stats
+ *
+ * @param format        pointer to the format object to use
+ * @param stats         pointer to the stats to add to
+ *
+ * May be called while another thread is reading records from the format.
+ */
+void bgpstream_format_get_stats(bgpstream_format_t *format,
+                                bgpstream_stats_t *stats);
+
 /** Initialize/create the format data in a given record
  *
  * @param record        pointer to the record to init data for
@@ -29,6 +29,7 @@
 
 #include "bgpstream.h"
 #include "bgpstream_format.h" /* for bgpstream_format_t */
+#include "bgpstream_stats.h"
 #include "bgpstream_transport.h"
 #include "config.h"
 
@@ -143,9 +144,19 @@ struct bgpstream_format {
   /** Pointer to the filter manager instance to use to filter records */
   bgpstream_filter_mgr_t *filter_mgr;
 
+  /** Options to read the resource with */
+  bgpstream_format_opts_t opts;
+
   /** An opaque pointer to format-specific state if needed */
   void *state;
 
+  /** Performance counters for this resource. Formats should count messages
+      read (before record-level filtering) in `records_read` using
+      BGPSTREAM_STATS_INC. Decode time and record outcomes are counted by
+      bgpstream_format_populate_record, and elem counters by the record
+      module. */
+  bgpstream_stats_t stats;
+
   /** }@ */
 };
 
@@ -31,6 +31,39 @@
 #include "bgpstream.h"
 #include "bgpstream_filter.h"
 
+/** Keep records returned by bgpstream_get_next_record valid until they are
+ * explicitly released
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param hold          maximum number of records that may be held at once
+ *                      (including the most recently returned one)
+ * @return 0 if record hold was enabled, -1 otherwise
+ *
+ * Every record must then be released, in order, using
+ * bgpstream_release_record (possibly from a different thread).
+ */
+int bgpstream_set_record_hold(bgpstream_t *bs, int hold);
+
+/** Release the oldest record held by the caller
+ *
+ * @param bs            pointer to a BGP Stream instance
+ */
+void bgpstream_release_record(bgpstream_t *bs);
+
+/** Restrict the stream to the given interval
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param begin_time    the first time that may be read
+ * @param end_time      the last time that may be read (not BGPSTREAM_FOREVER)
+ * @return 1 if the interval was restricted, 0 if it does not overlap the
+ * interval that is already set, -1 if an error occurred
+ *
+ * If an interval filter is already set, it is replaced by its intersection
+ * with the given interval, otherwise the given interval is set.
+ */
+int bgpstream_restrict_interval_filter(bgpstream_t *bs, uint32_t begin_time,
+                                       uint32_t end_time);
+
 // Append ch and '\0' to buf if there's enough room.
 // Returns number of characters that would have been written (excluding the
 // terminating '\0'), i.e. 1.  Use (retval >= len) to check for overflow.
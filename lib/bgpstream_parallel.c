@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_int.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/** Number of records that each partition may read ahead of the consumer when
+    records are returned in order */
+#define PARTITION_QUEUE_LEN 64
+
+struct partition {
+
+  // the parallel stream that this partition belongs to
+  bgpstream_parallel_t *p;
+
+  // index of this partition
+  int idx;
+
+  // the (inclusive) window of time read by this partition
+  uint32_t begin_time;
+  uint32_t end_time;
+
+  // stream instance that reads the window
+  bgpstream_t *bs;
+
+  // worker thread
+  pthread_t thread;
+  int thread_running;
+
+  // set if the worker stopped because of an error
+  int failed;
+
+  // ALL BELOW HERE MUST USE MUTEX (only used for ordered reading)
+
+  // records read by the worker that have not been given to the consumer
+  bgpstream_record_t *queue[PARTITION_QUEUE_LEN];
+  unsigned long produced;
+  unsigned long consumed;
+
+  // set once the worker has finished reading
+  int done;
+
+  // set when the consumer no longer wants records
+  int shutdown;
+
+  pthread_cond_t cond;
+  pthread_mutex_t mutex;
+};
+
+struct bgpstream_parallel {
+
+  // the full interval
+  uint32_t begin_time;
+  uint32_t end_time;
+
+  // length of each window (the last window also gets any remainder)
+  uint32_t window_len;
+
+  // partitions, in time order
+  struct partition *partitions;
+  int partitions_cnt;
+
+  // first and last partitions that overlap any interval set by config_cb
+  // (partitions outside these are not read)
+  int first;
+  int last;
+
+  // used to configure the stream of each partition
+  bgpstream_parallel_config_cb_t *config_cb;
+  void *config_user;
+
+  // used to process records when partitions are read concurrently
+  bgpstream_parallel_record_cb_t *record_cb;
+  void *record_user;
+
+  // set if any partition fails while reading concurrently
+  int abort;
+
+  // set once started
+  int started;
+
+  // (ordered) partition we are currently returning records from
+  int current;
+
+  // (ordered) is the consumer holding a record from the current partition
+  int holding;
+};
+
+// the index of the partition whose window contains the given time
+static int partition_of(bgpstream_parallel_t *p, uint32_t time)
+{
+  int idx;
+
+  if (time <= p->begin_time) {
+    return 0;
+  }
+  idx = (time - p->begin_time) / p->window_len;
+  return (idx < p->partitions_cnt) ? idx : p->partitions_cnt - 1;
+}
+
+// should the given record be returned by the given partition?
+static int wanted_record(struct partition *pt, bgpstream_record_t *record)
+{
+  int idx;
+
+  switch (record->status) {
+  case BGPSTREAM_RECORD_STATUS_OUTSIDE_TIME_INTERVAL:
+    // only the end of the last window is the end of the interval
+    return (pt->idx == pt->p->last);
+
+  case BGPSTREAM_RECORD_STATUS_FILTERED_SOURCE:
+  case BGPSTREAM_RECORD_STATUS_EMPTY_SOURCE:
+  case BGPSTREAM_RECORD_STATUS_CORRUPTED_SOURCE:
+    // resources that straddle a window boundary are read by more than one
+    // partition, but only the partition that the resource starts in (or the
+    // nearest one that is read) reports on it
+    idx = partition_of(pt->p, record->dump_time_sec);
+    if (idx < pt->p->first) {
+      idx = pt->p->first;
+    } else if (idx > pt->p->last) {
+      idx = pt->p->last;
+    }
+    return (idx == pt->idx);
+
+  default:
+    return 1;
+  }
+}
+
+static int partition_init(struct partition *pt, int hold)
+{
+  int rc;
+
+  if ((pt->bs = bgpstream_create()) == NULL) {
+    return -1;
+  }
+
+  if (pt->p->config_cb(pt->bs, pt->idx, pt->p->config_user) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to configure partition %d",
+                  pt->idx);
+    return -1;
+  }
+
+  // restrict any interval set by config_cb to the window
+  if ((rc = bgpstream_restrict_interval_filter(pt->bs, pt->begin_time,
+                                               pt->end_time)) < 0) {
+    return -1;
+  }
+  if (rc == 0) {
+    // nothing to read in this window
+    bgpstream_destroy(pt->bs);
+    pt->bs = NULL;
+    pt->done = 1;
+    return 0;
+  }
+
+  // the worker holds one record, and the consumer holds one more than we let
+  // the worker queue
+  if (hold != 0 &&
+      bgpstream_set_record_hold(pt->bs, PARTITION_QUEUE_LEN + 2) != 0) {
+    return -1;
+  }
+
+  if (bgpstream_start(pt->bs) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to start partition %d", pt->idx);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int partitions_init(bgpstream_parallel_t *p, int hold)
+{
+  int i;
+
+  p->first = p->partitions_cnt;
+  p->last = -1;
+  for (i = 0; i < p->partitions_cnt; i++) {
+    if (partition_init(&p->partitions[i], hold) != 0) {
+      return -1;
+    }
+    if (p->partitions[i].bs == NULL) {
+      continue;
+    }
+    if (p->first > i) {
+      p->first = i;
+    }
+    p->last = i;
+  }
+
+  return 0;
+}
+
+static void partition_stop(struct partition *pt)
+{
+  pthread_mutex_lock(&pt->mutex);
+  pt->shutdown = 1;
+  pthread_cond_signal(&pt->cond);
+  pthread_mutex_unlock(&pt->mutex);
+
+  if (pt->thread_running != 0) {
+    pthread_join(pt->thread, NULL);
+    pt->thread_running = 0;
+  }
+
+  bgpstream_destroy(pt->bs);
+  pt->bs = NULL;
+}
+
+static void *ordered_worker(void *user)
+{
+  struct partition *pt = (struct partition *)user;
+  bgpstream_record_t *record;
+  int rc;
+
+  while (1) {
+    rc = bgpstream_get_next_record(pt->bs, &record);
+
+    pthread_mutex_lock(&pt->mutex);
+    if (rc <= 0) {
+      pt->failed = (rc < 0);
+      pt->done = 1;
+      pthread_cond_signal(&pt->cond);
+      pthread_mutex_unlock(&pt->mutex);
+      break;
+    }
+    while (pt->produced - pt->consumed >= PARTITION_QUEUE_LEN &&
+           pt->shutdown == 0) {
+      pthread_cond_wait(&pt->cond, &pt->mutex);
+    }
+    if (pt->shutdown != 0) {
+      pthread_mutex_unlock(&pt->mutex);
+      break;
+    }
+    pt->queue[pt->produced % PARTITION_QUEUE_LEN] = record;
+    pt->produced++;
+    pthread_cond_signal(&pt->cond);
+    pthread_mutex_unlock(&pt->mutex);
+  }
+
+  return NULL;
+}
+
+static void *concurrent_worker(void *user)
+{
+  struct partition *pt = (struct partition *)user;
+  bgpstream_parallel_t *p = pt->p;
+  bgpstream_record_t *record;
+  int rc = 0;
+
+  while (__atomic_load_n(&p->abort, __ATOMIC_RELAXED) == 0 &&
+         (rc = bgpstream_get_next_record(pt->bs, &record)) > 0) {
+    if (wanted_record(pt, record) == 0) {
+      continue;
+    }
+    if (p->record_cb(record, pt->idx, p->record_user) != 0) {
+      rc = -1;
+      break;
+    }
+  }
+
+  if (rc < 0) {
+    pt->failed = 1;
+    // no point letting the other partitions carry on
+    __atomic_store_n(&p->abort, 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+/* ========== PUBLIC METHODS BELOW HERE ========== */
+
+bgpstream_parallel_t *bgpstream_parallel_create(
+  uint32_t begin_time, uint32_t end_time, int partitions,
+  bgpstream_parallel_config_cb_t *config_cb, void *user)
+{
+  bgpstream_parallel_t *p;
+  struct partition *pt;
+  uint64_t len;
+  int i;
+
+  if (end_time == BGPSTREAM_FOREVER || end_time < begin_time ||
+      partitions <= 0 || config_cb == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Invalid parallel stream configuration (%" PRIu32
+                  " - %" PRIu32 ", %d partitions)",
+                  begin_time, end_time, partitions);
+    return NULL;
+  }
+
+  // there is no point in having windows shorter than a second
+  len = (uint64_t)end_time - begin_time + 1;
+  if ((uint64_t)partitions > len) {
+    partitions = len;
+  }
+
+  if ((p = malloc_zero(sizeof(bgpstream_parallel_t))) == NULL) {
+    return NULL;
+  }
+  p->begin_time = begin_time;
+  p->end_time = end_time;
+  p->window_len = len / partitions;
+  p->config_cb = config_cb;
+  p->config_user = user;
+
+  if ((p->partitions = malloc_zero(sizeof(struct partition) * partitions)) ==
+      NULL) {
+    free(p);
+    return NULL;
+  }
+  p->partitions_cnt = partitions;
+
+  for (i = 0; i < partitions; i++) {
+    pt = &p->partitions[i];
+    pt->p = p;
+    pt->idx = i;
+    pt->begin_time = begin_time + (i * p->window_len);
+    pt->end_time = (i == partitions - 1) ? end_time
+                                         : pt->begin_time + p->window_len - 1;
+    pthread_mutex_init(&pt->mutex, NULL);
+    pthread_cond_init(&pt->cond, NULL);
+  }
+
+  return p;
+}
+
+int bgpstream_parallel_start(bgpstream_parallel_t *p)
+{
+  struct partition *pt;
+  int i;
+
+  assert(!p->started);
+  p->started = 1;
+
+  if (partitions_init(p, 1) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < p->partitions_cnt; i++) {
+    pt = &p->partitions[i];
+    if (pt->bs == NULL) {
+      continue;
+    }
+    if (pthread_create(&pt->thread, NULL, ordered_worker, pt) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start partition thread");
+      return -1;
+    }
+    pt->thread_running = 1;
+  }
+
+  return 0;
+}
+
+int bgpstream_parallel_get_next_record(bgpstream_parallel_t *p,
+                                       bgpstream_record_t **record)
+{
+  struct partition *pt;
+
+  assert(p->started);
+  *record = NULL;
+
+  while (p->current < p->partitions_cnt) {
+    pt = &p->partitions[p->current];
+
+    // we are done with the record we returned last time
+    if (p->holding != 0) {
+      bgpstream_release_record(pt->bs);
+      p->holding = 0;
+    }
+
+    pthread_mutex_lock(&pt->mutex);
+    while (pt->consumed == pt->produced && pt->done == 0) {
+      pthread_cond_wait(&pt->cond, &pt->mutex);
+    }
+    if (pt->consumed != pt->produced) {
+      *record = pt->queue[pt->consumed % PARTITION_QUEUE_LEN];
+      pt->consumed++;
+      pthread_cond_signal(&pt->cond);
+      pthread_mutex_unlock(&pt->mutex);
+      p->holding = 1;
+      if (wanted_record(pt, *record) != 0) {
+        return 1;
+      }
+      continue;
+    }
+    pthread_mutex_unlock(&pt->mutex);
+
+    if (pt->failed != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Partition %d failed", pt->idx);
+      *record = NULL;
+      return -1;
+    }
+
+    // this partition is finished, so free its resources and move on
+    partition_stop(pt);
+    p->current++;
+  }
+
+  *record = NULL;
+  return 0;
+}
+
+int bgpstream_parallel_run(bgpstream_parallel_t *p,
+                           bgpstream_parallel_record_cb_t *record_cb,
+                           void *user)
+{
+  struct partition *pt;
+  int rc = 0;
+  int i;
+
+  assert(!p->started);
+  p->started = 1;
+  p->record_cb = record_cb;
+  p->record_user = user;
+
+  if (partitions_init(p, 0) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < p->partitions_cnt; i++) {
+    pt = &p->partitions[i];
+    if (pt->bs == NULL) {
+      continue;
+    }
+    if (pthread_create(&pt->thread, NULL, concurrent_worker, pt) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start partition thread");
+      __atomic_store_n(&p->abort, 1, __ATOMIC_RELAXED);
+      rc = -1;
+      break;
+    }
+    pt->thread_running = 1;
+  }
+
+  for (i = 0; i < p->partitions_cnt; i++) {
+    pt = &p->partitions[i];
+    partition_stop(pt);
+    if (pt->failed != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Partition %d failed", pt->idx);
+      rc = -1;
+    }
+  }
+
+  return rc;
+}
+
+void bgpstream_parallel_destroy(bgpstream_parallel_t *p)
+{
+  struct partition *pt;
+  int i;
+
+  if (p == NULL) {
+    return;
+  }
+
+  for (i = 0; i < p->partitions_cnt; i++) {
+    pt = &p->partitions[i];
+    partition_stop(pt);
+    pthread_mutex_destroy(&pt->mutex);
+    pthread_cond_destroy(&pt->cond);
+  }
+  free(p->partitions);
+  p->partitions = NULL;
+
+  free(p);
+}
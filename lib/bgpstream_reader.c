@@ -27,6 +27,7 @@
 #include "bgpstream_reader.h"
 #include "bgpstream_record_int.h"
 #include "bgpstream_log.h"
+#include "bgpstream_stats.h"
 #include "utils.h"
 #include <assert.h>
 #include <pthread.h>
@@ -35,8 +36,26 @@
 #define DUMP_OPEN_MAX_RETRIES 5
 #define DUMP_OPEN_MIN_RETRY_WAIT 10
 
-#define PREFETCH_IDX (reader->rec_buf_prefetch_idx)
-#define EXPORTED_IDX ((reader->rec_buf_prefetch_idx + 1) % 2)
+/** Slot that holds the record with the given sequence number */
+#define SLOT(seq) (&reader->slots[(seq) % reader->slots_cnt])
+
+/** A record buffer, along with the state of the reader immediately after the
+ * record was prefetched */
+typedef struct rec_slot {
+
+  // the record
+  bgpstream_record_t *record;
+
+  // has the record been filled (i.e. should it be exported)
+  int filled;
+
+  // status of the underlying reader after this record was read
+  bgpstream_format_status_t status;
+
+  // time of the next record after this record was read
+  uint32_t next_time;
+
+} rec_slot_t;
 
 struct bgpstream_reader {
 
@@ -46,19 +65,50 @@ struct bgpstream_reader {
   // borrowed pointer to a filter manager instance
   bgpstream_filter_mgr_t *filter_mgr;
 
-  // internal flip-flop buffers for storing records
-  bgpstream_record_t *rec_buf[2];
-  int rec_buf_filled[2];
+  // ring of record buffers. without read-ahead this is a pair of flip-flop
+  // buffers: one holding the "prefetch" record and the other holding the
+  // "exported" record. records are identified by their sequence number (the
+  // number of prefetches before they were read).
+  rec_slot_t *slots;
+  int slots_cnt;
+
+  // number of records to decode ahead in a background thread (0 to disable)
+  int readahead;
+
+  // number of exported records that the consumer may hold on to (0 if each
+  // record is implicitly released by the next call to get_next_record)
+  int hold;
 
-  // which of the flip-flop buffers is currently holding the "prefetch" record
-  // the other ((this+1)%2) is holding the "exported" record
-  int rec_buf_prefetch_idx;
+  // options to create the format with
+  bgpstream_format_opts_t format_opts;
 
-  // status of the underlying reader
+  // number of (filled) records that have been exported
+  unsigned long exported_cnt;
+
+  // sequence number of the current "prefetch" record. the "exported" record
+  // is the one before it.
+  unsigned long prefetch_seq;
+
+  // status of the underlying reader (as of the prefetch record)
   bgpstream_format_status_t status;
 
-  // handle for the thread that will do the actual opening
-  pthread_t opener_thread;
+  // what is the time of the next record (PREFETCH)
+  uint32_t next_time;
+
+  // state of the decoder (only touched by whoever is doing the decoding)
+  bgpstream_format_status_t decode_status;
+  uint32_t decode_next_time;
+
+  // borrowed pointer to the pool that will do the actual opening
+  bgpstream_reader_pool_t *pool;
+
+  // ALL BELOW HERE MUST USE POOL MUTEX
+
+  // is this reader waiting in the pool queue?
+  int queued;
+
+  // next reader in the pool queue
+  struct bgpstream_reader *queue_next;
 
   // ALL BELOW HERE MUST USE MUTEX
 
@@ -70,67 +120,179 @@ struct bgpstream_reader {
   pthread_cond_t dump_ready_cond;
   pthread_mutex_t mutex;
 
+  // time taken to open the dump (set along with dump_ready)
+  uint64_t open_time_usec;
+
   // can the dump open check be skipped?
   int skip_dump_check;
 
-  // what is the time of the next record (PREFETCH)
-  uint32_t next_time;
+  // read-ahead state (only used if readahead is enabled)
+  pthread_t decode_thread;
+  int decode_thread_running;
+  // number of records that have been decoded
+  unsigned long decoded_cnt;
+  // records with a sequence number lower than this may be reused
+  // (if hold is enabled, this is the number of records released)
+  unsigned long released_seq;
+  // set when the reader is being destroyed
+  int shutdown;
+  // signalled when a record is decoded, or a slot is released
+  pthread_cond_t ring_cond;
 };
 
-static int prefetch_record(bgpstream_reader_t *reader)
-{
-  bgpstream_record_t *record;
-  assert(reader->status == BGPSTREAM_FORMAT_OK);
-  assert(reader->rec_buf_filled[PREFETCH_IDX] == 0);
+struct bgpstream_reader_pool {
+
+  // opener threads (started on demand)
+  pthread_t *threads;
+  int threads_cnt;
+
+  // maximum number of threads
+  int threads_max;
+
+  // ALL BELOW HERE MUST USE MUTEX
+
+  // number of threads waiting for work
+  int idle_cnt;
+
+  // FIFO queue of readers waiting to be opened
+  bgpstream_reader_t *queue_head;
+  bgpstream_reader_t *queue_tail;
+  int queue_cnt;
+
+  // set when the pool is being destroyed
+  int shutdown;
+
+  pthread_cond_t cond;
+  pthread_mutex_t mutex;
+};
 
-  record = reader->rec_buf[PREFETCH_IDX];
+// decodes the record with the given sequence number into its slot
+static void prefetch_record(bgpstream_reader_t *reader, unsigned long seq)
+{
+  rec_slot_t *slot = SLOT(seq);
+  bgpstream_record_t *record = slot->record;
+  assert(reader->decode_status == BGPSTREAM_FORMAT_OK);
 
   // first, clear up our record
   // note that this only destroys the reader struct and resets the elem
   // generator. it does not clear the collector name etc as we reuse that.
   bgpstream_record_clear(record);
+  slot->filled = 0;
 
   // try and get the next entry from the resource (will do filtering)
-  reader->status = bgpstream_format_populate_record(reader->format, record);
+  reader->decode_status =
+    bgpstream_format_populate_record(reader->format, record);
 
   // if we got any of the non-error END_OF_DUMP messages but this is a stream
   // resource, then pretend we're ok.  but beware that now we'll be "OK", with
   // an unfilled prefetch record
   if (reader->res->duration == BGPSTREAM_FOREVER &&
-      (reader->status == BGPSTREAM_FORMAT_END_OF_DUMP ||
-       reader->status == BGPSTREAM_FORMAT_FILTERED_DUMP ||
-       reader->status == BGPSTREAM_FORMAT_EMPTY_DUMP ||
-       reader->status == BGPSTREAM_FORMAT_CORRUPTED_DUMP)) {
-    reader->status = BGPSTREAM_FORMAT_OK;
-    return 0;
+      (reader->decode_status == BGPSTREAM_FORMAT_END_OF_DUMP ||
+       reader->decode_status == BGPSTREAM_FORMAT_FILTERED_DUMP ||
+       reader->decode_status == BGPSTREAM_FORMAT_EMPTY_DUMP ||
+       reader->decode_status == BGPSTREAM_FORMAT_CORRUPTED_DUMP)) {
+    reader->decode_status = BGPSTREAM_FORMAT_OK;
+    goto done;
   }
 
   // if we see corrupted or unsupported message, we still
   // fill the buffer and should continue reading
-  if (reader->status == BGPSTREAM_FORMAT_CORRUPTED_MSG ||
-      reader->status == BGPSTREAM_FORMAT_UNSUPPORTED_MSG) {
-    reader->rec_buf_filled[PREFETCH_IDX] = 1;
-    reader->status = BGPSTREAM_FORMAT_OK;
-    return 0;
+  if (reader->decode_status == BGPSTREAM_FORMAT_CORRUPTED_MSG ||
+      reader->decode_status == BGPSTREAM_FORMAT_UNSUPPORTED_MSG) {
+    slot->filled = 1;
+    reader->decode_status = BGPSTREAM_FORMAT_OK;
+    goto done;
   }
 
-  reader->next_time = record->time_sec;
+  reader->decode_next_time = record->time_sec;
+
+  // we export a meta record for every status except end of dump
+  if (reader->decode_status != BGPSTREAM_FORMAT_END_OF_DUMP) {
+    slot->filled = 1;
+  }
+
+done:
+  slot->status = reader->decode_status;
+  slot->next_time = reader->decode_next_time;
+}
+
+// makes the record with the given sequence number the "prefetch" record. the
+// record before it becomes the "exported" record.
+static void adopt_record(bgpstream_reader_t *reader, unsigned long seq)
+{
+  rec_slot_t *slot = SLOT(seq);
+
+  reader->prefetch_seq = seq;
+  reader->status = slot->status;
+  reader->next_time = slot->next_time;
 
   // set the previous record position to END if we didn't skip any records. we
   // know this because the format has set the position of the current record to
   // END (if records were skipped, it would be set to MIDDLE)
-  if (reader->status == BGPSTREAM_FORMAT_END_OF_DUMP &&
-      record->dump_pos == BGPSTREAM_DUMP_END &&
-      reader->rec_buf_filled[EXPORTED_IDX] == 1) {
-    reader->rec_buf[EXPORTED_IDX]->dump_pos = BGPSTREAM_DUMP_END;
+  if (seq > 0 && slot->status == BGPSTREAM_FORMAT_END_OF_DUMP &&
+      slot->record->dump_pos == BGPSTREAM_DUMP_END &&
+      SLOT(seq - 1)->filled == 1) {
+    SLOT(seq - 1)->record->dump_pos = BGPSTREAM_DUMP_END;
   }
+}
 
-  // we export a meta record for every status except end of dump
-  if (reader->status != BGPSTREAM_FORMAT_END_OF_DUMP) {
-    reader->rec_buf_filled[PREFETCH_IDX] = 1;
+static void *threaded_decoder(void *user)
+{
+  bgpstream_reader_t *reader = (bgpstream_reader_t *)user;
+  unsigned long seq;
+
+  pthread_mutex_lock(&reader->mutex);
+  while (reader->shutdown == 0 &&
+         reader->decode_status == BGPSTREAM_FORMAT_OK) {
+    seq = reader->decoded_cnt;
+    if (seq - reader->released_seq >= (unsigned long)reader->slots_cnt) {
+      // no free slots, wait for the consumer to release one
+      pthread_cond_wait(&reader->ring_cond, &reader->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&reader->mutex);
+
+    prefetch_record(reader, seq);
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->decoded_cnt++;
+    pthread_cond_signal(&reader->ring_cond);
   }
+  pthread_mutex_unlock(&reader->mutex);
 
-  return 0;
+  return NULL;
+}
+
+// gets the record after the current prefetch record ready to be adopted
+static void next_record(bgpstream_reader_t *reader)
+{
+  unsigned long seq = reader->prefetch_seq + 1;
+
+  if (reader->decode_thread_running == 0) {
+    if (reader->hold > 0) {
+      // wait until the consumer has released enough records
+      pthread_mutex_lock(&reader->mutex);
+      while (seq - reader->released_seq >= (unsigned long)reader->slots_cnt) {
+        pthread_cond_wait(&reader->ring_cond, &reader->mutex);
+      }
+      pthread_mutex_unlock(&reader->mutex);
+    }
+    // decode it ourselves. without hold, the slot we decode into is the one
+    // holding the previously exported record
+    prefetch_record(reader, seq);
+    return;
+  }
+
+  pthread_mutex_lock(&reader->mutex);
+  if (reader->hold == 0) {
+    // the previously exported record may now be reused
+    reader->released_seq = reader->prefetch_seq;
+    pthread_cond_signal(&reader->ring_cond);
+  }
+  while (reader->decoded_cnt <= seq) {
+    pthread_cond_wait(&reader->ring_cond, &reader->mutex);
+  }
+  pthread_mutex_unlock(&reader->mutex);
 }
 
 // fills the record with resource-level info that doesn't change per-record
@@ -154,18 +316,20 @@ static int prepopulate_record(bgpstream_record_t *record,
   return 0;
 }
 
-static void *threaded_opener(void *user)
+static void open_reader(bgpstream_reader_t *reader)
 {
-  bgpstream_reader_t *reader = (bgpstream_reader_t *)user;
   int retries = 0;
   int delay = DUMP_OPEN_MIN_RETRY_WAIT;
+  uint64_t start = bgpstream_stats_now_usec();
+  uint64_t open_time;
   int i;
 
   /* all we do is open the dump */
   /* but try a few times in case there is a transient failure */
   while (retries < DUMP_OPEN_MAX_RETRIES && reader->format == NULL) {
     if ((reader->format =
-           bgpstream_format_create(reader->res, reader->filter_mgr)) == NULL) {
+           bgpstream_format_create(reader->res, reader->filter_mgr,
+                                   &reader->format_opts)) == NULL) {
       bgpstream_log(BGPSTREAM_LOG_WARN, "Could not open (%s). Attempt %d of %d",
                     reader->res->url, retries + 1, DUMP_OPEN_MAX_RETRIES);
       retries++;
@@ -175,41 +339,213 @@ static void *threaded_opener(void *user)
       }
     }
   }
+  open_time = bgpstream_stats_now_usec() - start;
 
   pthread_mutex_lock(&reader->mutex);
+  reader->open_time_usec = open_time;
   if (reader->format == NULL) {
     bgpstream_log(BGPSTREAM_LOG_ERR,
                   "Could not open dumpfile (%s) after %d attempts. Giving up.",
                   reader->res->url, DUMP_OPEN_MAX_RETRIES);
     reader->status = BGPSTREAM_FORMAT_CANT_OPEN_DUMP;
   } else {
-    // create the pair of records
-    for (i = 0; i < 2; i++) {
-      if ((reader->rec_buf[i] = bgpstream_record_create(reader->format)) ==
-            NULL ||
-          prepopulate_record(reader->rec_buf[i], reader->res) != 0) {
+    // create the ring of records (a pair if there is no read-ahead)
+    for (i = 0; i < reader->slots_cnt; i++) {
+      if ((reader->slots[i].record =
+             bgpstream_record_create(reader->format)) == NULL ||
+          prepopulate_record(reader->slots[i].record, reader->res) != 0) {
         reader->status = BGPSTREAM_FORMAT_CANT_OPEN_DUMP;
         break;
       }
-      reader->rec_buf_filled[i] = 0;
     }
-    reader->rec_buf_prefetch_idx = 0;
     if (reader->status != BGPSTREAM_FORMAT_CANT_OPEN_DUMP) {
       // prefetch the first record (will set reader->status to error if needed)
-      prefetch_record(reader);
+      prefetch_record(reader, 0);
+      reader->decoded_cnt = 1;
+      adopt_record(reader, 0);
+
+      // and then keep decoding in the background if we can
+      if (reader->readahead > 0 && reader->status == BGPSTREAM_FORMAT_OK) {
+        if (pthread_create(&reader->decode_thread, NULL, threaded_decoder,
+                           reader) == 0) {
+          reader->decode_thread_running = 1;
+        } else {
+          bgpstream_log(BGPSTREAM_LOG_WARN,
+                        "Could not start decode thread for %s",
+                        reader->res->url);
+        }
+      }
     }
   }
   reader->dump_ready = 1;
   pthread_cond_signal(&reader->dump_ready_cond);
   pthread_mutex_unlock(&reader->mutex);
+}
+
+static void *pool_thread(void *user)
+{
+  bgpstream_reader_pool_t *pool = (bgpstream_reader_pool_t *)user;
+  bgpstream_reader_t *reader;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (1) {
+    while (pool->queue_head == NULL && pool->shutdown == 0) {
+      pool->idle_cnt++;
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+      pool->idle_cnt--;
+    }
+    if (pool->queue_head == NULL) {
+      // shutting down and nothing left to do
+      break;
+    }
+
+    // grab the next reader from the queue
+    reader = pool->queue_head;
+    pool->queue_head = reader->queue_next;
+    if (pool->queue_head == NULL) {
+      pool->queue_tail = NULL;
+    }
+    pool->queue_cnt--;
+    reader->queue_next = NULL;
+    reader->queued = 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    open_reader(reader);
+
+    pthread_mutex_lock(&pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
 
   return NULL;
 }
 
+static int pool_submit(bgpstream_reader_pool_t *pool,
+                       bgpstream_reader_t *reader)
+{
+  pthread_mutex_lock(&pool->mutex);
+
+  // start another thread if there are not enough idle threads to handle the
+  // queue
+  if (pool->queue_cnt >= pool->idle_cnt &&
+      pool->threads_cnt < pool->threads_max) {
+    if (pthread_create(&pool->threads[pool->threads_cnt], NULL, pool_thread,
+                       pool) == 0) {
+      pool->threads_cnt++;
+    } else if (pool->threads_cnt == 0) {
+      // no threads to open anything
+      pthread_mutex_unlock(&pool->mutex);
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start reader thread");
+      return -1;
+    }
+  }
+
+  // and then queue the reader
+  reader->queued = 1;
+  reader->queue_next = NULL;
+  if (pool->queue_tail == NULL) {
+    pool->queue_head = reader;
+  } else {
+    pool->queue_tail->queue_next = reader;
+  }
+  pool->queue_tail = reader;
+  pool->queue_cnt++;
+
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+// removes the reader from the pool queue if it has not been opened yet.
+// returns 1 if it was removed, 0 if it is being (or has been) opened.
+static int pool_cancel(bgpstream_reader_pool_t *pool,
+                       bgpstream_reader_t *reader)
+{
+  bgpstream_reader_t *cur, *prev = NULL;
+  int removed = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (reader->queued != 0) {
+    cur = pool->queue_head;
+    while (cur != NULL && cur != reader) {
+      prev = cur;
+      cur = cur->queue_next;
+    }
+    assert(cur == reader);
+    if (prev == NULL) {
+      pool->queue_head = reader->queue_next;
+    } else {
+      prev->queue_next = reader->queue_next;
+    }
+    if (pool->queue_tail == reader) {
+      pool->queue_tail = prev;
+    }
+    pool->queue_cnt--;
+    reader->queue_next = NULL;
+    reader->queued = 0;
+    removed = 1;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return removed;
+}
+
 /* ========== PUBLIC FUNCTIONS BELOW ========== */
 
-bgpstream_reader_t *bgpstream_reader_create(bgpstream_resource_t *resource,
-                                            bgpstream_filter_mgr_t *filter_mgr)
+bgpstream_reader_pool_t *bgpstream_reader_pool_create(int concurrency)
+{
+  bgpstream_reader_pool_t *pool;
+
+  assert(concurrency > 0);
+
+  if ((pool = malloc_zero(sizeof(bgpstream_reader_pool_t))) == NULL) {
+    return NULL;
+  }
+
+  if ((pool->threads = malloc_zero(sizeof(pthread_t) * concurrency)) ==
+      NULL) {
+    free(pool);
+    return NULL;
+  }
+  pool->threads_max = concurrency;
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  return pool;
+}
+
+void bgpstream_reader_pool_destroy(bgpstream_reader_pool_t *pool)
+{
+  int i;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  // tell the threads to finish up
+  pthread_mutex_lock(&pool->mutex);
+  assert(pool->queue_head == NULL);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->threads_cnt; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  pool->threads = NULL;
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+
+  free(pool);
+}
+
+bgpstream_reader_t *
+bgpstream_reader_create(bgpstream_resource_t *resource,
+                        bgpstream_filter_mgr_t *filter_mgr,
+                        bgpstream_reader_pool_t *pool, int readahead, int hold,
+                        const bgpstream_format_opts_t *format_opts)
 {
   bgpstream_reader_t *reader;
 
@@ -220,14 +556,39 @@ bgpstream_reader_t *bgpstream_reader_create(bgpstream_resource_t *resource,
   reader->res = resource;
   reader->filter_mgr = filter_mgr;
   reader->status = BGPSTREAM_FORMAT_OK;
+  reader->decode_status = BGPSTREAM_FORMAT_OK;
+
+  // stream resources are polled, so there is nothing to read ahead
+  if (resource->duration != BGPSTREAM_FOREVER && readahead > 0) {
+    reader->readahead = readahead;
+  }
+  reader->hold = hold;
+  reader->format_opts = *format_opts;
+  // the read-ahead records, plus the exported and prefetch records, plus any
+  // records held by the consumer
+  reader->slots_cnt = reader->readahead + 2 + reader->hold;
+  if ((reader->slots = malloc_zero(sizeof(rec_slot_t) * reader->slots_cnt)) ==
+      NULL) {
+    free(reader);
+    return NULL;
+  }
 
-  // initialize and start the thread to open the resource
+  // initialize and queue the resource to be opened by the pool
   // this will also pre-fetch the first record
   pthread_mutex_init(&reader->mutex, NULL);
   pthread_cond_init(&reader->dump_ready_cond, NULL);
+  pthread_cond_init(&reader->ring_cond, NULL);
   reader->dump_ready = 0;
   reader->skip_dump_check = 0;
-  pthread_create(&reader->opener_thread, NULL, threaded_opener, reader);
+  reader->pool = pool;
+  if (pool_submit(pool, reader) != 0) {
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->dump_ready_cond);
+    pthread_cond_destroy(&reader->ring_cond);
+    free(reader->slots);
+    free(reader);
+    return NULL;
+  }
 
   return reader;
 }
@@ -244,16 +605,37 @@ void bgpstream_reader_destroy(bgpstream_reader_t *reader)
     return;
   }
 
-  // Ensure the thread is done
-  pthread_join(reader->opener_thread, NULL);
+  // Ensure the pool is done with us (either never started, or finished)
+  if (pool_cancel(reader->pool, reader) == 0) {
+    pthread_mutex_lock(&reader->mutex);
+    while (reader->dump_ready == 0) {
+      pthread_cond_wait(&reader->dump_ready_cond, &reader->mutex);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+  }
+  reader->pool = NULL;
+
+  // stop the decoder (if there is one)
+  if (reader->decode_thread_running != 0) {
+    pthread_mutex_lock(&reader->mutex);
+    reader->shutdown = 1;
+    pthread_cond_signal(&reader->ring_cond);
+    pthread_mutex_unlock(&reader->mutex);
+    pthread_join(reader->decode_thread, NULL);
+    reader->decode_thread_running = 0;
+  }
+
   pthread_mutex_destroy(&reader->mutex);
   pthread_cond_destroy(&reader->dump_ready_cond);
+  pthread_cond_destroy(&reader->ring_cond);
 
   int i;
-  for (i = 0; i < 2; i++) {
-    bgpstream_record_destroy(reader->rec_buf[i]);
-    reader->rec_buf[i] = NULL;
+  for (i = 0; i < reader->slots_cnt; i++) {
+    bgpstream_record_destroy(reader->slots[i].record);
+    reader->slots[i].record = NULL;
   }
+  free(reader->slots);
+  reader->slots = NULL;
 
   bgpstream_format_destroy(reader->format);
 
@@ -280,6 +662,33 @@ int bgpstream_reader_open_wait(bgpstream_reader_t *reader)
   return 0;
 }
 
+int bgpstream_reader_is_ready(bgpstream_reader_t *reader)
+{
+  int ready;
+
+  pthread_mutex_lock(&reader->mutex);
+  if (reader->dump_ready == 0) {
+    ready = 0;
+  } else if (reader->decode_thread_running == 0 ||
+             reader->status != BGPSTREAM_FORMAT_OK) {
+    // we will either decode the next record ourselves, or not need one
+    ready = 1;
+  } else {
+    ready = (reader->decoded_cnt > reader->prefetch_seq + 1);
+  }
+  pthread_mutex_unlock(&reader->mutex);
+
+  return ready;
+}
+
+int bgpstream_reader_get_poll_fd(bgpstream_reader_t *reader)
+{
+  if (bgpstream_reader_open_wait(reader) != 0) {
+    return -1;
+  }
+  return bgpstream_format_get_poll_fd(reader->format);
+}
+
 int bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
                                      bgpstream_record_t **record)
 {
@@ -289,30 +698,32 @@ int bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
     // cant even open the dump file
     // we're not going to last long, but we should return the record saying
     // we're a failure
-    *record = reader->rec_buf[PREFETCH_IDX];
+    *record = SLOT(reader->prefetch_seq)->record;
     (*record)->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_SOURCE;
     assert((*record)->__int->data == NULL);
     return BGPSTREAM_READER_STATUS_EOS;
   }
 
-  // mark the previous record as unfilled (about to become PREFETCH_IDX)
-  reader->rec_buf_filled[EXPORTED_IDX] = 0;
-  // the record contents will be cleared by the next prefetch
-
-  // flip-flop the buffers (EXPORTED will mean "about to export")
-  reader->rec_buf_prefetch_idx = EXPORTED_IDX;
+  // the current prefetch record is about to be exported
+  rec_slot_t *exported = SLOT(reader->prefetch_seq);
 
   // prefetch the next message (so we can see if the record we're about to
-  // export would be the last one)
-  if (reader->status == BGPSTREAM_FORMAT_OK && prefetch_record(reader) != 0) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Prefetch failed");
-    return BGPSTREAM_READER_STATUS_ERROR;
+  // export would be the last one). the previously exported record will be
+  // reused, and its contents cleared by the prefetch.
+  if (reader->status == BGPSTREAM_FORMAT_OK) {
+    next_record(reader);
+    adopt_record(reader, reader->prefetch_seq + 1);
   }
 
   // if the EXPORT record is not filled then we need to return EOS or AGAIN
-  if (reader->rec_buf_filled[EXPORTED_IDX] == 0) {
+  if (exported->filled == 0) {
     if (reader->res->duration == BGPSTREAM_FOREVER &&
         reader->status == BGPSTREAM_FORMAT_OK) {
+      // if the prefetch got some data then there is no point making the
+      // caller wait for more
+      if (SLOT(reader->prefetch_seq)->filled != 0) {
+        return bgpstream_reader_get_next_record(reader, record);
+      }
       return BGPSTREAM_READER_STATUS_AGAIN;
     } else {
       return BGPSTREAM_READER_STATUS_EOS;
@@ -321,7 +732,48 @@ int bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
 
   // we have something in our EXPORT record, so go ahead and copy that into the
   // user's record
-  *record = reader->rec_buf[EXPORTED_IDX];
+  *record = exported->record;
+  if (reader->hold > 0) {
+    pthread_mutex_lock(&reader->mutex);
+    reader->exported_cnt++;
+    pthread_mutex_unlock(&reader->mutex);
+  }
 
   return BGPSTREAM_READER_STATUS_OK;
 }
+
+void bgpstream_reader_release_record(bgpstream_reader_t *reader)
+{
+  assert(reader->hold > 0);
+  pthread_mutex_lock(&reader->mutex);
+  assert(reader->released_seq < reader->exported_cnt);
+  reader->released_seq++;
+  pthread_cond_signal(&reader->ring_cond);
+  pthread_mutex_unlock(&reader->mutex);
+}
+
+int bgpstream_reader_get_held_cnt(bgpstream_reader_t *reader)
+{
+  int held;
+  if (reader->hold == 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&reader->mutex);
+  held = reader->exported_cnt - reader->released_seq;
+  pthread_mutex_unlock(&reader->mutex);
+  return held;
+}
+
+void bgpstream_reader_get_stats(bgpstream_reader_t *reader,
+                                bgpstream_stats_t *stats)
+{
+  pthread_mutex_lock(&reader->mutex);
+  if (reader->dump_ready != 0) {
+    stats->resources_opened++;
+    stats->open_time_usec += reader->open_time_usec;
+    if (reader->format != NULL) {
+      bgpstream_format_get_stats(reader->format, stats);
+    }
+  }
+  pthread_mutex_unlock(&reader->mutex);
+}
@@ -28,11 +28,18 @@
 #define __BGPSTREAM_READER_H
 
 #include "bgpstream_filter.h"
+#include "bgpstream_format.h"
 #include "bgpstream_resource.h"
 
 /** Opaque structure representing a reader instance */
 typedef struct bgpstream_reader bgpstream_reader_t;
 
+/** Opaque structure representing a pool of threads that open readers */
+typedef struct bgpstream_reader_pool bgpstream_reader_pool_t;
+
+/** Default maximum number of resources that will be opened concurrently */
+#define BGPSTREAM_READER_CONCURRENCY_DEFAULT 16
+
 /** Return codes for get_next_record */
 typedef enum {
 
@@ -50,9 +57,46 @@ typedef enum {
 
 } bgpstream_reader_status_t;
 
-/** Create a new reader for the given resource */
-bgpstream_reader_t *bgpstream_reader_create(bgpstream_resource_t *resource,
-                                            bgpstream_filter_mgr_t *filter_mgr);
+/** Create a new pool of opener threads
+ *
+ * @param concurrency   maximum number of threads (and thus resources being
+ *                      opened at once) in the pool
+ * @return pointer to a pool instance if successful, NULL otherwise
+ *
+ * Threads are started on demand (up to `concurrency`) and are reused for
+ * subsequent resources.
+ */
+bgpstream_reader_pool_t *bgpstream_reader_pool_create(int concurrency);
+
+/** Destroy the given pool
+ *
+ * All readers that were created using this pool must be destroyed first.
+ */
+void bgpstream_reader_pool_destroy(bgpstream_reader_pool_t *pool);
+
+/** Create a new reader for the given resource
+ *
+ * The resource is opened asynchronously by a thread from the given pool. Use
+ * bgpstream_reader_open_wait to wait for the open to complete.
+ *
+ * If readahead is > 0 (and the resource is not a stream), once the resource
+ * has been opened a background thread decodes up to `readahead` records ahead
+ * of the consumer.
+ *
+ * If hold is > 0, records returned by bgpstream_reader_get_next_record remain
+ * valid until they are released (in order) using
+ * bgpstream_reader_release_record, and the consumer may hold up to `hold`
+ * records (plus the most recently returned one) at once. Stream resources
+ * cannot be held.
+ *
+ * The format is created with the given options (see
+ * bgpstream_format_create).
+ */
+bgpstream_reader_t *
+bgpstream_reader_create(bgpstream_resource_t *resource,
+                        bgpstream_filter_mgr_t *filter_mgr,
+                        bgpstream_reader_pool_t *pool, int readahead, int hold,
+                        const bgpstream_format_opts_t *format_opts);
 
 /** Get the time of the next record available in the reader
  *
@@ -64,6 +108,20 @@ uint32_t bgpstream_reader_get_next_time(bgpstream_reader_t *reader);
 /** Block until the resource has opened */
 int bgpstream_reader_open_wait(bgpstream_reader_t *reader);
 
+/** Check if the next record can be returned without waiting
+ * @param reader        pointer to a reader instance
+ * @return 1 if the resource has opened and (when reading ahead) the next record
+ * has already been decoded, 0 otherwise
+ */
+int bgpstream_reader_is_ready(bgpstream_reader_t *reader);
+
+/** Get a file descriptor to wait on after the reader has returned AGAIN
+ * @param reader        pointer to an open reader instance
+ * @return a file descriptor that becomes readable when the resource has more
+ * data, or -1 if the resource must be polled periodically instead
+ */
+int bgpstream_reader_get_poll_fd(bgpstream_reader_t *reader);
+
 /** Destroy the given reader */
 void bgpstream_reader_destroy(bgpstream_reader_t *reader);
 
@@ -82,4 +140,30 @@ bgpstream_reader_status_t
 bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
                                  bgpstream_record_t **record);
 
+/** Release the oldest record held by the consumer
+ *
+ * @param reader        pointer to a reader instance created with hold > 0
+ *
+ * This may be called from a different thread to the one reading records.
+ */
+void bgpstream_reader_release_record(bgpstream_reader_t *reader);
+
+/** Get the number of records that are held by the consumer
+ *
+ * @param reader        pointer to a reader instance
+ * @return the number of records returned by the reader that have not yet been
+ * released (always 0 if hold was not enabled)
+ */
+int bgpstream_reader_get_held_cnt(bgpstream_reader_t *reader);
+
+/** Add the performance counters for the given reader to the given stats
+ *
+ * @param reader        pointer to a reader instance
+ * @param stats         pointer to the stats to add to
+ *
+ * Nothing is added until the reader has finished opening.
+ */
+void bgpstream_reader_get_stats(bgpstream_reader_t *reader,
+                                bgpstream_stats_t *stats);
+
 #endif /* __BGPSTREAM_READER_H */
@@ -34,12 +34,99 @@
 #include "bgpstream_format_interface.h" // to access filter mgr
 #include "bgpstream_int.h"
 #include "bgpstream_log.h"
+#include "bgpstream_utils_as_path_int.h"
+#include "bgpstream_utils_community_int.h"
 #include "utils.h"
 #include <assert.h>
 #include <inttypes.h>
-#include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/** Default size of an elem arena chunk (larger allocations get their own
+    chunk) */
+#define ARENA_CHUNK_LEN (64 * 1024)
+
+/** Alignment of the allocations made from an elem arena */
+#define ARENA_ALIGN sizeof(void *)
+
+struct bgpstream_record_arena_chunk {
+
+  /** Next chunk in the arena */
+  struct bgpstream_record_arena_chunk *next;
+
+  /** Number of bytes in the chunk */
+  size_t len;
+
+  /** Number of bytes of the chunk in use */
+  size_t used;
+
+  /** Chunk data */
+  uint8_t *data;
+};
+
+static void *arena_alloc(bgpstream_record_internal_t *ri, size_t len)
+{
+  struct bgpstream_record_arena_chunk *chunk = ri->arena_cur;
+  struct bgpstream_record_arena_chunk *new_chunk;
+  void *ptr;
+
+  len = (len + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  // move on to the next (reused) chunk if this one is full. chunks after the
+  // current one are empty
+  if (chunk != NULL && chunk->len - chunk->used < len && chunk->next != NULL &&
+      chunk->next->len >= len) {
+    chunk = chunk->next;
+  }
+
+  if (chunk == NULL || chunk->len - chunk->used < len) {
+    // add a new chunk after the current one
+    if ((new_chunk =
+           malloc_zero(sizeof(struct bgpstream_record_arena_chunk))) == NULL) {
+      return NULL;
+    }
+    new_chunk->len = len > ARENA_CHUNK_LEN ? len : ARENA_CHUNK_LEN;
+    if ((new_chunk->data = malloc(new_chunk->len)) == NULL) {
+      free(new_chunk);
+      return NULL;
+    }
+    if (chunk == NULL) {
+      ri->arena = new_chunk;
+    } else {
+      new_chunk->next = chunk->next;
+      chunk->next = new_chunk;
+    }
+    chunk = new_chunk;
+  }
+
+  ri->arena_cur = chunk;
+  ptr = chunk->data + chunk->used;
+  chunk->used += len;
+  return ptr;
+}
+
+static void arena_reset(bgpstream_record_internal_t *ri)
+{
+  struct bgpstream_record_arena_chunk *chunk;
+
+  for (chunk = ri->arena; chunk != NULL; chunk = chunk->next) {
+    chunk->used = 0;
+  }
+  ri->arena_cur = ri->arena;
+}
+
+static void arena_destroy(bgpstream_record_internal_t *ri)
+{
+  struct bgpstream_record_arena_chunk *chunk;
+
+  while ((chunk = ri->arena) != NULL) {
+    ri->arena = chunk->next;
+    free(chunk->data);
+    free(chunk);
+  }
+  ri->arena_cur = NULL;
+}
 
 bgpstream_record_t *bgpstream_record_create(bgpstream_format_t *format)
 {
@@ -67,6 +154,11 @@ void bgpstream_record_destroy(bgpstream_record_t *record)
 
   bgpstream_format_destroy_data(record);
 
+  if (record->__int != NULL) {
+    free(record->__int->elems);
+    arena_destroy(record->__int);
+  }
+
   free(record->__int);
   free(record);
 }
@@ -78,183 +170,16 @@ void bgpstream_record_clear(bgpstream_record_t *record)
 {
   bgpstream_format_clear_data(record);
 
+  // forget the extracted elems, but keep their memory
+  record->__int->elems_cnt = 0;
+  record->__int->elems_done = 0;
+  arena_reset(record->__int);
+
   // reset the record timestamps
   record->time_sec = 0;
   record->time_usec = 0;
 }
 
-static bgpstream_patricia_walk_cb_result_t pfx_exists(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  *(int*)data = 1;
-  return BGPSTREAM_PATRICIA_WALK_END_ALL;
-}
-
-static bgpstream_patricia_walk_cb_result_t pfx_allows_more_specifics(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
-  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
-      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_MORE) {
-    *(int*)data = 1;
-    return BGPSTREAM_PATRICIA_WALK_END_ALL;
-  }
-  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
-}
-
-static bgpstream_patricia_walk_cb_result_t pfx_allows_less_specifics(
-    const bgpstream_patricia_tree_t *pt, const bgpstream_patricia_node_t *node,
-    void *data)
-{
-  const bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(node);
-  if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
-      pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_LESS) {
-    *(int*)data = 1;
-    return BGPSTREAM_PATRICIA_WALK_END_ALL;
-  }
-  return BGPSTREAM_PATRICIA_WALK_CONTINUE;
-}
-
-static int bgpstream_elem_prefix_match(bgpstream_patricia_tree_t *prefixes,
-                                       bgpstream_pfx_t *search)
-{
-  int matched = 0;
-
-  bgpstream_patricia_tree_walk_up_down(prefixes, search, pfx_exists,
-      pfx_allows_more_specifics, pfx_allows_less_specifics, &matched);
-  return matched;
-}
-
-static int elem_check_filters(bgpstream_record_t *record,
-                              bgpstream_elem_t *elem)
-{
-  bgpstream_filter_mgr_t *filter_mgr = record->__int->format->filter_mgr;
-
-  /* First up, check if this element is the right type */
-  if (filter_mgr->elemtype_mask) {
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_PEERSTATE)) {
-      return 0;
-    }
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_RIB &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_RIB)) {
-      return 0;
-    }
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT &&
-        !(filter_mgr->elemtype_mask &
-          BGPSTREAM_FILTER_ELEM_TYPE_ANNOUNCEMENT)) {
-      return 0;
-    }
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL &&
-        !(filter_mgr->elemtype_mask & BGPSTREAM_FILTER_ELEM_TYPE_WITHDRAWAL)) {
-      return 0;
-    }
-  }
-
-  /* Checking peer ASNs: if the filter is on and the peer asn is not in the
-   * set, return 0 */
-  if (filter_mgr->peer_asns &&
-      bgpstream_id_set_exists(filter_mgr->peer_asns, elem->peer_asn) == 0) {
-    return 0;
-  }
-
-  /* Checking origin ASN */
-  if (filter_mgr->origin_asns) {
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-    uint32_t origin_asn;
-
-    if (bgpstream_as_path_get_origin_val(elem->as_path, &origin_asn) < 0) {
-      return 0;
-    }
-
-    if (bgpstream_id_set_exists(filter_mgr->origin_asns, origin_asn) == 0) {
-      return 0;
-    }
-  }
-
-  if (filter_mgr->ipversion) {
-    /* Determine address version for the element prefix */
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-
-    if (elem->prefix.address.version != filter_mgr->ipversion)
-      return 0;
-  }
-
-  if (filter_mgr->prefixes) {
-    if (elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-    if (bgpstream_elem_prefix_match(filter_mgr->prefixes, &elem->prefix) == 0)
-      return 0;
-  }
-
-  /* Checking AS Path expressions */
-  if (filter_mgr->aspath_exprs) {
-    char aspath[65536];
-    int pathlen;
-
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-
-    pathlen = bgpstream_as_path_snprintf(aspath, sizeof(aspath), elem->as_path);
-
-    if (pathlen >= sizeof(aspath)) {
-      bgpstream_log(BGPSTREAM_LOG_WARN,
-                    "AS Path is too long? Filter may not work well.");
-    }
-
-    for (int i = 0; i < filter_mgr->aspath_expr_cnt; i++) {
-      int result = regexec(filter_mgr->aspath_exprs[i].re, aspath, 0, NULL, 0);
-      // All aspath regexes must match
-      if ((result == 0) != (filter_mgr->aspath_exprs[i].negate == 0)) {
-        return 0;
-      }
-    }
-  }
-
-  /* Checking communities (unless it is a withdrawal message) */
-  if (filter_mgr->communities) {
-    int pass = 0;
-    if (elem->type == BGPSTREAM_ELEM_TYPE_WITHDRAWAL ||
-        elem->type == BGPSTREAM_ELEM_TYPE_PEERSTATE) {
-      return 0;
-    }
-
-    bgpstream_community_t *c;
-    khiter_t k;
-    for (k = kh_begin(filter_mgr->communities);
-         k != kh_end(filter_mgr->communities); ++k) {
-      if (kh_exist(filter_mgr->communities, k)) {
-        c = &(kh_key(filter_mgr->communities, k));
-        if (bgpstream_community_set_match(
-              elem->communities, c, kh_value(filter_mgr->communities, k))) {
-          pass = 1;
-          break;
-        }
-      }
-    }
-    if (pass == 0) {
-      return 0;
-    }
-  }
-
-  return 1;
-}
-
 int bgpstream_record_get_next_elem(bgpstream_record_t *record,
                                    bgpstream_elem_t **elemp)
 {
@@ -274,8 +199,11 @@ int bgpstream_record_get_next_elem(bgpstream_record_t *record,
       // either error or end-of-elems
       return rc;
     }
+    BGPSTREAM_STATS_INC(record->__int->format->stats.elems_read, 1);
 
-    if (elem_check_filters(record, elem) == 0) {
+    if (bgpstream_filter_mgr_elem_check(record->__int->format->filter_mgr,
+                                        elem) == 0) {
+      BGPSTREAM_STATS_INC(record->__int->format->stats.elems_filtered, 1);
       elem = NULL;
     }
   }
@@ -284,6 +212,61 @@ int bgpstream_record_get_next_elem(bgpstream_record_t *record,
   return 1;
 }
 
+int bgpstream_record_get_elems(bgpstream_record_t *record,
+                               bgpstream_elem_t **elems, int *elems_cnt)
+{
+  bgpstream_record_internal_t *ri = record->__int;
+  bgpstream_elem_t *elem;
+  bgpstream_elem_t *copy;
+  void *buf;
+  int rc;
+
+  while (ri->elems_done == 0) {
+    if ((rc = bgpstream_record_get_next_elem(record, &elem)) < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      ri->elems_done = 1;
+      break;
+    }
+
+    if (ri->elems_cnt == ri->elems_alloc_cnt) {
+      if ((copy = realloc(ri->elems, sizeof(bgpstream_elem_t) *
+                                       (ri->elems_alloc_cnt * 2 + 16))) ==
+          NULL) {
+        return -1;
+      }
+      ri->elems = copy;
+      ri->elems_alloc_cnt = ri->elems_alloc_cnt * 2 + 16;
+    }
+    copy = &ri->elems[ri->elems_cnt];
+
+    // the fixed-size fields are copied as-is, and the AS path and communities
+    // are stored inline in the arena
+    *copy = *elem;
+    if (elem->as_path != NULL) {
+      if ((buf = arena_alloc(ri, bgpstream_as_path_inline_size(
+                                   elem->as_path))) == NULL) {
+        return -1;
+      }
+      copy->as_path = bgpstream_as_path_copy_inline(buf, elem->as_path);
+    }
+    if (elem->communities != NULL) {
+      if ((buf = arena_alloc(ri, bgpstream_community_set_inline_size(
+                                   elem->communities))) == NULL) {
+        return -1;
+      }
+      copy->communities =
+        bgpstream_community_set_copy_inline(buf, elem->communities);
+    }
+    ri->elems_cnt++;
+  }
+
+  *elems = ri->elems;
+  *elems_cnt = ri->elems_cnt;
+  return 0;
+}
+
 int bgpstream_record_type_snprintf(char *buf, size_t len,
                                    bgpstream_record_type_t type)
 {
@@ -244,6 +244,32 @@ typedef struct bgpstream_record {
 int bgpstream_record_get_next_elem(bgpstream_record_t *record,
                                    bgpstream_elem_t **elem);
 
+/** Retrieve all the (remaining) elems of the record at once
+ *
+ * @param record        pointer to the BGP Stream Record to retrieve the elems
+ *                      from
+ * @param[out] elems    set to point to a borrowed array of elems
+ * @param[out] elems_cnt  set to the number of elems in the array
+ * @return 0 if the elems were retrieved successfully, -1 if an error occurred
+ *
+ * The elems (including their AS paths and community sets) are decoded in a
+ * single pass and stored in memory owned by the record, which is reused for
+ * subsequent records. This avoids having to bgpstream_elem_copy each elem
+ * returned by bgpstream_record_get_next_elem in order to keep them all.
+ *
+ * Elems already returned by bgpstream_record_get_next_elem are not included,
+ * and once this function has been called, bgpstream_record_get_next_elem will
+ * return no more elems. Calling it again for the same record returns the same
+ * array.
+ *
+ * The returned elems must not be modified, and their AS paths and community
+ * sets must not be destroyed. They are guaranteed to be valid until the record
+ * is re-used in a subsequent call to bgpstream_get_next_record, or is destroyed
+ * with bgpstream_record_destroy
+ */
+int bgpstream_record_get_elems(bgpstream_record_t *record,
+                               bgpstream_elem_t **elems, int *elems_cnt);
+
 /** Write the string representation of the record type into the provided buffer
  *
  * @param buf           pointer to a char array
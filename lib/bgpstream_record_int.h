@@ -52,6 +52,25 @@ struct bgpstream_record_internal {
 
   /** Private data-structure (optionally) populated by the format module */
   void *data;
+
+  /** Elems extracted by bgpstream_record_get_elems */
+  bgpstream_elem_t *elems;
+
+  /** Number of elems in the elems array */
+  int elems_cnt;
+
+  /** Number of elems allocated in the elems array */
+  int elems_alloc_cnt;
+
+  /** Set once the elems of this record have been extracted */
+  int elems_done;
+
+  /** Arena that holds the AS paths and community sets of the extracted
+      elems. Chunks are kept (and reused) until the record is destroyed */
+  struct bgpstream_record_arena_chunk *arena;
+
+  /** Chunk of the arena that is currently being filled */
+  struct bgpstream_record_arena_chunk *arena_cur;
 };
 
 /** @} */
@@ -28,9 +28,13 @@
 #include "bgpstream_filter.h"
 #include "bgpstream_log.h"
 #include "bgpstream_reader.h"
+#include "bgpstream_stats.h"
 #include "config.h"
+#include "khash.h"
 #include "utils.h"
 #include <assert.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,9 +43,18 @@
 #define BUFFER_LEN 1024
 
 /** Approximately how frequently should stream resources that return AGAIN be
-    polled? (in msec) */
+    polled? (in msec). Streams that provide a poll descriptor are woken as soon
+    as data arrives, so for them this is only an upper bound. */
 #define AGAIN_POLL_INTERVAL 500
-#define MSEC_TO_NSEC 1000000
+
+/** Initial number of slots allocated for stream poll descriptors */
+#define POLLFDS_ALLOC_INIT 8
+
+/** Initial number of group slots allocated for the group heap */
+#define GROUPS_ALLOC_INIT 128
+
+/** Number of records that each merge shard may queue ahead of the merge */
+#define SHARD_QUEUE_LEN 64
 
 struct res_list_elem {
   /** The resource info */
@@ -62,6 +75,25 @@ struct res_list_elem {
 
   /** Next list elem */
   struct res_list_elem *next;
+
+  /** Previous and next elems in the list of resources with a reader (used to
+      gather stats) */
+  struct res_list_elem *live_prev;
+  struct res_list_elem *live_next;
+};
+
+/** A resource that has been read to the end, but has not yet been reported to
+ * the stats callback */
+struct finished_res {
+
+  /** The list elem of the resource (its reader has been destroyed) */
+  struct res_list_elem *el;
+
+  /** Final counters for the resource */
+  bgpstream_stats_t stats;
+
+  /** Next resource to report */
+  struct finished_res *next;
 };
 
 struct res_group {
@@ -87,20 +119,107 @@ struct res_group {
   /** The number of open resources that have been checked and re-sorted */
   int res_open_checked_cnt;
 
-  /** Previous group (newer timestamp) */
-  struct res_group *prev;
+  /** Index of this group in the group heap */
+  int heap_idx;
+
+  /** The number of resources opened by lookahead (i.e. before this group was
+      part of the batch being read) */
+  int lookahead_cnt;
+};
+
+/** Map from group time to group */
+KHASH_INIT(res_group_time, uint32_t, struct res_group *, 1, kh_int_hash_func,
+           kh_int_hash_equal)
+
+/** A record (or end-of-queue marker) produced by a merge shard */
+struct shard_entry {
+
+  /** Borrowed pointer to the record (NULL if the shard has reached the end of
+      its queue, or failed) */
+  bgpstream_record_t *record;
+
+  /** Reader that the record must be released to */
+  bgpstream_reader_t *reader;
+
+  /** Time of the group the record was read from */
+  uint32_t time;
+
+  /** Type of the resource the record was read from */
+  bgpstream_record_type_t type;
+
+  /** Set if the shard failed to read a record */
+  int error;
+};
+
+/** A merge shard: a thread that reads (in order) from the resources of a
+ * subset of collectors, and queues the records for the k-way merge */
+struct shard {
+
+  /** Resource manager holding the resources of this shard */
+  bgpstream_resource_mgr_t *mgr;
+
+  /** Thread that reads records from the resource manager */
+  pthread_t thread;
+  int thread_running;
+
+  /** Single-producer, single-consumer ring of records. The producer (shard
+      thread) only writes `produced` and the consumer (merge) only writes
+      `consumed` */
+  struct shard_entry queue[SHARD_QUEUE_LEN];
+  unsigned long produced;
+  unsigned long consumed;
+
+  /** Set when either side is blocked waiting on the other */
+  int producer_waiting;
+  int consumer_waiting;
+
+  /** Does the shard have resources that have not been fully merged? (only
+      used by the consumer) */
+  int active;
+
+  /** Have resources been added since the shard thread was last started? (only
+      used by the consumer) */
+  int pending;
+
+  // ALL BELOW HERE MUST USE MUTEX
+
+  /** Set while the shard thread is reading from `mgr`. The consumer only adds
+      resources to `mgr` while this is not set, and only sets it once it has
+      added all resources in a batch (otherwise the shard could read records
+      out of order) */
+  int running;
+
+  /** Set when the shard thread should exit */
+  int shutdown;
 
-  /** Next group (older timestamp) */
-  struct res_group *next;
+  /** Set if the shard failed to read a record */
+  int failed;
+
+  pthread_cond_t cond;
+  pthread_mutex_t mutex;
 };
 
 struct bgpstream_resource_mgr {
 
-  /** Ordered queue of resources, grouped by timestamp (i.e. group by second).
-   * The oldest timestamp is at the head, newest at the tail */
-  struct res_group *head;
+  /** Queue of resources, grouped by timestamp (i.e. group by second). This is
+   * a binary min-heap keyed on the group time, so the oldest group is always
+   * at index 0 */
+  struct res_group **groups;
+  int groups_cnt;
+  int groups_alloc_cnt;
+
+  /** Index of groups by time so that adding a resource to an existing group
+   * does not need to search the heap */
+  khash_t(res_group_time) * groups_by_time;
+
+  /** Scratch heap (of indices into groups) used to walk groups in time order.
+   * Allocated to groups_alloc_cnt */
+  int *walk;
+  int walk_cnt;
 
-  struct res_group *tail;
+  /** Scratch list of groups used by sort_batch. Allocated to
+   * groups_alloc_cnt */
+  struct res_group **batch;
 
   // the number of resources in the queue
   int res_cnt;
@@ -113,9 +232,94 @@ struct bgpstream_resource_mgr {
 
   // borrowed pointer to a filter manager instance
   bgpstream_filter_mgr_t *filter_mgr;
+
+  // pool of threads used to open resources (created when first needed)
+  bgpstream_reader_pool_t *reader_pool;
+
+  // maximum number of resources to open concurrently
+  int reader_concurrency;
+
+  // number of records each reader should decode ahead (0 to disable)
+  int reader_readahead;
+
+  // number of records that may be held by the consumer of each reader
+  int reader_hold;
+
+  // options to create the format of each resource with
+  bgpstream_format_opts_t format_opts;
+
+  // number of groups after the current batch to open in advance (0 to
+  // disable), and the maximum number of record buffers that the readers opened
+  // in advance may use (0 for no limit)
+  int lookahead_groups;
+  int lookahead_max_records;
+
+  // the number of resources opened in advance that are not yet in the batch
+  int lookahead_cnt;
+
+  // list of readers that have reached EOS but still have records held
+  struct res_list_elem *retired;
+
+  // merge shards (if enabled, resources are all queued in the shards rather
+  // than in this queue)
+  struct shard *shards;
+  int shards_cnt;
+
+  // reader of the last record returned by the merge (to be released)
+  bgpstream_reader_t *held_reader;
+
+  // if the caller holds on to records (see set_record_hold), the readers of
+  // the records that have not been released yet (oldest first). the caller
+  // only ever appends, and release only ever removes.
+  bgpstream_reader_t **hold_readers;
+  int hold_cnt;
+  unsigned long hold_in;
+  unsigned long hold_out;
+
+  // order in which records are returned. if not BGPSTREAM_ORDER_TIME,
+  // resources are queued in the lists below rather than in groups
+  bgpstream_ordering_t ordering;
+
+  // (unordered) FIFO of resources that have not been opened yet
+  struct res_list_elem *pending_head;
+  struct res_list_elem *pending_tail;
+
+  // (unordered) list of open resources, and the number of these that are not
+  // streams (which is bounded by reader_concurrency)
+  struct res_list_elem *active;
+  int active_cnt;
+
+  // (unordered) resource to try reading from first
+  struct res_list_elem *cursor;
+
+  // scratch space for waiting on stream resources (and the resource that each
+  // descriptor belongs to)
+  struct pollfd *pollfds;
+  struct res_list_elem **poll_els;
+  int pollfds_alloc_cnt;
+
+  // if set, get_record returns 0 rather than waiting for a stream resource to
+  // have data or for a merge shard to read a record (see get_ready_record)
+  int no_wait;
+
+  // resources that have a reader, and the totals for those that have
+  // finished. these are also used by get_stats from the parent if this is a
+  // merge shard (so must use stats_mutex).
+  struct res_list_elem *live;
+  bgpstream_stats_t stats;
+
+  // callback for the stats of each finished resource. finished resources are
+  // queued (in the parent, for merge shards) and reported by get_record.
+  bgpstream_resource_stats_cb_t *stats_cb;
+  void *stats_user;
+  struct finished_res *finished_head;
+  struct finished_res *finished_tail;
+  bgpstream_resource_mgr_t *stats_parent;
+
+  pthread_mutex_t stats_mutex;
 };
 
-static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp);
+static int open_batch(bgpstream_resource_mgr_t *q);
 
 static void res_list_destroy(struct res_list_elem *l, int destroy_resource)
 {
@@ -155,6 +359,93 @@ static struct res_list_elem *res_list_elem_create(bgpstream_resource_t *res)
   return el;
 }
 
+// track a newly opened resource so that get_stats includes its counters
+static void live_add(bgpstream_resource_mgr_t *q, struct res_list_elem *el)
+{
+  pthread_mutex_lock(&q->stats_mutex);
+  el->live_prev = NULL;
+  el->live_next = q->live;
+  if (q->live != NULL) {
+    q->live->live_prev = el;
+  }
+  q->live = el;
+  pthread_mutex_unlock(&q->stats_mutex);
+}
+
+// add the counters of a resource that has been read to the end to the totals,
+// queue it for the stats callback (if there is one), and destroy it
+static void res_finished(bgpstream_resource_mgr_t *q, struct res_list_elem *el)
+{
+  bgpstream_resource_mgr_t *cb_q = 
+    (q->stats_parent != NULL) ? q->stats_parent : q;
+  struct finished_res *f = NULL;
+  bgpstream_stats_t stats;
+
+  memset(&stats, 0, sizeof(stats));
+  bgpstream_reader_get_stats(el->reader, &stats);
+  stats.resources_finished = 1;
+
+  pthread_mutex_lock(&q->stats_mutex);
+  if (el->live_prev != NULL) {
+    el->live_prev->live_next = el->live_next;
+  } else {
+    q->live = el->live_next;
+  }
+  if (el->live_next != NULL) {
+    el->live_next->live_prev = el->live_prev;
+  }
+  el->live_prev = el->live_next = NULL;
+  bgpstream_stats_add(&q->stats, &stats);
+  pthread_mutex_unlock(&q->stats_mutex);
+
+  bgpstream_reader_destroy(el->reader);
+  el->reader = NULL;
+  el->open = 0;
+
+  if (cb_q->stats_cb == NULL ||
+      (f = malloc_zero(sizeof(struct finished_res))) == NULL) {
+    res_list_destroy(el, 1);
+    return;
+  }
+  f->el = el;
+  f->stats = stats;
+
+  pthread_mutex_lock(&cb_q->stats_mutex);
+  if (cb_q->finished_tail == NULL) {
+    // get_record checks this without the mutex
+    __atomic_store_n(&cb_q->finished_head, f, __ATOMIC_RELEASE);
+  } else {
+    cb_q->finished_tail->next = f;
+  }
+  cb_q->finished_tail = f;
+  pthread_mutex_unlock(&cb_q->stats_mutex);
+}
+
+// pass the queued finished resources to the stats callback
+static void report_finished(bgpstream_resource_mgr_t *q)
+{
+  struct finished_res *f;
+  bgpstream_resource_t *res;
+
+  pthread_mutex_lock(&q->stats_mutex);
+  f = q->finished_head;
+  __atomic_store_n(&q->finished_head, NULL, __ATOMIC_RELAXED);
+  q->finished_tail = NULL;
+  pthread_mutex_unlock(&q->stats_mutex);
+
+  while (f != NULL) {
+    struct finished_res *next = f->next;
+    res = f->el->res;
+    if (q->stats_cb != NULL) {
+      q->stats_cb(res->project, res->collector, res->url, &f->stats,
+                  q->stats_user);
+    }
+    res_list_destroy(f->el, 1);
+    free(f);
+    f = next;
+  }
+}
+
 static int open_res_list(bgpstream_resource_mgr_t *q, struct res_group *gp,
                          struct res_list_elem *el)
 {
@@ -166,12 +457,20 @@ static int open_res_list(bgpstream_resource_mgr_t *q, struct res_group *gp,
       continue;
     }
     // open this resource
-    if ((el->reader = bgpstream_reader_create(el->res, q->filter_mgr)) ==
-        NULL) {
+    if (q->reader_pool == NULL &&
+        (q->reader_pool = bgpstream_reader_pool_create(
+           q->reader_concurrency)) == NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to create reader pool");
+      return -1;
+    }
+    if ((el->reader = bgpstream_reader_create(
+           el->res, q->filter_mgr, q->reader_pool, q->reader_readahead,
+           q->reader_hold, &q->format_opts)) == NULL) {
       bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to open resource: %s",
                     el->res->url);
       return -1;
     }
+    live_add(q, el);
     // update stats
     q->res_open_cnt++;
     gp->res_open_cnt++;
@@ -183,6 +482,14 @@ static int open_res_list(bgpstream_resource_mgr_t *q, struct res_group *gp,
 
 static int open_group(bgpstream_resource_mgr_t *q, struct res_group *gp)
 {
+  // this group is now part of the batch, so it no longer counts against the
+  // lookahead budget
+  if (gp->lookahead_cnt != 0) {
+    q->lookahead_cnt -= gp->lookahead_cnt;
+    gp->lookahead_cnt = 0;
+    assert(q->lookahead_cnt >= 0);
+  }
+
   // do nothing if everything is open
   if (gp->res_open_cnt == gp->res_cnt) {
     return 0;
@@ -206,8 +513,7 @@ static void res_group_destroy(struct res_group *g, int destroy_resource)
   if (g == NULL) {
     return;
   }
-  g->prev = NULL;
-  g->next = NULL;
+  g->heap_idx = -1;
   int i;
   for (i = 0; i < _BGPSTREAM_RECORD_TYPE_CNT; i++) {
     res_list_destroy(g->res_list[i], destroy_resource);
@@ -216,6 +522,187 @@ static void res_group_destroy(struct res_group *g, int destroy_resource)
   free(g);
 }
 
+/* ========== GROUP HEAP ========== */
+
+static void heap_swap(bgpstream_resource_mgr_t *q, int a, int b)
+{
+  struct res_group *tmp = q->groups[a];
+  q->groups[a] = q->groups[b];
+  q->groups[b] = tmp;
+  q->groups[a]->heap_idx = a;
+  q->groups[b]->heap_idx = b;
+}
+
+static void heap_sift_up(bgpstream_resource_mgr_t *q, int idx)
+{
+  int parent;
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (q->groups[parent]->time <= q->groups[idx]->time) {
+      break;
+    }
+    heap_swap(q, idx, parent);
+    idx = parent;
+  }
+}
+
+static void heap_sift_down(bgpstream_resource_mgr_t *q, int idx)
+{
+  int l, r, min;
+  while (1) {
+    l = (2 * idx) + 1;
+    r = l + 1;
+    min = idx;
+    if (l < q->groups_cnt && q->groups[l]->time < q->groups[min]->time) {
+      min = l;
+    }
+    if (r < q->groups_cnt && q->groups[r]->time < q->groups[min]->time) {
+      min = r;
+    }
+    if (min == idx) {
+      break;
+    }
+    heap_swap(q, idx, min);
+    idx = min;
+  }
+}
+
+static int heap_push(bgpstream_resource_mgr_t *q, struct res_group *gp)
+{
+  int new_cnt;
+  struct res_group **groups, **batch;
+  int *walk;
+
+  if (q->groups_cnt == q->groups_alloc_cnt) {
+    new_cnt = (q->groups_alloc_cnt == 0) ? GROUPS_ALLOC_INIT
+                                         : (q->groups_alloc_cnt * 2);
+    if ((groups = realloc(q->groups, sizeof(struct res_group *) * new_cnt)) ==
+        NULL) {
+      return -1;
+    }
+    q->groups = groups;
+    if ((batch = realloc(q->batch, sizeof(struct res_group *) * new_cnt)) ==
+        NULL) {
+      return -1;
+    }
+    q->batch = batch;
+    if ((walk = realloc(q->walk, sizeof(int) * new_cnt)) == NULL) {
+      return -1;
+    }
+    q->walk = walk;
+    q->groups_alloc_cnt = new_cnt;
+  }
+
+  gp->heap_idx = q->groups_cnt;
+  q->groups[q->groups_cnt++] = gp;
+  heap_sift_up(q, gp->heap_idx);
+  return 0;
+}
+
+static void heap_remove(bgpstream_resource_mgr_t *q, struct res_group *gp)
+{
+  int idx = gp->heap_idx;
+  assert(idx >= 0 && idx < q->groups_cnt && q->groups[idx] == gp);
+
+  q->groups_cnt--;
+  if (idx != q->groups_cnt) {
+    // move the last group into the hole and restore the heap property
+    q->groups[idx] = q->groups[q->groups_cnt];
+    q->groups[idx]->heap_idx = idx;
+    heap_sift_up(q, idx);
+    heap_sift_down(q, q->groups[idx]->heap_idx);
+  }
+  q->groups[q->groups_cnt] = NULL;
+  gp->heap_idx = -1;
+}
+
+// remove the given (empty) group from the queue and destroy it
+static void remove_group(bgpstream_resource_mgr_t *q, struct res_group *gp)
+{
+  khiter_t k;
+
+  assert(gp->res_cnt == 0);
+  if ((k = kh_get(res_group_time, q->groups_by_time, gp->time)) !=
+      kh_end(q->groups_by_time)) {
+    kh_del(res_group_time, q->groups_by_time, k);
+  }
+  heap_remove(q, gp);
+  res_group_destroy(gp, 0);
+}
+
+/* The group heap only guarantees that the oldest group is at the head, so to
+ * visit groups in time order we keep a second (scratch) heap of indices into
+ * the group heap. The group heap MUST NOT be modified during a walk. */
+
+#define WALK_LESS(q, a, b)                                                     \
+  ((q)->groups[(q)->walk[(a)]]->time < (q)->groups[(q)->walk[(b)]]->time)
+
+static void walk_push(bgpstream_resource_mgr_t *q, int gidx)
+{
+  int idx, parent, tmp;
+
+  if (gidx >= q->groups_cnt) {
+    return;
+  }
+  idx = q->walk_cnt++;
+  q->walk[idx] = gidx;
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (!WALK_LESS(q, idx, parent)) {
+      break;
+    }
+    tmp = q->walk[idx];
+    q->walk[idx] = q->walk[parent];
+    q->walk[parent] = tmp;
+    idx = parent;
+  }
+}
+
+static void group_walk_start(bgpstream_resource_mgr_t *q)
+{
+  q->walk_cnt = 0;
+  walk_push(q, 0);
+}
+
+// returns the next oldest group in the walk, or NULL if there are none left
+static struct res_group *group_walk_next(bgpstream_resource_mgr_t *q)
+{
+  int gidx, idx, l, r, min, tmp;
+
+  if (q->walk_cnt == 0) {
+    return NULL;
+  }
+  gidx = q->walk[0];
+
+  // pop the min from the walk heap
+  q->walk[0] = q->walk[--q->walk_cnt];
+  idx = 0;
+  while (1) {
+    l = (2 * idx) + 1;
+    r = l + 1;
+    min = idx;
+    if (l < q->walk_cnt && WALK_LESS(q, l, min)) {
+      min = l;
+    }
+    if (r < q->walk_cnt && WALK_LESS(q, r, min)) {
+      min = r;
+    }
+    if (min == idx) {
+      break;
+    }
+    tmp = q->walk[idx];
+    q->walk[idx] = q->walk[min];
+    q->walk[min] = tmp;
+    idx = min;
+  }
+
+  // the children of this group are the only new candidates
+  walk_push(q, (2 * gidx) + 1);
+  walk_push(q, (2 * gidx) + 2);
+
+  return q->groups[gidx];
+}
+
 static uint32_t get_next_time(struct res_list_elem *el)
 {
   if (el->reader != NULL) {
@@ -332,9 +819,11 @@ static void list_dump(struct res_list_elem *el)
   }
 }
 
-static void queue_dump(struct res_group *head)
+static void queue_dump(bgpstream_resource_mgr_t *q)
 {
-  while (head != NULL) {
+  struct res_group *head;
+  group_walk_start(q);
+  while ((head = group_walk_next(q)) != NULL) {
     fprintf(stderr,
             "res_group: time: %d, overlap_start: %d, "
             "overlap_end: %d, "
@@ -347,91 +836,40 @@ static void queue_dump(struct res_group *head)
       fprintf(stderr, "  records (type %d):\n", i);
       list_dump(head->res_list[i]);
     }
-
-    head = head->next;
   }
   fprintf(stderr, "\n");
 }
 #endif
 
-/** Insert a result into the queue from either end
- *
- * FROMEND = {head, tail};
- * TOEND = {tail, head};
- * CMP = {<, >};
- * TODIR = {next, prev};
- * FROMDIR = {prev, next};
- */
-#define QUEUE_PUSH(el, FROMEND, TOEND, CMPOP, TODIR, FROMDIR)                  \
-  do {                                                                         \
-    cur = q->FROMEND;                                                          \
-    last = NULL;                                                               \
-    while (cur != NULL && cur->time CMPOP get_next_time(el)) {                 \
-      last = cur;                                                              \
-      cur = cur->TODIR;                                                        \
-    }                                                                          \
-    if (cur != NULL && cur->time == get_next_time(el)) {                       \
-      /* just add to the current group */                                      \
-      if ((is_dirty = res_group_add(q, cur, el)) < 0) {                        \
-        goto err;                                                              \
-      }                                                                        \
-      dirty_cnt += is_dirty;                                                   \
-    } else {                                                                   \
-      /* we first need to create a new group */                                \
-      if ((gp = res_group_create(el)) == NULL) {                               \
-        goto err;                                                              \
-      }                                                                        \
-      gp->TODIR = cur;                                                         \
-      gp->FROMDIR = last;                                                      \
-      if (cur == NULL) {                                                       \
-        /* creating a new TOEND */                                             \
-        assert(last == q->TOEND);                                              \
-        last->TODIR = gp;                                                      \
-        q->TOEND = gp;                                                         \
-      } else if (last == NULL) {                                               \
-        /* creating a new FROMEND */                                           \
-        assert(q->FROMEND == cur);                                             \
-        cur->FROMDIR = gp;                                                     \
-        q->FROMEND = gp;                                                       \
-      } else {                                                                 \
-        /* splicing into the list */                                           \
-        cur->FROMDIR = gp;                                                     \
-        last->TODIR = gp;                                                      \
-      }                                                                        \
-    }                                                                          \
-  } while (0)
-
 static int insert_resource_elem(bgpstream_resource_mgr_t *q,
                                 struct res_list_elem *el)
 {
-  struct res_group *gp = NULL, *cur = NULL, *last = NULL;
-  int dirty_cnt = 0, is_dirty = 0;
-
-  // is the list empty?
-  if (q->head == NULL) {
-    assert(q->tail == NULL);
+  struct res_group *gp = NULL;
+  uint32_t time = get_next_time(el);
+  khiter_t k;
+  int khret;
+  int dirty_cnt = 0;
 
-    // create a new res group
-    if ((gp = res_group_create(el)) == NULL) {
+  if ((k = kh_get(res_group_time, q->groups_by_time, time)) !=
+      kh_end(q->groups_by_time)) {
+    // just add to the existing group
+    if ((dirty_cnt = res_group_add(q, kh_val(q->groups_by_time, k), el)) < 0) {
       return -1;
     }
-
-    // and make it the head/tail
-    q->head = q->tail = gp;
   } else {
-    // by here head AND tail are guaranteed to be set
-    assert(q->head != NULL && q->tail != NULL);
-
-    // which end of the list is this record closer to?
-    // can probably be optimized somewhat, lists are not my specialty...
-    if (abs((int)get_next_time(el) - (int)q->head->time) <
-        abs((int)get_next_time(el) - (int)q->tail->time)) {
-      // closer to the head of the list
-      QUEUE_PUSH(el, head, tail, <, next, prev);
-    } else {
-      // equidistant, or closer to the tail
-      QUEUE_PUSH(el, tail, head, >, prev, next);
+    // we first need to create a new group
+    if ((gp = res_group_create(el)) == NULL) {
+      return -1;
+    }
+    k = kh_put(res_group_time, q->groups_by_time, time, &khret);
+    if (khret < 0) {
+      goto err;
+    }
+    if (heap_push(q, gp) != 0) {
+      kh_del(res_group_time, q->groups_by_time, k);
+      goto err;
     }
+    kh_val(q->groups_by_time, k) = gp;
   }
 
   // count the resource
@@ -447,7 +885,9 @@ static int insert_resource_elem(bgpstream_resource_mgr_t *q,
   return dirty_cnt;
 
 err:
-  res_group_destroy(gp, 1);
+  // the list elem is owned by the caller
+  gp->res_list[el->res->record_type] = NULL;
+  res_group_destroy(gp, 0);
   return -1;
 }
 
@@ -494,39 +934,6 @@ static void pop_res_el(bgpstream_resource_mgr_t *q, struct res_group *gp,
   el->next = NULL;
 }
 
-static void reap_groups(bgpstream_resource_mgr_t *q)
-{
-  struct res_group *gp = q->head;
-  struct res_group *nxt;
-
-  while (gp != NULL) {
-    nxt = gp->next;
-
-    if (gp->res_cnt == 0) {
-      if (gp->next != NULL) {
-        gp->next->prev = gp->prev;
-      }
-      if (gp->prev != NULL) {
-        gp->prev->next = gp->next;
-      }
-
-      if (q->head == gp) {
-        q->head = gp->next;
-      }
-      if (q->tail == gp) {
-        q->tail = gp->prev;
-      }
-
-      // and destroy the group
-      gp->prev = NULL;
-      gp->next = NULL;
-      res_group_destroy(gp, 0);
-    }
-
-    gp = nxt;
-  }
-}
-
 static int sort_res_list(bgpstream_resource_mgr_t *q, struct res_group *gp,
                          struct res_list_elem *el)
 {
@@ -580,15 +987,25 @@ static int sort_group(bgpstream_resource_mgr_t *q, struct res_group *gp)
    call to open_batch) */
 static int sort_batch(bgpstream_resource_mgr_t *q)
 {
-  struct res_group *cur = q->head;
-  int empty_groups = 0;
+  struct res_group *cur;
+  int batch_cnt = 0;
+  int i;
   int dirty_cnt_total = 0, dirty_cnt = 0;
 
-  // wait for the batch to open first
-  while (cur != NULL && cur->res_open_cnt != 0) {
+  // find the (open) batch first, since sorting will modify the heap
+  group_walk_start(q);
+  while ((cur = group_walk_next(q)) != NULL && cur->res_open_cnt != 0) {
+    q->batch[batch_cnt++] = cur;
+  }
+
+  // wait for the batch to open
+  for (i = 0; i < batch_cnt; i++) {
+    cur = q->batch[i];
 
-    if (cur->res_open_checked_cnt == cur->res_open_cnt) {
-      cur = cur->next;
+    // groups opened by lookahead are not waited for until they are part of
+    // the batch
+    if (cur->res_open_checked_cnt == cur->res_open_cnt ||
+        cur->lookahead_cnt != 0) {
       continue;
     }
 
@@ -596,31 +1013,29 @@ static int sort_batch(bgpstream_resource_mgr_t *q)
       return -1;
     }
     dirty_cnt_total += dirty_cnt;
-
-    if (cur->res_cnt == 0) {
-      empty_groups++;
-    }
-
-    cur = cur->next;
   }
 
   // now reap any empty groups that our sorting has created
-  if (empty_groups != 0) {
-    reap_groups(q);
+  for (i = 0; i < batch_cnt; i++) {
+    if (q->batch[i]->res_cnt == 0) {
+      remove_group(q, q->batch[i]);
+    }
   }
 
   return dirty_cnt_total;
 }
 
 // open all overlapping resources. does not modify the queue
-static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp)
+static int open_batch(bgpstream_resource_mgr_t *q)
 {
   // start from the head of the queue and open resources until we
   // find a group that does not overlap with the previous ones
-  struct res_group *cur = gp;
+  struct res_group *cur;
   int first = 1;
   uint32_t last_overlap_end = 0;
 
+  group_walk_start(q);
+  cur = group_walk_next(q);
   while (cur != NULL && (first != 0 || last_overlap_end > cur->overlap_start)) {
     // this is included in the batch
 
@@ -634,7 +1049,125 @@ static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp)
       last_overlap_end = cur->overlap_end;
     }
 
-    cur = cur->next;
+    cur = group_walk_next(q);
+  }
+
+  return 0;
+}
+
+/* ========== STREAM POLLING ========== */
+
+// wait until one of the stream resources in the given list that are waiting to
+// be polled has data, or until the given time. ready is set to the first
+// resource that has data, or NULL if we timed out.
+static int wait_streams(bgpstream_resource_mgr_t *q, struct res_list_elem *el,
+                        uint32_t until, struct res_list_elem **ready)
+{
+  uint32_t now = epoch_msec();
+  int cnt = 0;
+  int new_cnt;
+  int fd, rc, i;
+  void *ptr;
+
+  *ready = NULL;
+
+  for (; el != NULL; el = el->next) {
+    if (el->next_poll == 0 || el->reader == NULL ||
+        (fd = bgpstream_reader_get_poll_fd(el->reader)) == -1) {
+      continue;
+    }
+    if (cnt == q->pollfds_alloc_cnt) {
+      new_cnt = (cnt == 0) ? POLLFDS_ALLOC_INIT : cnt * 2;
+      if ((ptr = realloc(q->pollfds, sizeof(struct pollfd) * new_cnt)) ==
+          NULL) {
+        return -1;
+      }
+      q->pollfds = ptr;
+      if ((ptr = realloc(q->poll_els, sizeof(struct res_list_elem *) *
+                                        new_cnt)) == NULL) {
+        return -1;
+      }
+      q->poll_els = ptr;
+      q->pollfds_alloc_cnt = new_cnt;
+    }
+    q->pollfds[cnt].fd = fd;
+    q->pollfds[cnt].events = POLLIN;
+    q->pollfds[cnt].revents = 0;
+    q->poll_els[cnt] = el;
+    cnt++;
+  }
+
+  // if none of the streams can be waited on, this is just a sleep
+  if ((rc = poll(q->pollfds, cnt, (until > now) ? (int)(until - now) : 0)) <
+      0) {
+    // interrupted
+    return -1;
+  }
+
+  for (i = 0; i < cnt && rc > 0; i++) {
+    if (q->pollfds[i].revents == 0) {
+      continue;
+    }
+    // there is no need to wait before reading from this one again
+    q->poll_els[i]->next_poll = 0;
+    if (*ready == NULL) {
+      *ready = q->poll_els[i];
+    }
+  }
+
+  return 0;
+}
+
+// move the given element to the head of its list
+static void move_to_head(struct res_list_elem **head, struct res_list_elem *el)
+{
+  if (*head == el) {
+    return;
+  }
+  el->prev->next = el->next;
+  if (el->next != NULL) {
+    el->next->prev = el->prev;
+  }
+  el->prev = NULL;
+  el->next = *head;
+  (*head)->prev = el;
+  *head = el;
+}
+
+// start opening the groups that follow the current batch so that they are ready
+// by the time we get to them. does not modify the queue
+static int open_lookahead(bgpstream_resource_mgr_t *q)
+{
+  struct res_group *cur;
+  int groups = 0;
+  int opened;
+  // each open reader buffers up to this many records
+  int cost = q->reader_readahead + 2 + q->reader_hold;
+
+  group_walk_start(q);
+  while ((cur = group_walk_next(q)) != NULL && groups < q->lookahead_groups) {
+    if (cur->res_open_cnt == cur->res_cnt && cur->lookahead_cnt == 0) {
+      // this is part of the current batch
+      continue;
+    }
+    groups++;
+
+    if ((opened = cur->res_cnt - cur->res_open_cnt) == 0) {
+      // already opened by a previous lookahead
+      continue;
+    }
+    if (q->lookahead_max_records > 0 &&
+        (q->lookahead_cnt + opened) * cost > q->lookahead_max_records) {
+      // this group would put us over budget
+      break;
+    }
+
+    if (open_res_list(q, cur, cur->res_list[BGPSTREAM_RIB]) != 0 ||
+        open_res_list(q, cur, cur->res_list[BGPSTREAM_UPDATE]) != 0) {
+      return -1;
+    }
+    cur->lookahead_cnt += opened;
+    q->lookahead_cnt += opened;
   }
 
   return 0;
@@ -644,24 +1177,25 @@ static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp)
 // if things have gone right, we should read from the first resource in the
 // queue. once we have read from the resource, we should check the new time of
 // the resource and see if it needs to be moved.
-static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
-                                            bgpstream_record_t **record)
+static bgpstream_reader_status_t
+pop_record(bgpstream_resource_mgr_t *q, bgpstream_record_t **record,
+           bgpstream_reader_t **reader, uint32_t *time,
+           bgpstream_record_type_t *type)
 {
   uint32_t prev_time;
   bgpstream_reader_status_t rs;
   struct res_list_elem *el = NULL;
-  struct res_group *gp = NULL;
+  struct res_list_elem *ready = NULL;
+  struct res_group *head = q->groups[0];
   uint32_t now;
-  uint64_t sleep_nsec;
-  struct timespec rqtp;
-
-  // the resource we want to read from MUST be in the first group (q->head), and
-  // will either be the head of the RIBS list if there are any ribs, otherwise
-  // it will be the head of the updates list
-  if (q->head->res_list[BGPSTREAM_RIB] != NULL) {
-    el = q->head->res_list[BGPSTREAM_RIB];
+
+  // the resource we want to read from MUST be in the first group (the head of
+  // the heap), and will either be the head of the RIBS list if there are any
+  // ribs, otherwise it will be the head of the updates list
+  if (head->res_list[BGPSTREAM_RIB] != NULL) {
+    el = head->res_list[BGPSTREAM_RIB];
   } else {
-    el = q->head->res_list[BGPSTREAM_UPDATE];
+    el = head->res_list[BGPSTREAM_UPDATE];
   }
   assert(el != NULL && el->res != NULL);
   assert(el->prev == NULL);
@@ -669,21 +1203,29 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
 
   // we assume that if this resource has a poll timer set that has not expired
   // then since it would have been pushed to the end of the group and as such
-  // all other resources already polled.
+  // all other resources already polled. so we wait for any of them to have
+  // data (or for the timer to expire), and then read from that one first.
   if (el->next_poll > 0) {
     now = epoch_msec();
     if (el->next_poll > now) {
-      sleep_nsec = (el->next_poll - now) * MSEC_TO_NSEC;
-      rqtp.tv_sec = sleep_nsec / 1000000000;
-      rqtp.tv_nsec = sleep_nsec % 1000000000;
-      if (nanosleep(&rqtp, NULL) != 0) {
-        // interrupted
+      if (q->no_wait != 0) {
+        return BGPSTREAM_READER_STATUS_AGAIN;
+      }
+      if (wait_streams(q, el, el->next_poll, &ready) != 0) {
         return -1;
       }
+      if (ready != NULL && ready != el) {
+        move_to_head(&head->res_list[el->res->record_type], ready);
+        el = ready;
+      }
     }
     el->next_poll = 0;
   }
 
+  *reader = el->reader;
+  *time = head->time;
+  *type = el->res->record_type;
+
   // cache the current time so we can check if we need to remove and re-insert
   prev_time = get_next_time(el);
 
@@ -701,12 +1243,12 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   // a fair shake
   if (rs == BGPSTREAM_READER_STATUS_AGAIN) {
     assert(el->prev == NULL);
-    assert(q->head->res_list[el->res->record_type] == el);
+    assert(head->res_list[el->res->record_type] == el);
     if (el->next != NULL) {
       // grab the next element
       struct res_list_elem *next_el = el->next;
       // move the next element to the head
-      q->head->res_list[el->res->record_type] = next_el;
+      head->res_list[el->res->record_type] = next_el;
 
       // disconnect ourselves from the list
       next_el->prev = NULL;
@@ -725,7 +1267,7 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
     // and then tell the caller that while we didn't get anything useful, they
     // should try again soon
     el->next_poll = epoch_msec() + AGAIN_POLL_INTERVAL;
-    assert(q->head->res_list[el->res->record_type]->prev == NULL);
+    assert(head->res_list[el->res->record_type]->prev == NULL);
     return rs;
   }
 
@@ -735,27 +1277,23 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   // if the time has changed or we've reached EOS, pop from the queue
   if (get_next_time(el) != prev_time || rs == BGPSTREAM_READER_STATUS_EOS) {
     // first, remove this list elem from the group
-    pop_res_el(q, q->head, el);
-
-    // if we have emptied the group, remove the group
-    if (q->head->res_cnt == 0) {
-      gp = q->head;
-      q->head = gp->next;
-      if (q->head != NULL) {
-        q->head->prev = NULL;
-      }
-      if (q->tail == gp) {
-        q->tail = q->head;
-      }
+    pop_res_el(q, head, el);
 
-      // and then destroy the group
-      gp->next = NULL;
-      res_group_destroy(gp, 0);
+    // if we have emptied the group, remove (and destroy) the group
+    if (head->res_cnt == 0) {
+      remove_group(q, head);
     }
 
     if (rs == BGPSTREAM_READER_STATUS_EOS) {
-      // we're at EOS, so destroy the resource
-      res_list_destroy(el, 1);
+      if (bgpstream_reader_get_held_cnt(el->reader) != 0) {
+        // the consumer still has records from this resource, so destroy it
+        // once they have been released
+        el->next = q->retired;
+        q->retired = el;
+      } else {
+        // we're at EOS, so destroy the resource
+        res_finished(q, el);
+      }
     } else if (get_next_time(el) != prev_time) {
       // time has changed, so we need to re-insert
       if (insert_resource_elem(q, el) < 0) {
@@ -768,30 +1306,580 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   return rs;
 }
 
-static int wanted_resource(bgpstream_resource_t *res,
-                           bgpstream_filter_mgr_t *filter_mgr)
+// destroy any retired resources that no longer have records held
+static void reap_retired(bgpstream_resource_mgr_t *q)
 {
-  char buffer[BUFFER_LEN];
-  khiter_t k;
-  int khret;
+  struct res_list_elem *el = q->retired;
+  struct res_list_elem **prevp = &q->retired;
 
-  if (res->record_type != BGPSTREAM_RIB || filter_mgr->rib_period == 0) {
-    // its an updates file or there is no rib period set
-    return 1;
+  while (el != NULL) {
+    if (bgpstream_reader_get_held_cnt(el->reader) != 0) {
+      prevp = &el->next;
+      el = el->next;
+      continue;
+    }
+    *prevp = el->next;
+    el->next = NULL;
+    res_finished(q, el);
+    el = *prevp;
   }
+}
 
-  snprintf(buffer, BUFFER_LEN, "%s.%s", res->project, res->collector);
+static int get_record(bgpstream_resource_mgr_t *q, bgpstream_record_t **record,
+                      bgpstream_reader_t **reader, uint32_t *time,
+                      bgpstream_record_type_t *type);
 
-  if ((k = kh_get(collector_ts, filter_mgr->last_processed_ts, buffer)) ==
-      kh_end(filter_mgr->last_processed_ts)) {
-    // first time we've seen a rib for this collector
-    k = kh_put(collector_ts, filter_mgr->last_processed_ts, strdup(buffer),
-               &khret);
-    kh_value(filter_mgr->last_processed_ts, k) = res->initial_time;
-    return 1;
+// takes ownership of the resource
+static int push_resource(bgpstream_resource_mgr_t *q,
+                         bgpstream_resource_t *res)
+{
+  struct res_list_elem *el = NULL;
+
+  // now create a list element to hold the resource
+  if ((el = res_list_elem_create(res)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create list element");
+    bgpstream_resource_destroy(res);
+    return -1;
   }
 
-  if (res->initial_time <
+  // now we know we want to keep it
+  if (insert_resource_elem(q, el) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not insert resource into queue");
+    res_list_destroy(el, 1);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ========== MERGE SHARDS ========== */
+
+static void *shard_thread(void *user)
+{
+  struct shard *sh = (struct shard *)user;
+  struct shard_entry *e;
+  bgpstream_record_t *record = NULL;
+  bgpstream_reader_t *reader = NULL;
+  uint32_t time = 0;
+  bgpstream_record_type_t type = BGPSTREAM_UPDATE;
+  int rc;
+
+  pthread_mutex_lock(&sh->mutex);
+  while (sh->shutdown == 0) {
+    if (sh->running == 0 || sh->failed != 0) {
+      // wait to be started
+      pthread_cond_wait(&sh->cond, &sh->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&sh->mutex);
+
+    // read the next record from our queue (or discover that it is empty)
+    rc = get_record(sh->mgr, &record, &reader, &time, &type);
+
+    pthread_mutex_lock(&sh->mutex);
+    if (rc < 0) {
+      sh->failed = 1;
+    } else if (rc == 0) {
+      // our queue is empty, so hand it back to the consumer
+      sh->running = 0;
+    }
+
+    // wait for space in the ring
+    while (sh->shutdown == 0 &&
+           sh->produced - __atomic_load_n(&sh->consumed, __ATOMIC_SEQ_CST) >=
+             SHARD_QUEUE_LEN) {
+      __atomic_store_n(&sh->producer_waiting, 1, __ATOMIC_SEQ_CST);
+      if (sh->produced - __atomic_load_n(&sh->consumed, __ATOMIC_SEQ_CST) >=
+          SHARD_QUEUE_LEN) {
+        pthread_cond_wait(&sh->cond, &sh->mutex);
+      }
+      __atomic_store_n(&sh->producer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    if (sh->shutdown != 0) {
+      break;
+    }
+
+    // and queue the record (or end-of-queue marker)
+    e = &sh->queue[sh->produced % SHARD_QUEUE_LEN];
+    e->record = (rc > 0) ? record : NULL;
+    e->reader = (rc > 0) ? reader : NULL;
+    e->time = time;
+    e->type = type;
+    e->error = (rc < 0);
+    __atomic_store_n(&sh->produced, sh->produced + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sh->consumer_waiting, __ATOMIC_SEQ_CST) != 0) {
+      pthread_cond_signal(&sh->cond);
+    }
+  }
+  pthread_mutex_unlock(&sh->mutex);
+
+  return NULL;
+}
+
+// returns a borrowed pointer to the next entry in the shard queue, waiting for
+// the shard thread to produce one if needed
+static struct shard_entry *shard_peek(struct shard *sh)
+{
+  if (__atomic_load_n(&sh->produced, __ATOMIC_SEQ_CST) == sh->consumed) {
+    pthread_mutex_lock(&sh->mutex);
+    __atomic_store_n(&sh->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&sh->produced, __ATOMIC_SEQ_CST) == sh->consumed) {
+      pthread_cond_wait(&sh->cond, &sh->mutex);
+    }
+    __atomic_store_n(&sh->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sh->mutex);
+  }
+  return &sh->queue[sh->consumed % SHARD_QUEUE_LEN];
+}
+
+static void shard_consume(struct shard *sh)
+{
+  __atomic_store_n(&sh->consumed, sh->consumed + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sh->producer_waiting, __ATOMIC_SEQ_CST) != 0) {
+    pthread_mutex_lock(&sh->mutex);
+    pthread_cond_signal(&sh->cond);
+    pthread_mutex_unlock(&sh->mutex);
+  }
+}
+
+// destroy the first cnt shards (the rest have not been initialized)
+static void shards_destroy(bgpstream_resource_mgr_t *q, int cnt)
+{
+  struct shard *sh;
+  int i;
+
+  if (q->shards == NULL) {
+    return;
+  }
+
+  for (i = 0; i < cnt; i++) {
+    sh = &q->shards[i];
+    if (sh->thread_running != 0) {
+      pthread_mutex_lock(&sh->mutex);
+      sh->shutdown = 1;
+      pthread_cond_signal(&sh->cond);
+      pthread_mutex_unlock(&sh->mutex);
+      pthread_join(sh->thread, NULL);
+      sh->thread_running = 0;
+    }
+    // any records still held by the merge are simply destroyed along with
+    // their readers
+    bgpstream_resource_mgr_destroy(sh->mgr);
+    sh->mgr = NULL;
+    pthread_mutex_destroy(&sh->mutex);
+    pthread_cond_destroy(&sh->cond);
+  }
+  free(q->shards);
+  q->shards = NULL;
+  q->held_reader = NULL;
+}
+
+static int shards_create(bgpstream_resource_mgr_t *q)
+{
+  struct shard *sh;
+  int i;
+
+  assert(q->shards == NULL && q->shards_cnt > 1);
+
+  if ((q->shards = malloc_zero(sizeof(struct shard) * q->shards_cnt)) ==
+      NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < q->shards_cnt; i++) {
+    sh = &q->shards[i];
+    pthread_mutex_init(&sh->mutex, NULL);
+    pthread_cond_init(&sh->cond, NULL);
+    if ((sh->mgr = bgpstream_resource_mgr_create(q->filter_mgr)) == NULL) {
+      goto err;
+    }
+    // share the opener threads between the shards
+    sh->mgr->reader_concurrency =
+      (q->reader_concurrency + q->shards_cnt - 1) / q->shards_cnt;
+    sh->mgr->reader_readahead = q->reader_readahead;
+    sh->mgr->format_opts = q->format_opts;
+    sh->mgr->lookahead_groups = q->lookahead_groups;
+    sh->mgr->lookahead_max_records =
+      (q->lookahead_max_records + q->shards_cnt - 1) / q->shards_cnt;
+    // records stay valid until the merge (and our caller, if it is holding
+    // records) is done with them
+    sh->mgr->reader_hold = SHARD_QUEUE_LEN + 1 + q->reader_hold;
+    // finished resources are reported to our stats callback
+    sh->mgr->stats_parent = q;
+    if (pthread_create(&sh->thread, NULL, shard_thread, sh) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start merge shard thread");
+      goto err;
+    }
+    sh->thread_running = 1;
+  }
+
+  return 0;
+
+err:
+  // only destroy the shards that were initialized
+  shards_destroy(q, i + 1);
+  return -1;
+}
+
+static int shards_push(bgpstream_resource_mgr_t *q, bgpstream_resource_t *res)
+{
+  struct shard *sh;
+  int rc;
+
+  if (res->duration == BGPSTREAM_FOREVER) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Stream resources (%s) cannot be used with merge shards",
+                  res->url);
+    bgpstream_resource_destroy(res);
+    return -1;
+  }
+
+  if (q->shards == NULL && shards_create(q) != 0) {
+    bgpstream_resource_destroy(res);
+    return -1;
+  }
+
+  // all resources from a collector go to the same shard
+  sh = &q->shards[kh_str_hash_func(res->collector) % q->shards_cnt];
+
+  pthread_mutex_lock(&sh->mutex);
+  assert(sh->running == 0);
+  if ((rc = push_resource(sh->mgr, res)) == 0) {
+    // the shard will be started when the next record is requested
+    sh->active = 1;
+    sh->pending = 1;
+  }
+  pthread_mutex_unlock(&sh->mutex);
+
+  return rc;
+}
+
+// k-way merge of the records from the shards. ties are broken in the same way
+// as the resource queue: by time, then RIBs before updates (and then by shard)
+static int shards_get_record(bgpstream_resource_mgr_t *q,
+                             bgpstream_record_t **record,
+                             bgpstream_reader_t **reader)
+{
+  struct shard *sh;
+  struct shard_entry *e, *best_e = NULL;
+  struct shard *best = NULL;
+  int i;
+
+  // we are done with the record we returned last time (unless the caller is
+  // holding records, in which case it will release them itself)
+  if (q->held_reader != NULL) {
+    bgpstream_reader_release_record(q->held_reader);
+    q->held_reader = NULL;
+  }
+
+  // start any shards that have new resources
+  for (i = 0; i < q->shards_cnt; i++) {
+    sh = &q->shards[i];
+    if (sh->pending != 0) {
+      pthread_mutex_lock(&sh->mutex);
+      sh->running = 1;
+      pthread_cond_signal(&sh->cond);
+      pthread_mutex_unlock(&sh->mutex);
+      sh->pending = 0;
+    }
+  }
+
+  for (i = 0; i < q->shards_cnt; i++) {
+    sh = &q->shards[i];
+    e = NULL;
+    while (sh->active != 0) {
+      // the merge needs the next record of every active shard
+      if (q->no_wait != 0 &&
+          __atomic_load_n(&sh->produced, __ATOMIC_SEQ_CST) == sh->consumed) {
+        return 0;
+      }
+      e = shard_peek(sh);
+      if (e->record != NULL) {
+        break;
+      }
+      if (e->error != 0) {
+        return -1;
+      }
+      // this shard has emptied its queue
+      shard_consume(sh);
+      sh->active = 0;
+      // and we have released all of its records, so any resources that it
+      // retired can now be finished
+      pthread_mutex_lock(&sh->mutex);
+      reap_retired(sh->mgr);
+      pthread_mutex_unlock(&sh->mutex);
+    }
+    if (sh->active == 0) {
+      continue;
+    }
+    if (best_e == NULL || e->time < best_e->time ||
+        (e->time == best_e->time && e->type == BGPSTREAM_RIB &&
+         best_e->type != BGPSTREAM_RIB)) {
+      best_e = e;
+      best = sh;
+    }
+  }
+
+  if (best_e == NULL) {
+    // all shards are empty
+    return 0;
+  }
+
+  *record = best_e->record;
+  *reader = best_e->reader;
+  if (q->hold_readers == NULL) {
+    q->held_reader = best_e->reader;
+  }
+  shard_consume(best);
+  return 1;
+}
+
+/* ========== UNORDERED QUEUE ========== */
+
+// takes ownership of the resource
+static int unordered_push(bgpstream_resource_mgr_t *q,
+                          bgpstream_resource_t *res)
+{
+  struct res_list_elem *el;
+
+  if ((el = res_list_elem_create(res)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create list element");
+    bgpstream_resource_destroy(res);
+    return -1;
+  }
+
+  // append to the pending list so resources are opened in the order that they
+  // were given to us
+  if (q->pending_tail == NULL) {
+    q->pending_head = el;
+  } else {
+    q->pending_tail->next = el;
+    el->prev = q->pending_tail;
+  }
+  q->pending_tail = el;
+
+  q->res_cnt++;
+  if (res->duration == BGPSTREAM_FOREVER) {
+    q->res_stream_cnt++;
+  }
+
+  return 0;
+}
+
+// open pending resources until we have reader_concurrency (non-stream)
+// resources open
+static int unordered_fill(bgpstream_resource_mgr_t *q)
+{
+  struct res_list_elem *el;
+  struct res_list_elem *tail = q->active;
+
+  while (tail != NULL && tail->next != NULL) {
+    tail = tail->next;
+  }
+
+  while ((el = q->pending_head) != NULL &&
+         (q->active_cnt < q->reader_concurrency ||
+          el->res->duration == BGPSTREAM_FOREVER)) {
+    if (q->reader_pool == NULL &&
+        (q->reader_pool = bgpstream_reader_pool_create(
+           q->reader_concurrency)) == NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to create reader pool");
+      return -1;
+    }
+    if ((el->reader = bgpstream_reader_create(
+           el->res, q->filter_mgr, q->reader_pool, q->reader_readahead,
+           q->reader_hold, &q->format_opts)) == NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to open resource: %s",
+                    el->res->url);
+      return -1;
+    }
+    live_add(q, el);
+
+    // move from the pending list to the end of the active list
+    q->pending_head = el->next;
+    if (q->pending_head == NULL) {
+      q->pending_tail = NULL;
+    } else {
+      q->pending_head->prev = NULL;
+    }
+    el->next = NULL;
+    el->prev = tail;
+    if (tail == NULL) {
+      q->active = el;
+    } else {
+      tail->next = el;
+    }
+    tail = el;
+
+    q->res_open_cnt++;
+    if (el->res->duration != BGPSTREAM_FOREVER) {
+      q->active_cnt++;
+    }
+  }
+
+  return 0;
+}
+
+// removes the given resource from the active list and destroys it
+static void unordered_remove(bgpstream_resource_mgr_t *q,
+                             struct res_list_elem *el)
+{
+  if (q->cursor == el) {
+    q->cursor = el->next;
+  }
+  if (el->prev != NULL) {
+    el->prev->next = el->next;
+  } else {
+    q->active = el->next;
+  }
+  if (el->next != NULL) {
+    el->next->prev = el->prev;
+  }
+  el->prev = NULL;
+  el->next = NULL;
+
+  q->res_cnt--;
+  q->res_open_cnt--;
+  if (el->res->duration == BGPSTREAM_FOREVER) {
+    q->res_stream_cnt--;
+  } else {
+    q->active_cnt--;
+  }
+  assert(q->res_cnt >= 0 && q->res_open_cnt >= 0 && q->active_cnt >= 0);
+
+  if (bgpstream_reader_get_held_cnt(el->reader) != 0) {
+    // destroy once the caller has released all of its records
+    el->next = q->retired;
+    q->retired = el;
+  } else {
+    res_finished(q, el);
+  }
+}
+
+// find the resource to read from next, starting at the cursor. in
+// BGPSTREAM_ORDER_NONE mode a resource that has a record ready is preferred.
+// returns NULL (and sets next_poll) if all resources are waiting to be polled
+static struct res_list_elem *unordered_select(bgpstream_resource_mgr_t *q,
+                                              uint32_t *next_poll)
+{
+  struct res_list_elem *el;
+  struct res_list_elem *first = NULL;
+  uint32_t now = epoch_msec();
+
+  *next_poll = 0;
+  if (q->cursor == NULL) {
+    q->cursor = q->active;
+  }
+  el = q->cursor;
+  do {
+    if (el->next_poll > now) {
+      if (*next_poll == 0 || el->next_poll < *next_poll) {
+        *next_poll = el->next_poll;
+      }
+    } else if (q->ordering != BGPSTREAM_ORDER_NONE ||
+               bgpstream_reader_is_ready(el->reader) != 0) {
+      return el;
+    } else if (first == NULL) {
+      first = el;
+    }
+    el = (el->next != NULL) ? el->next : q->active;
+  } while (el != q->cursor);
+
+  // nothing is ready, so we'll wait on the first pollable resource
+  return first;
+}
+
+static int unordered_get_record(bgpstream_resource_mgr_t *q,
+                                bgpstream_record_t **record,
+                                bgpstream_reader_t **reader)
+{
+  struct res_list_elem *el;
+  bgpstream_reader_status_t rs;
+  uint32_t next_poll;
+
+  if (q->retired != NULL) {
+    reap_retired(q);
+  }
+
+  while (1) {
+    if (unordered_fill(q) != 0) {
+      return -1;
+    }
+    if (q->active == NULL) {
+      // nothing left to read
+      assert(q->res_cnt == 0);
+      return 0;
+    }
+
+    if ((el = unordered_select(q, &next_poll)) == NULL) {
+      if (q->no_wait != 0) {
+        return 0;
+      }
+      // everything is a stream waiting to be polled, so wait for one of them
+      // to have data
+      if (wait_streams(q, q->active, next_poll, &el) != 0) {
+        return -1;
+      }
+      if (el != NULL) {
+        q->cursor = el;
+      }
+      continue;
+    }
+    el->next_poll = 0;
+
+    if ((rs = bgpstream_reader_get_next_record(el->reader, record)) ==
+        BGPSTREAM_READER_STATUS_ERROR) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to get next record from reader");
+      return -1;
+    }
+
+    switch (rs) {
+    case BGPSTREAM_READER_STATUS_OK:
+      // in per-resource mode we stick with this resource until it runs dry,
+      // otherwise we give the next resource a turn
+      q->cursor = (q->ordering == BGPSTREAM_ORDER_PER_RESOURCE) ? el : el->next;
+      *reader = el->reader;
+      return 1;
+
+    case BGPSTREAM_READER_STATUS_AGAIN:
+      el->next_poll = epoch_msec() + AGAIN_POLL_INTERVAL;
+      q->cursor = el->next;
+      break;
+
+    default:
+      assert(rs == BGPSTREAM_READER_STATUS_EOS);
+      unordered_remove(q, el);
+      break;
+    }
+  }
+
+  return -1;
+}
+
+static int wanted_resource(bgpstream_resource_t *res,
+                           bgpstream_filter_mgr_t *filter_mgr)
+{
+  char buffer[BUFFER_LEN];
+  khiter_t k;
+  int khret;
+
+  if (res->record_type != BGPSTREAM_RIB || filter_mgr->rib_period == 0) {
+    // its an updates file or there is no rib period set
+    return 1;
+  }
+
+  snprintf(buffer, BUFFER_LEN, "%s.%s", res->project, res->collector);
+
+  if ((k = kh_get(collector_ts, filter_mgr->last_processed_ts, buffer)) ==
+      kh_end(filter_mgr->last_processed_ts)) {
+    // first time we've seen a rib for this collector
+    k = kh_put(collector_ts, filter_mgr->last_processed_ts, strdup(buffer),
+               &khret);
+    kh_value(filter_mgr->last_processed_ts, k) = res->initial_time;
+    return 1;
+  }
+
+  if (res->initial_time <
       kh_value(filter_mgr->last_processed_ts, k) + filter_mgr->rib_period) {
     // still within our period
     return 0;
@@ -802,6 +1890,75 @@ static int wanted_resource(bgpstream_resource_t *res,
   return 1;
 }
 
+static int get_record(bgpstream_resource_mgr_t *q, bgpstream_record_t **record,
+                      bgpstream_reader_t **reader, uint32_t *time,
+                      bgpstream_record_type_t *type)
+{
+  int rs = BGPSTREAM_READER_STATUS_EOS;
+  int dirty_cnt = 0;
+  int batch_changed;
+
+  // destroy any finished resources that the consumer is now done with
+  if (q->retired != NULL) {
+    reap_retired(q);
+  }
+
+  // don't let EOF mean EOS until we have no more resources left
+  while (rs == BGPSTREAM_READER_STATUS_EOS ||
+         rs == BGPSTREAM_READER_STATUS_AGAIN) {
+    if (q->res_cnt == 0) {
+      // we have nothing in the queue, so now we can return EOS
+      return 0;
+    }
+
+    // we know we have something in the queue, but if we have nothing open, then
+    // it is time to open some resources!
+    // we do this inside a loop since in some cases the first batch we open get
+    // sorted elsewhere in the queue, leaving the head still unopened.
+    dirty_cnt = 0;
+    batch_changed = 0;
+    while (q->groups[0]->res_open_cnt != q->groups[0]->res_cnt ||
+           q->groups[0]->lookahead_cnt != 0 || dirty_cnt > 0) {
+      batch_changed = 1;
+      if (open_batch(q) != 0) {
+        goto err;
+      }
+      // its possible that the timestamp of the first record in a dump file
+      // doesn't match the initial time reported to us from the broker (e.g., in
+      // the case of filtering), so we re-sort the batch before we read anything
+      // from it.
+      if ((dirty_cnt = sort_batch(q)) < 0) {
+        goto err;
+      }
+    }
+    // its possible that we failed to open all the files, perhaps in that case
+    // we shouldn't abort, but instead return EOS and let the caller decide what
+    // to do, but for now:
+    assert(q->res_open_cnt != 0);
+
+    // now that we have a new batch, get the following groups ready
+    if (batch_changed != 0 && q->lookahead_groups > 0 &&
+        open_lookahead(q) != 0) {
+      goto err;
+    }
+
+    // we now know that we have open resources to read from, lets do it
+    if ((rs = pop_record(q, record, reader, time, type)) ==
+        BGPSTREAM_READER_STATUS_ERROR) {
+      return -1;
+    } else if (rs == BGPSTREAM_READER_STATUS_OK) {
+      return 1;
+    } else if (rs == BGPSTREAM_READER_STATUS_AGAIN && q->no_wait != 0) {
+      return 0;
+    }
+    // otherwise, could be EOS or AGAIN, so keep trying (from other resources in
+    // the case of EOS)
+  }
+
+err:
+  return -1;
+}
+
 /* ========== PUBLIC METHODS BELOW HERE ========== */
 
 bgpstream_resource_mgr_t *
@@ -814,6 +1971,14 @@ bgpstream_resource_mgr_create(bgpstream_filter_mgr_t *filter_mgr)
   }
 
   q->filter_mgr = filter_mgr;
+  q->reader_concurrency = BGPSTREAM_READER_CONCURRENCY_DEFAULT;
+
+  if ((q->groups_by_time = kh_init(res_group_time)) == NULL) {
+    free(q);
+    return NULL;
+  }
+
+  pthread_mutex_init(&q->stats_mutex, NULL);
 
   return q;
 }
@@ -823,14 +1988,61 @@ void bgpstream_resource_mgr_destroy(bgpstream_resource_mgr_t *q)
   if (q == NULL) {
     return;
   }
-  struct res_group *cur = q->head;
+  int i;
+  struct res_list_elem *el;
+  struct finished_res *f;
 
-  while (cur != NULL) {
-    q->head = cur->next;
-    res_group_destroy(cur, 1);
-    cur = q->head;
+  shards_destroy(q, q->shards_cnt);
+
+  for (i = 0; i < q->groups_cnt; i++) {
+    res_group_destroy(q->groups[i], 1);
+    q->groups[i] = NULL;
+  }
+  q->groups_cnt = 0;
+  free(q->groups);
+  q->groups = NULL;
+  free(q->batch);
+  q->batch = NULL;
+  free(q->walk);
+  q->walk = NULL;
+  q->groups_alloc_cnt = 0;
+
+  kh_destroy(res_group_time, q->groups_by_time);
+  q->groups_by_time = NULL;
+
+  while ((el = q->retired) != NULL) {
+    q->retired = el->next;
+    el->next = NULL;
+    res_list_destroy(el, 1);
+  }
+
+  res_list_destroy(q->pending_head, 1);
+  q->pending_head = q->pending_tail = NULL;
+  res_list_destroy(q->active, 1);
+  q->active = q->cursor = NULL;
+
+  free(q->hold_readers);
+  q->hold_readers = NULL;
+
+  free(q->pollfds);
+  q->pollfds = NULL;
+  free(q->poll_els);
+  q->poll_els = NULL;
+  q->pollfds_alloc_cnt = 0;
+
+  // resources that have not been reported yet are simply destroyed
+  while ((f = q->finished_head) != NULL) {
+    q->finished_head = f->next;
+    res_list_destroy(f->el, 1);
+    free(f);
   }
-  q->tail = NULL;
+  q->finished_tail = NULL;
+
+  // all readers have been destroyed, so now the pool can go
+  bgpstream_reader_pool_destroy(q->reader_pool);
+  q->reader_pool = NULL;
+
+  pthread_mutex_destroy(&q->stats_mutex);
 
   // filter manager is a borrowed pointer
   q->filter_mgr = NULL;
@@ -838,6 +2050,207 @@ void bgpstream_resource_mgr_destroy(bgpstream_resource_mgr_t *q)
   free(q);
 }
 
+int bgpstream_resource_mgr_set_reader_concurrency(bgpstream_resource_mgr_t *q,
+                                                 int concurrency)
+{
+  if (concurrency <= 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid reader concurrency: %d",
+                  concurrency);
+    return -1;
+  }
+  if (q->reader_pool != NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Reader concurrency must be set before reading records");
+    return -1;
+  }
+  q->reader_concurrency = concurrency;
+  return 0;
+}
+
+int bgpstream_resource_mgr_set_reader_readahead(bgpstream_resource_mgr_t *q,
+                                               int readahead)
+{
+  if (readahead < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid reader read-ahead: %d",
+                  readahead);
+    return -1;
+  }
+  q->reader_readahead = readahead;
+  return 0;
+}
+
+int bgpstream_resource_mgr_set_decompress_threads(bgpstream_resource_mgr_t *q,
+                                                  int threads)
+{
+  if (threads < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Invalid number of decompression threads: %d", threads);
+    return -1;
+  }
+  q->format_opts.decompress_threads = threads;
+  return 0;
+}
+
+void bgpstream_resource_mgr_set_time_index(bgpstream_resource_mgr_t *q,
+                                           int enabled)
+{
+  q->format_opts.time_index = enabled;
+}
+
+void bgpstream_resource_mgr_set_mmap(bgpstream_resource_mgr_t *q, int enabled)
+{
+  q->format_opts.mmap = enabled;
+}
+
+int bgpstream_resource_mgr_set_decode_threads(bgpstream_resource_mgr_t *q,
+                                              int threads)
+{
+  if (threads < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid number of decode threads: %d",
+                  threads);
+    return -1;
+  }
+  q->format_opts.decode_threads = threads;
+  return 0;
+}
+
+int bgpstream_resource_mgr_set_lookahead(bgpstream_resource_mgr_t *q,
+                                         int groups, int max_records)
+{
+  if (groups < 0 || max_records < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid lookahead: %d groups, %d records",
+                  groups, max_records);
+    return -1;
+  }
+  if (q->shards != NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Lookahead must be set before resources are added");
+    return -1;
+  }
+  q->lookahead_groups = groups;
+  q->lookahead_max_records = max_records;
+  return 0;
+}
+
+int bgpstream_resource_mgr_set_record_hold(bgpstream_resource_mgr_t *q,
+                                           int hold)
+{
+  if (hold <= 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid record hold: %d", hold);
+    return -1;
+  }
+  if (q->res_cnt != 0 || q->shards != NULL || q->hold_readers != NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Record hold must be set before resources are added");
+    return -1;
+  }
+  if ((q->hold_readers = malloc_zero(sizeof(bgpstream_reader_t *) * hold)) ==
+      NULL) {
+    return -1;
+  }
+  q->hold_cnt = hold;
+  q->reader_hold = hold;
+  return 0;
+}
+
+int bgpstream_resource_mgr_get_ready_record(bgpstream_resource_mgr_t *q,
+                                            bgpstream_record_t **record)
+{
+  int rc;
+
+  q->no_wait = 1;
+  rc = bgpstream_resource_mgr_get_record(q, record);
+  q->no_wait = 0;
+
+  return rc;
+}
+
+void bgpstream_resource_mgr_release_record(bgpstream_resource_mgr_t *q)
+{
+  assert(q->hold_readers != NULL &&
+         q->hold_out < __atomic_load_n(&q->hold_in, __ATOMIC_ACQUIRE));
+  bgpstream_reader_release_record(
+    q->hold_readers[q->hold_out % q->hold_cnt]);
+  // may be released from a different thread to the one getting records
+  __atomic_store_n(&q->hold_out, q->hold_out + 1, __ATOMIC_RELEASE);
+}
+
+void bgpstream_resource_mgr_set_stats_cb(bgpstream_resource_mgr_t *q,
+                                         bgpstream_resource_stats_cb_t *cb,
+                                         void *user)
+{
+  // merge shards read this from their own threads
+  assert(q->res_cnt == 0 && q->shards == NULL);
+  q->stats_cb = cb;
+  q->stats_user = user;
+}
+
+void bgpstream_resource_mgr_get_stats(bgpstream_resource_mgr_t *q,
+                                      bgpstream_stats_t *stats)
+{
+  struct res_list_elem *el;
+  int i;
+
+  pthread_mutex_lock(&q->stats_mutex);
+  bgpstream_stats_add(stats, &q->stats);
+  for (el = q->live; el != NULL; el = el->live_next) {
+    bgpstream_reader_get_stats(el->reader, stats);
+  }
+  pthread_mutex_unlock(&q->stats_mutex);
+
+  if (q->shards != NULL) {
+    for (i = 0; i < q->shards_cnt; i++) {
+      bgpstream_resource_mgr_get_stats(q->shards[i].mgr, stats);
+    }
+  }
+}
+
+int bgpstream_resource_mgr_set_merge_shards(bgpstream_resource_mgr_t *q,
+                                            int shards)
+{
+  if (shards < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid number of merge shards: %d",
+                  shards);
+    return -1;
+  }
+  if (q->shards != NULL || q->res_cnt != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Merge shards must be set before resources are added");
+    return -1;
+  }
+  if (shards > 1 && q->ordering != BGPSTREAM_ORDER_TIME) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Merge shards can only be used with time ordering");
+    return -1;
+  }
+  // a single shard is the same as no shards
+  q->shards_cnt = (shards > 1) ? shards : 0;
+  return 0;
+}
+
+int bgpstream_resource_mgr_set_ordering(bgpstream_resource_mgr_t *q,
+                                        bgpstream_ordering_t ordering)
+{
+  if (ordering != BGPSTREAM_ORDER_TIME &&
+      ordering != BGPSTREAM_ORDER_PER_RESOURCE &&
+      ordering != BGPSTREAM_ORDER_NONE) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Invalid record ordering: %d", ordering);
+    return -1;
+  }
+  if (q->res_cnt != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Ordering must be set before resources are added");
+    return -1;
+  }
+  if (ordering != BGPSTREAM_ORDER_TIME && q->shards_cnt > 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Merge shards can only be used with time ordering");
+    return -1;
+  }
+  q->ordering = ordering;
+  return 0;
+}
+
 int bgpstream_resource_mgr_push(
   bgpstream_resource_mgr_t *q,
   bgpstream_resource_transport_type_t transport_type,
@@ -847,11 +2260,20 @@ int bgpstream_resource_mgr_push(
   bgpstream_resource_t **resp)
 {
   bgpstream_resource_t *res = NULL;
-  struct res_list_elem *el = NULL;
+  int rc;
   if (resp != NULL) {
     *resp = NULL;
   }
 
+  // a stream may return no record at all when polled, and held records would
+  // then never be released (whatever the ordering)
+  if (q->reader_hold > 0 && duration == BGPSTREAM_FOREVER) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Stream resources (%s) cannot be used with record hold",
+                  url);
+    return -1;
+  }
+
   // first create the resource
   if ((res = bgpstream_resource_create(transport_type, format_type, url,
                                        initial_time, duration, project,
@@ -866,85 +2288,77 @@ int bgpstream_resource_mgr_push(
     return 0;
   }
 
-  // now create a list element to hold the resource
-  if ((el = res_list_elem_create(res)) == NULL) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create list element");
-    goto err;
+  // now we know we want to keep it (this takes ownership of the resource)
+  if (q->ordering != BGPSTREAM_ORDER_TIME) {
+    rc = unordered_push(q, res);
+  } else if (q->shards_cnt > 0) {
+    rc = shards_push(q, res);
+  } else {
+    rc = push_resource(q, res);
   }
-
-  // now we know we want to keep it
-  if (insert_resource_elem(q, el) < 0) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not insert resource into queue");
-    goto err;
+  if (rc != 0) {
+    return -1;
   }
 
   if (resp != NULL) {
     *resp = res;
   }
   return 1;
-
-err:
-  res_list_destroy(el, 1);
-  bgpstream_resource_destroy(res);
-  return -1;
 }
 
 int bgpstream_resource_mgr_empty(bgpstream_resource_mgr_t *q)
 {
-  return (q->head == NULL);
+  int i;
+  if (q->shards != NULL) {
+    for (i = 0; i < q->shards_cnt; i++) {
+      if (q->shards[i].active != 0) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+  if (q->ordering != BGPSTREAM_ORDER_TIME) {
+    return (q->res_cnt == 0);
+  }
+  return (q->groups_cnt == 0);
 }
 
 int bgpstream_resource_mgr_stream_only(bgpstream_resource_mgr_t *q)
 {
+  if (q->shards != NULL) {
+    // shards never contain streams
+    return bgpstream_resource_mgr_empty(q);
+  }
   return (q->res_stream_cnt == q->res_cnt);
 }
 
 int bgpstream_resource_mgr_get_record(bgpstream_resource_mgr_t *q,
                                       bgpstream_record_t **record)
 {
-  int rs = BGPSTREAM_READER_STATUS_EOS;
-  int dirty_cnt = 0;
+  bgpstream_reader_t *reader = NULL;
+  uint32_t time;
+  bgpstream_record_type_t type;
+  int rc;
 
-  // don't let EOF mean EOS until we have no more resources left
-  while (rs == BGPSTREAM_READER_STATUS_EOS ||
-         rs == BGPSTREAM_READER_STATUS_AGAIN) {
-    if (q->res_cnt == 0) {
-      // we have nothing in the queue, so now we can return EOS
-      return 0;
-    }
+  if (q->ordering != BGPSTREAM_ORDER_TIME) {
+    rc = unordered_get_record(q, record, &reader);
+  } else if (q->shards != NULL) {
+    rc = shards_get_record(q, record, &reader);
+  } else {
+    rc = get_record(q, record, &reader, &time, &type);
+  }
 
-    // we know we have something in the queue, but if we have nothing open, then
-    // it is time to open some resources!
-    // we do this inside a loop since in some cases the first batch we open get
-    // sorted elsewhere in the queue, leaving the head still unopened.
-    dirty_cnt = 0;
-    while (q->head->res_open_cnt != q->head->res_cnt || dirty_cnt > 0) {
-      if (open_batch(q, q->head) != 0) {
-        goto err;
-      }
-      // its possible that the timestamp of the first record in a dump file
-      // doesn't match the initial time reported to us from the broker (e.g., in
-      // the case of filtering), so we re-sort the batch before we read anything
-      // from it.
-      if ((dirty_cnt = sort_batch(q)) < 0) {
-        goto err;
-      }
-    }
-    // its possible that we failed to open all the files, perhaps in that case
-    // we shouldn't abort, but instead return EOS and let the caller decide what
-    // to do, but for now:
-    assert(q->res_open_cnt != 0);
+  // remember who to release this record to
+  if (rc > 0 && q->hold_readers != NULL) {
+    assert(q->hold_in - __atomic_load_n(&q->hold_out, __ATOMIC_ACQUIRE) <
+           (unsigned long)q->hold_cnt);
+    q->hold_readers[q->hold_in % q->hold_cnt] = reader;
+    __atomic_store_n(&q->hold_in, q->hold_in + 1, __ATOMIC_RELEASE);
+  }
 
-    // we now know that we have open resources to read from, lets do it
-    if ((rs = pop_record(q, record)) == BGPSTREAM_READER_STATUS_ERROR) {
-      return -1;
-    } else if (rs == BGPSTREAM_READER_STATUS_OK) {
-      return 1;
-    }
-    // otherwise, could be EOS or AGAIN, so keep trying (from other resources in
-    // the case of EOS)
+  if (__atomic_load_n(&q->finished_head, __ATOMIC_ACQUIRE) != NULL) {
+    report_finished(q);
   }
 
-err:
-  return -1;
+  return rc;
 }
@@ -44,6 +44,173 @@ bgpstream_resource_mgr_create(bgpstream_filter_mgr_t *filter_mgr);
 /** Destroy the given resource queue */
 void bgpstream_resource_mgr_destroy(bgpstream_resource_mgr_t *q);
 
+/** Set the maximum number of resources that will be opened concurrently
+ *
+ * @param q             pointer to the queue
+ * @param concurrency   maximum number of opener threads (must be > 0)
+ * @return 0 if the concurrency was set, -1 otherwise
+ *
+ * This must be called before the first record is read.
+ */
+int bgpstream_resource_mgr_set_reader_concurrency(bgpstream_resource_mgr_t *q,
+                                                 int concurrency);
+
+/** Set the number of records each reader should decode ahead
+ *
+ * @param q             pointer to the queue
+ * @param readahead     number of records to decode ahead in a background
+ *                      thread per reader, or 0 to decode on demand
+ * @return 0 if the read-ahead was set, -1 otherwise
+ *
+ * Only affects resources that are opened after this is called.
+ */
+int bgpstream_resource_mgr_set_reader_readahead(bgpstream_resource_mgr_t *q,
+                                               int readahead);
+
+/** Set the number of threads used to decompress each resource
+ *
+ * @param q             pointer to the queue
+ * @param threads       number of decompression threads per resource, or 0 to
+ *                      let wandio decompress
+ * @return 0 if the number of threads was set, -1 otherwise
+ *
+ * Only affects resources that are opened after this is called.
+ */
+int bgpstream_resource_mgr_set_decompress_threads(bgpstream_resource_mgr_t *q,
+                                                  int threads);
+
+/** Enable or disable the use of sidecar time indexes
+ *
+ * @param q             pointer to the queue
+ * @param enabled       1 to use (and build) time indexes, 0 otherwise
+ *
+ * Only affects resources that are opened after this is called.
+ */
+void bgpstream_resource_mgr_set_time_index(bgpstream_resource_mgr_t *q,
+                                           int enabled);
+
+/** Enable or disable mapping uncompressed local files into memory
+ *
+ * @param q             pointer to the queue
+ * @param enabled       1 to map files, 0 to read them through wandio
+ *
+ * Only affects resources that are opened after this is called.
+ */
+void bgpstream_resource_mgr_set_mmap(bgpstream_resource_mgr_t *q, int enabled);
+
+/** Set the number of threads used to decode each resource
+ *
+ * @param q             pointer to the queue
+ * @param threads       number of decode threads per resource, or 0 to decode
+ *                      in the reader thread
+ * @return 0 if the number of threads was set, -1 otherwise
+ *
+ * Only affects resources that are opened after this is called.
+ */
+int bgpstream_resource_mgr_set_decode_threads(bgpstream_resource_mgr_t *q,
+                                              int threads);
+
+/** Set how many groups of resources to open ahead of the current batch
+ *
+ * @param q             pointer to the queue
+ * @param groups        number of groups (distinct start times) after the
+ *                      current batch to open in advance, or 0 to disable
+ * @param max_records   maximum number of record buffers that readers opened in
+ *                      advance may use, or 0 for no limit
+ * @return 0 if the lookahead was set, -1 otherwise
+ *
+ * Each open reader buffers up to (read-ahead + 2) records, so this bounds the
+ * memory used by resources that are not being read yet.
+ */
+int bgpstream_resource_mgr_set_lookahead(bgpstream_resource_mgr_t *q,
+                                         int groups, int max_records);
+
+/** Keep returned records valid until they are explicitly released
+ *
+ * @param q             pointer to the queue
+ * @param hold          maximum number of records that the caller may hold at
+ *                      once (including the most recently returned one)
+ * @return 0 if record hold was enabled, -1 otherwise
+ *
+ * Once enabled, every record returned by bgpstream_resource_mgr_get_record
+ * must be released (in order) using bgpstream_resource_mgr_release_record.
+ * This must be called before any resources are added, and stream resources
+ * (with a duration of BGPSTREAM_FOREVER) are then refused.
+ */
+int bgpstream_resource_mgr_set_record_hold(bgpstream_resource_mgr_t *q,
+                                           int hold);
+
+/** Release the oldest record held by the caller
+ *
+ * @param q             pointer to the queue
+ *
+ * This may be called from a different thread to the one getting records.
+ */
+void bgpstream_resource_mgr_release_record(bgpstream_resource_mgr_t *q);
+
+/** Get the next record from the queue, but only if it can be read without
+ * waiting for a stream resource to have data (or for a merge shard to read
+ * its next record)
+ *
+ * @param q             pointer to the queue
+ * @param[out] record   set to a borrowed pointer to a record if the return
+ *                      code is >0
+ * @return >0 if a record was read, 0 if the queue is empty or no record is
+ * ready yet, <0 if an error occurred
+ */
+int bgpstream_resource_mgr_get_ready_record(bgpstream_resource_mgr_t *q,
+                                            bgpstream_record_t **record);
+
+/** Set a callback to receive the counters of each resource that is read to the
+ * end
+ *
+ * @param q             pointer to the queue
+ * @param cb            callback to invoke, or NULL to disable
+ * @param user          user pointer to pass to the callback
+ *
+ * The callback is invoked from bgpstream_resource_mgr_get_record. This must be
+ * called before any resources are added.
+ */
+void bgpstream_resource_mgr_set_stats_cb(bgpstream_resource_mgr_t *q,
+                                         bgpstream_resource_stats_cb_t *cb,
+                                         void *user);
+
+/** Add the counters of all resources (finished or still open) to the given
+ * stats
+ *
+ * @param q             pointer to the queue
+ * @param stats         pointer to the stats to add to
+ */
+void bgpstream_resource_mgr_get_stats(bgpstream_resource_mgr_t *q,
+                                      bgpstream_stats_t *stats);
+
+/** Merge resources using a number of parallel shards
+ *
+ * @param q             pointer to the queue
+ * @param shards        number of shards to partition collectors into, or 0
+ *                      (or 1) to merge all resources in the calling thread
+ * @return 0 if the number of shards was set, -1 otherwise
+ *
+ * Each shard runs its own resource queue in a background thread and the
+ * per-shard record streams are merged by time. This must be called before any
+ * resources are added, and stream resources cannot be used when sharding.
+ */
+int bgpstream_resource_mgr_set_merge_shards(bgpstream_resource_mgr_t *q,
+                                            int shards);
+
+/** Set the order in which records are returned
+ *
+ * @param q             pointer to the queue
+ * @param ordering      record ordering mode
+ * @return 0 if the ordering was set, -1 otherwise
+ *
+ * With any mode other than BGPSTREAM_ORDER_TIME, resources are opened in the
+ * order they are added, up to the reader concurrency at a time, and no time
+ * ordering is done. This must be called before any resources are added.
+ */
+int bgpstream_resource_mgr_set_ordering(bgpstream_resource_mgr_t *q,
+                                        bgpstream_ordering_t ordering);
+
 /** Add a resource item to the queue
  *
  * @param q               pointer to the queue
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2014 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_STATS_H
+#define __BGPSTREAM_STATS_H
+
+#include "bgpstream.h"
+#include <stdint.h>
+
+/** Add to a counter that has a single writer, but may be read concurrently by
+ * bgpstream_stats_add (this is a plain load and store on most platforms) */
+#define BGPSTREAM_STATS_INC(counter, n)                                        \
+  __atomic_store_n(&(counter),                                                 \
+                   __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n),        \
+                   __ATOMIC_RELAXED)
+
+/** Get the current time of a monotonic clock
+ *
+ * @return time in microseconds (with an unspecified epoch)
+ */
+uint64_t bgpstream_stats_now_usec(void);
+
+/** Add all the counters of one stats structure to another
+ *
+ * @param dst           pointer to the stats to add to
+ * @param src           pointer to the stats to add (may be updated
+ *                      concurrently using BGPSTREAM_STATS_INC)
+ */
+void bgpstream_stats_add(bgpstream_stats_t *dst, const bgpstream_stats_t *src);
+
+#endif /* __BGPSTREAM_STATS_H */
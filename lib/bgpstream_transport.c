@@ -32,11 +32,14 @@
 #include "bgpstream_transport.h"
 #include "bgpstream_log.h"
 #include "bgpstream_resource.h"
+#include "bgpstream_stats.h"
 #include "utils.h"
 
 #include "bs_transport_cache.h"
+#include "bs_transport_decompress.h"
 #include "bs_transport_file.h"
 #include "bs_transport_http.h"
+#include "bs_transport_mmap.h"
 
 #ifdef WITH_KAFKA
 #include "bs_transport_kafka.h"
@@ -64,7 +67,9 @@ static const transport_create_func_t create_functions[] = {
   bs_transport_http_create,
 };
 
-bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res)
+bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res,
+                                                  int decompress_threads,
+                                                  int mmap)
 {
   bgpstream_transport_t *transport = NULL;
 
@@ -92,6 +97,15 @@ bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res)
 
   // store a pointer to the resource
   transport->res = res;
+  transport->decompress_threads = decompress_threads;
+
+  // compressed local files may be decompressed in parallel, and uncompressed
+  // ones may be mapped rather than read through wandio
+  if (res->transport_type == BGPSTREAM_RESOURCE_TRANSPORT_FILE &&
+      (bs_transport_decompress_create(transport) == 0 ||
+       (mmap != 0 && bs_transport_mmap_create(transport) == 0))) {
+    return transport;
+  }
 
   if (create_functions[res->transport_type](transport) != 0) {
     bgpstream_log(BGPSTREAM_LOG_ERR, "Could not open resource (%s)", res->url);
@@ -108,7 +122,41 @@ err:
 int64_t bgpstream_transport_read(bgpstream_transport_t *transport, void *buffer,
                                  int64_t len)
 {
-  return transport->read(transport, buffer, len);
+  int64_t rc = transport->read(transport, buffer, len);
+  if (rc > 0) {
+    BGPSTREAM_STATS_INC(transport->bytes_read, rc);
+  }
+  return rc;
+}
+
+int64_t bgpstream_transport_map(bgpstream_transport_t *transport,
+                                const uint8_t **data)
+{
+  int64_t rc;
+
+  if (transport->map == NULL) {
+    return -1;
+  }
+  rc = transport->map(transport, data);
+  if (rc > 0) {
+    BGPSTREAM_STATS_INC(transport->bytes_read, rc);
+  }
+  return rc;
+}
+
+int bgpstream_transport_get_poll_fd(bgpstream_transport_t *transport)
+{
+  if (transport->get_poll_fd == NULL) {
+    return -1;
+  }
+  return transport->get_poll_fd(transport);
+}
+
+void bgpstream_transport_get_stats(bgpstream_transport_t *transport,
+                                   bgpstream_stats_t *stats)
+{
+  stats->bytes_read +=
+    __atomic_load_n(&transport->bytes_read, __ATOMIC_RELAXED);
 }
 
 void bgpstream_transport_destroy(bgpstream_transport_t *transport)
@@ -125,5 +173,9 @@ void bgpstream_transport_destroy(bgpstream_transport_t *transport)
 int64_t bgpstream_transport_readline(bgpstream_transport_t *transport,
                                      void *buffer, int64_t len)
 {
-  return transport->readline(transport, buffer, len);
+  int64_t rc = transport->readline(transport, buffer, len);
+  if (rc > 0) {
+    BGPSTREAM_STATS_INC(transport->bytes_read, rc);
+  }
+  return rc;
 }
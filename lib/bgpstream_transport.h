@@ -32,6 +32,7 @@
 #ifndef __BGPSTREAM_TRANSPORT_H
 #define __BGPSTREAM_TRANSPORT_H
 
+#include "bgpstream.h"
 #include "bgpstream_resource.h"
 
 /** Generic interface to specific data transport modules */
@@ -40,9 +41,20 @@ typedef struct bgpstream_transport bgpstream_transport_t;
 /** Create a transport handler for the given resource
  *
  * @param res           pointer to a resource
+ * @param decompress_threads number of threads to decompress the resource with
+ * @param mmap          1 to map uncompressed local files into memory
  * @return pointer to a transport module instance if successful, NULL otherwise
+ *
+ * File resources that are local bzip2 files, or gzip files with multiple
+ * members, are split at block (or member) boundaries and decompressed by
+ * decompress_threads threads if it is greater than 1. If mmap is set,
+ * uncompressed local files are mapped into memory (so they must not be
+ * truncated or appended to while they are read). Everything else is read
+ * through wandio.
  */
-bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res);
+bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res,
+                                                  int decompress_threads,
+                                                  int mmap);
 
 /** Read from the given transport handler
  *
@@ -60,6 +72,40 @@ int64_t bgpstream_transport_read(bgpstream_transport_t *transport, void *buffer,
 int64_t bgpstream_transport_readline(bgpstream_transport_t *transport,
                                      void *buffer, int64_t len);
 
+/** Get all remaining data from the given transport without copying it
+ *
+ * @param transport     pointer to a transport handler
+ * @param[out] data     set to point to the data
+ * @return the number of bytes available at data, or -1 if the transport cannot
+ * provide its data this way (in which case it should be read as usual)
+ *
+ * If successful, the data is consumed and subsequent reads return EOF. The data
+ * remains valid until the transport is destroyed.
+ */
+int64_t bgpstream_transport_map(bgpstream_transport_t *transport,
+                                const uint8_t **data);
+
+/** Get a file descriptor that becomes readable when the transport has data
+ *
+ * @param transport     pointer to a transport handler
+ * @return a pollable file descriptor, or -1 if the transport does not provide
+ * one
+ *
+ * The descriptor is owned by the transport and must not be read from or closed
+ * by the caller.
+ */
+int bgpstream_transport_get_poll_fd(bgpstream_transport_t *transport);
+
+/** Add the counters maintained by the transport to the given stats
+ *
+ * @param transport     pointer to a transport handler
+ * @param stats         pointer to the stats to add to
+ *
+ * May be called while another thread is reading from the transport.
+ */
+void bgpstream_transport_get_stats(bgpstream_transport_t *transport,
+                                   bgpstream_stats_t *stats);
+
 /** Shutdown and destroy the given transport handler
  *
  * @param transport     pointer to a transport handler to destroy
@@ -98,6 +98,30 @@ struct bgpstream_transport {
    */
   void (*destroy)(struct bgpstream_transport *transport);
 
+  /** Get a file descriptor that becomes readable when data arrives (optional)
+   *
+   * @param t           The data transport object to get the descriptor for
+   * @return a file descriptor that can be polled for reading, or -1 if the
+   * transport does not support this
+   *
+   * This is only useful for stream transports whose read method returns 0
+   * when no data is available. It is not set by BS_TRANSPORT_SET_METHODS, so
+   * transports that support it must set it explicitly.
+   */
+  int (*get_poll_fd)(struct bgpstream_transport *t);
+
+  /** Get the remaining data as a single read-only buffer (optional)
+   *
+   * @param t           The data transport object to map
+   * @param[out] data   Set to point to the data
+   * @return the number of bytes available at data
+   *
+   * The data is consumed (later reads return EOF) but remains valid until the
+   * transport is destroyed. Like get_poll_fd, this is not set by
+   * BS_TRANSPORT_SET_METHODS.
+   */
+  int64_t (*map)(struct bgpstream_transport *t, const uint8_t **data);
+
   /** }@ */
 
   /**
@@ -114,6 +138,14 @@ struct bgpstream_transport {
       transport */
   void *state;
 
+  /** The number of bytes read from this transport (maintained by
+      bgpstream_transport_read and bgpstream_transport_readline) */
+  uint64_t bytes_read;
+
+  /** The number of threads to decompress the resource with (if the transport
+      supports it) */
+  int decompress_threads;
+
   /** }@ */
 };
 
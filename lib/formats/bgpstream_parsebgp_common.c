@@ -31,9 +31,14 @@
 #include "bgpstream_utils_as_path_int.h"
 #include "bgpstream_utils_community_int.h"
 #include "bgpstream_log.h"
+#include "utils.h"
 #include <assert.h>
-#include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // if the parser encounters an "invalid" message, it will be written to
 // "debug.msg" if this is set
@@ -179,31 +184,138 @@ static int handle_as_paths(bgpstream_as_path_t *path,
   return 0;
 }
 
+#ifdef HAVE_MEMFD_CREATE
+// map len bytes (a multiple of the page size) of anonymous memory twice,
+// back-to-back, so that reads and writes can run off the end of the first copy
+static uint8_t *map_ring(size_t len)
+{
+  uint8_t *base;
+  int fd;
+
+  if ((fd = memfd_create("bgpstream-decode", MFD_CLOEXEC)) == -1) {
+    return NULL;
+  }
+  if (ftruncate(fd, len) != 0) {
+    goto err;
+  }
+  // reserve address space for both copies, then map the memfd over it twice
+  if ((base = mmap(NULL, len * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                   0)) == MAP_FAILED) {
+    goto err;
+  }
+  if (mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) ==
+        MAP_FAILED ||
+      mmap(base + len, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+           0) == MAP_FAILED) {
+    munmap(base, len * 2);
+    goto err;
+  }
+  // the mappings keep the memory alive
+  close(fd);
+  return base;
+
+err:
+  close(fd);
+  return NULL;
+}
+#endif
+
+static void free_buffer(bgpstream_parsebgp_decode_state_t *state)
+{
+  if (state->buffer == NULL) {
+    return;
+  }
+#ifdef HAVE_MEMFD_CREATE
+  if (state->mirrored != 0) {
+    munmap(state->buffer, state->buflen * 2);
+  } else
+#endif
+  {
+    free(state->buffer);
+  }
+  state->buffer = NULL;
+}
+
+// (re)allocate the buffer with room for len bytes, keeping any unread data
+static int alloc_buffer(bgpstream_parsebgp_decode_state_t *state, size_t len)
+{
+  uint8_t *buf = NULL;
+  int mirrored = 0;
+
+#ifdef HAVE_MEMFD_CREATE
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if (pagesize > 0 && (len % pagesize) == 0 && (buf = map_ring(len)) != NULL) {
+    mirrored = 1;
+  }
+#endif
+  // fall back to a plain buffer that is compacted before each read
+  if (buf == NULL && (buf = malloc(len)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Could not allocate %zu byte decode buffer", len);
+    return -1;
+  }
+
+  if (state->remain > 0) {
+    memcpy(buf, state->ptr, state->remain);
+  }
+  free_buffer(state);
+  state->buffer = buf;
+  state->buflen = len;
+  state->mirrored = mirrored;
+  state->ptr = buf;
+  return 0;
+}
+
+// append as much data as will fit after the unread bytes. returns the number
+// of bytes read (0 at EOF, or if the message is too large to buffer)
 static ssize_t refill_buffer(bgpstream_parsebgp_decode_state_t *state,
                              bgpstream_transport_t *transport)
 {
-  size_t len = 0;
   int64_t new_read = 0;
 
-  if (state->remain > 0) {
+  if (state->mapped != 0) {
+    // all of the data was given to us up front
+    return 0;
+  }
+
+  if (state->remain == state->buflen) {
+    // a single message fills the whole buffer, so it needs to grow
+    if (state->buflen * 2 > BGPSTREAM_PARSEBGP_BUFLEN_MAX) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "Message is larger than the %d byte decode buffer limit",
+                    BGPSTREAM_PARSEBGP_BUFLEN_MAX);
+      return 0;
+    }
+    if (alloc_buffer(state, state->buflen * 2) != 0) {
+      return -1;
+    }
+  }
+
+  if (state->remain == 0) {
+    state->ptr = state->buffer;
+  } else if (state->mirrored != 0) {
+    // the unread bytes may run into the second copy, but the free space after
+    // them does not wrap past the end of it as long as ptr is in the first
+    if (state->ptr >= state->buffer + state->buflen) {
+      state->ptr -= state->buflen;
+    }
+  } else if (state->ptr != state->buffer) {
     // need to move remaining data to start of buffer
-    memmove(state->buffer,
-            state->buffer + BGPSTREAM_PARSEBGP_BUFLEN - state->remain,
-            state->remain);
-    len += state->remain;
+    memmove(state->buffer, state->ptr, state->remain);
+    state->ptr = state->buffer;
   }
 
   // try and do a read
-  if ((new_read = bgpstream_transport_read(transport, state->buffer + len,
-                                           BGPSTREAM_PARSEBGP_BUFLEN - len)) <
-      0) {
+  if ((new_read = bgpstream_transport_read(
+         transport, state->ptr + state->remain,
+         state->buflen - state->remain)) < 0) {
     // read failed
     return new_read;
   }
 
-  // new_read could be 0, indicating EOF, so need to check returned len is
-  // larger than passed in remain
-  return len + new_read;
+  state->remain += new_read;
+  state->read_len += new_read;
+  return new_read;
 }
 
 static bgpstream_format_status_t
@@ -238,6 +350,217 @@ handle_eof(bgpstream_parsebgp_decode_state_t *state, bgpstream_record_t *record,
   return BGPSTREAM_FORMAT_END_OF_DUMP;
 }
 
+/* -------------------- DECODE POOL -------------------- */
+
+// number of messages queued for each decode thread
+#define POOL_SLOTS_PER_THREAD 8
+
+typedef struct pool_slot {
+
+  // raw message (owned by the slot)
+  uint8_t *raw;
+  size_t raw_len;
+  size_t raw_alloc;
+
+  // offset of the message in the decompressed data
+  uint64_t offset;
+
+  // message decoded by a pool thread, and the result of decoding it
+  parsebgp_msg_t *msg;
+  parsebgp_error_t err;
+
+  // has the message been decoded (protected by the pool mutex)
+  int done;
+
+} pool_slot_t;
+
+struct bgpstream_parsebgp_pool {
+
+  // decode state that the pool reads raw messages from
+  bgpstream_parsebgp_decode_state_t *state;
+
+  // length of the header that the frame callback needs
+  size_t hdr_len;
+  bgpstream_parsebgp_frame_cb_t *frame_cb;
+
+  // ring of messages. slots from head to job are waiting for a thread, slots
+  // from head to tail are queued or decoded, and are handed out in order
+  pool_slot_t *slots;
+  int slots_cnt;
+  uint64_t head;
+  uint64_t job;
+  uint64_t tail;
+
+  // set once there are no more raw messages to queue
+  int eof;
+
+  pthread_t *threads;
+  int threads_cnt;
+  pthread_mutex_t mutex;
+  pthread_cond_t job_cond;
+  pthread_cond_t done_cond;
+  int shutdown;
+};
+
+static void *pool_thread(void *user)
+{
+  bgpstream_parsebgp_pool_t *pool = user;
+  pool_slot_t *slot;
+  size_t len;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (1) {
+    while (pool->shutdown == 0 && pool->job == pool->tail) {
+      pthread_cond_wait(&pool->job_cond, &pool->mutex);
+    }
+    if (pool->shutdown != 0) {
+      break;
+    }
+    slot = &pool->slots[pool->job % pool->slots_cnt];
+    pool->job++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    parsebgp_clear_msg(slot->msg);
+    len = slot->raw_len;
+    slot->err = parsebgp_decode(pool->state->parser_opts,
+                                pool->state->msg_type, slot->msg, slot->raw,
+                                &len);
+
+    pthread_mutex_lock(&pool->mutex);
+    slot->done = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+// copy the next raw message into the slot. returns 1 if a message was
+// queued, 0 at EOF, -1 if an error occurred
+static int pool_frame(bgpstream_parsebgp_pool_t *pool, pool_slot_t *slot,
+                      bgpstream_transport_t *transport)
+{
+  bgpstream_parsebgp_decode_state_t *state = pool->state;
+  const uint8_t *data;
+  uint64_t len;
+  uint8_t *raw;
+  int rc;
+
+  if ((rc = bgpstream_parsebgp_decode_state_peek(state, transport,
+                                                 pool->hdr_len, &data)) < 0) {
+    return -1;
+  }
+  len = rc == 1 ? pool->frame_cb(data) : state->remain;
+  if (len == 0) {
+    // EOF (and no partial header)
+    return 0;
+  }
+  if ((rc = bgpstream_parsebgp_decode_state_peek(state, transport, len,
+                                                 &data)) < 0) {
+    return -1;
+  }
+  if (rc == 0) {
+    // the message is truncated (or too large to buffer), so let the parser
+    // complain about what there is
+    len = state->remain;
+  }
+
+  if (slot->raw_alloc < len) {
+    if ((raw = realloc(slot->raw, len)) == NULL) {
+      return -1;
+    }
+    slot->raw = raw;
+    slot->raw_alloc = len;
+  }
+  memcpy(slot->raw, state->ptr, len);
+  slot->raw_len = len;
+  slot->offset = bgpstream_parsebgp_decode_state_offset(state);
+  slot->done = 0;
+
+  return bgpstream_parsebgp_decode_state_skip(state, transport, len) == 0 ? 1
+                                                                          : -1;
+}
+
+// get the next decoded message from the pool, swapping it with *msgp. returns
+// 1 if a message was returned, 0 at EOF, -1 if an error occurred
+static int pool_next(bgpstream_parsebgp_pool_t *pool,
+                     bgpstream_transport_t *transport, parsebgp_msg_t **msgp,
+                     parsebgp_error_t *err)
+{
+  pool_slot_t *slot;
+  parsebgp_msg_t *tmp;
+  int rc;
+
+  // keep the threads busy. only this thread changes tail, so the slots from
+  // tail to head + slots_cnt can be filled without holding the lock
+  while (pool->eof == 0 &&
+         pool->tail - pool->head < (uint64_t)pool->slots_cnt) {
+    slot = &pool->slots[pool->tail % pool->slots_cnt];
+    if ((rc = pool_frame(pool, slot, transport)) < 0) {
+      return -1;
+    }
+    if (rc == 0) {
+      pool->eof = 1;
+      break;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->tail++;
+    pthread_cond_signal(&pool->job_cond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  if (pool->head == pool->tail) {
+    return 0;
+  }
+
+  slot = &pool->slots[pool->head % pool->slots_cnt];
+  pthread_mutex_lock(&pool->mutex);
+  while (slot->done == 0) {
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  tmp = *msgp;
+  *msgp = slot->msg;
+  slot->msg = tmp;
+  *err = slot->err;
+  pool->state->msg_offset = slot->offset;
+  pool->head++;
+
+  return 1;
+}
+
+static void pool_destroy(bgpstream_parsebgp_pool_t *pool)
+{
+  int i;
+
+  if (pool == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->job_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (i = 0; i < pool->threads_cnt; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+
+  for (i = 0; i < pool->slots_cnt; i++) {
+    free(pool->slots[i].raw);
+    if (pool->slots[i].msg != NULL) {
+      parsebgp_destroy_msg(pool->slots[i].msg);
+    }
+  }
+  free(pool->slots);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->job_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool);
+}
+
 /* -------------------- PUBLIC API FUNCTIONS -------------------- */
 
 void bgpstream_parsebgp_upd_state_reset(
@@ -246,9 +569,11 @@ void bgpstream_parsebgp_upd_state_reset(
   memset(upd_state, 0, sizeof(*upd_state));
 }
 
+// returns 1 if the elem was populated, 0 if the prefix was skipped
 static int handle_prefix(bgpstream_elem_t *elem,
                          bgpstream_elem_type_t elem_type,
-                         parsebgp_bgp_prefix_t *prefix)
+                         parsebgp_bgp_prefix_t *prefix,
+                         bgpstream_filter_mgr_t *filter_mgr)
 {
   if (prefix->type != PARSEBGP_BGP_PREFIX_UNICAST_IPV4 &&
       prefix->type != PARSEBGP_BGP_PREFIX_UNICAST_IPV6) {
@@ -261,6 +586,12 @@ static int handle_prefix(bgpstream_elem_t *elem,
   COPY_IP(&elem->prefix.address, prefix->afi, prefix->addr, return 0);
   elem->prefix.mask_len = prefix->len;
 
+  // apply the prefix filters now, before any per-elem work is done
+  if ((filter_mgr->ipversion || filter_mgr->prefixes) &&
+      bgpstream_filter_mgr_prefix_check(filter_mgr, &elem->prefix) == 0) {
+    return 0;
+  }
+
   return 1;
 }
 
@@ -270,7 +601,8 @@ static int handle_prefix(bgpstream_elem_t *elem,
     while (upd_state->withdrawal_##nlri_type##_cnt > 0 && rc == 0) {           \
       if ((rc = handle_prefix(                                                 \
              elem, BGPSTREAM_ELEM_TYPE_WITHDRAWAL,                             \
-             &prefixes[upd_state->withdrawal_##nlri_type##_idx])) < 0) {       \
+             &prefixes[upd_state->withdrawal_##nlri_type##_idx],               \
+             filter_mgr)) < 0) {                                               \
         bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract withdrawal elem"); \
         return -1;                                                             \
       }                                                                        \
@@ -286,24 +618,38 @@ static int handle_prefix(bgpstream_elem_t *elem,
   do {                                                                         \
     rc = 0;                                                                    \
     while (upd_state->announce_##nlri_type##_cnt > 0 && rc == 0) {             \
-      if (upd_state->next_hop_##nlri_type##_done == 0) {                       \
-        if (bgpstream_parsebgp_process_next_hop(                               \
-              elem, update->path_attrs.attrs, is_mp_reach) != 0) {             \
-          bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract next-hop");      \
-          return -1;                                                           \
-        }                                                                      \
-        upd_state->next_hop_##nlri_type##_done = 1;                            \
-      }                                                                        \
-                                                                               \
       if ((rc = handle_prefix(                                                 \
              elem, BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT,                           \
-             &prefixes[upd_state->announce_##nlri_type##_idx])) < 0) {         \
+             &prefixes[upd_state->announce_##nlri_type##_idx],                 \
+             filter_mgr)) < 0) {                                               \
         bgpstream_log(BGPSTREAM_LOG_ERR,                                       \
                       "Could not extract announcement elem");                  \
         return -1;                                                             \
       }                                                                        \
       upd_state->announce_##nlri_type##_cnt--;                                 \
       upd_state->announce_##nlri_type##_idx++;                                 \
+      if (rc == 0) {                                                           \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      /* only process the attributes once a prefix passes the filters */       \
+      if (upd_state->path_attr_done == 0) {                                    \
+        if (bgpstream_parsebgp_process_path_attrs(                             \
+              elem, update->path_attrs.attrs) != 0) {                          \
+          bgpstream_log(BGPSTREAM_LOG_ERR,                                     \
+                        "Could not extract path attributes");                  \
+          return -1;                                                           \
+        }                                                                      \
+        upd_state->path_attr_done = 1;                                         \
+      }                                                                        \
+      if (upd_state->next_hop_##nlri_type##_done == 0) {                       \
+        if (bgpstream_parsebgp_process_next_hop(                               \
+              elem, update->path_attrs.attrs, is_mp_reach, filter_mgr) != 0) { \
+          bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract next-hop");      \
+          return -1;                                                           \
+        }                                                                      \
+        upd_state->next_hop_##nlri_type##_done = 1;                            \
+      }                                                                        \
     }                                                                          \
     if (rc != 0) {                                                             \
       return rc;                                                               \
@@ -312,7 +658,8 @@ static int handle_prefix(bgpstream_elem_t *elem,
 
 int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
                                       bgpstream_elem_t *elem,
-                                      parsebgp_bgp_msg_t *bgp)
+                                      parsebgp_bgp_msg_t *bgp,
+                                      bgpstream_filter_mgr_t *filter_mgr)
 {
   parsebgp_bgp_update_t *update = bgp->types.update; // could be NULL!
   int rc = 0;
@@ -366,20 +713,12 @@ int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
     v6, update->path_attrs.attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_UNREACH_NLRI]
           .data.mp_unreach->withdrawn_nlris);
 
-  // at this point we need the path attributes processed
-  if (upd_state->path_attr_done == 0) {
-    if (bgpstream_parsebgp_process_path_attrs(elem, update->path_attrs.attrs) !=
-        0) {
-      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not extract path attributes");
-      return -1;
-    }
-    upd_state->path_attr_done = 1;
-  }
-
-  // IPv4 Announcements (will also trigger next-hop extraction)
+  // IPv4 Announcements (will also trigger path attribute and next-hop
+  // extraction)
   ANNOUNCEMENT_GENERATOR(v4, update->announced_nlris.prefixes, 0);
 
-  // IPv6 Announcements (will also trigger next-hop extraction)
+  // IPv6 Announcements (will also trigger path attribute and next-hop
+  // extraction)
   ANNOUNCEMENT_GENERATOR(
     v6,
     update->path_attrs.attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_REACH_NLRI]
@@ -480,10 +819,18 @@ int bgpstream_parsebgp_process_path_attrs(
 
 int bgpstream_parsebgp_process_next_hop(bgpstream_elem_t *el,
                                         parsebgp_bgp_update_path_attr_t *attrs,
-                                        int is_mp_pfx)
+                                        int is_mp_pfx,
+                                        bgpstream_filter_mgr_t *filter_mgr)
 {
   parsebgp_bgp_update_mp_reach_t *mp_reach;
 
+  // MP_REACH is always decoded (for its prefixes), but its next-hop must be
+  // left unset like the NEXT_HOP attribute if the field was not selected
+  if ((filter_mgr->elem_fields & BGPSTREAM_ELEM_FIELD_NEXTHOP) == 0) {
+    el->nexthop.version = 0;
+    return 0;
+  }
+
   if (is_mp_pfx && attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_REACH_NLRI].type ==
                      PARSEBGP_BGP_PATH_ATTR_TYPE_MP_REACH_NLRI) {
     // extract next-hop from MP_REACH attribute
@@ -493,6 +840,7 @@ int bgpstream_parsebgp_process_next_hop(bgpstream_elem_t *el,
     // extract next-hop from NEXT_HOP attribute
     if (attrs[PARSEBGP_BGP_PATH_ATTR_TYPE_NEXT_HOP].type !=
         PARSEBGP_BGP_PATH_ATTR_TYPE_NEXT_HOP) {
+      el->nexthop.version = 0;
       return 0;
     }
     COPY_IP(&el->nexthop, PARSEBGP_BGP_AFI_IPV4,
@@ -503,17 +851,156 @@ int bgpstream_parsebgp_process_next_hop(bgpstream_elem_t *el,
   return 0;
 }
 
+int bgpstream_parsebgp_decode_state_init(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport)
+{
+  const uint8_t *data;
+  int64_t len;
+
+  state->remain = 0;
+
+  // decode straight from the transport's memory if we can
+  if ((len = bgpstream_transport_map(transport, &data)) >= 0) {
+    // parsebgp does not write to the data
+    state->ptr = (uint8_t *)data;
+    state->remain = len;
+    state->read_len = len;
+    state->mapped = 1;
+    return 0;
+  }
+
+  return alloc_buffer(state, BGPSTREAM_PARSEBGP_BUFLEN);
+}
+
+int bgpstream_parsebgp_decode_state_start_pool(
+  bgpstream_parsebgp_decode_state_t *state, int threads, size_t hdr_len,
+  bgpstream_parsebgp_frame_cb_t *frame_cb)
+{
+  bgpstream_parsebgp_pool_t *pool;
+  int i;
+
+  assert(state->pool == NULL);
+
+  if ((pool = malloc_zero(sizeof(bgpstream_parsebgp_pool_t))) == NULL) {
+    return -1;
+  }
+  pool->state = state;
+  pool->hdr_len = hdr_len;
+  pool->frame_cb = frame_cb;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->job_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  pool->slots_cnt = threads * POOL_SLOTS_PER_THREAD;
+  if ((pool->slots = malloc_zero(sizeof(pool_slot_t) * pool->slots_cnt)) ==
+      NULL) {
+    goto err;
+  }
+  for (i = 0; i < pool->slots_cnt; i++) {
+    if ((pool->slots[i].msg = parsebgp_create_msg()) == NULL) {
+      goto err;
+    }
+  }
+
+  if ((pool->threads = malloc(sizeof(pthread_t) * threads)) == NULL) {
+    goto err;
+  }
+  for (; pool->threads_cnt < threads; pool->threads_cnt++) {
+    if (pthread_create(&pool->threads[pool->threads_cnt], NULL, pool_thread,
+                       pool) != 0) {
+      goto err;
+    }
+  }
+
+  state->pool = pool;
+  return 0;
+
+err:
+  bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start %d decode threads",
+                threads);
+  pool_destroy(pool);
+  return -1;
+}
+
+void bgpstream_parsebgp_decode_state_clear(
+  bgpstream_parsebgp_decode_state_t *state)
+{
+  // the threads may be using the parser options and the buffer
+  pool_destroy(state->pool);
+  state->pool = NULL;
+
+  free_buffer(state);
+  state->buflen = 0;
+  state->remain = 0;
+  state->ptr = NULL;
+}
+
+uint64_t bgpstream_parsebgp_decode_state_offset(
+  bgpstream_parsebgp_decode_state_t *state)
+{
+  return state->read_len - state->remain;
+}
+
+int bgpstream_parsebgp_decode_state_peek(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport,
+  size_t len, const uint8_t **data)
+{
+  ssize_t fill_len;
+
+  while (state->remain < len) {
+    if ((fill_len = refill_buffer(state, transport)) < 0) {
+      return -1;
+    }
+    if (fill_len == 0) {
+      return 0;
+    }
+  }
+
+  *data = state->ptr;
+  return 1;
+}
+
+int bgpstream_parsebgp_decode_state_skip(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport,
+  uint64_t len)
+{
+  ssize_t fill_len;
+  size_t skip_len;
+
+  while (len > 0) {
+    if (state->remain == 0) {
+      if ((fill_len = refill_buffer(state, transport)) < 0) {
+        return -1;
+      }
+      if (fill_len == 0) {
+        // EOF
+        return 0;
+      }
+    }
+    skip_len = len < state->remain ? len : state->remain;
+    state->ptr += skip_len;
+    state->remain -= skip_len;
+    len -= skip_len;
+  }
+
+  return 0;
+}
+
 bgpstream_format_status_t bgpstream_parsebgp_populate_record(
-  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t *msg,
+  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msgp,
   bgpstream_format_t *format, bgpstream_record_t *record,
   bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+  bgpstream_parsebgp_skip_cb_t *skip_cb,
   bgpstream_parsebgp_check_filter_cb_t *filter_cb)
 {
   assert(record->__int->format == format);
 
+  parsebgp_msg_t *msg = *msgp;
+  int pool_rc;
   int refill = 0;
   ssize_t fill_len = 0;
   size_t dec_len = 0, hdr_len = 0;
+  uint64_t skip_len;
   uint64_t skipped_cnt = 0;
   parsebgp_error_t err;
   bgpstream_parsebgp_check_filter_rc_t filter_rc;
@@ -523,20 +1010,31 @@ bgpstream_format_status_t bgpstream_parsebgp_populate_record(
   assert(record->time_sec == 0);
 
 refill:
+  if (state->pool != NULL) {
+    // messages are framed here, and decoded ahead by the pool threads
+    if ((pool_rc = pool_next(state->pool, format->transport, msgp, &err)) <
+        0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not refill decode pool");
+      return BGPSTREAM_FORMAT_READ_ERROR;
+    }
+    if (pool_rc == 0) {
+      // EOF
+      return handle_eof(state, record, skipped_cnt);
+    }
+    msg = *msgp;
+    goto decoded;
+  }
+
   // if there's nothing left in the buffer, it could just be because we happened
   // to empty it, so let's try and get some more data from the transport just in
   // case.
   // on the other hand, if there are some bytes left in the buffer, but we've
   // got to the end, and there's a partial message left, the "refill" flag will
-  // be set which causes us to do a forced refill (the remaining bytes will be
-  // shifted to the beginning of the buffer, and the rest filled).
+  // be set which causes us to do a forced refill (more data is appended after
+  // the remaining bytes, growing the buffer if the message does not fit).
   if (state->remain == 0 || refill != 0) {
     // try to refill the buffer
-    if ((fill_len = refill_buffer(state, format->transport)) == 0) {
-      // EOF
-      return handle_eof(state, record, skipped_cnt);
-    }
-    if (fill_len < 0) {
+    if ((fill_len = refill_buffer(state, format->transport)) < 0) {
       // read error
 
       // check if EIO happened during read. if so, return warning instead of error.
@@ -551,13 +1049,15 @@ refill:
       bgpstream_log(BGPSTREAM_LOG_ERR, "Could not refill buffer");
       return BGPSTREAM_FORMAT_READ_ERROR;
     }
-    if (fill_len == state->remain) {
+    if (fill_len == 0) {
+      if (state->remain == 0) {
+        // EOF
+        return handle_eof(state, record, skipped_cnt);
+      }
+      // EOF (or no room) with a partial message left over
       record->status = BGPSTREAM_RECORD_STATUS_CORRUPTED_RECORD;
       return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
     }
-    // here we have something new to read
-    state->remain = fill_len;
-    state->ptr = state->buffer;
 
     // reset the "force refill" flag
     refill = 0;
@@ -569,6 +1069,26 @@ refill:
     return handle_eof(state, record, skipped_cnt);
   }
 
+  state->msg_offset = state->read_len - state->remain;
+
+  // see if the caller can tell from the header that the message is not wanted
+  if (skip_cb != NULL &&
+      (skip_len = skip_cb(format, state->ptr, state->remain)) != 0) {
+    if (bgpstream_parsebgp_decode_state_skip(state, format->transport,
+                                             skip_len) != 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not skip message");
+      return BGPSTREAM_FORMAT_READ_ERROR;
+    }
+    if (skipped_cnt == UINT64_MAX) {
+      skipped_cnt = 0;
+    }
+    skipped_cnt++;
+    state->successful_read_cnt++;
+    BGPSTREAM_STATS_INC(format->stats.records_read, 1);
+    refill = 0;
+    goto refill;
+  }
+
   // see if the caller wants to parse some special headers (openbmp...)
   if (prep_cb != NULL) {
     hdr_len = state->remain;
@@ -583,6 +1103,7 @@ refill:
   dec_len = state->remain;
   err = parsebgp_decode(state->parser_opts, state->msg_type, msg,
                              state->ptr, &dec_len);
+decoded:
   if (err == PARSEBGP_TRUNCATED_MSG) {
     bgpstream_log(BGPSTREAM_LOG_WARN,
                   "Read truncated record %"PRIu64" from '%s'",
@@ -590,7 +1111,7 @@ refill:
                   format->res->url);
   } else if (err != PARSEBGP_OK) {
     parsebgp_clear_msg(msg);
-    if (err == PARSEBGP_PARTIAL_MSG) {
+    if (err == PARSEBGP_PARTIAL_MSG && state->pool == NULL) {
       // refill the buffer and try again
       refill = 1;
       goto refill;
@@ -610,8 +1131,10 @@ refill:
     return BGPSTREAM_FORMAT_CORRUPTED_DUMP;
   }
   // else: successful read
-  state->ptr += dec_len;
-  state->remain -= dec_len;
+  if (state->pool == NULL) {
+    state->ptr += dec_len;
+    state->remain -= dec_len;
+  }
 
   // got a message!
   // let the caller decide if they want it
@@ -625,6 +1148,7 @@ refill:
     // valid message, and it passes our filters
     state->valid_read_cnt++;
     state->successful_read_cnt++;
+    BGPSTREAM_STATS_INC(format->stats.records_read, 1);
     record->status = BGPSTREAM_RECORD_STATUS_VALID_RECORD;
   } else if (filter_rc == BGPSTREAM_PARSEBGP_EOS) {
     if (state->successful_read_cnt > 0) {
@@ -645,6 +1169,7 @@ refill:
       }
       skipped_cnt++;
       state->successful_read_cnt++;
+      BGPSTREAM_STATS_INC(format->stats.records_read, 1);
     }
     parsebgp_clear_msg(msg);
     // there is a cool corner case here when our buffer ends perfectly at the
@@ -676,22 +1201,51 @@ refill:
   return BGPSTREAM_FORMAT_OK;
 }
 
-void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts)
+void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts,
+                                  bgpstream_filter_mgr_t *filter_mgr)
 {
-  // select only the Path Attributes that we care about
+  uint32_t fields = filter_mgr->elem_fields;
+
+  // the elem filters need some fields whether the user wants them or not
+  if (filter_mgr->origin_asns != NULL || filter_mgr->aspath_exprs != NULL) {
+    fields |= BGPSTREAM_ELEM_FIELD_AS_PATH;
+  }
+  if (filter_mgr->communities != NULL) {
+    fields |= BGPSTREAM_ELEM_FIELD_COMMUNITIES;
+  }
+
+  // select only the Path Attributes that we care about. MP_REACH and
+  // MP_UNREACH carry prefixes, so they are always needed
   opts->bgp.path_attr_filter_enabled = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_ORIGIN] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS_PATH] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_NEXT_HOP] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_MED] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_LOCAL_PREF] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_ATOMIC_AGGREGATE] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AGGREGATOR] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES] = 1;
   opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_REACH_NLRI] = 1;
   opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_MP_UNREACH_NLRI] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS4_PATH] = 1;
-  opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS4_AGGREGATOR] = 1;
+  if (fields & BGPSTREAM_ELEM_FIELD_ORIGIN) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_ORIGIN] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_AS_PATH) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS_PATH] = 1;
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS4_PATH] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_NEXTHOP) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_NEXT_HOP] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_MED) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_MED] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_LOCAL_PREF) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_LOCAL_PREF] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_ATOMIC_AGGREGATE) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_ATOMIC_AGGREGATE] =
+      1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_AGGREGATOR) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AGGREGATOR] = 1;
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_AS4_AGGREGATOR] = 1;
+  }
+  if (fields & BGPSTREAM_ELEM_FIELD_COMMUNITIES) {
+    opts->bgp.path_attr_filter[PARSEBGP_BGP_PATH_ATTR_TYPE_COMMUNITIES] = 1;
+  }
 
   // and ask for shallow parsing of communities
   opts->bgp.path_attr_raw_enabled = 1;
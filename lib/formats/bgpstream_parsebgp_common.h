@@ -29,6 +29,7 @@
 
 #include "bgpstream_elem.h"
 #include "bgpstream_format.h"
+#include "bgpstream_transport.h"
 #include "parsebgp.h"
 
 #define COPY_IP(dst, afi, src, do_unknown)                                     \
@@ -52,6 +53,10 @@
 // might help reduce the time waiting for locks
 #define BGPSTREAM_PARSEBGP_BUFLEN 1024 * 1024
 
+// the decode buffer starts at BGPSTREAM_PARSEBGP_BUFLEN and is doubled each
+// time a single message does not fit, up to this limit
+#define BGPSTREAM_PARSEBGP_BUFLEN_MAX 64 * 1024 * 1024
+
 /** Process the given path attributes and populate the given elem
  *
  * @param el            pointer to the elem to populate
@@ -69,6 +74,8 @@ int bgpstream_parsebgp_process_path_attrs(
  * @param el            pointer to the elem to populate
  * @param attrs         array of parsebgp path attributes to process
  * @param is_mp_pfx     flag indicating if the current prefix is from MP_REACH
+ * @param filter_mgr    filter manager (the next-hop is left unset if it is not
+ *                      one of the selected elem fields)
  * @return 0 if processing was successful, -1 otherwise
  *
  * Note: from my reading of RFC4760, it is theoretically possible for a single
@@ -78,7 +85,8 @@ int bgpstream_parsebgp_process_path_attrs(
  */
 int bgpstream_parsebgp_process_next_hop(bgpstream_elem_t *el,
                                         parsebgp_bgp_update_path_attr_t *attrs,
-                                        int is_mp_pfx);
+                                        int is_mp_pfx,
+                                        bgpstream_filter_mgr_t *filter_mgr);
 
 /** State used when extracting elems from an UPDATE message */
 typedef struct bgpstream_parsebgp_upd_state {
@@ -122,12 +130,23 @@ void bgpstream_parsebgp_upd_state_reset(
  * @param upd_state     pointer to the generator state
  * @param elem          pointer to the elem to populate
  * @param bgp           pointer to a parsed BGP message
+ * @param filter_mgr    pointer to the filter manager, whose IP version and
+ *                      prefix filters are applied to each prefix before the
+ *                      elem is populated, and whose selected elem fields
+ *                      decide whether the next-hop is set
  * @return 1 if the elem was populated, 0 if there are no more elems, -1 if an
  * error occurred.
+ *
+ * Path attributes are only processed once a prefix that passes the filters
+ * has been found.
  */
 int bgpstream_parsebgp_process_update(bgpstream_parsebgp_upd_state_t *upd_state,
                                       bgpstream_elem_t *elem,
-                                      parsebgp_bgp_msg_t *bgp);
+                                      parsebgp_bgp_msg_t *bgp,
+                                      bgpstream_filter_mgr_t *filter_mgr);
+
+/** Opaque structure for a pool of decode threads */
+typedef struct bgpstream_parsebgp_pool bgpstream_parsebgp_pool_t;
 
 typedef struct bgpstream_parsebgp_decode_state {
 
@@ -137,8 +156,18 @@ typedef struct bgpstream_parsebgp_decode_state {
   // options for libparsebgp
   parsebgp_opts_t parser_opts;
 
-  // raw data buffer
-  uint8_t buffer[BGPSTREAM_PARSEBGP_BUFLEN];
+  // raw data buffer. when mirrored, the buffer is mapped twice back-to-back
+  // so that any buflen bytes starting inside the first mapping are contiguous
+  uint8_t *buffer;
+
+  // size of the buffer (i.e. of one mapping)
+  size_t buflen;
+
+  // is the buffer a mirrored ring (or a plain buffer that must be compacted)?
+  int mirrored;
+
+  // is the data mapped by the transport (in which case there is no buffer)?
+  int mapped;
 
   // number of bytes left to read in the buffer
   size_t remain;
@@ -146,6 +175,17 @@ typedef struct bgpstream_parsebgp_decode_state {
   // pointer into buffer
   uint8_t *ptr;
 
+  // number of bytes given to the decoder so far (so ptr is at offset
+  // read_len - remain in the decompressed data)
+  uint64_t read_len;
+
+  // offset of the message most recently given to the filter callback
+  uint64_t msg_offset;
+
+  // threads that decode messages ahead of _populate_record (NULL if messages
+  // are decoded by _populate_record itself)
+  bgpstream_parsebgp_pool_t *pool;
+
   // the total number of successful (filtered and not) reads
   uint64_t successful_read_cnt;
 
@@ -206,14 +246,118 @@ typedef int(bgpstream_parsebgp_prep_buf_cb_t)(bgpstream_format_t *format,
                                               uint8_t *buf, size_t *len,
                                               bgpstream_record_t *record);
 
-/** Use libparsebgp to decode a message */
+/** Called before a message is decoded to give the caller a chance to skip it
+ * based on its header alone
+ *
+ * @param format        pointer to the format that originally called
+ *                      _populate_record
+ * @param buf           pointer to the raw data buffer
+ * @param len           number of bytes available in the buffer
+ * @return the length of the message if it should be skipped without decoding
+ * it, 0 if it should be decoded (e.g. because the header is not complete)
+ *
+ * Skipped messages are treated as if they had been filtered out by the filter
+ * callback. They may extend past the end of the buffer.
+ */
+typedef uint64_t(bgpstream_parsebgp_skip_cb_t)(bgpstream_format_t *format,
+                                               const uint8_t *buf, size_t len);
+
+/** Get the total length of a message from its header
+ *
+ * @param hdr           pointer to the message header
+ * @return the length of the message (including the header)
+ */
+typedef uint64_t(bgpstream_parsebgp_frame_cb_t)(const uint8_t *hdr);
+
+/** Prepare the given decode state to read from the given transport
+ *
+ * @param state         pointer to the decode state to initialize
+ * @param transport     pointer to the transport that data will be read from
+ * @return 0 if successful, -1 otherwise
+ *
+ * If the transport can map its data, messages are decoded directly from the
+ * mapping. Otherwise a raw data buffer is allocated.
+ */
+int bgpstream_parsebgp_decode_state_init(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport);
+
+/** Free the raw data buffer of the given decode state
+ *
+ * @param state         pointer to the decode state to clear
+ */
+void bgpstream_parsebgp_decode_state_clear(
+  bgpstream_parsebgp_decode_state_t *state);
+
+/** Get the offset of the next unread byte in the decompressed data
+ *
+ * @param state         pointer to the decode state
+ * @return the number of bytes that have been decoded or skipped so far
+ */
+uint64_t bgpstream_parsebgp_decode_state_offset(
+  bgpstream_parsebgp_decode_state_t *state);
+
+/** Make the next len bytes of data available without consuming them
+ *
+ * @param state         pointer to the decode state
+ * @param transport     pointer to the transport to read more data from
+ * @param len           number of bytes needed
+ * @param[out] data     set to point to the next unread byte
+ * @return 1 if len bytes are available, 0 if there are fewer than len bytes
+ * left, -1 if an error occurred.
+ */
+int bgpstream_parsebgp_decode_state_peek(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport,
+  size_t len, const uint8_t **data);
+
+/** Consume the next len bytes of data without decoding them
+ *
+ * @param state         pointer to the decode state
+ * @param transport     pointer to the transport to read more data from
+ * @param len           number of bytes to skip
+ * @return 0 if the bytes were skipped (or the end of the data was reached), -1
+ * if an error occurred.
+ */
+int bgpstream_parsebgp_decode_state_skip(
+  bgpstream_parsebgp_decode_state_t *state, bgpstream_transport_t *transport,
+  uint64_t len);
+
+/** Decode the remaining messages using a pool of threads
+ *
+ * @param state         pointer to the decode state
+ * @param threads       number of decode threads to start
+ * @param hdr_len       length of the message header that frame_cb needs
+ * @param frame_cb      callback that gets the length of a message
+ * @return 0 if the threads were started, -1 otherwise
+ *
+ * From now on, _populate_record splits the data into messages using frame_cb,
+ * and the threads decode them ahead of time using the parser options of the
+ * state, which must not change any more. Messages are still given to the
+ * filter callback in order, but the prep and skip callbacks are no longer
+ * used. The threads are stopped by bgpstream_parsebgp_decode_state_clear.
+ */
+int bgpstream_parsebgp_decode_state_start_pool(
+  bgpstream_parsebgp_decode_state_t *state, int threads, size_t hdr_len,
+  bgpstream_parsebgp_frame_cb_t *frame_cb);
+
+/** Use libparsebgp to decode a message
+ *
+ * The decoded message is stored in *msgp. When a decode pool is running, the
+ * message is swapped with one decoded by the pool, so *msgp may change.
+ */
 bgpstream_format_status_t bgpstream_parsebgp_populate_record(
-  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t *msg,
+  bgpstream_parsebgp_decode_state_t *state, parsebgp_msg_t **msgp,
   bgpstream_format_t *format, bgpstream_record_t *record,
   bgpstream_parsebgp_prep_buf_cb_t *prep_cb,
+  bgpstream_parsebgp_skip_cb_t *skip_cb,
   bgpstream_parsebgp_check_filter_cb_t *filter_cb);
 
-/** Set options specific to how we use libparsebgp in BGPStream */
-void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts);
+/** Set options specific to how we use libparsebgp in BGPStream
+ *
+ * @param opts          pointer to the parsebgp options to set
+ * @param filter_mgr    pointer to the filter manager, used to decide which
+ *                      path attributes need to be decoded
+ */
+void bgpstream_parsebgp_opts_init(parsebgp_opts_t *opts,
+                                  bgpstream_filter_mgr_t *filter_mgr);
 
 #endif /* __BGPSTREAM_PARSEBGP_COMMON_H */
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2017 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_time_index.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Index file layout (all integers are big-endian):
+ *
+ *   magic    (8 bytes)
+ *   size     (8 bytes)  size of the indexed file
+ *   mtime    (8 bytes)  modification time of the indexed file
+ *   count    (4 bytes)  number of entries
+ *   reserved (4 bytes)
+ *   entries  (count * 12 bytes):
+ *     offset      (8 bytes)
+ *     max_before  (4 bytes)
+ */
+#define INDEX_MAGIC "BSIDX\0\0\1"
+#define INDEX_MAGIC_LEN 8
+#define INDEX_HDR_LEN 32
+#define INDEX_ENTRY_LEN 12
+
+typedef struct entry {
+
+  // offset of a record in the decompressed data
+  uint64_t offset;
+
+  // latest time of the records before offset
+  uint32_t max_before;
+
+} entry_t;
+
+struct bgpstream_time_index {
+
+  // path of the indexed file, and of the index file
+  char *path;
+  char *idx_path;
+
+  // size and modification time of the indexed file
+  uint64_t file_size;
+  uint64_t file_mtime;
+
+  // indexed positions, in offset order
+  entry_t *entries;
+  uint32_t entries_cnt;
+  uint32_t entries_alloc;
+
+  // latest time of the records added so far
+  uint32_t max_time;
+};
+
+static void put_u32(uint8_t *buf, uint32_t v)
+{
+  buf[0] = v >> 24;
+  buf[1] = v >> 16;
+  buf[2] = v >> 8;
+  buf[3] = v;
+}
+
+static void put_u64(uint8_t *buf, uint64_t v)
+{
+  put_u32(buf, v >> 32);
+  put_u32(buf + 4, v);
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+static uint64_t get_u64(const uint8_t *buf)
+{
+  return ((uint64_t)get_u32(buf) << 32) | get_u32(buf + 4);
+}
+
+// create an empty index for a regular local file
+static bgpstream_time_index_t *index_new(const char *path)
+{
+  bgpstream_time_index_t *idx;
+  struct stat st;
+
+  if (strcmp(path, "-") == 0 || strstr(path, "://") != NULL ||
+      stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+
+  if ((idx = malloc_zero(sizeof(bgpstream_time_index_t))) == NULL) {
+    return NULL;
+  }
+  if ((idx->path = strdup(path)) == NULL ||
+      (idx->idx_path = malloc(strlen(path) +
+                              sizeof(BGPSTREAM_TIME_INDEX_SUFFIX))) == NULL) {
+    bgpstream_time_index_destroy(idx);
+    return NULL;
+  }
+  strcpy(idx->idx_path, path);
+  strcat(idx->idx_path, BGPSTREAM_TIME_INDEX_SUFFIX);
+  idx->file_size = st.st_size;
+  idx->file_mtime = st.st_mtime;
+
+  return idx;
+}
+
+/* ========== PUBLIC FUNCTIONS BELOW HERE ========== */
+
+bgpstream_time_index_t *bgpstream_time_index_load(const char *path)
+{
+  bgpstream_time_index_t *idx;
+  uint8_t hdr[INDEX_HDR_LEN];
+  uint8_t *buf = NULL;
+  FILE *fp = NULL;
+  uint32_t i;
+
+  if ((idx = index_new(path)) == NULL) {
+    return NULL;
+  }
+
+  if ((fp = fopen(idx->idx_path, "rb")) == NULL) {
+    // no index yet
+    goto err;
+  }
+
+  if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+      memcmp(hdr, INDEX_MAGIC, INDEX_MAGIC_LEN) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "Ignoring invalid time index %s",
+                  idx->idx_path);
+    goto err;
+  }
+  if (get_u64(hdr + 8) != idx->file_size ||
+      get_u64(hdr + 16) != idx->file_mtime) {
+    bgpstream_log(BGPSTREAM_LOG_FINE, "Ignoring stale time index %s",
+                  idx->idx_path);
+    goto err;
+  }
+
+  idx->entries_cnt = idx->entries_alloc = get_u32(hdr + 24);
+  if (idx->entries_cnt == 0) {
+    goto err;
+  }
+  if ((buf = malloc((size_t)idx->entries_cnt * INDEX_ENTRY_LEN)) == NULL ||
+      (idx->entries = malloc(sizeof(entry_t) * idx->entries_cnt)) == NULL) {
+    goto err;
+  }
+  if (fread(buf, INDEX_ENTRY_LEN, idx->entries_cnt, fp) != idx->entries_cnt) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "Ignoring truncated time index %s",
+                  idx->idx_path);
+    goto err;
+  }
+  for (i = 0; i < idx->entries_cnt; i++) {
+    idx->entries[i].offset = get_u64(buf + i * INDEX_ENTRY_LEN);
+    idx->entries[i].max_before = get_u32(buf + i * INDEX_ENTRY_LEN + 8);
+  }
+
+  free(buf);
+  fclose(fp);
+  return idx;
+
+err:
+  free(buf);
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  bgpstream_time_index_destroy(idx);
+  return NULL;
+}
+
+bgpstream_time_index_t *bgpstream_time_index_create(const char *path)
+{
+  return index_new(path);
+}
+
+int bgpstream_time_index_add(bgpstream_time_index_t *idx, uint64_t offset,
+                             uint32_t time)
+{
+  entry_t *entries;
+
+  if (idx->entries_cnt == 0 ||
+      offset - idx->entries[idx->entries_cnt - 1].offset >=
+        BGPSTREAM_TIME_INDEX_STRIDE) {
+    if (idx->entries_cnt == idx->entries_alloc) {
+      idx->entries_alloc =
+        idx->entries_alloc == 0 ? 256 : idx->entries_alloc * 2;
+      if ((entries = realloc(idx->entries,
+                             sizeof(entry_t) * idx->entries_alloc)) == NULL) {
+        return -1;
+      }
+      idx->entries = entries;
+    }
+    idx->entries[idx->entries_cnt].offset = offset;
+    idx->entries[idx->entries_cnt].max_before = idx->max_time;
+    idx->entries_cnt++;
+  }
+
+  if (time > idx->max_time) {
+    idx->max_time = time;
+  }
+  return 0;
+}
+
+int bgpstream_time_index_write(bgpstream_time_index_t *idx)
+{
+  uint8_t hdr[INDEX_HDR_LEN];
+  uint8_t ent[INDEX_ENTRY_LEN];
+  char *tmp = NULL;
+  FILE *fp = NULL;
+  struct stat st;
+  uint32_t i;
+  int fd;
+
+  // don't index a file that was modified while we read it
+  if (stat(idx->path, &st) != 0 || (uint64_t)st.st_size != idx->file_size ||
+      (uint64_t)st.st_mtime != idx->file_mtime) {
+    bgpstream_log(BGPSTREAM_LOG_FINE, "Not indexing %s: modified while read",
+                  idx->path);
+    return -1;
+  }
+
+  if ((tmp = malloc(strlen(idx->idx_path) + sizeof(".XXXXXX"))) == NULL) {
+    return -1;
+  }
+  strcpy(tmp, idx->idx_path);
+  strcat(tmp, ".XXXXXX");
+  if ((fd = mkstemp(tmp)) == -1) {
+    bgpstream_log(BGPSTREAM_LOG_FINE, "Could not create time index %s: %s",
+                  idx->idx_path, strerror(errno));
+    free(tmp);
+    return -1;
+  }
+  fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if ((fp = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    goto err;
+  }
+
+  memcpy(hdr, INDEX_MAGIC, INDEX_MAGIC_LEN);
+  put_u64(hdr + 8, idx->file_size);
+  put_u64(hdr + 16, idx->file_mtime);
+  put_u32(hdr + 24, idx->entries_cnt);
+  put_u32(hdr + 28, 0);
+  if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+    goto err;
+  }
+  for (i = 0; i < idx->entries_cnt; i++) {
+    put_u64(ent, idx->entries[i].offset);
+    put_u32(ent + 8, idx->entries[i].max_before);
+    if (fwrite(ent, 1, sizeof(ent), fp) != sizeof(ent)) {
+      goto err;
+    }
+  }
+  if (fclose(fp) != 0) {
+    fp = NULL;
+    goto err;
+  }
+  fp = NULL;
+
+  if (rename(tmp, idx->idx_path) != 0) {
+    goto err;
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_FINE, "Wrote time index %s (%" PRIu32
+                " entries)", idx->idx_path, idx->entries_cnt);
+  free(tmp);
+  return 0;
+
+err:
+  bgpstream_log(BGPSTREAM_LOG_WARN, "Could not write time index %s: %s",
+                idx->idx_path, strerror(errno));
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  unlink(tmp);
+  free(tmp);
+  return -1;
+}
+
+uint64_t bgpstream_time_index_seek(bgpstream_time_index_t *idx,
+                                   uint32_t begin_time)
+{
+  uint32_t lo = 0, hi = idx->entries_cnt, mid;
+
+  // max_before never decreases, so find the last entry with
+  // max_before < begin_time
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].max_before < begin_time) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo == 0 ? 0 : idx->entries[lo - 1].offset;
+}
+
+void bgpstream_time_index_destroy(bgpstream_time_index_t *idx)
+{
+  if (idx == NULL) {
+    return;
+  }
+  free(idx->path);
+  idx->path = NULL;
+  free(idx->idx_path);
+  idx->idx_path = NULL;
+  free(idx->entries);
+  idx->entries = NULL;
+  free(idx);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_TIME_INDEX_H
+#define __BGPSTREAM_TIME_INDEX_H
+
+#include <stdint.h>
+
+/** @file
+ *
+ * @brief Sidecar index mapping offsets in a dump to record times
+ *
+ * The index for a local file `FILE` is stored in `FILE.bsidx`. Offsets are
+ * positions in the decompressed data, taken at record boundaries roughly every
+ * BGPSTREAM_TIME_INDEX_STRIDE bytes. Each position is stored along with the
+ * latest time of any record before it, so a reader looking for records at or
+ * after a given time can start at the last position whose preceding records
+ * are all earlier, even if the records are not quite in time order.
+ */
+
+/** Approximate number of bytes between indexed positions */
+#define BGPSTREAM_TIME_INDEX_STRIDE (64 * 1024)
+
+/** Suffix of the index file name */
+#define BGPSTREAM_TIME_INDEX_SUFFIX ".bsidx"
+
+/** Opaque handle for a time index */
+typedef struct bgpstream_time_index bgpstream_time_index_t;
+
+/** Load the index of the given file
+ *
+ * @param path          path to the indexed (local) file
+ * @return pointer to the index if there is one that is up-to-date with the
+ * file, NULL otherwise
+ */
+bgpstream_time_index_t *bgpstream_time_index_load(const char *path);
+
+/** Create an empty index for the given file
+ *
+ * @param path          path to the (local) file that will be indexed
+ * @return pointer to the index if the file can be indexed, NULL otherwise
+ *
+ * The index must then be given every record of the file, in order, using
+ * bgpstream_time_index_add, and written using bgpstream_time_index_write.
+ */
+bgpstream_time_index_t *bgpstream_time_index_create(const char *path);
+
+/** Add a record to an index being built
+ *
+ * @param idx           pointer to the index
+ * @param offset        offset of the record in the decompressed data
+ * @param time          time of the record
+ * @return 0 if the record was added, -1 otherwise
+ */
+int bgpstream_time_index_add(bgpstream_time_index_t *idx, uint64_t offset,
+                             uint32_t time);
+
+/** Write an index that has been given all records of the file
+ *
+ * @param idx           pointer to the index
+ * @return 0 if the index file was written, -1 otherwise
+ *
+ * The file is written to a temporary name and then renamed, so concurrent
+ * readers see either no index or a complete one. Nothing is written if the
+ * indexed file changed since the index was created.
+ */
+int bgpstream_time_index_write(bgpstream_time_index_t *idx);
+
+/** Find where to start reading to find all records at or after a given time
+ *
+ * @param idx           pointer to the index
+ * @param begin_time    time of the earliest record that is wanted
+ * @return offset of the last indexed position that is only preceded by records
+ * earlier than begin_time (0 if there is none)
+ */
+uint64_t bgpstream_time_index_seek(bgpstream_time_index_t *idx,
+                                   uint32_t begin_time);
+
+/** Destroy the given index
+ *
+ * @param idx           pointer to the index to destroy
+ */
+void bgpstream_time_index_destroy(bgpstream_time_index_t *idx);
+
+#endif /* __BGPSTREAM_TIME_INDEX_H */
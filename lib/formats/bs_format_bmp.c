@@ -67,12 +67,13 @@ typedef struct state {
 //local variable for signaling addpath state to opts.bgp
 int addpath;
 
-static int handle_update(rec_data_t *rd, parsebgp_bgp_msg_t *bgp)
+static int handle_update(rec_data_t *rd, parsebgp_bgp_msg_t *bgp,
+                         bgpstream_filter_mgr_t *filter_mgr)
 {
   int rc;
 
-  if ((rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem, bgp)) <
-      0) {
+  if ((rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem, bgp,
+                                              filter_mgr)) < 0) {
     return rc;
   }
   if (rc == 0) {
@@ -357,8 +358,12 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
     return BGPSTREAM_PARSEBGP_EOS;
   }
 
-  // check the filters
-  if (is_wanted_time(ts_sec, format->filter_mgr) != 0) {
+  // check the filters. all the elems of the message are from the peer in the
+  // per-peer header, so there is no point generating them if the peer is not
+  // wanted
+  if (is_wanted_time(ts_sec, format->filter_mgr) != 0 &&
+      bgpstream_filter_mgr_peer_asn_check(format->filter_mgr,
+                                          bmp->peer_hdr.asn) != 0) {
     // we want this entry
     return BGPSTREAM_PARSEBGP_KEEP;
   } else {
@@ -378,10 +383,16 @@ int bs_format_bmp_create(bgpstream_format_t *format, bgpstream_resource_t *res)
   }
 
   STATE->decoder.msg_type = PARSEBGP_MSG_TYPE_BMP;
+  if (bgpstream_parsebgp_decode_state_init(&STATE->decoder,
+                                           format->transport) != 0) {
+    free(format->state);
+    format->state = NULL;
+    return -1;
+  }
 
   opts = &STATE->decoder.parser_opts;
   parsebgp_opts_init(opts);
-  bgpstream_parsebgp_opts_init(opts);
+  bgpstream_parsebgp_opts_init(opts, format->filter_mgr);
 
   // DEBUG: force parsebgp to ignore things that it doesn't know about
   opts->ignore_not_implemented = 1;
@@ -398,7 +409,7 @@ bs_format_bmp_populate_record(bgpstream_format_t *format,
   //set addpath val before calling popualte_rec
   STATE->decoder.parser_opts.bgp.add_path = addpath;
   bgpstream_format_status_t rc = bgpstream_parsebgp_populate_record(
-    &STATE->decoder, RDATA->msg, format, record, populate_prep_cb,
+    &STATE->decoder, &RDATA->msg, format, record, populate_prep_cb, NULL,
     populate_filter_cb);
 
   if (record->status != BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
@@ -434,7 +445,7 @@ int bs_format_bmp_get_next_elem(bgpstream_format_t *format,
   // what kind of BMP message are we dealing with?
   switch (bmp->type) {
   case PARSEBGP_BMP_TYPE_ROUTE_MON:
-    rc = handle_update(RDATA, bmp->types.route_mon);
+    rc = handle_update(RDATA, bmp->types.route_mon, format->filter_mgr);
     break;
 
   case PARSEBGP_BMP_TYPE_PEER_DOWN:
@@ -505,6 +516,8 @@ void bs_format_bmp_destroy_data(bgpstream_format_t *format, void *data)
 
 void bs_format_bmp_destroy(bgpstream_format_t *format)
 {
+  bgpstream_parsebgp_decode_state_clear(&STATE->decoder);
+
   free(format->state);
   format->state = NULL;
 }
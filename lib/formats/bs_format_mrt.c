@@ -29,8 +29,12 @@
 #include "bgpstream_record_int.h"
 #include "bgpstream_log.h"
 #include "bgpstream_parsebgp_common.h"
+#include "bgpstream_time_index.h"
 #include "utils.h"
+#include <arpa/inet.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <string.h>
 
 #define STATE ((state_t *)(format->state))
 
@@ -46,6 +50,9 @@ typedef struct peer_index_entry {
   /** Peer IP */
   bgpstream_ip_addr_t peer_ip;
 
+  /** Set if elems from this peer are rejected by the peer filter */
+  uint8_t filtered;
+
 } peer_index_entry_t;
 
 KHASH_INIT(td2_peer, int, peer_index_entry_t, 1, kh_int_hash_func,
@@ -68,6 +75,10 @@ typedef struct rec_data {
   // reusable parser message structure
   parsebgp_msg_t *msg;
 
+  // borrowed pointer to the peer index table in effect when this record was
+  // read (records may be decoded ahead of elem extraction)
+  khash_t(td2_peer) * peer_table;
+
 } rec_data_t;
 
 typedef struct state {
@@ -78,9 +89,26 @@ typedef struct state {
   // state to store the "peer index table" when reading TABLE_DUMP_V2 records
   khash_t(td2_peer) * peer_table;
 
+  // peer index tables that have been replaced by a later table, but may still
+  // be referenced by records that have already been read
+  khash_t(td2_peer) * *old_peer_tables;
+  int old_peer_tables_cnt;
+
+  // set if no peer in the current peer index table passes the peer filter, so
+  // the RIB records that follow it (up to the next table) can be skipped
+  int peer_table_unwanted;
+
+  // time index being built while the file is read (NULL if the file is not
+  // being indexed)
+  bgpstream_time_index_t *index;
+
 } state_t;
 
-static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
+// length of the MRT common header
+#define MRT_HDR_LEN 12
+
+static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt,
+                             bgpstream_filter_mgr_t *filter_mgr)
 {
   bgpstream_elem_t *el = rd->elem;
   parsebgp_mrt_table_dump_t *td = mrt->types.table_dump;
@@ -98,8 +126,8 @@ static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   el->prefix.mask_len = td->prefix_len;
 
   if (bgpstream_parsebgp_process_next_hop(
-        el, td->path_attrs.attrs,
-        mrt->subtype == PARSEBGP_BGP_AFI_IPV6 ? 1 : 0) != 0) {
+        el, td->path_attrs.attrs, mrt->subtype == PARSEBGP_BGP_AFI_IPV6 ? 1 : 0,
+        filter_mgr) != 0) {
     return -1;
   }
 
@@ -113,32 +141,21 @@ static int handle_table_dump(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   return 1;
 }
 
-static int handle_td2_rib_entry(rec_data_t *rd, khash_t(td2_peer) * peer_table,
+static int handle_td2_rib_entry(rec_data_t *rd, peer_index_entry_t *bs_pie,
                                 parsebgp_mrt_msg_t *mrt, parsebgp_bgp_afi_t afi,
-                                parsebgp_mrt_table_dump_v2_rib_entry_t *re)
+                                parsebgp_mrt_table_dump_v2_rib_entry_t *re,
+                                bgpstream_filter_mgr_t *filter_mgr)
 {
-  peer_index_entry_t *bs_pie;
-  khiter_t k;
-
   rd->elem->orig_time_sec = re->originated_time;
   rd->elem->orig_time_usec = 0;
 
-  // look the peer up in the peer index table
-  if ((k = kh_get(td2_peer, peer_table, re->peer_index)) ==
-      kh_end(peer_table)) {
-    bgpstream_log(BGPSTREAM_LOG_ERR,
-                  "Missing Peer Index Table entry for Peer ID %d",
-                  re->peer_index);
-    return -1;
-  }
-  bs_pie = &kh_val(peer_table, k);
   bgpstream_addr_copy(&rd->elem->peer_ip, &bs_pie->peer_ip);
 
   rd->elem->peer_asn = bs_pie->peer_asn;
 
   if (bgpstream_parsebgp_process_next_hop(
-        rd->elem, re->path_attrs.attrs, afi == PARSEBGP_BGP_AFI_IPV6 ? 1 : 0) !=
-      0) {
+        rd->elem, re->path_attrs.attrs, afi == PARSEBGP_BGP_AFI_IPV6 ? 1 : 0,
+        filter_mgr) != 0) {
     return -1;
   }
 
@@ -153,8 +170,13 @@ static int handle_td2_rib_entry(rec_data_t *rd, khash_t(td2_peer) * peer_table,
 static int
 handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
                         parsebgp_mrt_msg_t *mrt, parsebgp_bgp_afi_t afi,
-                        parsebgp_mrt_table_dump_v2_afi_safi_rib_t *asr)
+                        parsebgp_mrt_table_dump_v2_afi_safi_rib_t *asr,
+                        bgpstream_filter_mgr_t *filter_mgr)
 {
+  parsebgp_mrt_table_dump_v2_rib_entry_t *re = NULL;
+  peer_index_entry_t *bs_pie = NULL;
+  khiter_t k;
+
   // if this is the first time we've been called, prep the elem
   if (rd->next_re == 0) {
     rd->elem->type = BGPSTREAM_ELEM_TYPE_RIB;
@@ -162,6 +184,14 @@ handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
     rd->elem->prefix.mask_len = asr->prefix_len;
     // other elem fields are specific to the entry
 
+    // all entries share the prefix, so if it is filtered out, so are they
+    if ((filter_mgr->ipversion || filter_mgr->prefixes) &&
+        bgpstream_filter_mgr_prefix_check(filter_mgr, &rd->elem->prefix) ==
+          0) {
+      rd->end_of_elems = 1;
+      return 0;
+    }
+
     // if we haven't seen a peer index table yet, then just give up
     if (peer_table == NULL) {
       bgpstream_log(BGPSTREAM_LOG_WARN,
@@ -170,9 +200,29 @@ handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
     }
   }
 
-  // since this is a generator, we just process one rib entry each time
-  if (handle_td2_rib_entry(rd, peer_table, mrt, afi,
-                           &asr->entries[rd->next_re]) != 0) {
+  // since this is a generator, we just process one rib entry each time,
+  // passing over entries from peers that the peer filter rejects
+  for (; rd->next_re < asr->entry_count; rd->next_re++) {
+    re = &asr->entries[rd->next_re];
+    // look the peer up in the peer index table
+    if ((k = kh_get(td2_peer, peer_table, re->peer_index)) ==
+        kh_end(peer_table)) {
+      bgpstream_log(BGPSTREAM_LOG_ERR,
+                    "Missing Peer Index Table entry for Peer ID %d",
+                    re->peer_index);
+      return -1;
+    }
+    bs_pie = &kh_val(peer_table, k);
+    if (bs_pie->filtered == 0) {
+      break;
+    }
+  }
+  if (rd->next_re == asr->entry_count) {
+    rd->end_of_elems = 1;
+    return 0;
+  }
+
+  if (handle_td2_rib_entry(rd, bs_pie, mrt, afi, re, filter_mgr) != 0) {
     return -1;
   }
 
@@ -186,7 +236,8 @@ handle_td2_afi_safi_rib(rec_data_t *rd, khash_t(td2_peer) * peer_table,
 }
 
 static int handle_table_dump_v2(rec_data_t *rd, khash_t(td2_peer) * peer_table,
-                                parsebgp_mrt_msg_t *mrt)
+                                parsebgp_mrt_msg_t *mrt,
+                                bgpstream_filter_mgr_t *filter_mgr)
 {
   parsebgp_mrt_table_dump_v2_t *td2 = mrt->types.table_dump_v2;
 
@@ -203,10 +254,10 @@ static int handle_table_dump_v2(rec_data_t *rd, khash_t(td2_peer) * peer_table,
 
   case PARSEBGP_MRT_TABLE_DUMP_V2_RIB_IPV4_UNICAST:
     return handle_td2_afi_safi_rib(rd, peer_table, mrt, PARSEBGP_BGP_AFI_IPV4,
-                                   &td2->afi_safi_rib);
+                                   &td2->afi_safi_rib, filter_mgr);
   case PARSEBGP_MRT_TABLE_DUMP_V2_RIB_IPV6_UNICAST:
     return handle_td2_afi_safi_rib(rd, peer_table, mrt, PARSEBGP_BGP_AFI_IPV6,
-                                   &td2->afi_safi_rib);
+                                   &td2->afi_safi_rib, filter_mgr);
 
   default:
     // do nothing
@@ -226,7 +277,8 @@ static int handle_bgp4mp_state_change(rec_data_t *rd,
   return 1;
 }
 
-static int handle_bgp4mp(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
+static int handle_bgp4mp(rec_data_t *rd, parsebgp_mrt_msg_t *mrt,
+                         bgpstream_filter_mgr_t *filter_mgr)
 {
   int rc = 0;
   parsebgp_mrt_bgp4mp_t *bgp4mp = mrt->types.bgp4mp;
@@ -257,7 +309,7 @@ static int handle_bgp4mp(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_LOCAL:
   case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_LOCAL_ADDPATH:
     rc = bgpstream_parsebgp_process_update(&rd->upd_state, rd->elem,
-                                           bgp4mp->data.bgp_msg);
+                                           bgp4mp->data.bgp_msg, filter_mgr);
     if (rc == 0) {
       rd->end_of_elems = 1;
     }
@@ -272,6 +324,56 @@ static int handle_bgp4mp(rec_data_t *rd, parsebgp_mrt_msg_t *mrt)
   return rc;
 }
 
+/* -------------------- TIME INDEX -------------------- */
+
+// load the time index of the file and skip to the start of the interval, or
+// prepare to build the index if there is none
+static int open_index(bgpstream_format_t *format)
+{
+  bgpstream_time_index_t *idx;
+  uint64_t offset;
+
+  if ((idx = bgpstream_time_index_load(format->res->url)) == NULL) {
+    STATE->index = bgpstream_time_index_create(format->res->url);
+    return 0;
+  }
+
+  offset = 0;
+  if (format->TIF != NULL) {
+    offset = bgpstream_time_index_seek(idx, format->TIF->begin_time);
+  }
+  bgpstream_time_index_destroy(idx);
+
+  if (offset == 0) {
+    return 0;
+  }
+  bgpstream_log(BGPSTREAM_LOG_FINE, "Skipping %" PRIu64 " bytes of %s",
+                offset, format->res->url);
+  if (bgpstream_parsebgp_decode_state_skip(&STATE->decoder, format->transport,
+                                           offset) != 0) {
+    return -1;
+  }
+  // the skipped records count as filtered reads
+  STATE->decoder.successful_read_cnt++;
+  return 0;
+}
+
+// add a record to the index being built
+static void index_record(bgpstream_format_t *format, uint64_t offset,
+                         uint16_t type, uint32_t ts_sec)
+{
+  if (STATE->index == NULL) {
+    return;
+  }
+  // TABLE_DUMP_V2 records depend on the peer index table, so we can't skip to
+  // them
+  if (type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 ||
+      bgpstream_time_index_add(STATE->index, offset, ts_sec) != 0) {
+    bgpstream_time_index_destroy(STATE->index);
+    STATE->index = NULL;
+  }
+}
+
 /* -------------------- RECORD FILTERING -------------------- */
 
 static int is_wanted_time(uint32_t record_time,
@@ -287,14 +389,31 @@ static int is_wanted_time(uint32_t record_time,
   return 0;
 }
 
+// returns the number of peers that are accepted by the peer filter, or -1 if
+// an error occurred
 static int handle_td2_peer_index(bgpstream_format_t *format,
                                  parsebgp_mrt_table_dump_v2_peer_index_t *pi)
 {
+  bgpstream_id_set_t *peer_asns = format->filter_mgr->peer_asns;
+  int wanted_cnt = 0;
   int i;
   khiter_t k;
   int khret;
   peer_index_entry_t *bs_pie;
   parsebgp_mrt_table_dump_v2_peer_entry_t *pie;
+  khash_t(td2_peer) * *old_tables;
+
+  // keep any previous table around until we are destroyed
+  if (STATE->peer_table != NULL) {
+    if ((old_tables = realloc(STATE->old_peer_tables,
+                              sizeof(khash_t(td2_peer) *) *
+                                (STATE->old_peer_tables_cnt + 1))) == NULL) {
+      return -1;
+    }
+    STATE->old_peer_tables = old_tables;
+    STATE->old_peer_tables[STATE->old_peer_tables_cnt++] = STATE->peer_table;
+    STATE->peer_table = NULL;
+  }
 
   // alloc the table hash
   if ((STATE->peer_table = kh_init(td2_peer)) == NULL) {
@@ -313,9 +432,145 @@ static int handle_td2_peer_index(bgpstream_format_t *format,
 
     bs_pie->peer_asn = pie->asn;
     COPY_IP(&bs_pie->peer_ip, pie->ip_afi, pie->ip, return -1);
+
+    // decide once per peer rather than once per RIB entry
+    bs_pie->filtered =
+      peer_asns != NULL && bgpstream_id_set_exists(peer_asns, pie->asn) == 0;
+    if (bs_pie->filtered == 0) {
+      wanted_cnt++;
+    }
+  }
+
+  return wanted_cnt;
+}
+
+static uint64_t mrt_frame_cb(const uint8_t *hdr)
+{
+  uint32_t len;
+
+  memcpy(&len, hdr + 8, sizeof(len));
+  return MRT_HDR_LEN + (uint64_t)ntohl(len);
+}
+
+// find the peer ASN in the header of a raw BGP4MP message. returns 1 if the
+// ASN was found, 0 otherwise
+static int bgp4mp_peer_asn(const uint8_t *buf, size_t len, uint16_t type,
+                           uint16_t subtype, uint32_t *peer_asn)
+{
+  size_t offset = MRT_HDR_LEN;
+  uint16_t asn16;
+  uint32_t asn32;
+
+  // extended timestamp records have the microseconds before the body
+  if (type == PARSEBGP_MRT_TYPE_BGP4MP_ET) {
+    offset += sizeof(uint32_t);
+  }
+
+  switch (subtype) {
+  case PARSEBGP_MRT_BGP4MP_STATE_CHANGE:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_ADDPATH:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_LOCAL:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_LOCAL_ADDPATH:
+    if (len < offset + sizeof(asn16)) {
+      return 0;
+    }
+    memcpy(&asn16, buf + offset, sizeof(asn16));
+    *peer_asn = ntohs(asn16);
+    return 1;
+
+  case PARSEBGP_MRT_BGP4MP_STATE_CHANGE_AS4:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_ADDPATH:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_LOCAL:
+  case PARSEBGP_MRT_BGP4MP_MESSAGE_AS4_LOCAL_ADDPATH:
+    if (len < offset + sizeof(asn32)) {
+      return 0;
+    }
+    memcpy(&asn32, buf + offset, sizeof(asn32));
+    *peer_asn = ntohl(asn32);
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+static uint64_t populate_skip_cb(bgpstream_format_t *format,
+                                 const uint8_t *buf, size_t len)
+{
+  uint32_t ts_sec, msg_len, peer_asn;
+  uint16_t type, subtype;
+
+  if (len < MRT_HDR_LEN) {
+    return 0;
+  }
+
+  memcpy(&ts_sec, buf, sizeof(ts_sec));
+  memcpy(&type, buf + 4, sizeof(type));
+  memcpy(&subtype, buf + 6, sizeof(subtype));
+  memcpy(&msg_len, buf + 8, sizeof(msg_len));
+  ts_sec = ntohl(ts_sec);
+  type = ntohs(type);
+  subtype = ntohs(subtype);
+
+  // the peer index table is needed by the records that follow it
+  if (type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 &&
+      subtype == PARSEBGP_MRT_TABLE_DUMP_V2_PEER_INDEX_TABLE) {
+    return 0;
+  }
+
+  if (format->TIF != NULL && ts_sec < format->TIF->begin_time) {
+    goto skip;
+  }
+
+  // records past the end of the interval are decoded, so that
+  // populate_filter_cb can end the stream
+  if (format->TIF != NULL && format->TIF->end_time != BGPSTREAM_FOREVER &&
+      ts_sec > format->TIF->end_time) {
+    return 0;
+  }
+
+  // none of the RIB entries up to the next peer index table can match
+  if (type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 &&
+      STATE->peer_table_unwanted != 0) {
+    goto skip;
+  }
+
+  // all the elems of a BGP4MP record are from the same peer
+  if ((type == PARSEBGP_MRT_TYPE_BGP4MP ||
+       type == PARSEBGP_MRT_TYPE_BGP4MP_ET) &&
+      bgp4mp_peer_asn(buf, len, type, subtype, &peer_asn) != 0 &&
+      bgpstream_filter_mgr_peer_asn_check(format->filter_mgr, peer_asn) ==
+        0) {
+    goto skip;
   }
 
   return 0;
+
+skip:
+  index_record(format, STATE->decoder.msg_offset, type, ts_sec);
+  return MRT_HDR_LEN + (uint64_t)ntohl(msg_len);
+}
+
+// can any of the elems of the record pass the peer filter? (TABLE_DUMP_V2
+// records are filtered per RIB entry instead)
+static int is_wanted_peer(parsebgp_mrt_msg_t *mrt,
+                          bgpstream_filter_mgr_t *filter_mgr)
+{
+  switch (mrt->type) {
+  case PARSEBGP_MRT_TYPE_TABLE_DUMP:
+    return bgpstream_filter_mgr_peer_asn_check(
+      filter_mgr, mrt->types.table_dump->peer_asn);
+
+  case PARSEBGP_MRT_TYPE_BGP4MP:
+  case PARSEBGP_MRT_TYPE_BGP4MP_ET:
+    return bgpstream_filter_mgr_peer_asn_check(filter_mgr,
+                                               mrt->types.bgp4mp->peer_asn);
+
+  default:
+    return 1;
+  }
 }
 
 static bgpstream_parsebgp_check_filter_rc_t
@@ -323,19 +578,35 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
                    parsebgp_msg_t *msg)
 {
   uint32_t ts_sec;
+  int wanted_cnt;
   assert(msg->type == PARSEBGP_MSG_TYPE_MRT);
 
-  // if this is a peer index table message, we parse it now and move on (we
-  // could also add a "filtered" flag to the peer_index_entry_t struct so that
-  // when elem parsing happens it can quickly filter out unwanted peers
-  // without having to check ASN or IP
+  index_record(format, STATE->decoder.msg_offset, msg->types.mrt->type,
+               msg->types.mrt->timestamp_sec);
+
+  // if this is a peer index table message, we parse it now and move on. the
+  // peer filter is evaluated for each peer in the table, so that RIB entries
+  // from unwanted peers can be passed over without checking ASN or IP
   if (msg->types.mrt->type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 &&
       msg->types.mrt->subtype == PARSEBGP_MRT_TABLE_DUMP_V2_PEER_INDEX_TABLE) {
-    if (handle_td2_peer_index(
-          format, &msg->types.mrt->types.table_dump_v2->peer_index) != 0) {
+    if ((wanted_cnt = handle_td2_peer_index(
+           format, &msg->types.mrt->types.table_dump_v2->peer_index)) < 0) {
       bgpstream_log(BGPSTREAM_LOG_ERR, "Failed to process Peer Index Table");
       return BGPSTREAM_PARSEBGP_FILTER_ERROR;
     }
+    // none of the RIB entries up to the next peer index table can match, but
+    // a later table may have peers that we want
+    STATE->peer_table_unwanted = (wanted_cnt == 0);
+    if (wanted_cnt == 0) {
+      return BGPSTREAM_PARSEBGP_SKIP;
+    }
+    // the RIB records that follow can be decoded independently (if this
+    // fails, we just carry on decoding them here)
+    if (format->opts.decode_threads > 0 && STATE->decoder.pool == NULL) {
+      bgpstream_parsebgp_decode_state_start_pool(
+        &STATE->decoder, format->opts.decode_threads, MRT_HDR_LEN,
+        mrt_frame_cb);
+    }
     // indicate that we want this message SKIPPED
     return BGPSTREAM_PARSEBGP_SKIP;
   }
@@ -358,7 +629,15 @@ populate_filter_cb(bgpstream_format_t *format, bgpstream_record_t *record,
     return BGPSTREAM_PARSEBGP_EOS;
   }
 
-  if (is_wanted_time(ts_sec, format->filter_mgr) != 0) {
+  // RIB records that follow a table with no wanted peers (if they were not
+  // skipped before being decoded)
+  if (msg->types.mrt->type == PARSEBGP_MRT_TYPE_TABLE_DUMP_V2 &&
+      STATE->peer_table_unwanted != 0) {
+    return BGPSTREAM_PARSEBGP_FILTER_OUT;
+  }
+
+  if (is_wanted_time(ts_sec, format->filter_mgr) != 0 &&
+      is_wanted_peer(msg->types.mrt, format->filter_mgr) != 0) {
     // we want this entry
     return BGPSTREAM_PARSEBGP_KEEP;
   } else {
@@ -378,10 +657,21 @@ int bs_format_mrt_create(bgpstream_format_t *format, bgpstream_resource_t *res)
   }
 
   STATE->decoder.msg_type = PARSEBGP_MSG_TYPE_MRT;
+  if (bgpstream_parsebgp_decode_state_init(&STATE->decoder,
+                                           format->transport) != 0) {
+    free(format->state);
+    format->state = NULL;
+    return -1;
+  }
 
   opts = &STATE->decoder.parser_opts;
   parsebgp_opts_init(opts);
-  bgpstream_parsebgp_opts_init(opts);
+  bgpstream_parsebgp_opts_init(opts, format->filter_mgr);
+
+  if (format->opts.time_index != 0 && open_index(format) != 0) {
+    bs_format_mrt_destroy(format);
+    return -1;
+  }
 
   return 0;
 }
@@ -390,8 +680,25 @@ bgpstream_format_status_t
 bs_format_mrt_populate_record(bgpstream_format_t *format,
                               bgpstream_record_t *record)
 {
-  return bgpstream_parsebgp_populate_record(&STATE->decoder, RDATA->msg, format,
-                                            record, NULL, populate_filter_cb);
+  bgpstream_format_status_t rc;
+  rc = bgpstream_parsebgp_populate_record(&STATE->decoder, &RDATA->msg, format,
+                                          record, NULL, populate_skip_cb,
+                                          populate_filter_cb);
+  RDATA->peer_table = STATE->peer_table;
+
+  if (STATE->index != NULL && rc != BGPSTREAM_FORMAT_OK) {
+    // we are done with the file. only index it if all of it was read anyway
+    // (reading the rest just to index it would cost a query that stops at
+    // the end of its interval the whole file)
+    if (rc == BGPSTREAM_FORMAT_END_OF_DUMP ||
+        rc == BGPSTREAM_FORMAT_FILTERED_DUMP) {
+      bgpstream_time_index_write(STATE->index);
+    }
+    bgpstream_time_index_destroy(STATE->index);
+    STATE->index = NULL;
+  }
+
+  return rc;
 }
 
 int bs_format_mrt_get_next_elem(bgpstream_format_t *format,
@@ -411,16 +718,17 @@ int bs_format_mrt_get_next_elem(bgpstream_format_t *format,
   mrt = RDATA->msg->types.mrt;
   switch (mrt->type) {
   case PARSEBGP_MRT_TYPE_TABLE_DUMP:
-    rc = handle_table_dump(RDATA, mrt);
+    rc = handle_table_dump(RDATA, mrt, format->filter_mgr);
     break;
 
   case PARSEBGP_MRT_TYPE_TABLE_DUMP_V2:
-    rc = handle_table_dump_v2(RDATA, STATE->peer_table, mrt);
+    rc = handle_table_dump_v2(RDATA, RDATA->peer_table, mrt,
+                              format->filter_mgr);
     break;
 
   case PARSEBGP_MRT_TYPE_BGP4MP:
   case PARSEBGP_MRT_TYPE_BGP4MP_ET:
-    rc = handle_bgp4mp(RDATA, mrt);
+    rc = handle_bgp4mp(RDATA, mrt, format->filter_mgr);
     break;
 
   default:
@@ -468,6 +776,7 @@ void bs_format_mrt_clear_data(bgpstream_format_t *format, void *data)
   bgpstream_elem_clear(rd->elem);
   rd->end_of_elems = 0;
   rd->next_re = 0;
+  rd->peer_table = NULL;
   bgpstream_parsebgp_upd_state_reset(&rd->upd_state);
   parsebgp_clear_msg(rd->msg);
 }
@@ -487,11 +796,24 @@ void bs_format_mrt_destroy_data(bgpstream_format_t *format, void *data)
 
 void bs_format_mrt_destroy(bgpstream_format_t *format)
 {
+  bgpstream_parsebgp_decode_state_clear(&STATE->decoder);
+
+  bgpstream_time_index_destroy(STATE->index);
+  STATE->index = NULL;
+
   if (STATE->peer_table != NULL) {
     kh_destroy(td2_peer, STATE->peer_table);
     STATE->peer_table = NULL;
   }
 
+  int i;
+  for (i = 0; i < STATE->old_peer_tables_cnt; i++) {
+    kh_destroy(td2_peer, STATE->old_peer_tables[i]);
+  }
+  free(STATE->old_peer_tables);
+  STATE->old_peer_tables = NULL;
+  STATE->old_peer_tables_cnt = 0;
+
   free(format->state);
   format->state = NULL;
 }
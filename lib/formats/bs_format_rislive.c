@@ -567,7 +567,7 @@ int bs_format_rislive_create(bgpstream_format_t *format,
   }
 
   parsebgp_opts_init(&STATE->opts);
-  bgpstream_parsebgp_opts_init(&STATE->opts);
+  bgpstream_parsebgp_opts_init(&STATE->opts, format->filter_mgr);
   STATE->opts.bgp.marker_omitted = 0;
   STATE->opts.bgp.asn_4_byte = 1;
 
@@ -600,6 +600,7 @@ retry:
   if ((rc = bs_format_process_json_fields(format, record)) != 0) {
     return rc;
   }
+  BGPSTREAM_STATS_INC(format->stats.records_read, 1);
 
   // reference: bgpstream_parsebgp_common.c:597
   if ((filter = check_filters(record, format->filter_mgr)) < 0) {
@@ -630,7 +631,8 @@ int bs_format_rislive_get_next_elem(bgpstream_format_t *format,
   switch (RDATA->msg_type) {
   case RISLIVE_MSG_TYPE_UPDATE:
     rc = bgpstream_parsebgp_process_update(&RDATA->upd_state, RDATA->elem,
-                                           RDATA->msg->types.bgp);
+                                           RDATA->msg->types.bgp,
+                                           format->filter_mgr);
     if (rc <= 0) {
       return rc;
     }
@@ -0,0 +1,783 @@
+/*
+ * Copyright (C) 2017 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bs_transport_decompress.h"
+#include "bgpstream_transport_interface.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(HAVE_LIBBZ2) && defined(HAVE_BZLIB_H)
+#define WITH_BZIP2
+#include <bzlib.h>
+#endif
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+#define WITH_GZIP
+#include <zlib.h>
+#endif
+
+#define STATE ((state_t *)(transport->state))
+
+// bzip2 blocks and the end-of-stream marker start with these 48-bit magic
+// numbers, which are not byte-aligned
+#define BZIP2_BLOCK_MAGIC 0x314159265359ULL
+#define BZIP2_EOS_MAGIC 0x177245385090ULL
+#define BZIP2_MAGIC_MASK 0xffffffffffffULL
+
+// bzip2 files smaller than this are left to wandio
+#define BZIP2_MIN_LEN (64 * 1024)
+
+// a bzip2 block holds at most 900k bytes, and even incompressible data does not
+// grow by more than a few percent, so a (compressed) block is never longer
+// than this
+#define BZIP2_MAX_BLOCK_LEN (1000 * 1000)
+
+// gzip members are grouped into pieces of at least this many bytes
+#define GZIP_PIECE_LEN (1024 * 1024)
+
+// a gzip member may be any length, but merging re-decompresses the whole
+// merged piece, so a member that (after merging) is still incomplete at this
+// many bytes is reported as corrupt rather than merged up to the end of the
+// file. multi-member files are written with members much shorter than this.
+#define GZIP_MAX_MERGE_LEN (64 * GZIP_PIECE_LEN)
+
+// number of pieces to keep in flight per thread
+#define PIECES_PER_THREAD 2
+
+typedef enum {
+  COMPRESSION_BZIP2,
+  COMPRESSION_GZIP,
+} compression_t;
+
+typedef enum {
+  // waiting for a thread to decompress it
+  PIECE_PENDING,
+
+  // being decompressed
+  PIECE_RUNNING,
+
+  // decompressed output is ready
+  PIECE_DONE,
+
+  // could not be decompressed on its own, but may be the start of a block or
+  // member that continues in the next piece
+  PIECE_INCOMPLETE,
+
+  // corrupt
+  PIECE_FAILED,
+
+  // merged into the next piece
+  PIECE_MERGED,
+} piece_status_t;
+
+typedef struct piece {
+
+  piece_status_t status;
+
+  // range of the compressed data (in bits for bzip2 blocks, otherwise bytes)
+  uint64_t start;
+  uint64_t end;
+
+  // decompressed data, and how much of it has been read
+  uint8_t *out;
+  size_t out_len;
+  size_t out_size;
+  size_t out_pos;
+
+} piece_t;
+
+typedef struct state {
+
+  compression_t type;
+
+  // the mapped (compressed) file
+  uint8_t *data;
+  size_t len;
+
+  // splitter state (only used by the reader). for bzip2, scan is the next byte
+  // to shift into reg, and block_start is the bit offset of the current block
+  // (if in_block is set). for gzip, scan is the start of the next piece.
+  uint64_t scan;
+  uint64_t reg;
+  uint64_t block_start;
+  int in_block;
+  int scan_done;
+
+  // ring of pieces, in file order, starting at head
+  piece_t *pieces;
+  int pieces_size;
+  int head;
+  int cnt;
+
+  // set once a piece cannot be decompressed
+  int error;
+
+  pthread_t *threads;
+  int threads_cnt;
+
+  // ALL BELOW HERE (and piece status) MUST USE MUTEX
+  pthread_mutex_t mutex;
+
+  // signaled when a piece becomes pending, or on shutdown
+  pthread_cond_t work_cond;
+
+  // signaled when a piece has been decompressed
+  pthread_cond_t done_cond;
+
+  int shutdown;
+
+} state_t;
+
+/* ========== bzip2 ========== */
+
+#ifdef WITH_BZIP2
+static uint32_t get_bits(const uint8_t *data, uint64_t bit, int n)
+{
+  uint32_t val = 0;
+  int i;
+
+  for (i = 0; i < n; i++, bit++) {
+    val = (val << 1) | ((data[bit / 8] >> (7 - (bit % 8))) & 1);
+  }
+  return val;
+}
+
+static void put_bits(uint8_t *buf, uint64_t *pos, uint64_t val, int n)
+{
+  int i;
+
+  for (i = n - 1; i >= 0; i--, (*pos)++) {
+    if ((val >> i) & 1) {
+      buf[*pos / 8] |= 0x80 >> (*pos % 8);
+    }
+  }
+}
+
+// copy n bits, starting at the given bit of src, to the (byte-aligned) dst.
+// the unused bits of the last byte are cleared.
+static void copy_bits(uint8_t *dst, const uint8_t *src, size_t src_len,
+                      uint64_t bit, uint64_t n)
+{
+  size_t bytes = (n + 7) / 8;
+  size_t i;
+  int shift = bit % 8;
+
+  src += bit / 8;
+  src_len -= bit / 8;
+  for (i = 0; i < bytes; i++) {
+    dst[i] = src[i] << shift;
+    if (shift != 0 && i + 1 < src_len) {
+      dst[i] |= src[i + 1] >> (8 - shift);
+    }
+  }
+  if (n % 8 != 0) {
+    dst[bytes - 1] &= 0xff << (8 - (n % 8));
+  }
+}
+
+// find the next block. a block runs from its magic number to the next block
+// or end-of-stream magic number.
+static int bzip2_next_piece(state_t *st, piece_t *piece)
+{
+  uint64_t magic, start;
+  int found, k;
+
+  while (st->scan < st->len) {
+    st->reg = (st->reg << 8) | st->data[st->scan++];
+    // magic numbers cannot overlap, so there is at most one per byte. check
+    // the alignment that ends earliest first.
+    for (k = 7; k >= 0; k--) {
+      magic = (st->reg >> k) & BZIP2_MAGIC_MASK;
+      if ((magic != BZIP2_BLOCK_MAGIC && magic != BZIP2_EOS_MAGIC) ||
+          st->scan * 8 - k < 48) {
+        continue;
+      }
+      start = st->scan * 8 - k - 48;
+      found = 0;
+      if (st->in_block != 0) {
+        piece->start = st->block_start;
+        piece->end = start;
+        found = 1;
+      }
+      st->in_block = (magic == BZIP2_BLOCK_MAGIC);
+      st->block_start = start;
+      if (found != 0) {
+        return 1;
+      }
+      break;
+    }
+  }
+
+  // a block without an end-of-stream marker is truncated, but it is passed on
+  // so that the error is reported in order
+  if (st->in_block != 0) {
+    piece->start = st->block_start;
+    piece->end = (uint64_t)st->len * 8;
+    st->in_block = 0;
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+/* ========== gzip ========== */
+
+#ifdef WITH_GZIP
+static int is_gzip_header(const uint8_t *p, size_t len)
+{
+  // deflate, no reserved flags, and a known OS
+  return len >= 10 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 &&
+         (p[3] & 0xe0) == 0 && (p[9] <= 13 || p[9] == 255);
+}
+
+// find something that looks like a member header at or after from. this may
+// also match inside compressed data, in which case the piece that ends there
+// fails to decompress and is merged with the next one.
+static size_t gzip_find_member(state_t *st, size_t from)
+{
+  uint8_t *p;
+
+  while (from < st->len &&
+         (p = memchr(st->data + from, 0x1f, st->len - from)) != NULL) {
+    if (is_gzip_header(p, st->data + st->len - p)) {
+      return p - st->data;
+    }
+    from = p - st->data + 1;
+  }
+  return st->len;
+}
+
+static int gzip_next_piece(state_t *st, piece_t *piece)
+{
+  if (st->scan >= st->len) {
+    return 0;
+  }
+  piece->start = st->scan;
+  if (st->len - st->scan <= GZIP_PIECE_LEN) {
+    piece->end = st->len;
+  } else {
+    piece->end = gzip_find_member(st, st->scan + GZIP_PIECE_LEN);
+  }
+  st->scan = piece->end;
+  return 1;
+}
+#endif
+
+/* ========== decompression threads ========== */
+
+static int grow_output(piece_t *piece, size_t hint)
+{
+  size_t size = piece->out_size == 0 ? hint : piece->out_size * 2;
+  uint8_t *out;
+
+  if ((out = realloc(piece->out, size)) == NULL) {
+    return -1;
+  }
+  piece->out = out;
+  piece->out_size = size;
+  return 0;
+}
+
+#ifdef WITH_BZIP2
+static int bzip2_decompress(state_t *st, piece_t *piece)
+{
+  uint64_t bits = piece->end - piece->start;
+  uint64_t pos;
+  size_t in_len;
+  uint8_t *in;
+  bz_stream bz;
+  int rc, ret = -1;
+  int incomplete = 0;
+
+  // wrap the block in a stream of its own: a header, the block, then the
+  // end-of-stream marker and the stream CRC (which for a single block is the
+  // same as the block CRC that follows the block magic number)
+  in_len = 4 + (bits + 48 + 32 + 7) / 8;
+  if (bits < 48 + 32 || (in = malloc_zero(in_len)) == NULL) {
+    return -1;
+  }
+  memcpy(in, "BZh9", 4);
+  copy_bits(in + 4, st->data, st->len, piece->start, bits);
+  pos = 32 + bits;
+  put_bits(in, &pos, BZIP2_EOS_MAGIC, 48);
+  put_bits(in, &pos, get_bits(st->data, piece->start + 48, 32), 32);
+
+  memset(&bz, 0, sizeof(bz));
+  if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) {
+    free(in);
+    return -1;
+  }
+  bz.next_in = (char *)in;
+  bz.avail_in = in_len;
+  for (;;) {
+    if (piece->out_len == piece->out_size &&
+        grow_output(piece, in_len * 8) != 0) {
+      break;
+    }
+    bz.next_out = (char *)piece->out + piece->out_len;
+    bz.avail_out = piece->out_size - piece->out_len;
+    rc = BZ2_bzDecompress(&bz);
+    piece->out_len = piece->out_size - bz.avail_out;
+    if (rc == BZ_STREAM_END) {
+      ret = 0;
+      break;
+    }
+    if (rc != BZ_OK || (bz.avail_in == 0 && bz.avail_out != 0)) {
+      // a block is only checked as a whole, so this may also be a block that
+      // was split at something that only looked like a magic number
+      incomplete = 1;
+      break;
+    }
+  }
+  BZ2_bzDecompressEnd(&bz);
+  free(in);
+  return (incomplete != 0) ? 1 : ret;
+}
+#endif
+
+#ifdef WITH_GZIP
+static int gzip_decompress(state_t *st, piece_t *piece)
+{
+  z_stream zs;
+  int rc, ret = -1;
+
+  memset(&zs, 0, sizeof(zs));
+  // 16 + MAX_WBITS: expect a gzip header
+  if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+    return -1;
+  }
+  zs.next_in = st->data + piece->start;
+  zs.avail_in = piece->end - piece->start;
+  for (;;) {
+    if (piece->out_len == piece->out_size &&
+        grow_output(piece, zs.avail_in * 4) != 0) {
+      break;
+    }
+    zs.next_out = piece->out + piece->out_len;
+    zs.avail_out = piece->out_size - piece->out_len;
+    rc = inflate(&zs, Z_NO_FLUSH);
+    piece->out_len = piece->out_size - zs.avail_out;
+    if (rc == Z_STREAM_END) {
+      if (zs.avail_in == 0) {
+        ret = 0;
+        break;
+      }
+      // anything after the last member that is not another member is trailing
+      // garbage (e.g. padding), which is ignored (as gzip does)
+      if (piece->end == st->len && !is_gzip_header(zs.next_in, zs.avail_in)) {
+        ret = 0;
+        break;
+      }
+      // a piece may hold several members
+      if (inflateReset(&zs) != Z_OK) {
+        break;
+      }
+      continue;
+    }
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      // corrupt (or the piece starts at something that only looked like a
+      // member header, and is merged with the incomplete piece before it).
+      // pieces that are read from start at a member, so merging cannot help.
+      break;
+    }
+    if (zs.avail_in == 0 && zs.avail_out != 0) {
+      // the member continues past the end of the piece
+      ret = 1;
+      break;
+    }
+  }
+  inflateEnd(&zs);
+  return ret;
+}
+#endif
+
+static int decompress_piece(state_t *st, piece_t *piece)
+{
+  piece->out_len = 0;
+  piece->out_pos = 0;
+  switch (st->type) {
+#ifdef WITH_BZIP2
+  case COMPRESSION_BZIP2:
+    return bzip2_decompress(st, piece);
+#endif
+#ifdef WITH_GZIP
+  case COMPRESSION_GZIP:
+    return gzip_decompress(st, piece);
+#endif
+  default:
+    return -1;
+  }
+}
+
+// must hold the mutex
+static piece_t *next_pending(state_t *st)
+{
+  int i;
+  piece_t *piece;
+
+  for (i = 0; i < st->cnt; i++) {
+    piece = &st->pieces[(st->head + i) % st->pieces_size];
+    if (piece->status == PIECE_PENDING) {
+      return piece;
+    }
+  }
+  return NULL;
+}
+
+static void *decompress_thread(void *user)
+{
+  state_t *st = (state_t *)user;
+  piece_t *piece;
+  int rc;
+
+  pthread_mutex_lock(&st->mutex);
+  for (;;) {
+    while (st->shutdown == 0 && (piece = next_pending(st)) == NULL) {
+      pthread_cond_wait(&st->work_cond, &st->mutex);
+    }
+    if (st->shutdown != 0) {
+      break;
+    }
+    piece->status = PIECE_RUNNING;
+    pthread_mutex_unlock(&st->mutex);
+
+    rc = decompress_piece(st, piece);
+
+    pthread_mutex_lock(&st->mutex);
+    piece->status = (rc == 0) ? PIECE_DONE
+                             : (rc > 0) ? PIECE_INCOMPLETE : PIECE_FAILED;
+    pthread_cond_broadcast(&st->done_cond);
+  }
+  pthread_mutex_unlock(&st->mutex);
+  return NULL;
+}
+
+/* ========== reading ========== */
+
+// queue pieces until the ring is full. must hold the mutex.
+static void fill_pieces(state_t *st)
+{
+  piece_t *piece;
+  int rc;
+
+  while (st->scan_done == 0 && st->cnt < st->pieces_size) {
+    // the slot is not in the ring, so no thread will look at it
+    piece = &st->pieces[(st->head + st->cnt) % st->pieces_size];
+    pthread_mutex_unlock(&st->mutex);
+    switch (st->type) {
+#ifdef WITH_BZIP2
+    case COMPRESSION_BZIP2:
+      rc = bzip2_next_piece(st, piece);
+      break;
+#endif
+#ifdef WITH_GZIP
+    case COMPRESSION_GZIP:
+      rc = gzip_next_piece(st, piece);
+      break;
+#endif
+    default:
+      rc = 0;
+    }
+    pthread_mutex_lock(&st->mutex);
+    if (rc == 0) {
+      st->scan_done = 1;
+      break;
+    }
+    piece->status = PIECE_PENDING;
+    st->cnt++;
+    pthread_cond_signal(&st->work_cond);
+  }
+}
+
+// the head piece is incomplete, probably because it was split at something
+// that only looked like a boundary. the next piece is extended back over it
+// and tried again, and the head piece is dropped. fails if the two pieces
+// cannot be one block, in which case the data is corrupt (rather than
+// re-decompressing an ever longer piece up to the end of the file). must hold
+// the mutex.
+static int merge_head(state_t *st)
+{
+  piece_t *head = &st->pieces[st->head];
+  piece_t *next;
+
+  if (st->cnt < 2) {
+    return -1;
+  }
+  next = &st->pieces[(st->head + 1) % st->pieces_size];
+  // bzip2 offsets are in bits
+  if (st->type == COMPRESSION_BZIP2 &&
+      next->end - head->start > (uint64_t)BZIP2_MAX_BLOCK_LEN * 8) {
+    return -1;
+  }
+  if (st->type == COMPRESSION_GZIP &&
+      next->end - head->start > GZIP_MAX_MERGE_LEN) {
+    return -1;
+  }
+  while (next->status == PIECE_RUNNING) {
+    pthread_cond_wait(&st->done_cond, &st->mutex);
+  }
+  next->start = head->start;
+  next->status = PIECE_PENDING;
+  head->status = PIECE_MERGED;
+  pthread_cond_signal(&st->work_cond);
+  return 0;
+}
+
+// which compression (that we can split) does the file use?
+static int detect_compression(const uint8_t *magic, off_t size,
+                              compression_t *type)
+{
+#ifdef WITH_BZIP2
+  if (memcmp(magic, "BZh", 3) == 0 && magic[3] >= '1' && magic[3] <= '9' &&
+      size >= BZIP2_MIN_LEN) {
+    *type = COMPRESSION_BZIP2;
+    return 0;
+  }
+#endif
+#ifdef WITH_GZIP
+  if (is_gzip_header(magic, 10)) {
+    *type = COMPRESSION_GZIP;
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+int bs_transport_decompress_create(bgpstream_transport_t *transport)
+{
+  const char *path = transport->res->url;
+  compression_t type;
+  uint8_t magic[10];
+  struct stat st;
+  void *data = MAP_FAILED;
+  int fd, i;
+
+  if (transport->decompress_threads < 2 || strcmp(path, "-") == 0 ||
+      strstr(path, "://") != NULL) {
+    return -1;
+  }
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+      detect_compression(magic, st.st_size, &type) != 0) {
+    goto err;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  fd = -1;
+  if (data == MAP_FAILED) {
+    goto err;
+  }
+
+  if ((transport->state = malloc_zero(sizeof(state_t))) == NULL) {
+    goto err;
+  }
+  STATE->type = type;
+  STATE->data = data;
+  STATE->len = st.st_size;
+
+#ifdef WITH_GZIP
+  // a single gzip member cannot be split, and wandio streams it better
+  if (type == COMPRESSION_GZIP &&
+      gzip_find_member(STATE, GZIP_PIECE_LEN) == STATE->len) {
+    goto err;
+  }
+#endif
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  STATE->threads_cnt = transport->decompress_threads;
+  STATE->pieces_size = STATE->threads_cnt * PIECES_PER_THREAD;
+  if ((STATE->pieces = malloc_zero(sizeof(piece_t) * STATE->pieces_size)) ==
+        NULL ||
+      (STATE->threads = malloc_zero(sizeof(pthread_t) * STATE->threads_cnt)) ==
+        NULL) {
+    goto err;
+  }
+  pthread_mutex_init(&STATE->mutex, NULL);
+  pthread_cond_init(&STATE->work_cond, NULL);
+  pthread_cond_init(&STATE->done_cond, NULL);
+
+  BS_TRANSPORT_SET_METHODS(decompress, transport);
+
+  for (i = 0; i < STATE->threads_cnt; i++) {
+    if (pthread_create(&STATE->threads[i], NULL, decompress_thread, STATE) !=
+        0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start decompression thread");
+      // destroy joins the threads that did start
+      STATE->threads_cnt = i;
+      bs_transport_decompress_destroy(transport);
+      return -1;
+    }
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_FINE, "Decompressing %s with %d threads", path,
+                STATE->threads_cnt);
+  return 0;
+
+err:
+  if (fd != -1) {
+    close(fd);
+  }
+  if (transport->state != NULL) {
+    free(STATE->pieces);
+    free(STATE->threads);
+    free(transport->state);
+    transport->state = NULL;
+  }
+  if (data != MAP_FAILED) {
+    munmap(data, st.st_size);
+  }
+  return -1;
+}
+
+int64_t bs_transport_decompress_read(bgpstream_transport_t *transport,
+                                     uint8_t *buffer, int64_t len)
+{
+  state_t *st = STATE;
+  piece_t *piece;
+  int64_t done = 0;
+  size_t n;
+
+  pthread_mutex_lock(&st->mutex);
+  while (done < len && st->error == 0) {
+    fill_pieces(st);
+    if (st->cnt == 0) {
+      // EOF
+      break;
+    }
+    piece = &st->pieces[st->head];
+
+    if (piece->status == PIECE_PENDING || piece->status == PIECE_RUNNING) {
+      if (done > 0) {
+        // give the caller what we have rather than wait
+        break;
+      }
+      pthread_cond_wait(&st->done_cond, &st->mutex);
+      continue;
+    }
+
+    if (piece->status == PIECE_INCOMPLETE || piece->status == PIECE_FAILED) {
+      if (piece->status == PIECE_FAILED || merge_head(st) != 0) {
+        bgpstream_log(BGPSTREAM_LOG_ERR, "Could not decompress %s (corrupt)",
+                      transport->res->url);
+        st->error = 1;
+      }
+      continue;
+    }
+
+    if (piece->status == PIECE_DONE) {
+      // only we touch a finished piece
+      pthread_mutex_unlock(&st->mutex);
+      n = piece->out_len - piece->out_pos;
+      if ((int64_t)n > len - done) {
+        n = len - done;
+      }
+      memcpy(buffer + done, piece->out + piece->out_pos, n);
+      piece->out_pos += n;
+      done += n;
+      pthread_mutex_lock(&st->mutex);
+      if (piece->out_pos < piece->out_len) {
+        continue;
+      }
+    }
+
+    // done with this piece (or it was merged into the next one). its output
+    // buffer is kept for reuse.
+    st->head = (st->head + 1) % st->pieces_size;
+    st->cnt--;
+  }
+  pthread_mutex_unlock(&st->mutex);
+
+  if (done == 0 && st->error != 0) {
+    return -1;
+  }
+  return done;
+}
+
+int64_t bs_transport_decompress_readline(bgpstream_transport_t *transport,
+                                         uint8_t *buffer, int64_t len)
+{
+  int64_t i = 0, rc;
+  uint8_t c;
+
+  if (len <= 0) {
+    return -1;
+  }
+  // same semantics as wandio_fgets with chomp
+  while (i < len - 1) {
+    if ((rc = bs_transport_decompress_read(transport, &c, 1)) < 0) {
+      return rc;
+    }
+    if (rc == 0 || c == '\n') {
+      break;
+    }
+    buffer[i++] = c;
+  }
+  buffer[i] = '\0';
+  return i;
+}
+
+void bs_transport_decompress_destroy(bgpstream_transport_t *transport)
+{
+  int i;
+
+  if (transport->state == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&STATE->mutex);
+  STATE->shutdown = 1;
+  pthread_cond_broadcast(&STATE->work_cond);
+  pthread_mutex_unlock(&STATE->mutex);
+  for (i = 0; i < STATE->threads_cnt; i++) {
+    pthread_join(STATE->threads[i], NULL);
+  }
+  free(STATE->threads);
+
+  pthread_mutex_destroy(&STATE->mutex);
+  pthread_cond_destroy(&STATE->work_cond);
+  pthread_cond_destroy(&STATE->done_cond);
+
+  for (i = 0; i < STATE->pieces_size; i++) {
+    free(STATE->pieces[i].out);
+  }
+  free(STATE->pieces);
+
+  munmap(STATE->data, STATE->len);
+  free(transport->state);
+  transport->state = NULL;
+}
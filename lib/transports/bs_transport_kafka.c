@@ -29,9 +29,11 @@
 #include "bgpstream_log.h"
 #include "utils.h"
 #include <assert.h>
+#include <fcntl.h>
 #include <librdkafka/rdkafka.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define STATE ((state_t *)(transport->state))
 
@@ -56,6 +58,13 @@ typedef struct state {
   // has a fatal error occured?
   int fatal_error;
 
+  // consumer queue, used to signal poll_fds when messages arrive
+  rd_kafka_queue_t *queue;
+
+  // pipe that librdkafka writes to when the consumer queue becomes non-empty
+  // (poll_fds[0] is given to the resource manager to wait on)
+  int poll_fds[2];
+
 } state_t;
 
 static int parse_attrs(bgpstream_transport_t *transport)
@@ -217,6 +226,65 @@ static int init_topic(bgpstream_transport_t *transport)
   return 0;
 }
 
+static void close_poll_fds(bgpstream_transport_t *transport)
+{
+  int i;
+
+  if (STATE->queue != NULL) {
+    rd_kafka_queue_io_event_enable(STATE->queue, -1, NULL, 0);
+    rd_kafka_queue_destroy(STATE->queue);
+    STATE->queue = NULL;
+  }
+
+  for (i = 0; i < 2; i++) {
+    if (STATE->poll_fds[i] != -1) {
+      close(STATE->poll_fds[i]);
+      STATE->poll_fds[i] = -1;
+    }
+  }
+}
+
+static int init_poll_fds(bgpstream_transport_t *transport)
+{
+  int i;
+
+  if (pipe(STATE->poll_fds) != 0) {
+    STATE->poll_fds[0] = STATE->poll_fds[1] = -1;
+    return -1;
+  }
+
+  // neither librdkafka nor we should ever block on the pipe
+  for (i = 0; i < 2; i++) {
+    if (fcntl(STATE->poll_fds[i], F_SETFL, O_NONBLOCK) != 0) {
+      goto err;
+    }
+  }
+
+  if ((STATE->queue = rd_kafka_queue_get_consumer(STATE->rk)) == NULL) {
+    goto err;
+  }
+  rd_kafka_queue_io_event_enable(STATE->queue, STATE->poll_fds[1], "1", 1);
+
+  return 0;
+
+err:
+  close_poll_fds(transport);
+  return -1;
+}
+
+// empty the pipe so that it will only be readable again once a new message
+// arrives on an empty queue
+static void drain_poll_fd(bgpstream_transport_t *transport)
+{
+  char buf[64];
+
+  if (STATE->poll_fds[0] == -1) {
+    return;
+  }
+  while (read(STATE->poll_fds[0], buf, sizeof(buf)) > 0)
+    ;
+}
+
 int bs_transport_kafka_create(bgpstream_transport_t *transport)
 {
   rd_kafka_conf_t *conf;
@@ -224,9 +292,12 @@ int bs_transport_kafka_create(bgpstream_transport_t *transport)
 
   BS_TRANSPORT_SET_METHODS(kafka, transport);
 
+  transport->get_poll_fd = bs_transport_kafka_get_poll_fd;
+
   if ((transport->state = malloc_zero(sizeof(state_t))) == NULL) {
     return -1;
   }
+  STATE->poll_fds[0] = STATE->poll_fds[1] = -1;
 
   if (parse_attrs(transport) != 0) {
     return -1;
@@ -271,6 +342,14 @@ int bs_transport_kafka_create(bgpstream_transport_t *transport)
   // switch to consumer poll mode
   rd_kafka_poll_set_consumer(STATE->rk);
 
+  // have librdkafka tell us when messages arrive (if this fails, the resource
+  // manager will fall back to periodically polling us)
+  if (init_poll_fds(transport) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Could not create Kafka poll descriptor, falling back to "
+                  "periodic polling");
+  }
+
   bgpstream_log(BGPSTREAM_LOG_FINE, "Kafka connected!");
   return 0;
 }
@@ -311,6 +390,10 @@ int64_t bs_transport_kafka_read(bgpstream_transport_t *transport,
 {
   rd_kafka_message_t *rk_msg;
 
+  // drain the pipe before polling so that a message that arrives after we
+  // find the queue empty will make it readable again
+  drain_poll_fd(transport);
+
   // see if there is a message waiting for us
   // POLL_TIMEOUT_MSEC is set very low (0) since the transport should be
   // non-blocking
@@ -336,6 +419,11 @@ int64_t bs_transport_kafka_read(bgpstream_transport_t *transport,
   return len;
 }
 
+int bs_transport_kafka_get_poll_fd(bgpstream_transport_t *transport)
+{
+  return STATE->poll_fds[0];
+}
+
 void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
 {
   rd_kafka_resp_err_t err;
@@ -345,6 +433,9 @@ void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
   }
 
   if (STATE->rk != NULL) {
+    // stop signalling the pipe
+    close_poll_fds(transport);
+
     // shut down consumer
     if ((err = rd_kafka_consumer_close(STATE->rk)) != 0) {
       bgpstream_log(BGPSTREAM_LOG_ERR, "Could not shut down consumer: %s",
@@ -359,6 +450,8 @@ void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
     STATE->rk = NULL;
   }
 
+  close_poll_fds(transport);
+
   free(STATE->topic);
   free(STATE->group);
   free(STATE->offset);
@@ -31,6 +31,8 @@
 
 BS_TRANSPORT_GENERATE_PROTOS(kafka)
 
+int bs_transport_kafka_get_poll_fd(bgpstream_transport_t *transport);
+
 #define BGPSTREAM_TRANSPORT_KAFKA_DEFAULT_OFFSET "latest"
 
 #endif /* __BS_TRANSPORT_KAFKA_H */
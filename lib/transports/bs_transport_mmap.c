@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bs_transport_mmap.h"
+#include "bgpstream_transport_interface.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATE ((state_t *)(transport->state))
+
+typedef struct state {
+
+  // the mapped file
+  uint8_t *data;
+
+  // size of the mapping
+  size_t len;
+
+  // offset of the next byte to read
+  size_t pos;
+
+} state_t;
+
+// magic numbers of the compression formats that wandio understands. files that
+// start with any of these are left to the file transport.
+static const struct {
+  const char *magic;
+  size_t len;
+} compressed_magic[] = {
+  {"\x1f\x8b", 2},             // gzip
+  {"BZh", 3},                  // bzip2
+  {"\xfd" "7zXZ\x00", 6},      // xz
+  {"\x89LZO", 4},              // lzo
+  {"\x04\x22\x4d\x18", 4},     // lz4
+  {"\x28\xb5\x2f\xfd", 4},     // zstd
+};
+
+static int is_compressed(int fd)
+{
+  uint8_t buf[8];
+  ssize_t len;
+  int i;
+
+  if ((len = pread(fd, buf, sizeof(buf), 0)) < 0) {
+    // let wandio deal with it
+    return 1;
+  }
+  for (i = 0; i < (int)ARR_CNT(compressed_magic); i++) {
+    if ((size_t)len >= compressed_magic[i].len &&
+        memcmp(buf, compressed_magic[i].magic, compressed_magic[i].len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int bs_transport_mmap_create(bgpstream_transport_t *transport)
+{
+  const char *path = transport->res->url;
+  struct stat st;
+  void *data;
+  int fd;
+
+  // "-" (stdin) and anything that looks like a URL go through wandio
+  if (strcmp(path, "-") == 0 || strstr(path, "://") != NULL) {
+    return -1;
+  }
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+      is_compressed(fd) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  // we read front-to-back, so the kernel can read ahead aggressively
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  if ((transport->state = malloc_zero(sizeof(state_t))) == NULL) {
+    munmap(data, st.st_size);
+    return -1;
+  }
+  STATE->data = data;
+  STATE->len = st.st_size;
+
+  BS_TRANSPORT_SET_METHODS(mmap, transport);
+  transport->map = bs_transport_mmap_map;
+
+  bgpstream_log(BGPSTREAM_LOG_FINE, "Mapped %zu bytes from %s", STATE->len,
+                path);
+  return 0;
+}
+
+int64_t bs_transport_mmap_read(bgpstream_transport_t *transport,
+                               uint8_t *buffer, int64_t len)
+{
+  size_t avail = STATE->len - STATE->pos;
+
+  if ((size_t)len > avail) {
+    len = avail;
+  }
+  memcpy(buffer, STATE->data + STATE->pos, len);
+  STATE->pos += len;
+  return len;
+}
+
+int64_t bs_transport_mmap_readline(bgpstream_transport_t *transport,
+                                   uint8_t *buffer, int64_t len)
+{
+  size_t avail = STATE->len - STATE->pos;
+  uint8_t *start = STATE->data + STATE->pos;
+  uint8_t *nl;
+  size_t cnt;
+
+  if (len <= 0) {
+    return -1;
+  }
+  // same semantics as wandio_fgets with chomp: at most len-1 bytes are copied,
+  // and the newline is consumed but not copied
+  cnt = (size_t)len - 1 < avail ? (size_t)len - 1 : avail;
+  if ((nl = memchr(start, '\n', cnt)) != NULL) {
+    cnt = nl - start;
+    STATE->pos++;
+  }
+  memcpy(buffer, start, cnt);
+  buffer[cnt] = '\0';
+  STATE->pos += cnt;
+  return cnt;
+}
+
+int64_t bs_transport_mmap_map(bgpstream_transport_t *transport,
+                              const uint8_t **data)
+{
+  size_t avail = STATE->len - STATE->pos;
+
+  *data = STATE->data + STATE->pos;
+  STATE->pos = STATE->len;
+  return avail;
+}
+
+void bs_transport_mmap_destroy(bgpstream_transport_t *transport)
+{
+  if (transport->state == NULL) {
+    return;
+  }
+  munmap(STATE->data, STATE->len);
+  free(transport->state);
+  transport->state = NULL;
+}
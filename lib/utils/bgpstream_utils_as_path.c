@@ -594,3 +594,27 @@ void bgpstream_as_path_update_fields(bgpstream_as_path_t *path)
     offset += SIZEOF_SEG(seg);
   }
 }
+
+size_t bgpstream_as_path_inline_size(const bgpstream_as_path_t *path)
+{
+  return sizeof(bgpstream_as_path_t) + path->data_len;
+}
+
+bgpstream_as_path_t *
+bgpstream_as_path_copy_inline(void *buf, const bgpstream_as_path_t *src)
+{
+  bgpstream_as_path_t *path = buf;
+
+  /* the segment data is stored immediately after the path structure */
+  path->data = (uint8_t *)(path + 1);
+  memcpy(path->data, src->data, src->data_len);
+  path->data_len = src->data_len;
+
+  /* signal that this is external data */
+  path->data_alloc_len = UINT16_MAX;
+
+  path->seg_cnt = src->seg_cnt;
+  path->origin_offset = src->origin_offset;
+
+  return path;
+}
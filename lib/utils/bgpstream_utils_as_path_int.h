@@ -106,6 +106,27 @@ int bgpstream_as_path_append(bgpstream_as_path_t *path,
  */
 void bgpstream_as_path_update_fields(bgpstream_as_path_t *path);
 
+/** Get the number of bytes needed to store an inline copy of the given AS Path
+ *
+ * @param path          pointer to the AS Path to measure
+ * @return the number of bytes that bgpstream_as_path_copy_inline will use
+ */
+size_t bgpstream_as_path_inline_size(const bgpstream_as_path_t *path);
+
+/** Copy the given AS Path into a caller-provided buffer
+ *
+ * @param buf           pointer to a pointer-aligned buffer of at least
+ *                      bgpstream_as_path_inline_size(src) bytes
+ * @param src           pointer to the AS Path to copy
+ * @return pointer to the copy (which starts at buf)
+ *
+ * The copy (including its segment data) is stored entirely within buf, so it
+ * is only valid as long as buf is. It must not be destroyed with
+ * bgpstream_as_path_destroy, or used as the destination of a copy.
+ */
+bgpstream_as_path_t *
+bgpstream_as_path_copy_inline(void *buf, const bgpstream_as_path_t *src);
+
 /** @} */
 
 #endif /* __BGPSTREAM_UTILS_AS_PATH_INT_H */
@@ -340,6 +340,36 @@ int bgpstream_community_set_populate(bgpstream_community_set_t *set,
   return 0;
 }
 
+bgpstream_community_t
+bgpstream_community_set_get_hash(const bgpstream_community_set_t *set)
+{
+  return set->communities_hash;
+}
+
+size_t
+bgpstream_community_set_inline_size(const bgpstream_community_set_t *set)
+{
+  return sizeof(bgpstream_community_set_t) +
+         sizeof(bgpstream_community_t) * set->communities_cnt;
+}
+
+bgpstream_community_set_t *
+bgpstream_community_set_copy_inline(void *buf,
+                                    const bgpstream_community_set_t *src)
+{
+  bgpstream_community_set_t *set = buf;
+
+  /* the communities are stored immediately after the set structure */
+  set->communities = (bgpstream_community_t *)(set + 1);
+  memcpy(set->communities, src->communities,
+         sizeof(bgpstream_community_t) * src->communities_cnt);
+  set->communities_cnt = src->communities_cnt;
+  set->communities_alloc_cnt = -1; /* signal that memory is not owned by us */
+  set->communities_hash = src->communities_hash;
+
+  return set;
+}
+
 int bgpstream_community_set_exists(const bgpstream_community_set_t *set,
                                    const bgpstream_community_t *com)
 {
@@ -83,6 +83,40 @@
 int bgpstream_community_set_populate(bgpstream_community_set_t *set,
                                      uint8_t *buf, size_t len);
 
+/** Get the hash of the given community set
+ *
+ * @param set           pointer to the community set
+ * @return the OR of all the communities in the set
+ *
+ * A community can only be in the set if all of its bits are set in the hash.
+ */
+bgpstream_community_t
+bgpstream_community_set_get_hash(const bgpstream_community_set_t *set);
+
+/** Get the number of bytes needed to store an inline copy of the given
+ * community set
+ *
+ * @param set           pointer to the community set to measure
+ * @return the number of bytes that bgpstream_community_set_copy_inline will use
+ */
+size_t
+bgpstream_community_set_inline_size(const bgpstream_community_set_t *set);
+
+/** Copy the given community set into a caller-provided buffer
+ *
+ * @param buf           pointer to a pointer-aligned buffer of at least
+ *                      bgpstream_community_set_inline_size(src) bytes
+ * @param src           pointer to the community set to copy
+ * @return pointer to the copy (which starts at buf)
+ *
+ * The copy (including its communities) is stored entirely within buf, so it
+ * is only valid as long as buf is. It must not be destroyed with
+ * bgpstream_community_set_destroy, or used as the destination of a copy.
+ */
+bgpstream_community_set_t *
+bgpstream_community_set_copy_inline(void *buf,
+                                    const bgpstream_community_set_t *src);
+
 /** @} */
 
 #endif /* __BGPSTREAM_UTILS_COMMUNITY_INT_H */
@@ -26,6 +26,8 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "khash.h"
 #include "utils.h"
@@ -34,6 +36,19 @@
 
 /* PRIVATE */
 
+/** Number of IDs above which a set switches from a hash to a bitmap */
+#define BITMAP_THRESHOLD 4096
+
+/** Maximum number of IDs in an array container (above this, a bitmap
+ *  container is smaller) */
+#define ARRAY_CONTAINER_MAX 4096
+
+/** Number of words in a bitmap container */
+#define BITMAP_WORDS (65536 / 64)
+
+#define ID_HIGH(id) ((uint16_t)((id) >> 16))
+#define ID_LOW(id) ((uint16_t)((id)&0xFFFF))
+
 /** set of unique ids
  *  this structure maintains a set of unique
  *  ids (using a uint32 type)
@@ -43,18 +58,263 @@ KHASH_INIT(bgpstream_id_set /* name */, uint32_t /* khkey_t */,
            kh_int_hash_func /*__hash_func */,
            kh_int_hash_equal /* __hash_equal */)
 
+/** the IDs of a bitmap set that share the same high 16 bits (roaring style):
+ *  a sorted array of the low 16 bits while there are few of them, and a
+ *  bitmap of all 65536 low values otherwise */
+typedef struct id_container {
+
+  /** high 16 bits of the IDs in the container */
+  uint16_t key;
+
+  /** number of IDs in the container */
+  int cnt;
+
+  /** sorted low 16 bits of the IDs (if bits is NULL) */
+  uint16_t *array;
+  int array_alloc_cnt;
+
+  /** bitmap of the low 16 bits of the IDs (NULL for an array container) */
+  uint64_t *bits;
+
+} id_container_t;
+
 struct bgpstream_id_set {
   khiter_t k;
+
+  /** hash of the IDs (NULL once the set has become a bitmap) */
   khash_t(bgpstream_id_set) * hash;
+
+  /** containers sorted by key (if hash is NULL) */
+  id_container_t *containers;
+  int containers_cnt;
+  int containers_alloc_cnt;
+
+  /** number of IDs in the containers */
+  int bitmap_size;
+
+  /** bitmap iterator: container, and array index or bit within it */
+  int it_container;
+  int it_pos;
+  uint32_t it_id;
 };
 
+static int cmp_id(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* index of the container with the given key, or -(insertion point + 1) */
+static int container_find(bgpstream_id_set_t *set, uint16_t key)
+{
+  int lo = 0, hi = set->containers_cnt - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (set->containers[mid].key == key) {
+      return mid;
+    }
+    if (set->containers[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -(lo + 1);
+}
+
+/* index of low in an array container, or -(insertion point + 1) */
+static int array_find(id_container_t *c, uint16_t low)
+{
+  int lo = 0, hi = c->cnt - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (c->array[mid] == low) {
+      return mid;
+    }
+    if (c->array[mid] < low) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -(lo + 1);
+}
+
+static int container_exists(id_container_t *c, uint16_t low)
+{
+  if (c->bits != NULL) {
+    return (c->bits[low / 64] >> (low % 64)) & 1;
+  }
+  return array_find(c, low) >= 0;
+}
+
+static int container_to_bitmap(id_container_t *c)
+{
+  int i;
+
+  if ((c->bits = malloc_zero(sizeof(uint64_t) * BITMAP_WORDS)) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < c->cnt; i++) {
+    c->bits[c->array[i] / 64] |= (uint64_t)1 << (c->array[i] % 64);
+  }
+  free(c->array);
+  c->array = NULL;
+  c->array_alloc_cnt = 0;
+  return 0;
+}
+
+/* returns 1 if the ID was inserted, 0 if it already existed, -1 if an error
+   occurred */
+static int container_insert(id_container_t *c, uint16_t low)
+{
+  uint16_t *tmp;
+  int idx;
+
+  if (c->bits == NULL) {
+    if ((idx = array_find(c, low)) >= 0) {
+      return 0;
+    }
+    idx = -idx - 1;
+    if (c->cnt == ARRAY_CONTAINER_MAX) {
+      if (container_to_bitmap(c) != 0) {
+        return -1;
+      }
+    } else {
+      if (c->cnt == c->array_alloc_cnt) {
+        if ((tmp = realloc(c->array, sizeof(uint16_t) *
+                                       (c->array_alloc_cnt * 2 + 4))) ==
+            NULL) {
+          return -1;
+        }
+        c->array = tmp;
+        c->array_alloc_cnt = c->array_alloc_cnt * 2 + 4;
+      }
+      memmove(&c->array[idx + 1], &c->array[idx],
+              sizeof(uint16_t) * (c->cnt - idx));
+      c->array[idx] = low;
+      c->cnt++;
+      return 1;
+    }
+  }
+
+  if (container_exists(c, low)) {
+    return 0;
+  }
+  c->bits[low / 64] |= (uint64_t)1 << (low % 64);
+  c->cnt++;
+  return 1;
+}
+
+static int bitmap_insert(bgpstream_id_set_t *set, uint32_t id)
+{
+  id_container_t *tmp;
+  int idx;
+  int rc;
+
+  if ((idx = container_find(set, ID_HIGH(id))) < 0) {
+    idx = -idx - 1;
+    if (set->containers_cnt == set->containers_alloc_cnt) {
+      if ((tmp = realloc(set->containers,
+                         sizeof(id_container_t) *
+                           (set->containers_alloc_cnt * 2 + 4))) == NULL) {
+        return -1;
+      }
+      set->containers = tmp;
+      set->containers_alloc_cnt = set->containers_alloc_cnt * 2 + 4;
+    }
+    memmove(&set->containers[idx + 1], &set->containers[idx],
+            sizeof(id_container_t) * (set->containers_cnt - idx));
+    memset(&set->containers[idx], 0, sizeof(id_container_t));
+    set->containers[idx].key = ID_HIGH(id);
+    set->containers_cnt++;
+  }
+
+  if ((rc = container_insert(&set->containers[idx], ID_LOW(id))) == 1) {
+    set->bitmap_size++;
+  }
+  return rc;
+}
+
+static int bitmap_exists(bgpstream_id_set_t *set, uint32_t id)
+{
+  int idx;
+
+  if ((idx = container_find(set, ID_HIGH(id))) < 0) {
+    return 0;
+  }
+  return container_exists(&set->containers[idx], ID_LOW(id));
+}
+
+static void bitmap_clear(bgpstream_id_set_t *set)
+{
+  int i;
+
+  for (i = 0; i < set->containers_cnt; i++) {
+    free(set->containers[i].array);
+    free(set->containers[i].bits);
+  }
+  set->containers_cnt = 0;
+  set->bitmap_size = 0;
+}
+
+/* insert sorted IDs into a bitmap set, appending containers in order (the set
+   must be empty) */
+static int bitmap_load_sorted(bgpstream_id_set_t *set, const uint32_t *ids,
+                              int ids_cnt)
+{
+  int i;
+
+  assert(set->hash == NULL && set->containers_cnt == 0);
+
+  for (i = 0; i < ids_cnt; i++) {
+    // the ID is never smaller than the ones in the last container, so the
+    // inserts only ever append
+    if (bitmap_insert(set, ids[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* move the IDs of a hash set into bitmap containers */
+static int convert_to_bitmap(bgpstream_id_set_t *set)
+{
+  uint32_t *ids;
+  int ids_cnt = 0;
+  khiter_t k;
+
+  if ((ids = malloc(sizeof(uint32_t) * (kh_size(set->hash) + 1))) == NULL) {
+    return -1;
+  }
+  for (k = kh_begin(set->hash); k != kh_end(set->hash); ++k) {
+    if (kh_exist(set->hash, k)) {
+      ids[ids_cnt++] = kh_key(set->hash, k);
+    }
+  }
+  qsort(ids, ids_cnt, sizeof(uint32_t), cmp_id);
+
+  kh_destroy(bgpstream_id_set, set->hash);
+  set->hash = NULL;
+  if (bitmap_load_sorted(set, ids, ids_cnt) != 0) {
+    free(ids);
+    return -1;
+  }
+  free(ids);
+  bgpstream_id_set_rewind(set);
+  return 0;
+}
+
 /* PUBLIC FUNCTIONS */
 
 bgpstream_id_set_t *bgpstream_id_set_create()
 {
   bgpstream_id_set_t *set;
 
-  if ((set = (bgpstream_id_set_t *)malloc(sizeof(bgpstream_id_set_t))) ==
+  if ((set = (bgpstream_id_set_t *)malloc_zero(sizeof(bgpstream_id_set_t))) ==
       NULL) {
     return NULL;
   }
@@ -67,12 +327,65 @@ bgpstream_id_set_t *bgpstream_id_set_create()
   return set;
 }
 
+bgpstream_id_set_t *bgpstream_id_set_create_from_array(const uint32_t *ids,
+                                                       int ids_cnt)
+{
+  bgpstream_id_set_t *set;
+  uint32_t *sorted;
+  int i;
+
+  if ((set = bgpstream_id_set_create()) == NULL) {
+    return NULL;
+  }
+
+  if (ids_cnt <= BITMAP_THRESHOLD) {
+    for (i = 0; i < ids_cnt; i++) {
+      if (bgpstream_id_set_insert(set, ids[i]) < 0) {
+        goto err;
+      }
+    }
+    return set;
+  }
+
+  // large sets go straight into (sorted) bitmap containers
+  if ((sorted = malloc(sizeof(uint32_t) * ids_cnt)) == NULL) {
+    goto err;
+  }
+  memcpy(sorted, ids, sizeof(uint32_t) * ids_cnt);
+  qsort(sorted, ids_cnt, sizeof(uint32_t), cmp_id);
+  kh_destroy(bgpstream_id_set, set->hash);
+  set->hash = NULL;
+  if (bitmap_load_sorted(set, sorted, ids_cnt) != 0) {
+    free(sorted);
+    goto err;
+  }
+  free(sorted);
+  bgpstream_id_set_rewind(set);
+  return set;
+
+err:
+  bgpstream_id_set_destroy(set);
+  return NULL;
+}
+
 int bgpstream_id_set_insert(bgpstream_id_set_t *set, uint32_t id)
 {
   int khret;
   khiter_t k;
+
+  if (set->hash == NULL) {
+    return bitmap_insert(set, id);
+  }
+
   if ((k = kh_get(bgpstream_id_set, set->hash, id)) == kh_end(set->hash)) {
     k = kh_put(bgpstream_id_set, set->hash, id, &khret);
+    if (khret < 0) {
+      return -1;
+    }
+    // large sets are smaller and faster to search as a bitmap
+    if (kh_size(set->hash) > BITMAP_THRESHOLD && convert_to_bitmap(set) != 0) {
+      return -1;
+    }
     return 1;
   }
   return 0;
@@ -81,6 +394,11 @@ int bgpstream_id_set_insert(bgpstream_id_set_t *set, uint32_t id)
 int bgpstream_id_set_exists(bgpstream_id_set_t *set, uint32_t id)
 {
   khiter_t k;
+
+  if (set->hash == NULL) {
+    return bitmap_exists(set, id);
+  }
+
   if ((k = kh_get(bgpstream_id_set, set->hash, id)) == kh_end(set->hash)) {
     return 0;
   }
@@ -90,12 +408,12 @@ int bgpstream_id_set_exists(bgpstream_id_set_t *set, uint32_t id)
 int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
                            bgpstream_id_set_t *src_set)
 {
-  khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_id_set_insert(dst_set, kh_key(src_set->hash, k)) < 0) {
-        return -1;
-      }
+  uint32_t *id;
+
+  bgpstream_id_set_rewind(src_set);
+  while ((id = bgpstream_id_set_next(src_set)) != NULL) {
+    if (bgpstream_id_set_insert(dst_set, *id) < 0) {
+      return -1;
     }
   }
   bgpstream_id_set_rewind(dst_set);
@@ -103,14 +421,83 @@ int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
   return 0;
 }
 
+int bgpstream_id_set_intersect(bgpstream_id_set_t *dst_set,
+                               bgpstream_id_set_t *src_set)
+{
+  uint32_t *ids;
+  uint32_t *id;
+  int ids_cnt = 0;
+  int i;
+
+  // collect the IDs to keep, then rebuild the set from them
+  if ((ids = malloc(sizeof(uint32_t) *
+                    (bgpstream_id_set_size(dst_set) + 1))) == NULL) {
+    return -1;
+  }
+  bgpstream_id_set_rewind(dst_set);
+  while ((id = bgpstream_id_set_next(dst_set)) != NULL) {
+    if (bgpstream_id_set_exists(src_set, *id)) {
+      ids[ids_cnt++] = *id;
+    }
+  }
+
+  bgpstream_id_set_clear(dst_set);
+  for (i = 0; i < ids_cnt; i++) {
+    if (bgpstream_id_set_insert(dst_set, ids[i]) < 0) {
+      free(ids);
+      return -1;
+    }
+  }
+  free(ids);
+  bgpstream_id_set_rewind(dst_set);
+  return 0;
+}
+
 void bgpstream_id_set_rewind(bgpstream_id_set_t *set)
 {
+  if (set->hash == NULL) {
+    set->it_container = 0;
+    set->it_pos = 0;
+    return;
+  }
   set->k = kh_begin(set->hash);
 }
 
 uint32_t *bgpstream_id_set_next(bgpstream_id_set_t *set)
 {
   uint32_t *v = NULL;
+  id_container_t *c;
+  uint64_t word;
+
+  if (set->hash == NULL) {
+    for (; set->it_container < set->containers_cnt;
+         set->it_container++, set->it_pos = 0) {
+      c = &set->containers[set->it_container];
+      if (c->bits == NULL) {
+        if (set->it_pos < c->cnt) {
+          set->it_id = ((uint32_t)c->key << 16) | c->array[set->it_pos++];
+          return &set->it_id;
+        }
+        continue;
+      }
+      while (set->it_pos < 65536) {
+        // skip over the empty part of the word
+        word = c->bits[set->it_pos / 64] >> (set->it_pos % 64);
+        if (word == 0) {
+          set->it_pos = (set->it_pos / 64 + 1) * 64;
+          continue;
+        }
+        while ((word & 1) == 0) {
+          word >>= 1;
+          set->it_pos++;
+        }
+        set->it_id = ((uint32_t)c->key << 16) | set->it_pos++;
+        return &set->it_id;
+      }
+    }
+    return NULL;
+  }
+
   for (; set->k != kh_end(set->hash); ++set->k) {
     if (kh_exist(set->hash, set->k)) {
       v = &kh_key(set->hash, set->k);
@@ -123,17 +510,29 @@ uint32_t *bgpstream_id_set_next(bgpstream_id_set_t *set)
 
 int bgpstream_id_set_size(bgpstream_id_set_t *set)
 {
+  if (set->hash == NULL) {
+    return set->bitmap_size;
+  }
   return kh_size(set->hash);
 }
 
 void bgpstream_id_set_destroy(bgpstream_id_set_t *set)
 {
-  kh_destroy(bgpstream_id_set, set->hash);
+  if (set->hash != NULL) {
+    kh_destroy(bgpstream_id_set, set->hash);
+  }
+  bitmap_clear(set);
+  free(set->containers);
   free(set);
 }
 
 void bgpstream_id_set_clear(bgpstream_id_set_t *set)
 {
+  if (set->hash == NULL) {
+    // the set stays a bitmap
+    bitmap_clear(set);
+  } else {
+    kh_clear(bgpstream_id_set, set->hash);
+  }
   bgpstream_id_set_rewind(set);
-  kh_clear(bgpstream_id_set, set->hash);
 }
@@ -57,6 +57,18 @@ typedef struct bgpstream_id_set bgpstream_id_set_t;
  */
 bgpstream_id_set_t *bgpstream_id_set_create(void);
 
+/** Create a new ID set instance populated with the given IDs
+ *
+ * @param ids           array of IDs to insert (duplicates are allowed)
+ * @param ids_cnt       number of IDs in the array
+ * @return a pointer to the structure, or NULL if an error occurred
+ *
+ * Large sets are stored as a compressed bitmap rather than a hash table, and
+ * bulk-loading them from an array is cheaper than inserting IDs one by one.
+ */
+bgpstream_id_set_t *bgpstream_id_set_create_from_array(const uint32_t *ids,
+                                                       int ids_cnt);
+
 /** Insert a new ID into the given set.
  *
  * @param set           pointer to the id set
@@ -90,6 +102,17 @@ int bgpstream_id_set_size(bgpstream_id_set_t *set);
 int bgpstream_id_set_merge(bgpstream_id_set_t *dst_set,
                            bgpstream_id_set_t *src_set);
 
+/** Intersect two ID sets
+ *
+ * @param dst_set      pointer to the set to intersect with src
+ * @param src_set      pointer to the set to intersect with dst
+ * @return 0 if the sets were intersected successfully, -1 otherwise
+ *
+ * On success, dst_set only contains the IDs that are in both sets.
+ */
+int bgpstream_id_set_intersect(bgpstream_id_set_t *dst_set,
+                               bgpstream_id_set_t *src_set);
+
 /** Reset the internal iterator
  *
  * @param set           pointer to the id set
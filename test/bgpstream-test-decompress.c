@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2017 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_resource.h"
+#include "bgpstream_transport.h"
+#include "bgpstream_transport_interface.h"
+#include "bs_transport_decompress.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wandio.h>
+
+#define BZIP2_FIXTURE "routeviews.route-views.jinx.updates.1427846400.bz2"
+#define GZIP_FIXTURE "ris.rrc06.updates.1427846400.gz"
+
+/* the fixtures are too small to be split, so the test files are several copies
+   of them (which are still valid bzip2 and gzip files). there are enough gzip
+   copies for more than one 1MB piece, and enough bzip2 copies that a corrupt
+   block cannot be merged up to the end of the file. */
+#define BZIP2_COPIES 80
+#define GZIP_COPIES 256
+
+#define TEST_FILE "decompress-test.tmp"
+
+#define DECOMPRESS_THREADS 2
+
+static uint8_t buf[65536];
+
+/* append len bytes to a growing buffer */
+static int append(uint8_t **out, size_t *len, size_t *size, const uint8_t *data,
+                  size_t data_len)
+{
+  uint8_t *tmp;
+
+  while (*len + data_len > *size) {
+    *size = (*size == 0) ? sizeof(buf) : *size * 2;
+    if ((tmp = realloc(*out, *size)) == NULL) {
+      return -1;
+    }
+    *out = tmp;
+  }
+  memcpy(*out + *len, data, data_len);
+  *len += data_len;
+  return 0;
+}
+
+/* decompress a file with wandio, copies times over */
+static uint8_t *read_wandio(const char *path, int copies, size_t *len)
+{
+  uint8_t *out = NULL, *tmp;
+  size_t size = 0, one_len;
+  io_t *io;
+  int64_t rc;
+  int i;
+
+  *len = 0;
+  if ((io = wandio_create(path)) == NULL) {
+    return NULL;
+  }
+  while ((rc = wandio_read(io, buf, sizeof(buf))) > 0) {
+    if (append(&out, len, &size, buf, rc) != 0) {
+      rc = -1;
+      break;
+    }
+  }
+  wandio_destroy(io);
+  if (rc < 0) {
+    free(out);
+    return NULL;
+  }
+
+  one_len = *len;
+  if (one_len == 0 || (tmp = realloc(out, one_len * copies)) == NULL) {
+    free(out);
+    return NULL;
+  }
+  out = tmp;
+  for (i = 1; i < copies; i++) {
+    memcpy(out + i * one_len, out, one_len);
+  }
+  *len = one_len * copies;
+  return out;
+}
+
+/* write copies of a file to TEST_FILE, inverting the middle byte of the
+   corrupt_copy'th copy (if it is not -1) */
+static int write_copies(const char *path, int copies, int corrupt_copy)
+{
+  uint8_t *data = NULL;
+  size_t len = 0, size = 0, n;
+  FILE *fp;
+  int i, ret = 0;
+
+  if ((fp = fopen(path, "rb")) == NULL) {
+    return -1;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    if (append(&data, &len, &size, buf, n) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  fclose(fp);
+  if (ret != 0 || len == 0 || (fp = fopen(TEST_FILE, "wb")) == NULL) {
+    free(data);
+    return -1;
+  }
+  for (i = 0; i < copies; i++) {
+    data[len / 2] ^= (i == corrupt_copy) ? 0xff : 0;
+    if (fwrite(data, 1, len, fp) != len) {
+      ret = -1;
+    }
+    data[len / 2] ^= (i == corrupt_copy) ? 0xff : 0;
+  }
+  if (fclose(fp) != 0) {
+    ret = -1;
+  }
+  free(data);
+  return ret;
+}
+
+/* append bytes that are not a gzip member to TEST_FILE */
+static int append_garbage()
+{
+  static const char garbage[] = "not a gzip member";
+  FILE *fp;
+  int ret = 0;
+
+  if ((fp = fopen(TEST_FILE, "ab")) == NULL) {
+    return -1;
+  }
+  memset(buf, 0, 512);
+  if (fwrite(buf, 1, 512, fp) != 512 ||
+      fwrite(garbage, 1, sizeof(garbage), fp) != sizeof(garbage)) {
+    ret = -1;
+  }
+  if (fclose(fp) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+/* read TEST_FILE through the transport. returns 1 if it was decompressed by the
+   decompress transport, 0 if the file was left to another transport (e.g.
+   because the library was built without the compression library), and -1 if
+   it could not be opened. */
+static int read_transport(uint8_t **out, size_t *len, int64_t *rc)
+{
+  bgpstream_resource_t *res;
+  bgpstream_transport_t *transport;
+  size_t size = 0;
+  int used;
+
+  *out = NULL;
+  *len = 0;
+  *rc = -1;
+  if ((res = bgpstream_resource_create(
+         BGPSTREAM_RESOURCE_TRANSPORT_FILE, BGPSTREAM_RESOURCE_FORMAT_MRT,
+         TEST_FILE, 0, 0, "test", "test", BGPSTREAM_UPDATE)) == NULL) {
+    return -1;
+  }
+  if ((transport = bgpstream_transport_create(res, DECOMPRESS_THREADS, 0)) ==
+      NULL) {
+    bgpstream_resource_destroy(res);
+    return -1;
+  }
+  used = (transport->read == bs_transport_decompress_read);
+
+  while ((*rc = bgpstream_transport_read(transport, buf, sizeof(buf))) > 0) {
+    if (append(out, len, &size, buf, *rc) != 0) {
+      *rc = -1;
+      break;
+    }
+  }
+
+  bgpstream_transport_destroy(transport);
+  bgpstream_resource_destroy(res);
+  return used;
+}
+
+static int test_decompress(const char *name, const char *fixture, int copies)
+{
+  uint8_t *expected, *out;
+  size_t expected_len, out_len;
+  int64_t rc;
+  int used;
+
+  CHECK("decompress fixture with wandio",
+        (expected = read_wandio(fixture, copies, &expected_len)) != NULL);
+  CHECK("write test file", write_copies(fixture, copies, -1) == 0);
+
+  CHECK("open test file", (used = read_transport(&out, &out_len, &rc)) >= 0);
+  if (used == 0) {
+    SKIPPED(name);
+    free(out);
+    free(expected);
+    unlink(TEST_FILE);
+    return 0;
+  }
+  CHECK("read to the end", rc == 0);
+  CHECK("same length as wandio", out_len == expected_len);
+  CHECK("same bytes as wandio",
+        out_len == expected_len && memcmp(out, expected, out_len) == 0);
+  free(out);
+
+  /* corrupt one of the copies. the copies before it are read (up to the piece
+     that holds the corrupt block or member), and then the error is reported
+     rather than merging pieces up to the end of the file */
+  CHECK("write corrupt test file",
+        write_copies(fixture, copies, copies / 2) == 0);
+  CHECK("open corrupt test file", read_transport(&out, &out_len, &rc) == 1);
+  CHECK("corruption reported", rc < 0);
+  CHECK("read up to the corrupt copy",
+        out_len <= expected_len / copies * (copies / 2) &&
+          memcmp(out, expected, out_len) == 0);
+  free(out);
+
+  free(expected);
+  unlink(TEST_FILE);
+  return 0;
+}
+
+/* garbage after the last gzip member is ignored rather than reported as
+   corruption (as gzip does) */
+static int test_trailing_garbage()
+{
+  uint8_t *expected, *out;
+  size_t expected_len, out_len;
+  int64_t rc;
+  int used;
+
+  CHECK("decompress fixture with wandio",
+        (expected = read_wandio(GZIP_FIXTURE, GZIP_COPIES, &expected_len)) !=
+          NULL);
+  CHECK("write test file", write_copies(GZIP_FIXTURE, GZIP_COPIES, -1) == 0 &&
+                             append_garbage() == 0);
+
+  CHECK("open test file", (used = read_transport(&out, &out_len, &rc)) >= 0);
+  if (used == 0) {
+    SKIPPED("gzip trailing garbage");
+    free(out);
+    free(expected);
+    unlink(TEST_FILE);
+    return 0;
+  }
+  CHECK("read to the end", rc == 0);
+  CHECK("same bytes as wandio",
+        out_len == expected_len && memcmp(out, expected, out_len) == 0);
+  free(out);
+
+  free(expected);
+  unlink(TEST_FILE);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("bzip2", test_decompress("bzip2", BZIP2_FIXTURE,
+                                         BZIP2_COPIES) == 0);
+  CHECK_SECTION("gzip", test_decompress("gzip", GZIP_FIXTURE,
+                                        GZIP_COPIES) == 0);
+  CHECK_SECTION("gzip trailing garbage", test_trailing_garbage() == 0);
+  ENDTEST;
+  return 0;
+}
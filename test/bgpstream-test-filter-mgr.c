@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_filter.h"
+#include "bgpstream_utils_as_path_int.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of distinct elems that are checked */
+#define PLAN_ELEMS_CNT 1000
+
+/* number of times each elem is checked (enough for the plan to be re-ordered
+   several times) */
+#define PLAN_ROUNDS 20
+
+#define PLAN_THREADS_CNT 4
+
+/* AS path patterns that are matched natively (and the 32 ASN pattern, which
+   is built by test_aspath_patterns) */
+static const char *aspath_native_patterns[] = {
+  "^1_",     "^2_",   "_4$",   "_3$",   "_1_2_",  "_2_3_", "_3_4_",
+  "_2_4_",   "^_1_",  "^_2_",  "_4_$",  "_3_$",   "_5_",   "^1_2_3_4$",
+  "^_1_2_$", "_12_",  "_1_1_", NULL};
+
+/* AS path patterns that are not matched natively */
+static const char *aspath_regex_patterns[] = {"_01_", "_1_.*_4_", "1_",
+                                              NULL};
+
+#define ASPATH_SEGS_MAX 4
+
+/* sets of community filters (separated by spaces) */
+static const char *community_filters[] = {
+  "65000:100",
+  "65000:100 3356:2",
+  "65000:*",
+  "65000:* 3356:*",
+  "*:666",
+  "*:666 *:100",
+  "*:*",
+  "65000:100 3356:* *:666",
+  /* filters of the same kind that share no bits */
+  "1:2 2:1",
+  "1:* 2:*",
+  "*:1 *:2",
+  "1:2 2:* *:4",
+  NULL};
+
+/* ASNs and values that the community sets are built from */
+static const uint16_t community_parts[] = {0,   1,    2,     4,    100,
+                                           666, 3356, 65000, 65535};
+
+#define COMMUNITY_PARTS_CNT                                                    \
+  (sizeof(community_parts) / sizeof(community_parts[0]))
+
+/* number of community sets that each set of filters is checked against */
+#define COMMUNITY_SETS_CNT 5000
+
+static struct {
+  const char *name;
+  int segs_cnt;
+  struct {
+    bgpstream_as_path_seg_type_t type;
+    int cnt;
+    uint32_t asns[4];
+  } segs[ASPATH_SEGS_MAX];
+} aspath_paths[] = {
+  {"empty", 0, {{0}}},
+  {"1 2 3 4", 1, {{BGPSTREAM_AS_PATH_SEG_ASN, 4, {1, 2, 3, 4}}}},
+  {"1 {2,3} 4",
+   3,
+   {{BGPSTREAM_AS_PATH_SEG_ASN, 1, {1}},
+    {BGPSTREAM_AS_PATH_SEG_SET, 2, {2, 3}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 1, {4}}}},
+  {"1 2 {3,4}",
+   2,
+   {{BGPSTREAM_AS_PATH_SEG_ASN, 2, {1, 2}},
+    {BGPSTREAM_AS_PATH_SEG_SET, 2, {3, 4}}}},
+  {"{1,2} 3 4",
+   2,
+   {{BGPSTREAM_AS_PATH_SEG_SET, 2, {1, 2}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 2, {3, 4}}}},
+  {"{1} {2} 3",
+   3,
+   {{BGPSTREAM_AS_PATH_SEG_SET, 1, {1}},
+    {BGPSTREAM_AS_PATH_SEG_SET, 1, {2}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 1, {3}}}},
+  {"(1 2) 3 4",
+   2,
+   {{BGPSTREAM_AS_PATH_SEG_CONFED_SEQ, 2, {1, 2}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 2, {3, 4}}}},
+  {"1 (2 3) 4",
+   3,
+   {{BGPSTREAM_AS_PATH_SEG_ASN, 1, {1}},
+    {BGPSTREAM_AS_PATH_SEG_CONFED_SEQ, 2, {2, 3}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 1, {4}}}},
+  {"[1,2] 3 [4]",
+   3,
+   {{BGPSTREAM_AS_PATH_SEG_CONFED_SET, 2, {1, 2}},
+    {BGPSTREAM_AS_PATH_SEG_ASN, 1, {3}},
+    {BGPSTREAM_AS_PATH_SEG_CONFED_SET, 1, {4}}}},
+  {"1 1 12 {4}",
+   2,
+   {{BGPSTREAM_AS_PATH_SEG_ASN, 3, {1, 1, 12}},
+    {BGPSTREAM_AS_PATH_SEG_SET, 1, {4}}}},
+  {NULL, 0, {{0}}},
+};
+
+static bgpstream_filter_mgr_t *mgr;
+static bgpstream_elem_t *plan_elems[PLAN_ELEMS_CNT];
+static int plan_expected[PLAN_ELEMS_CNT];
+
+static int plan_elems_create()
+{
+  bgpstream_community_t comm;
+  uint32_t asns[3];
+  char pfx_str[64];
+  int i;
+
+  for (i = 0; i < PLAN_ELEMS_CNT; i++) {
+    if ((plan_elems[i] = bgpstream_elem_create()) == NULL) {
+      return -1;
+    }
+    // the elem type filter passes every elem, so it should be moved to the
+    // end of the plan
+    plan_elems[i]->type = i % 10 == 0 ? BGPSTREAM_ELEM_TYPE_WITHDRAWAL
+                                      : BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT;
+    plan_elems[i]->peer_asn = 65000 + i % 4;
+    snprintf(pfx_str, sizeof(pfx_str), "%d.%d.0.0/16", i % 3 == 0 ? 192 : 10,
+             i % 256);
+    bgpstream_str2pfx(pfx_str, &plan_elems[i]->prefix);
+
+    asns[0] = plan_elems[i]->peer_asn;
+    asns[1] = i % 5 == 0 ? 174 : 3356;
+    asns[2] = 64496 + i % 7;
+    bgpstream_as_path_append(plan_elems[i]->as_path,
+                             BGPSTREAM_AS_PATH_SEG_ASN, asns, 3);
+
+    if (i % 2 == 0) {
+      comm.asn = i % 4 == 0 ? 65000 : 65001;
+      comm.value = i % 100;
+      bgpstream_community_set_insert(plan_elems[i]->communities, &comm);
+    }
+  }
+  return 0;
+}
+
+static void plan_elems_destroy()
+{
+  int i;
+
+  for (i = 0; i < PLAN_ELEMS_CNT; i++) {
+    bgpstream_elem_destroy(plan_elems[i]);
+    plan_elems[i] = NULL;
+  }
+}
+
+static void *plan_thread(void *user)
+{
+  int *mismatches = user;
+  int round, i;
+
+  for (round = 0; round < PLAN_ROUNDS; round++) {
+    for (i = 0; i < PLAN_ELEMS_CNT; i++) {
+      if (bgpstream_filter_mgr_elem_check(mgr, plan_elems[i]) !=
+          plan_expected[i]) {
+        (*mismatches)++;
+      }
+    }
+  }
+  return NULL;
+}
+
+static int test_plan_reorder()
+{
+  pthread_t threads[PLAN_THREADS_CNT];
+  int mismatches[PLAN_THREADS_CNT];
+  uint32_t initial_order;
+  int passed = 0;
+  int same = 1;
+  int round, i;
+
+  CHECK("filter mgr create", (mgr = bgpstream_filter_mgr_create()) != NULL);
+  CHECK("plan elems create", plan_elems_create() == 0);
+
+  CHECK("add filters",
+        bgpstream_filter_mgr_filter_add(mgr, BGPSTREAM_FILTER_TYPE_ELEM_TYPE,
+                                        "announcements") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_TYPE, "withdrawals") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "65001") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "65002") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_PREFIX, "10.0.0.0/8") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_COMMUNITY, "65001:*") &&
+          bgpstream_filter_mgr_filter_add(
+            mgr, BGPSTREAM_FILTER_TYPE_ELEM_ASPATH, "_3356_"));
+
+  bgpstream_filter_mgr_compile(mgr);
+  initial_order = mgr->checks_order;
+
+  /* results with the initial plan (the plan is not re-ordered before the
+     first CHECKS_REORDER_INTERVAL elems) */
+  for (i = 0; i < PLAN_ELEMS_CNT; i++) {
+    plan_expected[i] = bgpstream_filter_mgr_elem_check(mgr, plan_elems[i]);
+    passed += plan_expected[i];
+  }
+  CHECK("some elems pass and some are rejected",
+        passed > 0 && passed < PLAN_ELEMS_CNT);
+
+  /* results once the plan has been re-ordered */
+  for (round = 1; round < PLAN_ROUNDS; round++) {
+    for (i = 0; i < PLAN_ELEMS_CNT; i++) {
+      if (bgpstream_filter_mgr_elem_check(mgr, plan_elems[i]) !=
+          plan_expected[i]) {
+        same = 0;
+      }
+    }
+  }
+  CHECK("plan was re-ordered", mgr->checks_order != initial_order);
+  CHECK("same results after re-ordering", same);
+
+  /* results while the plan is re-ordered by other threads */
+  for (i = 0; i < PLAN_THREADS_CNT; i++) {
+    mismatches[i] = 0;
+    pthread_create(&threads[i], NULL, plan_thread, &mismatches[i]);
+  }
+  same = 1;
+  for (i = 0; i < PLAN_THREADS_CNT; i++) {
+    pthread_join(threads[i], NULL);
+    if (mismatches[i] != 0) {
+      same = 0;
+    }
+  }
+  CHECK("same results when checked concurrently", same);
+
+  plan_elems_destroy();
+  bgpstream_filter_mgr_destroy(mgr);
+  mgr = NULL;
+  return 0;
+}
+
+/* check that a pattern gives the same result for each path whether it is
+   matched natively or using the regex (returns the number of matching paths,
+   or -1 if the results differ) */
+static int aspath_compare(const char *pattern, int native,
+                          bgpstream_as_path_t **paths, int paths_cnt)
+{
+  bgpstream_aspath_expr_t nat;
+  bgpstream_aspath_expr_t re;
+  char path_str[1024];
+  int nat_result, re_result;
+  int matches = 0;
+  int i;
+
+  memset(&nat, 0, sizeof(nat));
+  memset(&re, 0, sizeof(re));
+  if (bgpstream_filter_aspath_expr_compile(&nat, pattern, 1) == 0 ||
+      bgpstream_filter_aspath_expr_compile(&re, pattern, 0) == 0 ||
+      re.re == NULL || (nat.re == NULL) != native) {
+    matches = -1;
+    goto done;
+  }
+
+  for (i = 0; i < paths_cnt; i++) {
+    bgpstream_as_path_snprintf(path_str, sizeof(path_str), paths[i]);
+    nat_result = bgpstream_filter_aspath_expr_match(&nat, paths[i], path_str);
+    re_result = bgpstream_filter_aspath_expr_match(&re, paths[i], path_str);
+    if (nat_result != re_result) {
+      fprintf(stderr, "pattern '%s' on path '%s': native %d, regex %d\n",
+              pattern, path_str, nat_result, re_result);
+      matches = -1;
+      goto done;
+    }
+    matches += nat_result;
+  }
+
+done:
+  bgpstream_filter_aspath_expr_clear(&nat);
+  bgpstream_filter_aspath_expr_clear(&re);
+  return matches;
+}
+
+static int test_aspath_patterns()
+{
+  bgpstream_as_path_t *paths[sizeof(aspath_paths) / sizeof(aspath_paths[0]) +
+                             2];
+  uint32_t asns[BGPSTREAM_ASPATH_PATTERN_MAX + 1];
+  char pattern[(BGPSTREAM_ASPATH_PATTERN_MAX + 1) * 4 + 4];
+  char *p;
+  int paths_cnt = 0;
+  int matches;
+  int total = 0;
+  int i, j;
+
+  for (i = 0; aspath_paths[i].name != NULL; i++) {
+    paths[paths_cnt] = bgpstream_as_path_create();
+    for (j = 0; j < aspath_paths[i].segs_cnt; j++) {
+      bgpstream_as_path_append(paths[paths_cnt], aspath_paths[i].segs[j].type,
+                               aspath_paths[i].segs[j].asns,
+                               aspath_paths[i].segs[j].cnt);
+    }
+    paths_cnt++;
+  }
+
+  /* paths with the 32 ASNs of the long patterns, and with one more ASN in
+     front */
+  for (i = 0; i <= BGPSTREAM_ASPATH_PATTERN_MAX; i++) {
+    asns[i] = 100 + i;
+  }
+  paths[paths_cnt] = bgpstream_as_path_create();
+  bgpstream_as_path_append(paths[paths_cnt++], BGPSTREAM_AS_PATH_SEG_ASN,
+                           &asns[1], BGPSTREAM_ASPATH_PATTERN_MAX);
+  paths[paths_cnt] = bgpstream_as_path_create();
+  bgpstream_as_path_append(paths[paths_cnt++], BGPSTREAM_AS_PATH_SEG_ASN,
+                           asns, BGPSTREAM_ASPATH_PATTERN_MAX + 1);
+
+  for (i = 0; aspath_native_patterns[i] != NULL; i++) {
+    CHECK(aspath_native_patterns[i],
+          (matches = aspath_compare(aspath_native_patterns[i], 1, paths,
+                                    paths_cnt)) >= 0);
+    total += matches;
+  }
+  for (i = 0; aspath_regex_patterns[i] != NULL; i++) {
+    CHECK(aspath_regex_patterns[i],
+          (matches = aspath_compare(aspath_regex_patterns[i], 0, paths,
+                                    paths_cnt)) >= 0);
+    total += matches;
+  }
+  CHECK("some paths match", total > 0);
+
+  /* the longest pattern that is matched natively */
+  p = pattern;
+  for (i = 1; i <= BGPSTREAM_ASPATH_PATTERN_MAX; i++) {
+    p += sprintf(p, "_%" PRIu32, asns[i]);
+  }
+  strcpy(p, "$");
+  CHECK("32 ASN pattern", aspath_compare(pattern, 1, paths, paths_cnt) == 2);
+
+  /* and one that is too long */
+  p = pattern;
+  for (i = 0; i <= BGPSTREAM_ASPATH_PATTERN_MAX; i++) {
+    p += sprintf(p, "_%" PRIu32, asns[i]);
+  }
+  strcpy(p, "_");
+  CHECK("33 ASN pattern", aspath_compare(pattern, 0, paths, paths_cnt) == 1);
+
+  for (i = 0; i < paths_cnt; i++) {
+    bgpstream_as_path_destroy(paths[i]);
+  }
+  return 0;
+}
+
+/* check a community set against each community filter in turn, as is done
+   when the filters are not indexed */
+static int community_scan(bgpstream_filter_mgr_t *mgr,
+                          bgpstream_community_set_t *set)
+{
+  khiter_t k;
+
+  for (k = kh_begin(mgr->communities); k != kh_end(mgr->communities); ++k) {
+    if (kh_exist(mgr->communities, k) &&
+        bgpstream_community_set_match(set, &kh_key(mgr->communities, k),
+                                      kh_value(mgr->communities, k))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int test_community_index()
+{
+  bgpstream_elem_t *elem;
+  bgpstream_community_t comm;
+  char filters[128];
+  char *filter, *next;
+  int added, same, matches;
+  int i, j, cnt;
+
+  CHECK("elem create", (elem = bgpstream_elem_create()) != NULL);
+  elem->type = BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT;
+
+  for (i = 0; community_filters[i] != NULL; i++) {
+    mgr = bgpstream_filter_mgr_create();
+    strcpy(filters, community_filters[i]);
+    added = 1;
+    for (filter = filters; filter != NULL; filter = next) {
+      if ((next = strchr(filter, ' ')) != NULL) {
+        *(next++) = '\0';
+      }
+      added &= bgpstream_filter_mgr_filter_add(
+        mgr, BGPSTREAM_FILTER_TYPE_ELEM_COMMUNITY, filter);
+    }
+    bgpstream_filter_mgr_compile(mgr);
+    CHECK("add community filters", added && mgr->communities_idx != NULL);
+
+    /* an empty community set never matches */
+    bgpstream_community_set_clear(elem->communities);
+    same = bgpstream_filter_mgr_elem_check(mgr, elem) == 0 &&
+           community_scan(mgr, elem->communities) == 0;
+
+    /* pseudo-random community sets (with up to 4 communities) */
+    srand(i);
+    matches = 0;
+    for (j = 0; j < COMMUNITY_SETS_CNT; j++) {
+      bgpstream_community_set_clear(elem->communities);
+      for (cnt = rand() % 5; cnt > 0; cnt--) {
+        comm.asn = community_parts[rand() % COMMUNITY_PARTS_CNT];
+        comm.value = community_parts[rand() % COMMUNITY_PARTS_CNT];
+        bgpstream_community_set_insert(elem->communities, &comm);
+      }
+      if (bgpstream_filter_mgr_elem_check(mgr, elem) !=
+          community_scan(mgr, elem->communities)) {
+        same = 0;
+      }
+      matches += community_scan(mgr, elem->communities);
+    }
+    CHECK(community_filters[i],
+          same && matches > 0 && matches < COMMUNITY_SETS_CNT);
+
+    bgpstream_filter_mgr_destroy(mgr);
+    mgr = NULL;
+  }
+
+  bgpstream_elem_destroy(elem);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("filter plan re-ordering", test_plan_reorder() == 0);
+  CHECK_SECTION("AS path patterns", test_aspath_patterns() == 0);
+  CHECK_SECTION("community filter index", test_community_index() == 0);
+
+  ENDTEST;
+  return 0;
+}
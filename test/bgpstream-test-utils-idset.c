@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* large enough for the set to switch from a hash to a bitmap, and for some of
+   the bitmap containers to switch from arrays to bitmaps */
+#define LARGE_SET_SIZE 100000
+
+/* IDs spread over several containers, dense in the low ones */
+#define LARGE_SET_ID(i) ((i) < 50000 ? (uint32_t)(i) : (uint32_t)(i)*7919)
+
+static int test_id_set_small()
+{
+  bgpstream_id_set_t *set;
+  int cnt = 0;
+
+  CHECK("id_set_create", (set = bgpstream_id_set_create()) != NULL);
+  if (set == NULL) {
+    return -1;
+  }
+
+  CHECK("id_set_insert", bgpstream_id_set_insert(set, 65000) == 1);
+  CHECK("id_set_insert", bgpstream_id_set_insert(set, 4200000000) == 1);
+  CHECK("id_set_insert dup", bgpstream_id_set_insert(set, 65000) == 0);
+  CHECK("id_set_exists", bgpstream_id_set_exists(set, 65000) &&
+                           bgpstream_id_set_exists(set, 4200000000) &&
+                           !bgpstream_id_set_exists(set, 3356));
+  CHECK("id_set_size", bgpstream_id_set_size(set) == 2);
+
+  bgpstream_id_set_rewind(set);
+  while (bgpstream_id_set_next(set) != NULL) {
+    cnt++;
+  }
+  CHECK("id_set iteration", cnt == 2);
+
+  bgpstream_id_set_clear(set);
+  CHECK("id_set_clear", bgpstream_id_set_size(set) == 0 &&
+                          !bgpstream_id_set_exists(set, 65000));
+
+  bgpstream_id_set_destroy(set);
+  return 0;
+}
+
+static int test_id_set_large()
+{
+  bgpstream_id_set_t *set;
+  uint32_t *id;
+  uint32_t last = 0;
+  int sorted = 1;
+  int found = 1;
+  int cnt = 0;
+  int i;
+
+  CHECK("id_set_create", (set = bgpstream_id_set_create()) != NULL);
+  if (set == NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < LARGE_SET_SIZE; i++) {
+    if (bgpstream_id_set_insert(set, LARGE_SET_ID(i)) != 1) {
+      found = 0;
+    }
+  }
+  CHECK("id_set_insert large", found);
+  CHECK("id_set_insert large dup",
+        bgpstream_id_set_insert(set, LARGE_SET_ID(0)) == 0 &&
+          bgpstream_id_set_insert(set, LARGE_SET_ID(LARGE_SET_SIZE - 1)) == 0);
+  CHECK("id_set_size large", bgpstream_id_set_size(set) == LARGE_SET_SIZE);
+
+  for (i = 0; i < LARGE_SET_SIZE; i++) {
+    if (!bgpstream_id_set_exists(set, LARGE_SET_ID(i))) {
+      found = 0;
+    }
+  }
+  CHECK("id_set_exists large", found);
+  CHECK("id_set_exists large missing",
+        !bgpstream_id_set_exists(set, 50000) &&
+          !bgpstream_id_set_exists(set, 7919 * 50000 + 1) &&
+          !bgpstream_id_set_exists(set, UINT32_MAX));
+
+  bgpstream_id_set_rewind(set);
+  while ((id = bgpstream_id_set_next(set)) != NULL) {
+    if (cnt > 0 && *id <= last) {
+      sorted = 0;
+    }
+    last = *id;
+    cnt++;
+  }
+  CHECK("id_set iteration large", cnt == LARGE_SET_SIZE && sorted);
+
+  bgpstream_id_set_clear(set);
+  CHECK("id_set_clear large", bgpstream_id_set_size(set) == 0 &&
+                                !bgpstream_id_set_exists(set, 0));
+  CHECK("id_set_insert after clear", bgpstream_id_set_insert(set, 0) == 1 &&
+                                       bgpstream_id_set_exists(set, 0));
+
+  bgpstream_id_set_destroy(set);
+  return 0;
+}
+
+static int test_id_set_ops()
+{
+  bgpstream_id_set_t *a;
+  bgpstream_id_set_t *b;
+  uint32_t *ids;
+  int found = 1;
+  int i;
+
+  if ((ids = malloc(sizeof(uint32_t) * LARGE_SET_SIZE)) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < LARGE_SET_SIZE; i++) {
+    ids[i] = LARGE_SET_ID(LARGE_SET_SIZE - 1 - i);
+  }
+
+  CHECK("id_set_create_from_array",
+        (a = bgpstream_id_set_create_from_array(ids, LARGE_SET_SIZE)) != NULL);
+  CHECK("id_set_create_from_array size",
+        bgpstream_id_set_size(a) == LARGE_SET_SIZE);
+  for (i = 0; i < LARGE_SET_SIZE; i++) {
+    if (!bgpstream_id_set_exists(a, ids[i])) {
+      found = 0;
+    }
+  }
+  CHECK("id_set_create_from_array exists", found);
+
+  /* even IDs only */
+  b = bgpstream_id_set_create();
+  for (i = 0; i < LARGE_SET_SIZE; i += 2) {
+    bgpstream_id_set_insert(b, i);
+  }
+  bgpstream_id_set_insert(b, UINT32_MAX);
+
+  CHECK("id_set_intersect", bgpstream_id_set_intersect(a, b) == 0);
+  CHECK("id_set_intersect size", bgpstream_id_set_size(a) == 25000);
+  CHECK("id_set_intersect exists",
+        bgpstream_id_set_exists(a, 0) && bgpstream_id_set_exists(a, 49998) &&
+          !bgpstream_id_set_exists(a, 1) &&
+          !bgpstream_id_set_exists(a, 50002) &&
+          !bgpstream_id_set_exists(a, UINT32_MAX));
+
+  CHECK("id_set_merge", bgpstream_id_set_merge(a, b) == 0);
+  CHECK("id_set_merge size", bgpstream_id_set_size(a) == 50001);
+  CHECK("id_set_merge exists", bgpstream_id_set_exists(a, 99998) &&
+                                 bgpstream_id_set_exists(a, UINT32_MAX) &&
+                                 !bgpstream_id_set_exists(a, 99999));
+
+  bgpstream_id_set_destroy(a);
+  bgpstream_id_set_destroy(b);
+  free(ids);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("small ID sets", test_id_set_small() == 0);
+  CHECK_SECTION("large ID sets", test_id_set_large() == 0);
+  CHECK_SECTION("ID set operations", test_id_set_ops() == 0);
+
+  ENDTEST;
+  return 0;
+}
@@ -25,11 +25,21 @@
  */
 
 #include "bgpstream_test.h"
+#include "bgpstream_filter.h"
+#include "bgpstream_int.h"
+#include "bgpstream_resource_mgr.h"
+#include "bgpstream_transport.h"
 
 #include "utils.h"
 
+#include <arpa/inet.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
 #include <wandio.h>
 
 #define singlefile_RECORDS 537347
@@ -37,6 +47,10 @@
 #define sqlite_RECORDS 538308
 #define broker_RECORDS 2153
 
+/* the dumps read by the singlefile tests */
+#define SINGLEFILE_RIB_FILE "routeviews.route-views.jinx.ribs.1427846400.bz2"
+#define SINGLEFILE_UPD_FILE "ris.rrc06.updates.1427846400.gz"
+
 static bgpstream_t *bs;
 static bgpstream_record_t *rec;
 static bgpstream_data_interface_id_t di_id = 0;
@@ -76,6 +90,135 @@ static bgpstream_data_interface_option_t *option;
     bgpstream_set_data_interface(bs, di_id);                                   \
   } while (0)
 
+/* FNV-1a, used to summarize the records returned by a stream */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* maximum number of collectors that a digest tracks separately */
+#define DIGEST_COLLECTORS_MAX 8
+
+/* summary of the valid records returned by a stream, used to check that two
+   streams return the same records (and in the same order) */
+typedef struct stream_digest {
+  /* number of valid records */
+  uint64_t records_cnt;
+  /* hash of the sequence of records */
+  uint64_t order_hash;
+  /* sum of the hashes of the records (i.e. independent of their order) */
+  uint64_t set_hash;
+  /* hash of the sequence of record times */
+  uint64_t time_hash;
+  /* hash of the sequence of records of each collector */
+  struct {
+    char name[BGPSTREAM_UTILS_STR_NAME_LEN];
+    uint64_t order_hash;
+  } collectors[DIGEST_COLLECTORS_MAX];
+  int collectors_cnt;
+} stream_digest_t;
+
+static uint64_t hash_bytes(uint64_t h, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ p[i]) * FNV_PRIME;
+  }
+  return h;
+}
+
+#define HASH_FIELD(h, field) hash_bytes((h), &(field), sizeof(field))
+#define HASH_STR(h, str) hash_bytes((h), (str), strlen(str))
+
+/* hash the fields of a record and its first elem (which consumes the elem) */
+static uint64_t record_hash(bgpstream_record_t *record)
+{
+  char buf[65536];
+  bgpstream_elem_t *elem;
+  uint64_t h = FNV_OFFSET;
+
+  h = HASH_STR(h, record->project_name);
+  h = HASH_STR(h, record->collector_name);
+  h = HASH_STR(h, record->router_name);
+  h = HASH_FIELD(h, record->type);
+  h = HASH_FIELD(h, record->status);
+  h = HASH_FIELD(h, record->dump_pos);
+  h = HASH_FIELD(h, record->dump_time_sec);
+  h = HASH_FIELD(h, record->time_sec);
+  h = HASH_FIELD(h, record->time_usec);
+
+  /* records of a dump often only differ in their elems */
+  if (bgpstream_record_get_next_elem(record, &elem) > 0 &&
+      bgpstream_elem_snprintf(buf, sizeof(buf), elem) != NULL) {
+    h = HASH_STR(h, buf);
+  }
+  return h;
+}
+
+static void digest_init(stream_digest_t *d)
+{
+  memset(d, 0, sizeof(*d));
+  d->order_hash = FNV_OFFSET;
+  d->time_hash = FNV_OFFSET;
+}
+
+static void digest_add(stream_digest_t *d, bgpstream_record_t *record)
+{
+  uint64_t h = record_hash(record);
+  int i;
+
+  d->records_cnt++;
+  d->order_hash = HASH_FIELD(d->order_hash, h);
+  d->set_hash += h;
+  d->time_hash = HASH_FIELD(d->time_hash, record->time_sec);
+  d->time_hash = HASH_FIELD(d->time_hash, record->time_usec);
+
+  for (i = 0; i < d->collectors_cnt; i++) {
+    if (strcmp(d->collectors[i].name, record->collector_name) == 0) {
+      break;
+    }
+  }
+  if (i == d->collectors_cnt) {
+    if (i == DIGEST_COLLECTORS_MAX) {
+      return;
+    }
+    strcpy(d->collectors[i].name, record->collector_name);
+    d->collectors[i].order_hash = FNV_OFFSET;
+    d->collectors_cnt++;
+  }
+  d->collectors[i].order_hash = HASH_FIELD(d->collectors[i].order_hash, h);
+}
+
+/* the streams returned the same records in the same order */
+static int digest_same_order(stream_digest_t *a, stream_digest_t *b)
+{
+  return a->records_cnt == b->records_cnt && a->order_hash == b->order_hash &&
+         a->set_hash == b->set_hash;
+}
+
+/* the streams returned the same records, in any order */
+static int digest_same_set(stream_digest_t *a, stream_digest_t *b)
+{
+  return a->records_cnt == b->records_cnt && a->set_hash == b->set_hash;
+}
+
+/* read the (configured) stream to the end, summarizing its valid records */
+static int read_stream(stream_digest_t *d)
+{
+  int ret;
+
+  digest_init(d);
+  if (bgpstream_start(bs) != 0) {
+    return -1;
+  }
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      digest_add(d, rec);
+    }
+  }
+  return ret;
+}
+
 static int test_bgpstream()
 {
   CHECK("BGPStream create", (bs = bgpstream_create()) != NULL);
@@ -95,21 +238,1408 @@ static int test_singlefile()
         (option = bgpstream_get_data_interface_option_by_name(
            bs, di_id, "rib-file")) != NULL);
   CHECK("set option (rib-file)",
-        bgpstream_set_data_interface_option(
-          bs, option, "routeviews.route-views.jinx.ribs.1427846400.bz2") == 0);
+        bgpstream_set_data_interface_option(bs, option,
+                                            SINGLEFILE_RIB_FILE) == 0);
 
   CHECK("get option (upd-file)",
         (option = bgpstream_get_data_interface_option_by_name(
            bs, di_id, "upd-file")) != NULL);
   CHECK("set option (upd-file)",
-        bgpstream_set_data_interface_option(
-          bs, option, "ris.rrc06.updates.1427846400.gz") == 0);
+        bgpstream_set_data_interface_option(bs, option,
+                                            SINGLEFILE_UPD_FILE) == 0);
 
   RUN(singlefile);
 
   TEARDOWN;
   return 0;
 }
+
+/* configure the given stream to read the singlefile dumps (without CHECKs, so
+   that it can be used from any thread) */
+static int singlefile_configure(bgpstream_t *stream)
+{
+  bgpstream_data_interface_id_t id;
+  bgpstream_data_interface_option_t *opt;
+
+  if ((id = bgpstream_get_data_interface_id_by_name(stream, "singlefile")) ==
+      0) {
+    return -1;
+  }
+  bgpstream_set_data_interface(stream, id);
+
+  if ((opt = bgpstream_get_data_interface_option_by_name(stream, id,
+                                                         "rib-file")) ==
+        NULL ||
+      bgpstream_set_data_interface_option(stream, opt, SINGLEFILE_RIB_FILE) !=
+        0) {
+    return -1;
+  }
+  if ((opt = bgpstream_get_data_interface_option_by_name(stream, id,
+                                                         "upd-file")) ==
+        NULL ||
+      bgpstream_set_data_interface_option(stream, opt, SINGLEFILE_UPD_FILE) !=
+        0) {
+    return -1;
+  }
+  return 0;
+}
+
+/* number of resources that the singlefile dumps are read from */
+#define SINGLEFILE_RESOURCES 2
+
+/* number of records held by the record hold modes */
+#define MODE_HOLD 8
+
+/* maximum number of records in each batch of the batch modes */
+#define MODE_BATCH_SIZE 64
+
+/* interval read by the parallel modes. it holds all of the singlefile records
+   (the RIB records are all at the dump time, and the last update is at
+   1427846699), and each partition gets some of the updates */
+#define MODE_PARALLEL_BEGIN 1427846400
+#define MODE_PARALLEL_END 1427846699
+#define MODE_PARALLEL_PARTITIONS 3
+
+/* how the records of a mode are read */
+typedef enum {
+  /* one at a time, using bgpstream_get_next_record */
+  MODE_READ_NEXT,
+  /* one at a time, holding the last MODE_HOLD records */
+  MODE_READ_HOLD,
+  /* in time order, using bgpstream_parallel_get_next_record */
+  MODE_READ_PARALLEL,
+  /* concurrently, using bgpstream_parallel_run */
+  MODE_READ_PARALLEL_RUN,
+  /* one at a time, then checking the stats against the records */
+  MODE_READ_STATS,
+  /* MODE_BATCH_SIZE at a time, using bgpstream_get_next_records */
+  MODE_READ_BATCH,
+} mode_read_t;
+
+/* what a mode must return, compared to the default stream */
+typedef enum {
+  /* the same records, in the same order */
+  MODE_SAME_ORDER,
+  /* the same records, in any order */
+  MODE_SAME_SET,
+} mode_compare_t;
+
+static int mode_one_opener(bgpstream_t *stream)
+{
+  return bgpstream_set_reader_concurrency(stream, 1);
+}
+
+static int mode_readahead(bgpstream_t *stream)
+{
+  return bgpstream_set_reader_readahead(stream, 16);
+}
+
+static int mode_readahead_one(bgpstream_t *stream)
+{
+  return bgpstream_set_reader_readahead(stream, 1);
+}
+
+static int mode_shards(bgpstream_t *stream)
+{
+  return bgpstream_set_merge_shards(stream, 4);
+}
+
+static int mode_shards_readahead(bgpstream_t *stream)
+{
+  return (bgpstream_set_merge_shards(stream, 4) == 0 &&
+          bgpstream_set_reader_readahead(stream, 16) == 0)
+           ? 0
+           : -1;
+}
+
+static int mode_per_resource(bgpstream_t *stream)
+{
+  return bgpstream_set_ordering(stream, BGPSTREAM_ORDER_PER_RESOURCE);
+}
+
+static int mode_unordered(bgpstream_t *stream)
+{
+  return (bgpstream_set_ordering(stream, BGPSTREAM_ORDER_NONE) == 0 &&
+          bgpstream_set_reader_readahead(stream, 16) == 0)
+           ? 0
+           : -1;
+}
+
+static int mode_lookahead(bgpstream_t *stream)
+{
+  return bgpstream_set_lookahead(stream, 2, 0);
+}
+
+static int mode_lookahead_bounded(bgpstream_t *stream)
+{
+  return (bgpstream_set_lookahead(stream, 2, 4) == 0 &&
+          bgpstream_set_reader_readahead(stream, 16) == 0)
+           ? 0
+           : -1;
+}
+
+static int mode_hold(bgpstream_t *stream)
+{
+  return bgpstream_set_record_hold(stream, MODE_HOLD);
+}
+
+static int mode_hold_readahead(bgpstream_t *stream)
+{
+  return (bgpstream_set_record_hold(stream, MODE_HOLD) == 0 &&
+          bgpstream_set_reader_readahead(stream, 16) == 0)
+           ? 0
+           : -1;
+}
+
+/* totals of the counters given to the resource stats callback */
+static struct {
+  int calls;
+  uint64_t records_valid;
+} resource_stats;
+
+static void mode_resource_stats_cb(const char *project, const char *collector,
+                                   const char *url,
+                                   const bgpstream_stats_t *stats, void *user)
+{
+  resource_stats.calls++;
+  resource_stats.records_valid += stats->records_valid;
+}
+
+static int mode_stats(bgpstream_t *stream)
+{
+  memset(&resource_stats, 0, sizeof(resource_stats));
+  bgpstream_set_resource_stats_cb(stream, mode_resource_stats_cb, NULL);
+  return 0;
+}
+
+static int mode_stats_shards(bgpstream_t *stream)
+{
+  return (mode_stats(stream) == 0 && mode_shards_readahead(stream) == 0) ? 0
+                                                                         : -1;
+}
+
+static int mode_batch(bgpstream_t *stream)
+{
+  return bgpstream_set_batch_size(stream, MODE_BATCH_SIZE);
+}
+
+static int mode_batch_unordered(bgpstream_t *stream)
+{
+  return (mode_batch(stream) == 0 && mode_unordered(stream) == 0) ? 0 : -1;
+}
+
+static int mode_decode_threads(bgpstream_t *stream)
+{
+  return bgpstream_set_decode_threads(stream, 4);
+}
+
+static int mode_decode_threads_readahead(bgpstream_t *stream)
+{
+  return (mode_decode_threads(stream) == 0 && mode_readahead(stream) == 0)
+           ? 0
+           : -1;
+}
+
+/* the ways of reading the singlefile dumps that must return the same records
+   as the default stream */
+static const struct singlefile_mode {
+  const char *name;
+  /* configures the mode on top of the singlefile dumps (may be NULL) */
+  int (*config)(bgpstream_t *stream);
+  mode_read_t read;
+  mode_compare_t compare;
+} singlefile_modes[] = {
+  /* the resource heap must merge the dumps the same way every time */
+  {"default", NULL, MODE_READ_NEXT, MODE_SAME_ORDER},
+  /* the opener pool opens both dumps with a single thread */
+  {"reader concurrency 1", mode_one_opener, MODE_READ_NEXT, MODE_SAME_ORDER},
+  /* each dump is decoded ahead by its own thread (and with a single record
+     ahead, the consumer keeps catching up with it) */
+  {"readahead 16", mode_readahead, MODE_READ_NEXT, MODE_SAME_ORDER},
+  {"readahead 1", mode_readahead_one, MODE_READ_NEXT, MODE_SAME_ORDER},
+  /* both dumps belong to the same collector, so they are merged by the same
+     shard and there are no ties between shards to reorder */
+  {"merge shards 4", mode_shards, MODE_READ_NEXT, MODE_SAME_ORDER},
+  {"merge shards 4, readahead 16", mode_shards_readahead, MODE_READ_NEXT,
+   MODE_SAME_ORDER},
+  /* lookahead must not change the order of the groups it opens (and with a
+     budget that is smaller than the readahead, it cannot open any) */
+  {"lookahead 2", mode_lookahead, MODE_READ_NEXT, MODE_SAME_ORDER},
+  {"lookahead 2, 4 records, readahead 16", mode_lookahead_bounded,
+   MODE_READ_NEXT, MODE_SAME_ORDER},
+  /* held records must stay valid while the following ones are read */
+  {"record hold 8", mode_hold, MODE_READ_HOLD, MODE_SAME_ORDER},
+  {"record hold 8, readahead 16", mode_hold_readahead, MODE_READ_HOLD,
+   MODE_SAME_ORDER},
+  /* the partitions are returned one after another, or (when they are run)
+     interleaved */
+  {"parallel", NULL, MODE_READ_PARALLEL, MODE_SAME_ORDER},
+  {"parallel, readahead 16", mode_readahead, MODE_READ_PARALLEL,
+   MODE_SAME_ORDER},
+  {"parallel run", NULL, MODE_READ_PARALLEL_RUN, MODE_SAME_SET},
+  /* the counters must add up to the records that were returned (and merge
+     shards report the resources they finish to the consumer) */
+  {"stats", mode_stats, MODE_READ_STATS, MODE_SAME_ORDER},
+  {"stats, merge shards 4, readahead 16", mode_stats_shards, MODE_READ_STATS,
+   MODE_SAME_ORDER},
+  /* the RIB records are decoded by a pool of threads, but must still be
+     returned in file order */
+  {"decode threads 4", mode_decode_threads, MODE_READ_NEXT, MODE_SAME_ORDER},
+  {"decode threads 4, readahead 16", mode_decode_threads_readahead,
+   MODE_READ_NEXT, MODE_SAME_ORDER},
+  /* every record of a batch must stay valid until the next batch */
+  {"batch 64", mode_batch, MODE_READ_BATCH, MODE_SAME_ORDER},
+  /* the dumps are not merged, so only the set of records is the same */
+  {"per-resource order", mode_per_resource, MODE_READ_NEXT, MODE_SAME_SET},
+  {"no order, readahead 16", mode_unordered, MODE_READ_NEXT, MODE_SAME_SET},
+  {"batch 64, no order, readahead 16", mode_batch_unordered, MODE_READ_BATCH,
+   MODE_SAME_SET},
+};
+
+#define SINGLEFILE_MODES_CNT ARR_CNT(singlefile_modes)
+
+/* summarize a held record, and release it */
+static void release_held(stream_digest_t *d, bgpstream_record_t *record)
+{
+  if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+    digest_add(d, record);
+  }
+  bgpstream_release_record(bs);
+}
+
+/* read the (configured) stream, only summarizing each record once MODE_HOLD - 1
+   more records have been read */
+static int read_stream_held(stream_digest_t *d)
+{
+  bgpstream_record_t *held[MODE_HOLD];
+  uint64_t in = 0, out = 0;
+  int ret;
+
+  if (bgpstream_start(bs) != 0) {
+    return -1;
+  }
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    held[in++ % MODE_HOLD] = rec;
+    if (in - out == MODE_HOLD) {
+      release_held(d, held[out++ % MODE_HOLD]);
+    }
+  }
+  while (out < in) {
+    release_held(d, held[out++ % MODE_HOLD]);
+  }
+  return ret;
+}
+
+/* read the (configured) stream in batches, only summarizing the records of a
+   batch once the whole batch has been read */
+static int read_stream_batch(stream_digest_t *d)
+{
+  bgpstream_record_t *records[MODE_BATCH_SIZE];
+  int ret, cnt, i;
+
+  if (bgpstream_start(bs) != 0) {
+    return -1;
+  }
+  while ((ret = bgpstream_get_next_records(bs, records, MODE_BATCH_SIZE,
+                                           &cnt)) > 0) {
+    for (i = 0; i < cnt; i++) {
+      if (records[i]->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+        digest_add(d, records[i]);
+      }
+    }
+  }
+  return ret;
+}
+
+static int mode_partition_config(bgpstream_t *stream, int partition,
+                                 void *user)
+{
+  const struct singlefile_mode *m = user;
+
+  if (singlefile_configure(stream) != 0) {
+    return -1;
+  }
+  return (m->config != NULL) ? m->config(stream) : 0;
+}
+
+/* called concurrently for different partitions, so each one has its own
+   digest */
+static int mode_partition_record(bgpstream_record_t *record, int partition,
+                                 void *user)
+{
+  stream_digest_t *parts = user;
+
+  if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+    digest_add(&parts[partition], record);
+  }
+  return 0;
+}
+
+/* read the singlefile dumps with a parallel stream */
+static int read_parallel(const struct singlefile_mode *m, stream_digest_t *d)
+{
+  stream_digest_t parts[MODE_PARALLEL_PARTITIONS];
+  bgpstream_parallel_t *p;
+  bgpstream_record_t *record;
+  int ret = -1;
+  int i;
+
+  if ((p = bgpstream_parallel_create(
+         MODE_PARALLEL_BEGIN, MODE_PARALLEL_END, MODE_PARALLEL_PARTITIONS,
+         mode_partition_config, (void *)m)) == NULL) {
+    return -1;
+  }
+
+  if (m->read == MODE_READ_PARALLEL) {
+    if (bgpstream_parallel_start(p) == 0) {
+      while ((ret = bgpstream_parallel_get_next_record(p, &record)) > 0) {
+        if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+          digest_add(d, record);
+        }
+      }
+    }
+  } else {
+    for (i = 0; i < MODE_PARALLEL_PARTITIONS; i++) {
+      digest_init(&parts[i]);
+    }
+    ret = bgpstream_parallel_run(p, mode_partition_record, parts);
+    /* only the sets of records of the partitions can be combined */
+    for (i = 0; i < MODE_PARALLEL_PARTITIONS; i++) {
+      d->records_cnt += parts[i].records_cnt;
+      d->set_hash += parts[i].set_hash;
+    }
+  }
+
+  bgpstream_parallel_destroy(p);
+  return ret;
+}
+
+/* read the singlefile dumps in the given mode */
+static int read_mode(const struct singlefile_mode *m, stream_digest_t *d)
+{
+  bgpstream_stats_t stats;
+  int ret = -1;
+
+  digest_init(d);
+  if (m->read == MODE_READ_PARALLEL || m->read == MODE_READ_PARALLEL_RUN) {
+    return read_parallel(m, d);
+  }
+
+  SETUP;
+  if (singlefile_configure(bs) != 0 ||
+      (m->config != NULL && m->config(bs) != 0)) {
+    TEARDOWN;
+    return -1;
+  }
+
+  switch (m->read) {
+  case MODE_READ_NEXT:
+    ret = read_stream(d);
+    break;
+
+  case MODE_READ_HOLD:
+    ret = read_stream_held(d);
+    break;
+
+  case MODE_READ_BATCH:
+    ret = read_stream_batch(d);
+    break;
+
+  case MODE_READ_STATS:
+    ret = read_stream(d);
+    bgpstream_get_stats(bs, &stats);
+    CHECK("resources finished (stats)",
+          stats.resources_finished == SINGLEFILE_RESOURCES);
+    CHECK("valid records (stats)", stats.records_valid == d->records_cnt);
+    CHECK("resources reported (resource stats)",
+          resource_stats.calls == SINGLEFILE_RESOURCES);
+    CHECK("valid records (resource stats)",
+          resource_stats.records_valid == d->records_cnt);
+    break;
+
+  default:
+    break;
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+static int test_singlefile_modes()
+{
+  const struct singlefile_mode *m;
+  stream_digest_t expected, d;
+  char name[256];
+  int same = 0;
+  int i;
+
+  SETUP;
+  CHECK("configure default stream", singlefile_configure(bs) == 0);
+  CHECK("read default stream", read_stream(&expected) == 0);
+  CHECK("read records (default)", expected.records_cnt == singlefile_RECORDS);
+  TEARDOWN;
+
+  for (i = 0; i < (int)SINGLEFILE_MODES_CNT; i++) {
+    m = &singlefile_modes[i];
+
+    snprintf(name, sizeof(name), "read stream (%s)", m->name);
+    CHECK(name, read_mode(m, &d) == 0);
+    snprintf(name, sizeof(name), "read records (%s)", m->name);
+    CHECK(name, d.records_cnt == singlefile_RECORDS);
+
+    switch (m->compare) {
+    case MODE_SAME_ORDER:
+      snprintf(name, sizeof(name), "same records in the same order (%s)",
+               m->name);
+      same = digest_same_order(&expected, &d);
+      break;
+
+    case MODE_SAME_SET:
+      snprintf(name, sizeof(name), "same records (%s)", m->name);
+      same = digest_same_set(&expected, &d);
+      break;
+    }
+    CHECK(name, same);
+  }
+
+  return 0;
+}
+
+/* intervals set by the configuration of a parallel stream, which is
+   intersected with each partition window: the first overlaps every partition,
+   and the second does not reach the last partition */
+static const uint32_t parallel_intervals[][2] = {
+  {1427846450, 1427846650},
+  {1427846450, 1427846550},
+};
+
+#define PARALLEL_INTERVALS_CNT ARR_CNT(parallel_intervals)
+
+/* interval set by parallel_interval_config */
+static const uint32_t *parallel_interval;
+
+static int parallel_interval_config(bgpstream_t *stream)
+{
+  return bgpstream_add_interval_filter(stream, parallel_interval[0],
+                                       parallel_interval[1])
+           ? 0
+           : -1;
+}
+
+static int test_parallel_interval()
+{
+  struct singlefile_mode m = {"parallel interval", parallel_interval_config,
+                              MODE_READ_PARALLEL, MODE_SAME_ORDER};
+  stream_digest_t expected, d;
+  int i;
+
+  for (i = 0; i < (int)PARALLEL_INTERVALS_CNT; i++) {
+    parallel_interval = parallel_intervals[i];
+
+    SETUP;
+    CHECK("configure interval stream",
+          singlefile_configure(bs) == 0 && parallel_interval_config(bs) == 0);
+    CHECK("read interval stream", read_stream(&expected) == 0);
+    CHECK("interval selects some records",
+          expected.records_cnt > 0 &&
+            expected.records_cnt < singlefile_RECORDS);
+    TEARDOWN;
+
+    m.read = MODE_READ_PARALLEL;
+    digest_init(&d);
+    CHECK("read parallel stream (parallel interval)",
+          read_parallel(&m, &d) == 0);
+    CHECK("same records in the same order (parallel interval)",
+          digest_same_order(&expected, &d));
+
+    m.read = MODE_READ_PARALLEL_RUN;
+    digest_init(&d);
+    CHECK("run parallel stream (parallel interval)",
+          read_parallel(&m, &d) == 0);
+    CHECK("same records (parallel interval)", digest_same_set(&expected, &d));
+  }
+
+  return 0;
+}
+
+/* the singlefile dumps, as given to a resource queue by the collectors that
+   dumped them (which are merged by different shards when there are
+   QUEUE_SHARDS of them) */
+#define QUEUE_DUMP_TIME 1427846400
+#define QUEUE_RIB_DURATION 120
+#define QUEUE_UPD_DURATION 300
+#define QUEUE_SHARDS 3
+
+static bgpstream_filter_mgr_t *queue_filter_mgr;
+
+/* create a resource queue with no filters */
+static bgpstream_resource_mgr_t *queue_create()
+{
+  if ((queue_filter_mgr = bgpstream_filter_mgr_create()) == NULL) {
+    return NULL;
+  }
+  bgpstream_filter_mgr_compile(queue_filter_mgr);
+  return bgpstream_resource_mgr_create(queue_filter_mgr);
+}
+
+static void queue_destroy(bgpstream_resource_mgr_t *q)
+{
+  bgpstream_resource_mgr_destroy(q);
+  bgpstream_filter_mgr_destroy(queue_filter_mgr);
+  queue_filter_mgr = NULL;
+}
+
+static int queue_push_dumps(bgpstream_resource_mgr_t *q)
+{
+  if (bgpstream_resource_mgr_push(
+        q, BGPSTREAM_RESOURCE_TRANSPORT_FILE, BGPSTREAM_RESOURCE_FORMAT_MRT,
+        SINGLEFILE_RIB_FILE, QUEUE_DUMP_TIME, QUEUE_RIB_DURATION, "routeviews",
+        "route-views.jinx", BGPSTREAM_RIB, NULL) != 1 ||
+      bgpstream_resource_mgr_push(
+        q, BGPSTREAM_RESOURCE_TRANSPORT_FILE, BGPSTREAM_RESOURCE_FORMAT_MRT,
+        SINGLEFILE_UPD_FILE, QUEUE_DUMP_TIME, QUEUE_UPD_DURATION, "ris",
+        "rrc06", BGPSTREAM_UPDATE, NULL) != 1) {
+    return -1;
+  }
+  return 0;
+}
+
+/* read every record from the queue. if hold is non-zero, up to hold records
+   are held at once (either one at a time, or in batches of the records that
+   are ready) */
+static int queue_read(bgpstream_resource_mgr_t *q, int hold, int batch,
+                      stream_digest_t *d)
+{
+  bgpstream_record_t *record;
+  int held = 0;
+  int ret;
+
+  digest_init(d);
+  while ((ret = bgpstream_resource_mgr_get_record(q, &record)) > 0) {
+    if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      digest_add(d, record);
+    }
+    if (hold == 0) {
+      continue;
+    }
+    held++;
+    if (batch != 0) {
+      while (held < hold &&
+             (ret = bgpstream_resource_mgr_get_ready_record(q, &record)) > 0) {
+        if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+          digest_add(d, record);
+        }
+        held++;
+      }
+      if (ret < 0) {
+        break;
+      }
+      for (; held > 0; held--) {
+        bgpstream_resource_mgr_release_record(q);
+      }
+    } else if (held == hold) {
+      bgpstream_resource_mgr_release_record(q);
+      held--;
+    }
+  }
+  for (; held > 0; held--) {
+    bgpstream_resource_mgr_release_record(q);
+  }
+  return ret;
+}
+
+/* the collectors of the dumps are merged by different shards, and the shards
+   must be merged in the same order as a single queue */
+static int test_merge_shards()
+{
+  bgpstream_resource_mgr_t *q;
+  stream_digest_t expected, d;
+
+  q = queue_create();
+  CHECK("read dumps",
+        q != NULL && queue_push_dumps(q) == 0 &&
+          queue_read(q, 0, 0, &expected) == 0);
+  queue_destroy(q);
+  CHECK("records from both collectors", expected.collectors_cnt == 2);
+
+  q = queue_create();
+  CHECK("read dumps (merge shards)",
+        q != NULL &&
+          bgpstream_resource_mgr_set_merge_shards(q, QUEUE_SHARDS) == 0 &&
+          queue_push_dumps(q) == 0 && queue_read(q, 0, 0, &d) == 0);
+  queue_destroy(q);
+  CHECK("same records in the same order (merge shards)",
+        digest_same_order(&expected, &d));
+
+  /* batches are filled from the shards without waiting for them */
+  q = queue_create();
+  CHECK("read dumps (merge shards, batch)",
+        q != NULL &&
+          bgpstream_resource_mgr_set_merge_shards(q, QUEUE_SHARDS) == 0 &&
+          bgpstream_resource_mgr_set_record_hold(q, MODE_BATCH_SIZE) == 0 &&
+          queue_push_dumps(q) == 0 &&
+          queue_read(q, MODE_BATCH_SIZE, 1, &d) == 0);
+  queue_destroy(q);
+  CHECK("same records in the same order (merge shards, batch)",
+        digest_same_order(&expected, &d));
+
+  return 0;
+}
+
+/* a file transport has no descriptor to wait on, so a stream resource read
+   from a file is polled periodically rather than waited on */
+static int test_poll_fd()
+{
+  bgpstream_resource_t *res;
+  bgpstream_transport_t *transport;
+
+  CHECK("create stream resource",
+        (res = bgpstream_resource_create(
+           BGPSTREAM_RESOURCE_TRANSPORT_FILE, BGPSTREAM_RESOURCE_FORMAT_MRT,
+           SINGLEFILE_UPD_FILE, QUEUE_DUMP_TIME, BGPSTREAM_FOREVER, "ris",
+           "rrc06", BGPSTREAM_UPDATE)) != NULL);
+  CHECK("create file transport",
+        (transport = bgpstream_transport_create(res, 0, 0)) != NULL);
+  CHECK("no poll descriptor", bgpstream_transport_get_poll_fd(transport) == -1);
+
+  bgpstream_transport_destroy(transport);
+  bgpstream_resource_destroy(res);
+  return 0;
+}
+
+/* read the singlefile updates dump through a resource queue, without waiting
+   for data, either as a dump or (with a duration of BGPSTREAM_FOREVER) as a
+   stream resource that never ends. finished is set if the queue is empty once
+   there are no more records. */
+static int read_resource(uint32_t duration, stream_digest_t *d, int *finished)
+{
+  bgpstream_resource_mgr_t *q;
+  bgpstream_record_t *record;
+  int ret = -1;
+
+  digest_init(d);
+  *finished = 0;
+  if ((q = queue_create()) == NULL ||
+      bgpstream_resource_mgr_push(
+        q, BGPSTREAM_RESOURCE_TRANSPORT_FILE, BGPSTREAM_RESOURCE_FORMAT_MRT,
+        SINGLEFILE_UPD_FILE, QUEUE_DUMP_TIME, duration, "ris", "rrc06",
+        BGPSTREAM_UPDATE, NULL) != 1) {
+    goto out;
+  }
+
+  while ((ret = bgpstream_resource_mgr_get_ready_record(q, &record)) > 0) {
+    if (record->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      digest_add(d, record);
+    }
+  }
+  /* asking again (while the stream is waiting to be polled) must neither
+     block nor drop the stream */
+  if (ret == 0) {
+    ret = bgpstream_resource_mgr_get_ready_record(q, &record);
+  }
+  *finished = bgpstream_resource_mgr_empty(q);
+
+out:
+  queue_destroy(q);
+  return ret;
+}
+
+/* the stream only stops because it has run out of data, so it returns the
+   records of the dump (but never marks the last one as the end of the dump) */
+static int test_stream_resource()
+{
+  stream_digest_t expected, d;
+  int finished;
+
+  CHECK("read updates dump",
+        read_resource(QUEUE_UPD_DURATION, &expected, &finished) == 0);
+  CHECK("dump finished", finished == 1 && expected.records_cnt > 0);
+
+  CHECK("read updates stream",
+        read_resource(BGPSTREAM_FOREVER, &d, &finished) == 0);
+  CHECK("stream still queued", finished == 0);
+  CHECK("same records from stream",
+        d.records_cnt == expected.records_cnt &&
+          d.time_hash == expected.time_hash);
+
+  return 0;
+}
+
+/* read the dumps from a queue with the given ordering that holds up to hold
+   records (one at a time, or in batches), setting refused if a stream
+   resource pushed before the dumps is refused */
+static int read_held_queue(bgpstream_ordering_t ordering, int hold, int batch,
+                           int *refused, stream_digest_t *d)
+{
+  bgpstream_resource_mgr_t *q;
+  int ret = -1;
+
+  if ((q = queue_create()) != NULL &&
+      bgpstream_resource_mgr_set_ordering(q, ordering) == 0 &&
+      bgpstream_resource_mgr_set_record_hold(q, hold) == 0) {
+    *refused = bgpstream_resource_mgr_push(
+                 q, BGPSTREAM_RESOURCE_TRANSPORT_FILE,
+                 BGPSTREAM_RESOURCE_FORMAT_MRT, SINGLEFILE_UPD_FILE,
+                 QUEUE_DUMP_TIME, BGPSTREAM_FOREVER, "ris", "rrc06",
+                 BGPSTREAM_UPDATE, NULL) == -1;
+    if (queue_push_dumps(q) == 0) {
+      ret = queue_read(q, hold, batch, d);
+    }
+  }
+  queue_destroy(q);
+  return ret;
+}
+
+/* a stream may have no record to return, and so would never release the
+   records held from it, so record hold refuses stream resources (whatever
+   the ordering) */
+static int test_record_hold()
+{
+  bgpstream_resource_mgr_t *q;
+  stream_digest_t expected, d;
+  int refused;
+
+  q = queue_create();
+  CHECK("read dumps",
+        q != NULL && queue_push_dumps(q) == 0 &&
+          queue_read(q, 0, 0, &expected) == 0);
+  queue_destroy(q);
+
+  refused = 0;
+  CHECK("read dumps (record hold)",
+        read_held_queue(BGPSTREAM_ORDER_TIME, MODE_HOLD, 0, &refused, &d) ==
+          0);
+  CHECK("stream refused (record hold)", refused);
+  CHECK("same records in the same order (record hold)",
+        digest_same_order(&expected, &d));
+
+  refused = 0;
+  CHECK("read dumps (record hold, no order)",
+        read_held_queue(BGPSTREAM_ORDER_NONE, MODE_HOLD, 0, &refused, &d) ==
+          0);
+  CHECK("stream refused (record hold, no order)", refused);
+  CHECK("same records (record hold, no order)",
+        digest_same_set(&expected, &d));
+
+  /* batches hold each record until the whole batch has been read */
+  refused = 0;
+  CHECK("read dumps (batch)",
+        read_held_queue(BGPSTREAM_ORDER_TIME, MODE_BATCH_SIZE, 1, &refused,
+                        &d) == 0);
+  CHECK("stream refused (batch)", refused);
+  CHECK("same records in the same order (batch)",
+        digest_same_order(&expected, &d));
+
+  return 0;
+}
+
+/* number of elems (and announcements) read from the updates dump, and of the
+   optional fields that were set in them */
+typedef struct elem_fields_count {
+  uint64_t elems;
+  uint64_t announcements;
+  uint64_t nexthop;
+  uint64_t as_path;
+  uint64_t communities;
+  uint64_t origin;
+  uint64_t med;
+  uint64_t local_pref;
+  uint64_t aggregator;
+  /* origin ASN of the first announcement with an AS path */
+  uint32_t origin_asn;
+} elem_fields_count_t;
+
+/* read the elems of the updates dump with the given elem fields (and filter,
+   if it is not NULL) */
+static int read_elem_fields(uint32_t fields, bgpstream_filter_type_t type,
+                            const char *filter, elem_fields_count_t *c)
+{
+  bgpstream_elem_t *elem;
+  int ret;
+
+  memset(c, 0, sizeof(*c));
+
+  SETUP;
+
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (upd-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "upd-file")) != NULL);
+  CHECK("set option (upd-file)",
+        bgpstream_set_data_interface_option(bs, option, SINGLEFILE_UPD_FILE) ==
+          0);
+  bgpstream_set_elem_fields(bs, fields);
+  if (filter != NULL) {
+    CHECK("add filter", bgpstream_add_filter(bs, type, filter) != 0);
+  }
+
+  CHECK("start stream", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      c->elems++;
+      if (elem->type != BGPSTREAM_ELEM_TYPE_ANNOUNCEMENT) {
+        continue;
+      }
+      c->announcements++;
+      c->nexthop += (elem->nexthop.version != 0);
+      c->as_path += (bgpstream_as_path_get_len(elem->as_path) != 0);
+      c->communities += (bgpstream_community_set_size(elem->communities) != 0);
+      c->origin += elem->has_origin;
+      c->med += elem->has_med;
+      c->local_pref += elem->has_local_pref;
+      c->aggregator +=
+        (elem->atomic_aggregate || elem->aggregator.has_aggregator);
+      if (c->origin_asn == 0 &&
+          bgpstream_as_path_get_origin_val(elem->as_path, &c->origin_asn) !=
+            0) {
+        c->origin_asn = 0;
+      }
+    }
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+/* fields that are not selected are left unset (including the next-hop of
+   MP_REACH announcements), unless an elem filter needs them */
+static int test_elem_fields()
+{
+  elem_fields_count_t all, c;
+  char filter[32];
+
+  CHECK("read elems (all fields)",
+        read_elem_fields(BGPSTREAM_ELEM_FIELD_ALL, 0, NULL, &all) == 0);
+  CHECK("fields set (all fields)",
+        all.announcements > 0 && all.nexthop == all.announcements &&
+          all.as_path > 0 && all.origin > 0 && all.origin_asn != 0);
+
+  CHECK("read elems (no fields)", read_elem_fields(0, 0, NULL, &c) == 0);
+  CHECK("same elems (no fields)",
+        c.elems == all.elems && c.announcements == all.announcements);
+  CHECK("no fields set (no fields)",
+        c.nexthop == 0 && c.as_path == 0 && c.communities == 0 &&
+          c.origin == 0 && c.med == 0 && c.local_pref == 0 &&
+          c.aggregator == 0);
+
+  CHECK("read elems (next-hop)",
+        read_elem_fields(BGPSTREAM_ELEM_FIELD_NEXTHOP, 0, NULL, &c) == 0);
+  CHECK("only next-hop set (next-hop)",
+        c.nexthop == all.nexthop && c.as_path == 0 && c.origin == 0);
+
+  CHECK("read elems (origin)",
+        read_elem_fields(BGPSTREAM_ELEM_FIELD_ORIGIN, 0, NULL, &c) == 0);
+  CHECK("only origin set (origin)",
+        c.origin == all.origin && c.nexthop == 0 && c.as_path == 0);
+
+  /* the AS path filters need the AS path, whether it was selected or not */
+  snprintf(filter, sizeof(filter), "%" PRIu32, all.origin_asn);
+  CHECK("read elems (origin ASN filter)",
+        read_elem_fields(0, BGPSTREAM_FILTER_TYPE_ELEM_ORIGIN_ASN, filter,
+                         &c) == 0);
+  CHECK("AS path set (origin ASN filter)",
+        c.announcements > 0 && c.as_path == c.announcements &&
+          c.nexthop == 0 && c.communities == 0);
+
+  snprintf(filter, sizeof(filter), "_%" PRIu32 "_", all.origin_asn);
+  CHECK("read elems (AS path filter)",
+        read_elem_fields(0, BGPSTREAM_FILTER_TYPE_ELEM_ASPATH, filter, &c) ==
+          0);
+  CHECK("AS path set (AS path filter)",
+        c.announcements > 0 && c.as_path == c.announcements &&
+          c.nexthop == 0 && c.communities == 0);
+
+  return 0;
+}
+
+/* synthetic TABLE_DUMP_V2 RIB dumps, written one record at a time */
+#define TD2_TIME 1427846400
+
+/* bytes in a RIB entry written by put_rib_entry */
+#define TD2_RIB_ENTRY_LEN 32
+
+static size_t put16(uint8_t *buf, uint16_t val)
+{
+  buf[0] = val >> 8;
+  buf[1] = val;
+  return 2;
+}
+
+static size_t put32(uint8_t *buf, uint32_t val)
+{
+  put16(buf, val >> 16);
+  put16(buf + 2, val);
+  return 4;
+}
+
+/* write a TABLE_DUMP_V2 record */
+static int write_td2(FILE *fp, uint16_t subtype, const uint8_t *body,
+                     size_t len)
+{
+  uint8_t hdr[12];
+
+  put32(hdr, TD2_TIME);
+  put16(hdr + 4, 13);
+  put16(hdr + 6, subtype);
+  put32(hdr + 8, len);
+  return (fwrite(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) &&
+          fwrite(body, 1, len, fp) == len)
+           ? 0
+           : -1;
+}
+
+/* write a PEER_INDEX_TABLE with one (IPv4, 4-byte ASN) peer */
+static int write_peer_table(FILE *fp, uint32_t peer_ip, uint32_t peer_asn)
+{
+  uint8_t body[32];
+  size_t len;
+
+  len = put32(body, 0xC0000201);
+  len += put16(body + len, 0);
+  len += put16(body + len, 1);
+  body[len++] = 0x02;
+  len += put32(body + len, peer_ip);
+  len += put32(body + len, peer_ip);
+  len += put32(body + len, peer_asn);
+  return write_td2(fp, 1, body, len);
+}
+
+/* put a RIB entry from the only peer, with ORIGIN, AS_PATH and NEXT_HOP
+   attributes */
+static size_t put_rib_entry(uint8_t *buf, uint32_t peer_ip, uint32_t peer_asn)
+{
+  size_t len;
+
+  len = put16(buf, 0);
+  len += put32(buf + len, TD2_TIME);
+  len += put16(buf + len, 24);
+  buf[len++] = 0x40;
+  buf[len++] = 1;
+  buf[len++] = 1;
+  buf[len++] = 0;
+  buf[len++] = 0x40;
+  buf[len++] = 2;
+  buf[len++] = 10;
+  buf[len++] = 2;
+  buf[len++] = 2;
+  len += put32(buf + len, peer_asn);
+  len += put32(buf + len, 65100);
+  buf[len++] = 0x40;
+  buf[len++] = 3;
+  buf[len++] = 4;
+  len += put32(buf + len, peer_ip);
+  return len;
+}
+
+/* write a RIB_IPV4_UNICAST record for the /24 at pfx, with entries RIB
+   entries */
+static int write_rib(FILE *fp, uint32_t seq, uint32_t pfx, int entries,
+                     uint32_t peer_ip, uint32_t peer_asn)
+{
+  uint8_t *body;
+  size_t len;
+  int i, ret;
+
+  if ((body = malloc(10 + (size_t)entries * TD2_RIB_ENTRY_LEN)) == NULL) {
+    return -1;
+  }
+  len = put32(body, seq);
+  body[len++] = 24;
+  body[len++] = pfx >> 24;
+  body[len++] = pfx >> 16;
+  body[len++] = pfx >> 8;
+  len += put16(body + len, entries);
+  for (i = 0; i < entries; i++) {
+    len += put_rib_entry(body + len, peer_ip, peer_asn);
+  }
+  ret = write_td2(fp, 2, body, len);
+  free(body);
+  return ret;
+}
+
+/* a RIB dump with one record that is larger than the initial 1MB decode
+   buffer. the small records before it move the read position into the
+   buffer, and those after it are enough to wrap the 2MB buffer that it is
+   grown to, so records are read across the end of the (mirrored) buffer */
+#define LARGE_RECORD_FILE "large-record-test.ribs.1427846400"
+#define LARGE_RECORD_BEFORE 10000
+#define LARGE_RECORD_ENTRIES 50000
+#define LARGE_RECORD_AFTER 50000
+#define LARGE_RECORD_PEER_IP 0xC0000202
+#define LARGE_RECORD_ASN 65001
+
+/* the /24 of the i'th small record (10.0.0.0/24 onwards), and of the large
+   record */
+#define LARGE_RECORD_SMALL_PFX(i) (0x0A000000 | ((uint32_t)(i) << 8))
+#define LARGE_RECORD_PFX 0x0B000000
+
+static int write_large_record()
+{
+  FILE *fp;
+  int i, ret = 0;
+
+  if ((fp = fopen(LARGE_RECORD_FILE, "wb")) == NULL) {
+    return -1;
+  }
+  ret |= write_peer_table(fp, LARGE_RECORD_PEER_IP, LARGE_RECORD_ASN);
+  for (i = 0; i < LARGE_RECORD_BEFORE + LARGE_RECORD_AFTER; i++) {
+    if (i == LARGE_RECORD_BEFORE) {
+      ret |= write_rib(fp, i, LARGE_RECORD_PFX, LARGE_RECORD_ENTRIES,
+                       LARGE_RECORD_PEER_IP, LARGE_RECORD_ASN);
+    }
+    ret |= write_rib(fp, i, LARGE_RECORD_SMALL_PFX(i), 1,
+                     LARGE_RECORD_PEER_IP, LARGE_RECORD_ASN);
+  }
+  if (fclose(fp) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+/* read the dump, counting the records whose elems are the ones that were
+   written (in the order they were written) */
+static int large_record_read(int threads, int use_mmap, int *small, int *large)
+{
+  bgpstream_elem_t *elem;
+  uint32_t pfx;
+  int elems, ret;
+
+  *small = 0;
+  *large = 0;
+
+  SETUP;
+
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (rib-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "rib-file")) != NULL);
+  CHECK("set option (rib-file)",
+        bgpstream_set_data_interface_option(bs, option, LARGE_RECORD_FILE) ==
+          0);
+  bgpstream_set_mmap(bs, use_mmap);
+  if (threads != 0) {
+    CHECK("set decode threads",
+          bgpstream_set_decode_threads(bs, threads) == 0);
+  }
+
+  CHECK("start stream", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    /* the large record comes after LARGE_RECORD_BEFORE small records */
+    pfx = (*small == LARGE_RECORD_BEFORE && *large == 0)
+            ? LARGE_RECORD_PFX
+            : LARGE_RECORD_SMALL_PFX(*small);
+    elems = 0;
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      if (elem->prefix.address.version != BGPSTREAM_ADDR_VERSION_IPV4 ||
+          ntohl(elem->prefix.bs_ipv4.address.addr.s_addr) != pfx ||
+          elem->peer_asn != LARGE_RECORD_ASN) {
+        break;
+      }
+      elems++;
+    }
+    if (elems == 0) {
+      /* the peer index table */
+      continue;
+    }
+    if (pfx == LARGE_RECORD_PFX && elems == LARGE_RECORD_ENTRIES) {
+      (*large)++;
+    } else if (pfx != LARGE_RECORD_PFX && elems == 1) {
+      (*small)++;
+    }
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+/* a record that does not fit in the decode buffer grows it, and the records
+   after it are read across the end of the grown buffer (whether the dump,
+   which is not compressed, is read or mapped) */
+static int test_large_record()
+{
+  static const int threads[] = {0, 4};
+  int small, large;
+  int use_mmap;
+  int i;
+
+  CHECK("write large record dump", write_large_record() == 0);
+
+  for (i = 0; i < (int)ARR_CNT(threads); i++) {
+    for (use_mmap = 0; use_mmap <= 1; use_mmap++) {
+      CHECK("read large record dump",
+            large_record_read(threads[i], use_mmap, &small, &large) == 0);
+      CHECK("large record read", large == 1);
+      CHECK("small records read in order",
+            small == LARGE_RECORD_BEFORE + LARGE_RECORD_AFTER);
+    }
+  }
+
+  unlink(LARGE_RECORD_FILE);
+  return 0;
+}
+
+/* a copy of the updates dump that can be indexed (and modified) */
+#define TIME_INDEX_FILE "time-index-test.updates.1427846400.bz2"
+#define TIME_INDEX_INDEX_FILE TIME_INDEX_FILE ".bsidx"
+
+/* an interval that starts well after the first index entry of the file, and
+   ends before the end of the file */
+#define TIME_INDEX_BEGIN 1427846800
+#define TIME_INDEX_END 1427846999
+
+static int copy_file(const char *src, const char *dst)
+{
+  char buf[65536];
+  FILE *in, *out;
+  size_t len;
+  int ret = 0;
+
+  if ((in = fopen(src, "rb")) == NULL) {
+    return -1;
+  }
+  if ((out = fopen(dst, "wb")) == NULL) {
+    fclose(in);
+    return -1;
+  }
+  while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (fwrite(buf, 1, len, out) != len) {
+      ret = -1;
+      break;
+    }
+  }
+  if (ferror(in)) {
+    ret = -1;
+  }
+  fclose(in);
+  if (fclose(out) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+/* set the modification time of a file */
+static int set_mtime(const char *path, time_t mtime)
+{
+  struct utimbuf times;
+
+  times.actime = mtime;
+  times.modtime = mtime;
+  return utime(path, &times);
+}
+
+/* read the copy of the updates dump (only the interval if end is not 0),
+   returning the number of records that were read from the file */
+static int time_index_read(int index, uint32_t begin, uint32_t end,
+                           stream_digest_t *d, uint64_t *records_read)
+{
+  bgpstream_stats_t stats;
+  int ret;
+
+  SETUP;
+
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (upd-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "upd-file")) != NULL);
+  CHECK("set option (upd-file)",
+        bgpstream_set_data_interface_option(bs, option, TIME_INDEX_FILE) ==
+          0);
+
+  bgpstream_set_time_index(bs, index);
+  if (end != 0) {
+    bgpstream_add_interval_filter(bs, begin, end);
+  }
+
+  ret = read_stream(d);
+  bgpstream_get_stats(bs, &stats);
+  *records_read = stats.records_read;
+
+  TEARDOWN;
+  return ret;
+}
+
+static int test_time_index()
+{
+  stream_digest_t plain, indexed;
+  uint64_t plain_read, indexed_read;
+  struct stat st;
+  uint8_t size_buf[8];
+  FILE *fp;
+  int i;
+
+  unlink(TIME_INDEX_INDEX_FILE);
+  CHECK("copy updates dump",
+        copy_file("routeviews.route-views.jinx.updates.1427846400.bz2",
+                  TIME_INDEX_FILE) == 0);
+  CHECK("stat updates dump", stat(TIME_INDEX_FILE, &st) == 0);
+
+  CHECK("read interval without index",
+        time_index_read(0, TIME_INDEX_BEGIN, TIME_INDEX_END, &plain,
+                        &plain_read) == 0);
+  CHECK("records in interval", plain.records_cnt != 0);
+
+  /* a read that stops at the end of the interval does not build an index */
+  CHECK("read interval (no index yet)",
+        time_index_read(1, TIME_INDEX_BEGIN, TIME_INDEX_END, &indexed,
+                        &indexed_read) == 0);
+  CHECK("same records (no index yet)", digest_same_order(&plain, &indexed));
+  CHECK("same records read (no index yet)", indexed_read == plain_read);
+  CHECK("no index built by interval read",
+        access(TIME_INDEX_INDEX_FILE, F_OK) != 0);
+
+  /* but reading the whole file does */
+  CHECK("read whole file",
+        time_index_read(1, 0, 0, &indexed, &indexed_read) == 0);
+  CHECK("index built by whole read", access(TIME_INDEX_INDEX_FILE, F_OK) == 0);
+
+  CHECK("read interval with index",
+        time_index_read(1, TIME_INDEX_BEGIN, TIME_INDEX_END, &indexed,
+                        &indexed_read) == 0);
+  CHECK("same records (index)", digest_same_order(&plain, &indexed));
+  CHECK("fewer records read (index)", indexed_read < plain_read);
+
+  /* the index is ignored if the file has been modified since */
+  CHECK("change mtime", set_mtime(TIME_INDEX_FILE, st.st_mtime + 60) == 0);
+  CHECK("read interval with stale index (mtime)",
+        time_index_read(1, TIME_INDEX_BEGIN, TIME_INDEX_END, &indexed,
+                        &indexed_read) == 0);
+  CHECK("same records (stale mtime)", digest_same_order(&plain, &indexed));
+  CHECK("index not used (stale mtime)", indexed_read == plain_read);
+  CHECK("restore mtime", set_mtime(TIME_INDEX_FILE, st.st_mtime) == 0);
+
+  /* the index header stores the (big-endian) size of the indexed file after
+     its magic (see bgpstream_time_index.c). record a different size there
+     rather than changing the dump itself */
+  for (i = 0; i < 8; i++) {
+    size_buf[i] = ((uint64_t)st.st_size + 1) >> (8 * (7 - i));
+  }
+  CHECK("change indexed size",
+        (fp = fopen(TIME_INDEX_INDEX_FILE, "r+b")) != NULL &&
+          fseek(fp, 8, SEEK_SET) == 0 &&
+          fwrite(size_buf, 1, sizeof(size_buf), fp) == sizeof(size_buf) &&
+          fclose(fp) == 0);
+  CHECK("read interval with stale index (size)",
+        time_index_read(1, TIME_INDEX_BEGIN, TIME_INDEX_END, &indexed,
+                        &indexed_read) == 0);
+  CHECK("same records (stale size)", digest_same_order(&plain, &indexed));
+  CHECK("index not used (stale size)", indexed_read == plain_read);
+
+  unlink(TIME_INDEX_INDEX_FILE);
+  unlink(TIME_INDEX_FILE);
+  return 0;
+}
+
+/* a RIB dump with two peer index tables, each followed by RIB records from its
+   only peer (as written when a collector dumps its tables one after another) */
+#define PEER_TABLES_FILE "peer-tables-test.ribs.1427846400"
+#define PEER_TABLES_CNT 2
+#define PEER_TABLES_RIBS 3
+
+static const uint32_t peer_tables_asns[PEER_TABLES_CNT] = {65001, 65002};
+
+static int write_peer_tables()
+{
+  uint32_t peer_ip;
+  FILE *fp;
+  int t, r, ret = 0;
+
+  if ((fp = fopen(PEER_TABLES_FILE, "wb")) == NULL) {
+    return -1;
+  }
+  for (t = 0; t < PEER_TABLES_CNT; t++) {
+    /* RIB records for 10.t.r.0/24 follow each table */
+    peer_ip = 0xC0000202 + t;
+    ret |= write_peer_table(fp, peer_ip, peer_tables_asns[t]);
+    for (r = 0; r < PEER_TABLES_RIBS; r++) {
+      ret |= write_rib(fp, t * PEER_TABLES_RIBS + r,
+                       0x0A000000 | (t << 16) | (r << 8), 1, peer_ip,
+                       peer_tables_asns[t]);
+    }
+  }
+  if (fclose(fp) != 0) {
+    ret = -1;
+  }
+  return ret;
+}
+
+/* count the elems of each peer in the dump (elems from any other peer are
+   counted in counts[PEER_TABLES_CNT]) */
+static int peer_tables_read(const char *peer, int threads,
+                            int counts[PEER_TABLES_CNT + 1])
+{
+  bgpstream_elem_t *elem;
+  int ret;
+  int t;
+
+  memset(counts, 0, sizeof(int) * (PEER_TABLES_CNT + 1));
+
+  SETUP;
+
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (rib-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "rib-file")) != NULL);
+  CHECK("set option (rib-file)",
+        bgpstream_set_data_interface_option(bs, option, PEER_TABLES_FILE) ==
+          0);
+  if (peer != NULL) {
+    CHECK("add peer filter",
+          bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN,
+                               peer) != 0);
+  }
+  if (threads != 0) {
+    CHECK("set decode threads",
+          bgpstream_set_decode_threads(bs, threads) == 0);
+  }
+
+  CHECK("start stream", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      for (t = 0; t < PEER_TABLES_CNT; t++) {
+        if (elem->peer_asn == peer_tables_asns[t]) {
+          break;
+        }
+      }
+      counts[t]++;
+    }
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+/* the RIB entries of each table must be attributed to the peers of that
+   table, and a peer filter that rejects every peer of one table must not stop
+   the entries of a later table from being read */
+static int test_peer_tables()
+{
+  static const int threads[] = {0, 4};
+  int counts[PEER_TABLES_CNT + 1];
+  int i;
+
+  CHECK("write peer tables dump", write_peer_tables() == 0);
+
+  for (i = 0; i < (int)ARR_CNT(threads); i++) {
+    CHECK("read peer tables dump",
+          peer_tables_read(NULL, threads[i], counts) == 0);
+    CHECK("elems of each table",
+          counts[0] == PEER_TABLES_RIBS && counts[1] == PEER_TABLES_RIBS &&
+            counts[2] == 0);
+
+    CHECK("read peer tables dump (second peer)",
+          peer_tables_read("65002", threads[i], counts) == 0);
+    CHECK("elems of the second table only",
+          counts[0] == 0 && counts[1] == PEER_TABLES_RIBS && counts[2] == 0);
+
+    CHECK("read peer tables dump (first peer)",
+          peer_tables_read("65001", threads[i], counts) == 0);
+    CHECK("elems of the first table only",
+          counts[0] == PEER_TABLES_RIBS && counts[1] == 0 && counts[2] == 0);
+  }
+
+  unlink(PEER_TABLES_FILE);
+  return 0;
+}
 #endif
 
 #ifdef WITH_DATA_INTERFACE_CSVFILE
@@ -131,6 +1661,390 @@ static int test_csvfile()
   TEARDOWN;
   return 0;
 }
+
+/* how the elems of each record are retrieved */
+typedef enum {
+  /* bgpstream_record_get_next_elem */
+  ELEMS_NEXT,
+  /* bgpstream_record_get_elems */
+  ELEMS_ARRAY,
+  /* the first elem with bgpstream_record_get_next_elem, the rest with
+     bgpstream_record_get_elems */
+  ELEMS_MIXED,
+} elems_mode_t;
+
+/* summary of the elems returned by a stream */
+typedef struct elems_digest {
+  uint64_t elems_cnt;
+  /* hash of the sequence of elems */
+  uint64_t hash;
+  /* number of elems that could not be printed, or records for which asking
+     for the elems again did not return the same array */
+  uint64_t errors;
+} elems_digest_t;
+
+static void elems_digest_add(elems_digest_t *d, bgpstream_elem_t *elem)
+{
+  char buf[65536];
+
+  d->elems_cnt++;
+  if (bgpstream_elem_snprintf(buf, sizeof(buf), elem) == NULL) {
+    d->errors++;
+    return;
+  }
+  d->hash = HASH_STR(d->hash, buf);
+}
+
+/* read the updates dumps of the csv file, with some elem filters if asked */
+static int read_elems(elems_mode_t mode, int filters, elems_digest_t *d)
+{
+  bgpstream_elem_t *elem, *elems, *again;
+  int elems_cnt, again_cnt, i, ret;
+
+  memset(d, 0, sizeof(*d));
+  d->hash = FNV_OFFSET;
+
+  SETUP;
+
+  CHECK_SET_INTERFACE(csvfile);
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, "csv_test.csv");
+  bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_RECORD_TYPE, "updates");
+  if (filters != 0) {
+    bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_ELEM_TYPE, "announcements");
+    bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "25152");
+    bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "30844");
+    bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_ELEM_IP_VERSION, "4");
+  }
+
+  if (bgpstream_start(bs) != 0) {
+    TEARDOWN;
+    return -1;
+  }
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (mode != ELEMS_ARRAY) {
+      while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+        elems_digest_add(d, elem);
+        if (mode == ELEMS_MIXED) {
+          break;
+        }
+      }
+      if (mode == ELEMS_NEXT) {
+        continue;
+      }
+    }
+
+    if (bgpstream_record_get_elems(rec, &elems, &elems_cnt) != 0) {
+      ret = -1;
+      break;
+    }
+    for (i = 0; i < elems_cnt; i++) {
+      elems_digest_add(d, &elems[i]);
+    }
+    /* the elems are kept: asking again returns the same array, and there are
+       no elems left to iterate over */
+    if (bgpstream_record_get_elems(rec, &again, &again_cnt) != 0 ||
+        again != elems || again_cnt != elems_cnt ||
+        bgpstream_record_get_next_elem(rec, &elem) != 0) {
+      d->errors++;
+    }
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+/* the elem arrays (whose AS paths and communities are copied into an arena
+   that is reset, not freed, when the record is re-used) hold the same elems
+   as bgpstream_record_get_next_elem */
+static int test_record_elems()
+{
+  elems_digest_t next, array, mixed, unfiltered;
+  int filters;
+
+  for (filters = 0; filters <= 1; filters++) {
+    CHECK("read elems (get_next_elem)",
+          read_elems(ELEMS_NEXT, filters, &next) == 0);
+    CHECK("read elems (get_elems)",
+          read_elems(ELEMS_ARRAY, filters, &array) == 0);
+    CHECK("read elems (get_next_elem, then get_elems)",
+          read_elems(ELEMS_MIXED, filters, &mixed) == 0);
+
+    CHECK("elems read", next.elems_cnt != 0 && next.errors == 0);
+    CHECK("same number of elems (get_elems)",
+          array.elems_cnt == next.elems_cnt);
+    CHECK("same elems (get_elems)",
+          array.hash == next.hash && array.errors == 0);
+    CHECK("same number of elems (get_next_elem, then get_elems)",
+          mixed.elems_cnt == next.elems_cnt);
+    CHECK("same elems (get_next_elem, then get_elems)",
+          mixed.hash == next.hash && mixed.errors == 0);
+
+    if (filters == 0) {
+      unfiltered = next;
+    } else {
+      CHECK("elems filtered", next.elems_cnt < unfiltered.elems_cnt);
+    }
+  }
+
+  return 0;
+}
+
+#define PUSHDOWN_FILTERS_MAX 4
+
+/* filters that are applied (at least partly) before the elems of a record are
+   extracted. each set is checked against a stream without filters, whose elems
+   are checked with bgpstream_filter_mgr_elem_check (and their record time with
+   the interval, if end is not 0) by the test. */
+static const struct pushdown_set {
+  const char *name;
+  /* set if no elems are wanted */
+  int none;
+  uint32_t begin;
+  uint32_t end;
+  struct {
+    bgpstream_filter_type_t type;
+    const char *value;
+  } filters[PUSHDOWN_FILTERS_MAX];
+} pushdown_sets[] = {
+  /* messages outside the interval are skipped using their MRT header */
+  {"interval", 0, 1427846500, 1427846799, {{0, NULL}}},
+  /* RIB entries from other peers are passed over */
+  {"peer",
+   0,
+   0,
+   0,
+   {{BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "25152"},
+    {BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "30844"}}},
+  /* no peer of the RIB dumps is wanted, so their RIB records are skipped
+     without being decoded */
+  {"peer not in any dump",
+   1,
+   0,
+   0,
+   {{BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "64512"}}},
+  /* announced and withdrawn prefixes are checked as the NLRI is walked */
+  {"prefix",
+   0,
+   0,
+   0,
+   {{BGPSTREAM_FILTER_TYPE_ELEM_PREFIX_MORE, "200.0.0.0/5"},
+    {BGPSTREAM_FILTER_TYPE_ELEM_PREFIX_ANY, "2a00::/12"}}},
+  /* update messages from other peers are skipped using their BGP4MP header,
+     up to the end of the interval (which is before the end of one of the
+     update dumps) */
+  {"interval and peer",
+   0,
+   1427846600,
+   1427846999,
+   {{BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "30844"},
+    {BGPSTREAM_FILTER_TYPE_ELEM_PEER_ASN, "3856"},
+    {BGPSTREAM_FILTER_TYPE_ELEM_TYPE, "announcements"}}},
+};
+
+#define PUSHDOWN_SETS_CNT ARR_CNT(pushdown_sets)
+
+/* summary of the records of a stream that have (wanted) elems */
+typedef struct pushdown_digest {
+  uint64_t records_cnt;
+  uint64_t elems_cnt;
+  /* number of those records at each dump position */
+  uint64_t pos_cnt[BGPSTREAM_DUMP_END + 1];
+  /* sum of the hashes of the records and their elems */
+  uint64_t set_hash;
+} pushdown_digest_t;
+
+/* hash of the fields of a record that filtering must not change */
+static uint64_t pushdown_record_hash(bgpstream_record_t *record)
+{
+  uint64_t h = FNV_OFFSET;
+
+  h = HASH_STR(h, record->collector_name);
+  h = HASH_FIELD(h, record->type);
+  h = HASH_FIELD(h, record->dump_pos);
+  h = HASH_FIELD(h, record->time_sec);
+  h = HASH_FIELD(h, record->time_usec);
+  return h;
+}
+
+static void pushdown_digest_add(pushdown_digest_t *d,
+                                bgpstream_record_t *record, uint64_t h,
+                                uint64_t elems_cnt)
+{
+  if (elems_cnt == 0) {
+    return;
+  }
+  d->records_cnt++;
+  d->elems_cnt += elems_cnt;
+  if (record->dump_pos <= BGPSTREAM_DUMP_END) {
+    d->pos_cnt[record->dump_pos]++;
+  }
+  d->set_hash += h;
+}
+
+static int pushdown_same(pushdown_digest_t *a, pushdown_digest_t *b)
+{
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static int pushdown_in_interval(const struct pushdown_set *set,
+                                bgpstream_record_t *record)
+{
+  return set->end == 0 ||
+         (record->time_sec >= set->begin && record->time_sec <= set->end);
+}
+
+static void pushdown_setup()
+{
+  SETUP;
+
+  CHECK_SET_INTERFACE(csvfile);
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, "csv_test.csv");
+}
+
+/* read the dumps with the filters of a set */
+static int read_pushdown(const struct pushdown_set *set, pushdown_digest_t *d)
+{
+  char buf[65536];
+  bgpstream_elem_t *elem;
+  uint64_t h, elems_cnt;
+  int i, ret;
+
+  memset(d, 0, sizeof(*d));
+  pushdown_setup();
+  for (i = 0; i < PUSHDOWN_FILTERS_MAX && set->filters[i].value != NULL;
+       i++) {
+    bgpstream_add_filter(bs, set->filters[i].type, set->filters[i].value);
+  }
+  if (set->end != 0) {
+    bgpstream_add_interval_filter(bs, set->begin, set->end);
+  }
+
+  if (bgpstream_start(bs) != 0) {
+    TEARDOWN;
+    return -1;
+  }
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    h = pushdown_record_hash(rec);
+    elems_cnt = 0;
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      if (bgpstream_elem_snprintf(buf, sizeof(buf), elem) != NULL) {
+        h = HASH_STR(h, buf);
+      }
+      elems_cnt++;
+    }
+    pushdown_digest_add(d, rec, h, elems_cnt);
+  }
+
+  TEARDOWN;
+  return ret;
+}
+
+/* read the dumps without filters, and apply the filters of every set to the
+   elems */
+static int read_pushdown_reference(pushdown_digest_t *d)
+{
+  char buf[65536];
+  bgpstream_filter_mgr_t *mgrs[PUSHDOWN_SETS_CNT];
+  bgpstream_elem_t *elem;
+  uint64_t h[PUSHDOWN_SETS_CNT], elems_cnt[PUSHDOWN_SETS_CNT];
+  int wanted[PUSHDOWN_SETS_CNT];
+  int i, j, printed, ret = 0;
+
+  memset(mgrs, 0, sizeof(mgrs));
+  for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+    memset(&d[i], 0, sizeof(d[i]));
+    if ((mgrs[i] = bgpstream_filter_mgr_create()) == NULL) {
+      ret = -1;
+      goto done;
+    }
+    for (j = 0; j < PUSHDOWN_FILTERS_MAX &&
+                pushdown_sets[i].filters[j].value != NULL;
+         j++) {
+      if (bgpstream_filter_mgr_filter_add(
+            mgrs[i], pushdown_sets[i].filters[j].type,
+            pushdown_sets[i].filters[j].value) != 0) {
+        ret = -1;
+        goto done;
+      }
+    }
+    bgpstream_filter_mgr_compile(mgrs[i]);
+  }
+
+  pushdown_setup();
+  if (bgpstream_start(bs) != 0) {
+    TEARDOWN;
+    ret = -1;
+    goto done;
+  }
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+      wanted[i] = pushdown_in_interval(&pushdown_sets[i], rec);
+      h[i] = pushdown_record_hash(rec);
+      elems_cnt[i] = 0;
+    }
+    while (bgpstream_record_get_next_elem(rec, &elem) > 0) {
+      printed = 0;
+      for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+        if (wanted[i] == 0 ||
+            bgpstream_filter_mgr_elem_check(mgrs[i], elem) == 0) {
+          continue;
+        }
+        if (printed == 0) {
+          printed = (bgpstream_elem_snprintf(buf, sizeof(buf), elem) != NULL)
+                      ? 1
+                      : -1;
+        }
+        if (printed == 1) {
+          h[i] = HASH_STR(h[i], buf);
+        }
+        elems_cnt[i]++;
+      }
+    }
+    for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+      pushdown_digest_add(&d[i], rec, h[i], elems_cnt[i]);
+    }
+  }
+  TEARDOWN;
+
+done:
+  for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+    if (mgrs[i] != NULL) {
+      bgpstream_filter_mgr_destroy(mgrs[i]);
+    }
+  }
+  return ret;
+}
+
+/* filters that skip messages (or parts of them) before their elems are
+   extracted return the same elems, with the same dump positions, as filtering
+   each elem */
+static int test_filter_pushdown()
+{
+  pushdown_digest_t expected[PUSHDOWN_SETS_CNT], d;
+  int i;
+
+  CHECK("read without filters", read_pushdown_reference(expected) == 0);
+
+  for (i = 0; i < (int)PUSHDOWN_SETS_CNT; i++) {
+    printf("# filters: %s\n", pushdown_sets[i].name);
+    CHECK("read with filters", read_pushdown(&pushdown_sets[i], &d) == 0);
+    CHECK("elems read", pushdown_sets[i].none != 0 || d.elems_cnt != 0);
+    CHECK("same number of records with elems",
+          d.records_cnt == expected[i].records_cnt);
+    CHECK("same number of elems", d.elems_cnt == expected[i].elems_cnt);
+    CHECK("same dump positions",
+          memcmp(d.pos_cnt, expected[i].pos_cnt, sizeof(d.pos_cnt)) == 0);
+    CHECK("same records and elems", pushdown_same(&d, &expected[i]));
+  }
+
+  return 0;
+}
 #endif
 
 #ifdef WITH_DATA_INTERFACE_SQLITE
@@ -187,14 +2101,38 @@ int main()
 
 #ifdef WITH_DATA_INTERFACE_SINGLEFILE
   CHECK_SECTION("singlefile data interface", test_singlefile() == 0);
+  CHECK_SECTION("singlefile modes", test_singlefile_modes() == 0);
+  CHECK_SECTION("parallel interval", test_parallel_interval() == 0);
+  CHECK_SECTION("stream resource", test_stream_resource() == 0);
+  CHECK_SECTION("merge shards", test_merge_shards() == 0);
+  CHECK_SECTION("poll descriptor", test_poll_fd() == 0);
+  CHECK_SECTION("record hold", test_record_hold() == 0);
+  CHECK_SECTION("elem fields", test_elem_fields() == 0);
+  CHECK_SECTION("large record", test_large_record() == 0);
+  CHECK_SECTION("time index", test_time_index() == 0);
+  CHECK_SECTION("peer index tables", test_peer_tables() == 0);
 #else
   SKIPPED_SECTION("singlefile data interface");
+  SKIPPED_SECTION("singlefile modes");
+  SKIPPED_SECTION("parallel interval");
+  SKIPPED_SECTION("stream resource");
+  SKIPPED_SECTION("merge shards");
+  SKIPPED_SECTION("poll descriptor");
+  SKIPPED_SECTION("record hold");
+  SKIPPED_SECTION("elem fields");
+  SKIPPED_SECTION("large record");
+  SKIPPED_SECTION("time index");
+  SKIPPED_SECTION("peer index tables");
 #endif
 
 #ifdef WITH_DATA_INTERFACE_CSVFILE
   CHECK_SECTION("csvfile data interface", test_csvfile() == 0);
+  CHECK_SECTION("record elems", test_record_elems() == 0);
+  CHECK_SECTION("filter pushdown", test_filter_pushdown() == 0);
 #else
   SKIPPED_SECTION("csvfile data interface");
+  SKIPPED_SECTION("record elems");
+  SKIPPED_SECTION("filter pushdown");
 #endif
 
 #ifdef WITH_DATA_INTERFACE_SQLITE